@@ -35,6 +35,9 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 /**@brief   Default filename.*/
 static const char *fname = "ExtFs.img";
@@ -54,6 +57,7 @@ static int file_dev_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id
 static int file_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
               uint64_t blk_id, uint32_t blk_cnt);
 static int file_dev_close(struct ext4_blockdev *bdev);
+static int file_dev_flush(struct ext4_blockdev *bdev);
 
 /******************************************************************************/
 EXT4_BLOCKDEV_STATIC_INSTANCE(file_dev, EXT4_FILEDEV_BSIZE, 0, file_dev_open,
@@ -76,6 +80,7 @@ static int file_dev_open(struct ext4_blockdev *bdev)
     file_dev.part_offset = 0;
     file_dev.part_size = ftello(dev_file);
     file_dev.bdif->ph_bcnt = file_dev.part_size / file_dev.bdif->ph_bsize;
+    file_dev.bdif->flush = file_dev_flush;
 
     return EOK;
 }
@@ -123,6 +128,18 @@ static int file_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
     return EOK;
 }
 /******************************************************************************/
+static int file_dev_flush(struct ext4_blockdev *bdev)
+{
+    if (fflush(dev_file))
+        return EIO;
+#ifndef _WIN32
+    if (fsync(fileno(dev_file)))
+        return EIO;
+#endif
+
+    return EOK;
+}
+/******************************************************************************/
 static int file_dev_close(struct ext4_blockdev *bdev)
 {
     fclose(dev_file);
@@ -533,27 +533,45 @@ static int dfs_ext_stat(struct dfs_filesystem* fs, const char *path, struct stat
     return -r;
 }
 
+#define EXT_GETDENTS_BATCH 16
+
 static int dfs_ext_getdents(struct dfs_fd* file, struct dirent* dirp, rt_uint32_t count)
 {
-    int index;
+    int r;
+    size_t i, max, index, cnt;
     struct dirent *d;
-    const ext4_direntry * rentry;
+    ext4_direntry *rentry;
 
     /* make integer count */
-    count = (count / sizeof(struct dirent)) * sizeof(struct dirent);
-    if (count == 0)
+    max = count / sizeof(struct dirent);
+    if (max == 0)
         return -RT_EINVAL;
 
+    rentry = rt_malloc(sizeof(ext4_direntry) *
+               (max < EXT_GETDENTS_BATCH ? max : EXT_GETDENTS_BATCH));
+    if (rentry == NULL)
+        return -RT_ENOMEM;
+
     index = 0;
-    while (1)
+    while (index < max)
     {
-        d = dirp + index;
+        cnt = max - index;
+        if (cnt > EXT_GETDENTS_BATCH)
+            cnt = EXT_GETDENTS_BATCH;
+
+        r = ext4_dir_entries_read(file->data, rentry, cnt, &cnt);
+        if (r != EOK && index == 0)
+        {
+            rt_free(rentry);
+            return -r;
+        }
 
-        rentry = ext4_dir_entry_next(file->data);
-        if(NULL != rentry)
+        for (i = 0; i < cnt; i++)
         {
-            strncpy(d->d_name, (char *)rentry->name, DFS_PATH_MAX);
-            if(EXT4_DE_DIR == rentry->inode_type)
+            d = dirp + index + i;
+
+            strncpy(d->d_name, (char *)rentry[i].name, DFS_PATH_MAX);
+            if(EXT4_DE_DIR == rentry[i].inode_type)
             {
                 d->d_type = DT_DIR;
             }
@@ -561,20 +579,16 @@ static int dfs_ext_getdents(struct dfs_fd* file, struct dirent* dirp, rt_uint32_
             {
                 d->d_type = DT_REG;
             }
-            d->d_namlen = (rt_uint8_t)rentry->name_length;
+            d->d_namlen = (rt_uint8_t)rentry[i].name_length;
             d->d_reclen = (rt_uint16_t)sizeof(struct dirent);
-
-            index ++;
-            if (index * sizeof(struct dirent) >= count)
-                break;
-
         }
-        else
-        {
+
+        index += cnt;
+        if (r != EOK || cnt == 0)
             break;
-        }
     }
 
+    rt_free(rentry);
     file->pos += index * sizeof(struct dirent);
 
     return index * sizeof(struct dirent);
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include <ext4.h>
+#include <ext4_super.h>
+#include <ext4_dir.h>
+
+/**@brief   Longest generated entry name.*/
+#define NAME_MAX_LEN 32
+
+/**@brief   Block size of synthetic directory.*/
+static uint32_t block_size = 4096;
+
+/**@brief   Blocks of synthetic directory.*/
+static uint32_t block_cnt = 16;
+
+/**@brief   Lookups per measured pass.*/
+static uint32_t lookups = 100000;
+
+static struct ext4_sblock sb;
+static uint8_t *blocks;
+static char (*names)[NAME_MAX_LEN + 1];
+static uint32_t names_cnt;
+
+static const char *usage = "                                    \n\
+Welcome in lwext4_dir_bench tool .                              \n\
+Lookup of names in synthetic linear directory blocks.           \n\
+Usage:                                                          \n\
+[-b] --block   - block size: 1024, 2048, 4096 (default 4096)    \n\
+[-c] --count   - directory blocks (default 16)                  \n\
+[-n] --lookups - lookups per pass (default 100000)              \n\
+\n";
+
+static uint64_t get_us(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+/**@brief   Name of entry @p i. Names share long prefixes and vary in
+ *          length, like files created by a program.*/
+static int make_name(char *name, uint32_t i, char tag)
+{
+    return sprintf(name, "%c%07" PRIu32 ".%.*s", tag, i,
+               (int)(i % 16), "dat_backup_01234");
+}
+
+/**@brief   Fill directory blocks with entries until they are full.*/
+static void fill_blocks(void)
+{
+    uint32_t b, off, last;
+    struct ext4_dir_en *de;
+
+    for (b = 0; b < block_cnt; b++) {
+        uint8_t *data = blocks + b * block_size;
+
+        off = 0;
+        last = 0;
+        while (1) {
+            char *name = names[names_cnt];
+            int len = make_name(name, names_cnt, 'f');
+            uint16_t rec_len = (8 + len + 3) & ~3;
+
+            if (off + rec_len > block_size)
+                break;
+
+            de = (void *)(data + off);
+            ext4_dir_en_set_inode(de, names_cnt + 12);
+            ext4_dir_en_set_entry_len(de, rec_len);
+            ext4_dir_en_set_name_len(&sb, de, len);
+            ext4_dir_en_set_inode_type(&sb, de, EXT4_DE_REG_FILE);
+            memcpy(de->name, name, len);
+
+            last = off;
+            off += rec_len;
+            names_cnt++;
+        }
+
+        de = (void *)(data + last);
+        ext4_dir_en_set_entry_len(de, block_size - last);
+    }
+}
+
+/**@brief   Look the name up block by block, as linear directory does.*/
+static bool lookup(const char *name, size_t len)
+{
+    struct ext4_block block;
+    struct ext4_dir_en *res;
+    uint32_t b;
+
+    memset(&block, 0, sizeof(block));
+    for (b = 0; b < block_cnt; b++) {
+        block.data = blocks + b * block_size;
+        if (ext4_dir_find_in_block(&block, &sb, len, name, &res) == EOK)
+            return true;
+    }
+
+    return false;
+}
+
+/**@brief   Measure one pass of lookups, existing or missing names.*/
+static bool run_pass(bool hit)
+{
+    uint32_t i, found = 0;
+    uint64_t scanned = 0;
+    uint64_t t;
+    char name[NAME_MAX_LEN + 1];
+
+    srand(1);
+    t = get_us();
+    for (i = 0; i < lookups; i++) {
+        uint32_t n = (uint32_t)rand() % names_cnt;
+        int len = make_name(name, n, hit ? 'f' : 'g');
+
+        /* Names are spread evenly, hit stops in block of the name */
+        found += lookup(name, len);
+        if (hit)
+            scanned += (uint64_t)n * block_cnt / names_cnt + 1;
+        else
+            scanned += block_cnt;
+    }
+    t = get_us() - t;
+    t = t ? t : 1;
+
+    printf("%s: %" PRIu32 " lookups, %.0f lookups/s, %.1f ns/block\n",
+           hit ? "hit " : "miss", lookups, lookups * 1e6 / t,
+           t * 1e3 / scanned);
+
+    if (found != (hit ? lookups : 0)) {
+        printf("run_pass: %" PRIu32 " names found\n", found);
+        return false;
+    }
+
+    return true;
+}
+
+static bool parse_opt(int argc, char **argv)
+{
+    int option_index = 0;
+    int c;
+
+    static struct option long_options[] = {
+        {"block", required_argument, 0, 'b'},
+        {"count", required_argument, 0, 'c'},
+        {"lookups", required_argument, 0, 'n'},
+        {"version", no_argument, 0, 'x'},
+        {0, 0, 0, 0}};
+
+    while (-1 != (c = getopt_long(argc, argv, "b:c:n:x",
+                      long_options, &option_index))) {
+
+        switch (c) {
+        case 'b':
+            block_size = atoi(optarg);
+            break;
+        case 'c':
+            block_cnt = atoi(optarg);
+            break;
+        case 'n':
+            lookups = atoi(optarg);
+            break;
+        case 'x':
+            puts(VERSION);
+            exit(0);
+            break;
+        default:
+            printf("%s", usage);
+            return false;
+        }
+    }
+
+    switch (block_size) {
+    case 1024:
+    case 2048:
+    case 4096:
+        break;
+    default:
+        printf("parse_opt: block_size = %" PRIu32 " unsupported\n",
+               block_size);
+        return false;
+    }
+
+    if (!block_cnt || !lookups) {
+        printf("parse_opt: count and lookups must not be 0\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_opt(argc, argv)) {
+        printf("parse_opt error\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Dynamic revision: 8 bit name length followed by file type */
+    memset(&sb, 0, sizeof(sb));
+    ext4_set32(&sb, rev_level, 1);
+    ext4_set32(&sb, log_block_size, block_size == 1024 ? 0 :
+                        block_size == 2048 ? 1 : 2);
+
+    blocks = calloc(block_cnt, block_size);
+    names = calloc(block_cnt * (block_size / 12), sizeof(*names));
+    if (!blocks || !names) {
+        printf("calloc error\n");
+        return EXIT_FAILURE;
+    }
+
+    fill_blocks();
+    printf("ext4_dir_find_in_block: %" PRIu32 " blocks of %" PRIu32
+           " bytes, %" PRIu32 " entries\n", block_cnt, block_size,
+           names_cnt);
+
+    if (!run_pass(true) || !run_pass(false))
+        return EXIT_FAILURE;
+
+    free(names);
+    free(blocks);
+    return EXIT_SUCCESS;
+}
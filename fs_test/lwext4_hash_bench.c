@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include <ext4.h>
+#include <ext4_types.h>
+#include <ext4_hash.h>
+
+/**@brief   Names hashed per measured pass.*/
+static uint32_t names_cnt = 100000;
+
+/**@brief   Name length, 0 for mixed lengths.*/
+static uint32_t name_len = 0;
+
+/**@brief   Measured passes.*/
+static uint32_t passes = 10;
+
+static char **names;
+static uint32_t *hashes;
+
+static const uint32_t seed[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+static const struct {
+    int version;
+    const char *name;
+} versions[] = {
+    {EXT2_HTREE_LEGACY, "legacy"},
+    {EXT2_HTREE_HALF_MD4, "half_md4"},
+    {EXT2_HTREE_TEA, "tea"},
+};
+
+static const char *usage = "                                    \n\
+Welcome in lwext4_hash_bench tool .                             \n\
+Directory index name hashing speed.                             \n\
+Usage:                                                          \n\
+[-n] --names   - names per pass (default 100000)                \n\
+[-l] --length  - name length 1-255, 0 mixed (default 0)         \n\
+[-p] --passes  - measured passes (default 10)                   \n\
+\n";
+
+static uint64_t get_us(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+/**@brief   Generate names. Mixed lengths are spread over 8-64 bytes,
+ *          typical file name lengths.*/
+static bool make_names(void)
+{
+    static const uint32_t mixed[] = {8, 12, 16, 20, 24, 32, 40, 48, 56, 64};
+    uint32_t i, j;
+
+    names = calloc(names_cnt, sizeof(char *));
+    hashes = calloc(names_cnt, sizeof(uint32_t));
+    if (!names || !hashes)
+        return false;
+
+    srand(1);
+    for (i = 0; i < names_cnt; i++) {
+        uint32_t len = name_len ? name_len : mixed[i % 10];
+
+        names[i] = malloc(len + 1);
+        if (!names[i])
+            return false;
+
+        for (j = 0; j < len; j++)
+            names[i][j] = "abcdefghijklmnopqrstuvwxyz0123456789_."
+                      [rand() % 38];
+        names[i][len] = 0;
+    }
+
+    return true;
+}
+
+/**@brief   Print hashing rate of one hash version, name by name and
+ *          through the batch call.*/
+static bool bench_version(int version, const char *vname)
+{
+    uint64_t t_one = 0, t_batch = 0, t;
+    uint32_t p, i, h;
+    int r;
+
+    for (p = 0; p < passes; p++) {
+        t = get_us();
+        for (i = 0; i < names_cnt; i++) {
+            r = ext2_htree_hash(names[i], (int)strlen(names[i]), seed,
+                        version, &h, NULL);
+            if (r != EOK)
+                return false;
+            hashes[i] ^= h;
+        }
+        t_one += get_us() - t;
+
+        t = get_us();
+        r = ext2_htree_hash_batch((const char *const *)names, names_cnt,
+                      seed, version, hashes);
+        if (r != EOK)
+            return false;
+        t_batch += get_us() - t;
+    }
+
+    t_one = t_one ? t_one : 1;
+    t_batch = t_batch ? t_batch : 1;
+    printf("%-9s %12.0f hashes/s %12.0f hashes/s (batch)\n", vname,
+           (double)names_cnt * passes * 1e6 / t_one,
+           (double)names_cnt * passes * 1e6 / t_batch);
+    return true;
+}
+
+static bool parse_opt(int argc, char **argv)
+{
+    int option_index = 0;
+    int c;
+
+    static struct option long_options[] = {
+        {"names", required_argument, 0, 'n'},
+        {"length", required_argument, 0, 'l'},
+        {"passes", required_argument, 0, 'p'},
+        {"version", no_argument, 0, 'x'},
+        {0, 0, 0, 0}};
+
+    while (-1 != (c = getopt_long(argc, argv, "n:l:p:x",
+                      long_options, &option_index))) {
+
+        switch (c) {
+        case 'n':
+            names_cnt = atoi(optarg);
+            break;
+        case 'l':
+            name_len = atoi(optarg);
+            break;
+        case 'p':
+            passes = atoi(optarg);
+            break;
+        case 'x':
+            puts(VERSION);
+            exit(0);
+            break;
+        default:
+            printf("%s", usage);
+            return false;
+        }
+    }
+
+    if (!names_cnt || !passes || name_len > 255) {
+        printf("parse_opt: invalid names, passes or length\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    char len_str[16];
+    uint32_t i;
+
+    if (!parse_opt(argc, argv)) {
+        printf("parse_opt error\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!make_names()) {
+        printf("make_names: alloc error\n");
+        return EXIT_FAILURE;
+    }
+
+    if (name_len)
+        sprintf(len_str, "%" PRIu32, name_len);
+    else
+        strcpy(len_str, "8-64");
+
+    printf("ext2_htree_hash: %" PRIu32 " names of length %s, %" PRIu32
+           " passes\n", names_cnt, len_str, passes);
+
+    for (i = 0; i < sizeof(versions) / sizeof(versions[0]); i++) {
+        if (!bench_version(versions[i].version, versions[i].name)) {
+            printf("ext2_htree_hash error\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < names_cnt; i++)
+        free(names[i]);
+    free(names);
+    free(hashes);
+    return EXIT_SUCCESS;
+}
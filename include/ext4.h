@@ -151,6 +151,18 @@ int ext4_mount(const char *dev_name,
  * @return  Standard error code */
 int ext4_umount(const char *mount_point);
 
+/**@brief   Use a registered block device as the external journal of
+ *          a filesystem (ext4 journal_dev). The device gets its own
+ *          block cache, so log writes do not compete with data blocks.
+ * @warning Must be called after @ref ext4_mount and before
+ *          @ref ext4_recover and @ref ext4_journal_start.
+ *
+ * @param   mount_point Mount point.
+ * @param   dev_name Journal block device name (@ref ext4_device_register).
+ *
+ * @return  Standard error code. */
+int ext4_journal_dev_set(const char *mount_point, const char *dev_name);
+
 /**@brief   Starts journaling. Journaling start/stop functions are transparent
  *          and might be used on filesystems without journaling support.
  * @warning Usage:
@@ -261,22 +273,51 @@ int ext4_get_sblock(const char *mount_point, struct ext4_sblock **sb);
 int ext4_cache_write_back(const char *path, bool on);
 
 
-/**@brief   Force cache flush.
+/**@brief   Force cache flush, then flush the device.
  *
  * @param   mount_pount Mount point.
  *
  * @return  Standard error code. */
 int ext4_cache_flush(const char *path);
 
+/**@brief   Background cache flusher step, meant to be called
+ *          periodically (e.g. from a host thread) while the cache is in
+ *          write back mode. Writes back blocks dirty for longer than
+ *          CONFIG_BLOCK_DEV_DIRTY_EXPIRE and keeps the dirty part of the
+ *          cache at CONFIG_BLOCK_DEV_DIRTY_BG_RATIO, so that eviction
+ *          rarely has to write synchronously.
+ *
+ * @param   mount_pount Mount point.
+ * @param   now Monotonic time in units of CONFIG_BLOCK_DEV_DIRTY_EXPIRE
+ *              (e.g. milliseconds), may wrap around.
+ *
+ * @return  Standard error code. */
+int ext4_cache_flusher(const char *path, uint32_t now);
+
 /********************************FILE OPERATIONS*****************************/
 
 /**@brief   Remove file by path.
+ *          A file bigger than CONFIG_MAX_TRUNCATE_SIZE is put on the
+ *          orphan list when its last link goes away, its blocks are
+ *          released later by @ref ext4_orphan_cleanup.
  *
  * @param   path Path to file.
  *
  * @return  Standard error code. */
 int ext4_fremove(const char *path);
 
+/**@brief   Release i-nodes left on the orphan list by @ref ext4_fremove.
+ *          Meant to be called from a background task. Orphans still on
+ *          the list are released by @ref ext4_journal_start and
+ *          @ref ext4_journal_stop, or at mount and umount time when the
+ *          filesystem has no journal.
+ *
+ * @param   mount_point Mount point.
+ * @param   count Maximum number of i-nodes to release, 0 for all.
+ *
+ * @return  Standard error code. */
+int ext4_orphan_cleanup(const char *mount_point, uint32_t count);
+
 /**@brief   Create a hardlink for a file.
  *
  * @param   path Path to file.
@@ -322,6 +363,18 @@ int ext4_fopen(ext4_file *file, const char *path, const char *flags);
  * @return  Standard error code.*/
 int ext4_fopen2(ext4_file *file, const char *path, int flags);
 
+/**@brief   Open an existing file/directory/link by its inode number,
+ *          without any path resolution.
+ *
+ * @param   file  File handle.
+ * @param   mount_point Mount point.
+ * @param   ino   Inode number (for example from @ref ext4_fstat).
+ * @param   flags File open flags (O_CREAT is not allowed).
+ *
+ * @return  Standard error code.*/
+int ext4_open_by_ino(ext4_file *file, const char *mount_point, uint32_t ino,
+             int flags);
+
 /**@brief   File close function.
  *
  * @param   file File handle.
@@ -338,6 +391,62 @@ int ext4_fclose(ext4_file *file);
  * @return  Standard error code.*/
 int ext4_ftruncate(ext4_file *file, uint64_t size);
 
+/**@brief   Make a file durable: its dirty directory, mapping and xattr
+ *          blocks and its i-node are written, then the device is
+ *          flushed. Other files' dirty blocks stay in the cache. With a
+ *          journal only the device is flushed, the log holds the rest.
+ *          A new directory entry needs an fsync of the directory.
+ *
+ * @param   file File handle (or the file of a directory handle).
+ *
+ * @return  Standard error code.*/
+int ext4_fsync(ext4_file *file);
+
+/**@brief   Like @ref ext4_fsync, without the xattr blocks: only what is
+ *          needed to read the data back. The i-node is still written,
+ *          it holds the size and the root of the block map.
+ *
+ * @param   file File handle (or the file of a directory handle).
+ *
+ * @return  Standard error code.*/
+int ext4_fdatasync(ext4_file *file);
+
+/**@brief   @ref ext4_fallocate mode: the file size stays, blocks past
+ *          the end are only reserved.*/
+#define EXT4_FALLOC_FL_KEEP_SIZE 0x01
+
+/**@brief   @ref ext4_fallocate mode: the range reads as zeros afterwards,
+ *          data it held are dropped.*/
+#define EXT4_FALLOC_FL_ZERO_RANGE 0x10
+
+/**@brief   Preallocate file space. Missing blocks are allocated as
+ *          unwritten extents (long physically continuous runs where free
+ *          space allows), nothing is written to them: they read as zeros
+ *          until written. Extent files only.
+ *
+ * @param   file File handle.
+ * @param   offset First byte of the range.
+ * @param   len Range length.
+ * @param   mode 0 or @ref EXT4_FALLOC_FL_KEEP_SIZE and
+ *               @ref EXT4_FALLOC_FL_ZERO_RANGE flags. Without KEEP_SIZE
+ *               the file grows to cover the range.
+ *
+ * @return  Standard error code (ENOTSUP for a file without extents).*/
+int ext4_fallocate(ext4_file *file, uint64_t offset, uint64_t len,
+           uint32_t mode);
+
+/**@brief   Punch a hole in a file: blocks entirely in the range are
+ *          released, bytes of blocks partly in it are zeroed. The range
+ *          reads as zeros afterwards, the file size stays. Extent and
+ *          inline data files only.
+ *
+ * @param   file File handle.
+ * @param   offset First byte of the range.
+ * @param   len Length of the range (not 0).
+ *
+ * @return  Standard error code.*/
+int ext4_fpunch_hole(ext4_file *file, uint64_t offset, uint64_t len);
+
 /**@brief   Read data from file.
  *
  * @param   file File handle.
@@ -355,7 +464,10 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt);
  * @param   size Write length..
  * @param   wcnt Bytes written (NULL allowed).
  *
- * @return  Standard error code.*/
+ * @return  Standard error code. Data written before an error (e.g.
+ *          ENOSPC) are kept and counted in @p wcnt. If the transaction
+ *          fails to commit (e.g. ordered data write error), nothing is
+ *          kept, @p wcnt is 0 and file position is left unchanged.*/
 int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt);
 
 /**@brief   File seek operation.
@@ -366,6 +478,12 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt);
  *              @ref SEEK_SET
  *              @ref SEEK_CUR
  *              @ref SEEK_END
+ *              @ref SEEK_DATA (next data at or after offset)
+ *              @ref SEEK_HOLE (next hole at or after offset, the file
+ *                             end counts as one)
+ *          Holes and unwritten extents are not data. ENXIO is returned
+ *          when offset is at or past the file end, or when there is no
+ *          data past it.
  *
  * @return  Standard error code.*/
 int ext4_fseek(ext4_file *file, int64_t offset, uint32_t origin);
@@ -395,6 +513,15 @@ uint64_t ext4_fsize(ext4_file *file);
 int ext4_raw_inode_fill(const char *path, uint32_t *ret_ino,
             struct ext4_inode *inode);
 
+/**@brief Get inode of an opened file/directory/link.
+ *
+ * @param file    File handle.
+ * @param ret_ino Inode number (NULL allowed).
+ * @param inode   Inode internals.
+ *
+ * @return  Standard error code.*/
+int ext4_fstat(ext4_file *file, uint32_t *ret_ino, struct ext4_inode *inode);
+
 /**@brief Check if inode exists.
  *
  * @param path    Parh to file/dir/link.
@@ -494,6 +621,36 @@ int ext4_mtime_get(const char *path, uint32_t *mtime);
  * @return  standard error code*/
 int ext4_ctime_get(const char *path, uint32_t *ctime);
 
+/**@brief   Attribute flags of @ref ext4_fattr.*/
+#define EXT4_FATTR_MODE (1 << 0)
+#define EXT4_FATTR_UID (1 << 1)
+#define EXT4_FATTR_GID (1 << 2)
+#define EXT4_FATTR_ATIME (1 << 3)
+#define EXT4_FATTR_MTIME (1 << 4)
+#define EXT4_FATTR_CTIME (1 << 5)
+
+/**@brief   Inode attributes set by @ref ext4_fsetattr.*/
+struct ext4_fattr {
+    /**@brief   Attributes to change (EXT4_FATTR_...).*/
+    uint32_t valid;
+
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t atime;
+    uint32_t mtime;
+    uint32_t ctime;
+};
+
+/**@brief Change attributes of an opened file/directory/link in a single
+ *        transaction.
+ *
+ * @param file File handle.
+ * @param attr Attributes to set, only those marked in attr->valid.
+ *
+ * @return  Standard error code.*/
+int ext4_fsetattr(ext4_file *file, const struct ext4_fattr *attr);
+
 /**@brief Create symbolic link.
  *
  * @param target Destination entry path.
@@ -545,6 +702,30 @@ int ext4_setxattr(const char *path, const char *name, size_t name_len,
 int ext4_getxattr(const char *path, const char *name, size_t name_len,
           void *buf, size_t buf_size, size_t *data_size);
 
+/**@brief Set extended attribute of an opened file/directory.
+ *
+ * @param file      File handle.
+ * @param name      Name of the entry to add.
+ * @param name_len  Length of @name in bytes.
+ * @param data      Data of the entry to add.
+ * @param data_size Size of data to add.
+ *
+ * @return  Standard error code.*/
+int ext4_fsetxattr(ext4_file *file, const char *name, size_t name_len,
+           const void *data, size_t data_size);
+
+/**@brief Get extended attribute of an opened file/directory.
+ *
+ * @param file      File handle.
+ * @param name      Name of the entry to get.
+ * @param name_len  Length of @name in bytes.
+ * @param data      Data of the entry to get.
+ * @param data_size Size of data to get.
+ *
+ * @return  Standard error code.*/
+int ext4_fgetxattr(ext4_file *file, const char *name, size_t name_len,
+           void *buf, size_t buf_size, size_t *data_size);
+
 /**@brief List extended attributes.
  *
  * @param path     Path to file/directory.
@@ -555,6 +736,37 @@ int ext4_getxattr(const char *path, const char *name, size_t name_len,
  * @return  Standard error code.*/
 int ext4_listxattr(const char *path, char *list, size_t size, size_t *ret_size);
 
+/**@brief Extended attribute record of @ref ext4_getxattr_all.*/
+typedef struct ext4_xattr_rec {
+    /**@brief Record length, the next record starts here (4 byte
+     *        aligned).*/
+    uint32_t rec_len;
+
+    /**@brief Value length.*/
+    uint32_t value_len;
+
+    /**@brief Name length (with prefix, without terminating zero).*/
+    uint32_t name_len;
+
+    /**@brief Null terminated name, the value follows it.*/
+    char name[];
+} ext4_xattr_rec;
+
+/**@brief Value of @ref ext4_xattr_rec.*/
+#define EXT4_XATTR_REC_VALUE(rec)                                             \
+    ((const void *)((rec)->name + (rec)->name_len + 1))
+
+/**@brief Get all extended attributes in one call.
+ *
+ * @param path     Path to file/directory.
+ * @param buf      Buffer (4 byte aligned) for @ref ext4_xattr_rec records.
+ * @param size     Size of @buf in bytes, 0 to query the needed size.
+ * @param ret_size Used (or needed) bytes of @buf.
+ *
+ * @return  Standard error code, ERANGE if @buf is too small.*/
+int ext4_getxattr_all(const char *path, void *buf, size_t size,
+              size_t *ret_size);
+
 /**@brief Remove extended attribute.
  *
  * @param path     Path to file/directory.
@@ -611,6 +823,78 @@ int ext4_dir_close(ext4_dir *dir);
  * @return  Directory entry id (NULL if no entry)*/
 const ext4_direntry *ext4_dir_entry_next(ext4_dir *dir);
 
+/**@brief   Read a batch of directory entries. Entries are copied
+ *          block by block under a single lock, which is much cheaper
+ *          than calling @ref ext4_dir_entry_next for each of them.
+ *
+ * @param   dir   Directory handle.
+ * @param   buf   Output array of entries.
+ * @param   max   Capacity of @buf (in entries).
+ * @param   count Number of entries read, 0 at the end of directory.
+ *
+ * @return  Standard error code. On error @p count is 0 and the
+ *          directory position is not moved, so no entry is lost.*/
+int ext4_dir_entries_read(ext4_dir *dir, ext4_direntry *buf, size_t max,
+              size_t *count);
+
+/**@brief   Read a batch of directory entries together with their inodes
+ *          (size, mode, times, owner...), without any path resolution.
+ *          Inodes are fetched in inode table order.
+ *
+ * @param   dir    Directory handle.
+ * @param   buf    Output array of entries.
+ * @param   inodes Output array of inodes, inodes[i] belongs to buf[i].
+ * @param   max    Capacity of @buf and @inodes (in entries).
+ * @param   count  Number of entries read, 0 at the end of directory.
+ *
+ * @return  Standard error code, EIO if an entry points outside of the
+ *          inode tables or an inode fails checksum verification. On
+ *          error @p count is 0 and the directory position is not moved.*/
+int ext4_dir_entries_read_plus(ext4_dir *dir, ext4_direntry *buf,
+                   struct ext4_inode *inodes, size_t max,
+                   size_t *count);
+
+/**@brief   Compact indexed directory: merge sparse leaf blocks, drop
+ *          their index entries and truncate released blocks. Entry
+ *          removal never does this by itself. Blocks get relocated, so
+ *          positions of directories open for reading become invalid.
+ *
+ * @param   path Directory path.
+ *
+ * @return  Standard error code.*/
+int ext4_dir_compact(const char *path);
+
+/**@brief   Create regular files in directory, all in one transaction.
+ *          Names are processed in directory index hash order, so
+ *          neighbouring inserts hit the same index leaf blocks.
+ *
+ * @param   dir   Directory handle.
+ * @param   names Names of new files (single path components).
+ * @param   count Number of names.
+ *
+ * @return  Standard error code (EEXIST if any name exists). On failure
+ *          the transaction is aborted, no file is created when
+ *          journaling is active.*/
+int ext4_create_batch(ext4_dir *dir, const char *const *names,
+              size_t count);
+
+/**@brief   Remove regular files from directory, all in one transaction.
+ *          Files bigger than CONFIG_MAX_TRUNCATE_SIZE are put on the
+ *          orphan list, as in @ref ext4_fremove, and their blocks are
+ *          freed later by @ref ext4_orphan_cleanup. So the transaction is
+ *          never split.
+ *
+ * @param   dir   Directory handle.
+ * @param   names Names of files (single path components).
+ * @param   count Number of names.
+ *
+ * @return  Standard error code (ENOENT if any name is missing, EISDIR
+ *          for directories). On failure the transaction is aborted, no
+ *          file is removed when journaling is active. Without journal
+ *          the files processed before the failure stay removed.*/
+int ext4_unlink_batch(ext4_dir *dir, const char *const *names,
+              size_t count);
+
 /**@brief   Rewine directory entry offset.
  *
  * @param   dir Directory handle.*/
@@ -102,6 +102,18 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
                 ext4_fsblk_t goal,
                 ext4_fsblk_t *baddr);
 
+/**@brief   Allocate a run of physically contiguous blocks. The first
+ *          free run long enough is taken, the longest run found
+ *          otherwise.
+ * @param   inode_ref inode reference
+ * @param   goal
+ * @param   first first allocated block address
+ * @param   count in: wanted block count, out: allocated block count
+ * @return  standard error code*/
+int ext4_balloc_alloc_blocks(struct ext4_inode_ref *inode_ref,
+                 ext4_fsblk_t goal, ext4_fsblk_t *first,
+                 uint32_t *count);
+
 /**@brief   Try allocate selected block.
  * @param   inode_ref inode reference
  * @param   baddr block address to allocate
@@ -91,6 +91,13 @@ struct ext4_buf {
     /**@brief   Whether or not buffer is on dirty list.*/
     bool on_dirty_list;
 
+    /**@brief   I-node whose directory, mapping or xattr block this is
+     *          (0 if unknown), for per-file sync.*/
+    uint32_t owner;
+
+    /**@brief   Writeback clock value when the buffer became dirty.*/
+    uint32_t dirty_time;
+
     /**@brief   LBA tree node*/
     RB_ENTRY(ext4_buf) lba_node;
 
@@ -138,6 +145,12 @@ struct ext4_bcache {
     /**@brief   The cache should not be shaked */
     bool dont_shake;
 
+    /**@brief   Number of buffers on dirty list*/
+    uint32_t dirty_cnt;
+
+    /**@brief   Writeback clock, advanced by the flusher*/
+    uint32_t clock;
+
     /**@brief   A tree holding all bufs*/
     RB_HEAD(ext4_buf_lba, ext4_buf) lba_root;
 
@@ -161,7 +174,8 @@ enum bcache_state_bits {
     BC_UPTODATE,
     BC_DIRTY,
     BC_FLUSH,
-    BC_TMP
+    BC_TMP,
+    BC_DATASYNC
 };
 
 #define ext4_bcache_set_flag(buf, b)    \
@@ -174,6 +188,9 @@ enum bcache_state_bits {
     (((buf)->flags & (1 << (b))) >> (b))
 
 static inline void ext4_bcache_set_dirty(struct ext4_buf *buf) {
+    if (!ext4_bcache_test_flag(buf, BC_DIRTY))
+        buf->dirty_time = buf->bc->clock;
+
     ext4_bcache_set_flag(buf, BC_UPTODATE);
     ext4_bcache_set_flag(buf, BC_DIRTY);
 }
@@ -197,6 +214,7 @@ ext4_bcache_insert_dirty_node(struct ext4_bcache *bc, struct ext4_buf *buf) {
     if (!buf->on_dirty_list) {
         SLIST_INSERT_HEAD(&bc->dirty_list, buf, dirty_node);
         buf->on_dirty_list = true;
+        bc->dirty_cnt++;
     }
 }
 
@@ -208,6 +226,7 @@ ext4_bcache_remove_dirty_node(struct ext4_bcache *bc, struct ext4_buf *buf) {
     if (buf->on_dirty_list) {
         SLIST_REMOVE(&bc->dirty_list, buf, ext4_buf, dirty_node);
         buf->on_dirty_list = false;
+        bc->dirty_cnt--;
     }
 }
 
@@ -234,6 +253,20 @@ int ext4_bcache_fini_dynamic(struct ext4_bcache *bc);
  * @return  buffer with the lowest LRU counter*/
 struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc);
 
+/**@brief   Get the unreferenced buffer following buf in LRU order.
+ * @param   bc block cache descriptor
+ * @param   buf unreferenced buffer
+ * @return  next buffer with a higher LRU counter or NULL*/
+struct ext4_buf *ext4_buf_next_lru(struct ext4_bcache *bc,
+                   struct ext4_buf *buf);
+
+/**@brief   Get the first unreferenced buffer with LRU counter not
+ *          lower than lru_id.
+ * @param   bc block cache descriptor
+ * @param   lru_id LRU counter to start from
+ * @return  buffer or NULL*/
+struct ext4_buf *ext4_buf_find_lru(struct ext4_bcache *bc, uint32_t lru_id);
+
 /**@brief   Drop unreferenced buffer from bcache.
  * @param   bc block cache descriptor
  * @param   buf buffer*/
@@ -80,6 +80,11 @@ struct ext4_blockdev_iface {
      * @param   bdev block device.*/
     int (*unlock)(struct ext4_blockdev *bdev);
 
+    /**@brief   Flush device write cache (write barrier). Not mandatory
+     *          field.
+     * @param   bdev block device.*/
+    int (*flush)(struct ext4_blockdev *bdev);
+
     /**@brief   Block size (bytes): physical*/
     uint32_t ph_bsize;
 
@@ -250,6 +255,29 @@ int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
  * @return  standard error code*/
 int ext4_block_cache_flush(struct ext4_blockdev *bdev);
 
+/**@brief   Flush dirty buffers belonging to one i-node to disk
+ * @param   bdev block device descriptor
+ * @param   owner i-node number
+ * @param   datasync only buffers needed to read the data back
+ * @return  standard error code*/
+int ext4_block_cache_flush_owner(struct ext4_blockdev *bdev, uint32_t owner,
+                 bool datasync);
+
+/**@brief   Make written blocks durable (device write barrier), a no-op
+ *          for devices without a flush function.
+ * @param   bdev block device descriptor
+ * @return  standard error code*/
+int ext4_block_flush_dev(struct ext4_blockdev *bdev);
+
+/**@brief   Background writeback step. Advances the writeback clock to
+ *          now, writes back buffers dirty for at least
+ *          @ref CONFIG_BLOCK_DEV_DIRTY_EXPIRE and then the coldest ones
+ *          until @ref CONFIG_BLOCK_DEV_DIRTY_BG_RATIO is reached.
+ * @param   bdev block device descriptor
+ * @param   now current time in flusher clock units (wraps around)
+ * @return  standard error code*/
+int ext4_block_cache_writeback(struct ext4_blockdev *bdev, uint32_t now);
+
 /**@brief   Enable/disable write back cache mode
  * @param   bdev block device descriptor
  * @param   on_off
@@ -88,11 +88,89 @@ extern "C" {
 #define CONFIG_JOURNALING_ENABLE 1
 #endif
 
+/**@brief  Use hash tables and pooled allocation for journal block
+ *         records and revoke records instead of RB-trees and malloc*/
+#ifndef CONFIG_JOURNAL_HASH_INDEX
+#define CONFIG_JOURNAL_HASH_INDEX 1
+#endif
+
+/**@brief  Bucket count of journal hash tables (must be a power of 2)*/
+#ifndef CONFIG_JOURNAL_HASH_SIZE
+#define CONFIG_JOURNAL_HASH_SIZE 256
+#endif
+
+/**@brief  Objects allocated at once by journal record pools*/
+#ifndef CONFIG_JOURNAL_POOL_CHUNK
+#define CONFIG_JOURNAL_POOL_CHUNK 64
+#endif
+
+/**@brief  Ordered data mode: file data written inside a transaction is
+ *         flushed in one sorted batch before the transaction commits*/
+#ifndef CONFIG_JOURNAL_ORDERED_DATA
+#define CONFIG_JOURNAL_ORDERED_DATA 1
+#endif
+
+/**@brief  Largest linear directory (in blocks) converted to indexed one
+ *         on entry insert. Conversion holds a copy of the whole directory
+ *         on heap*/
+#ifndef CONFIG_DIR_INDEX_CONVERT_BLOCKS
+#define CONFIG_DIR_INDEX_CONVERT_BLOCKS 32
+#endif
+
+/**@brief  Enable/disable directory entry lookup cache*/
+#ifndef CONFIG_DCACHE_ENABLE
+#define CONFIG_DCACHE_ENABLE 1
+#endif
+
+/**@brief  Entries of directory entry lookup cache*/
+#ifndef CONFIG_DCACHE_SIZE
+#define CONFIG_DCACHE_SIZE 64
+#endif
+
+/**@brief  Longest name kept in directory entry lookup cache*/
+#ifndef CONFIG_DCACHE_NAME_LEN
+#define CONFIG_DCACHE_NAME_LEN 32
+#endif
+
+/**@brief  Directories having bloom filter of their names, so most lookups
+ *         of missing names don't read directory blocks (0 - disable)*/
+#ifndef CONFIG_DCACHE_BLOOM_DIRS
+#define CONFIG_DCACHE_BLOOM_DIRS 4
+#endif
+
+/**@brief  Largest bloom filter of a directory (in bytes)*/
+#ifndef CONFIG_DCACHE_BLOOM_MAX_SIZE
+#define CONFIG_DCACHE_BLOOM_MAX_SIZE (64 * 1024)
+#endif
+
 /**@brief  Enable/disable xattr*/
 #ifndef CONFIG_XATTR_ENABLE
 #define CONFIG_XATTR_ENABLE 1
 #endif
 
+/**@brief  Enable/disable xattr block cache, identical xattr blocks are
+ *         shared between i-nodes*/
+#ifndef CONFIG_XCACHE_ENABLE
+#define CONFIG_XCACHE_ENABLE CONFIG_XATTR_ENABLE
+#endif
+
+/**@brief  Entries of xattr block cache*/
+#ifndef CONFIG_XCACHE_SIZE
+#define CONFIG_XCACHE_SIZE 64
+#endif
+
+/**@brief  I-nodes with decoded xattrs kept in xattr cache
+ *         (0 - getxattr always parses the i-node and xattr block)*/
+#ifndef CONFIG_XCACHE_INODES
+#define CONFIG_XCACHE_INODES 8
+#endif
+
+/**@brief  Enable/disable inline data (small files and directories kept
+ *         in the i-node, needs xattr)*/
+#ifndef CONFIG_INLINE_DATA_ENABLE
+#define CONFIG_INLINE_DATA_ENABLE CONFIG_XATTR_ENABLE
+#endif
+
 /**@brief  Enable/disable extents*/
 #ifndef CONFIG_EXTENTS_ENABLE
 #define CONFIG_EXTENTS_ENABLE 1
@@ -128,6 +206,27 @@ extern "C" {
 #define CONFIG_BLOCK_DEV_CACHE_SIZE 8
 #endif
 
+/**@brief   Percentage of the block cache that may hold dirty buffers
+ *          in write-back mode. Above it the caller getting a new block
+ *          writes back the coldest dirty buffers itself, down to
+ *          @ref CONFIG_BLOCK_DEV_DIRTY_BG_RATIO.*/
+#ifndef CONFIG_BLOCK_DEV_DIRTY_RATIO
+#define CONFIG_BLOCK_DEV_DIRTY_RATIO 50
+#endif
+
+/**@brief   Percentage of the block cache the flusher and the cold
+ *          writeback bring the dirty buffers down to, see
+ *          @ref ext4_cache_flusher.*/
+#ifndef CONFIG_BLOCK_DEV_DIRTY_BG_RATIO
+#define CONFIG_BLOCK_DEV_DIRTY_BG_RATIO 25
+#endif
+
+/**@brief   Age (in flusher clock units) after which the flusher writes
+ *          a dirty buffer back, see @ref ext4_cache_flusher.*/
+#ifndef CONFIG_BLOCK_DEV_DIRTY_EXPIRE
+#define CONFIG_BLOCK_DEV_DIRTY_EXPIRE 3000
+#endif
+
 
 /**@brief   Maximum block device name*/
 #ifndef CONFIG_EXT4_MAX_BLOCKDEV_NAME
@@ -161,6 +260,12 @@ extern "C" {
 #define CONFIG_MAX_TRUNCATE_SIZE (16ul * 1024ul * 1024ul)
 #endif
 
+/**@brief Number of journalled blocks after which a long truncate
+ *        commits its transaction and starts a new one*/
+#ifndef CONFIG_TRUNCATE_TRANS_BLOCKS
+#define CONFIG_TRUNCATE_TRANS_BLOCKS 64
+#endif
+
 
 /**@brief Unaligned access switch on/off*/
 #ifndef CONFIG_UNALIGNED_ACCESS
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_dcache.h
+ * @brief Directory entry lookup cache.
+ */
+
+#ifndef EXT4_DCACHE_H_
+#define EXT4_DCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <ext4_config.h>
+#include <ext4_types.h>
+
+#include <misc/queue.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if CONFIG_DCACHE_ENABLE
+
+/**@brief   Hash buckets of directory entry cache.*/
+#define EXT4_DCACHE_BUCKETS 64
+
+/**@brief   Cached result of a directory lookup.*/
+struct ext4_dcache_entry {
+    /**@brief   Directory inode, 0 if the entry is unused.*/
+    uint32_t parent;
+
+    /**@brief   Inode the name refers to, 0 for a negative entry.*/
+    uint32_t inode;
+
+    /**@brief   Inode mode type (EXT4_INODE_MODE_...).*/
+    uint32_t imode;
+
+    /**@brief   Name hash.*/
+    uint32_t hash;
+
+    /**@brief   Name length.*/
+    uint8_t name_len;
+
+    /**@brief   Entry name (not null terminated).*/
+    char name[CONFIG_DCACHE_NAME_LEN];
+
+    LIST_ENTRY(ext4_dcache_entry) hash_node;
+    TAILQ_ENTRY(ext4_dcache_entry) lru_node;
+};
+
+/**@brief   Bloom filter of names of one directory.*/
+struct ext4_dcache_bloom {
+    /**@brief   Directory inode, 0 if the slot is unused.*/
+    uint32_t dir;
+
+    /**@brief   Filter bits, NULL if the directory is not filtered.*/
+    uint8_t *bits;
+
+    /**@brief   Filter size in bits (power of 2).*/
+    uint32_t nbits;
+
+    /**@brief   Names added to the filter.*/
+    uint32_t names;
+
+    /**@brief   Names removed since the filter was built.*/
+    uint32_t removed;
+
+    /**@brief   Last use stamp.*/
+    uint32_t stamp;
+};
+
+/**@brief   Directory entry cache.*/
+struct ext4_dcache {
+    struct ext4_dcache_entry entries[CONFIG_DCACHE_SIZE];
+
+    LIST_HEAD(ext4_dcache_bucket, ext4_dcache_entry)
+        buckets[EXT4_DCACHE_BUCKETS];
+
+    /**@brief   Least recently used entry first.*/
+    TAILQ_HEAD(ext4_dcache_lru, ext4_dcache_entry) lru;
+
+#if CONFIG_DCACHE_BLOOM_DIRS
+    struct ext4_dcache_bloom blooms[CONFIG_DCACHE_BLOOM_DIRS];
+
+    /**@brief   Bloom filter use counter.*/
+    uint32_t bloom_stamp;
+#endif
+};
+
+/**@brief   Initialize directory entry cache.
+ * @param   dc directory entry cache*/
+void ext4_dcache_init(struct ext4_dcache *dc);
+
+/**@brief   Drop all entries of directory entry cache.
+ * @param   dc directory entry cache*/
+void ext4_dcache_purge(struct ext4_dcache *dc);
+
+/**@brief   Lookup a name in directory entry cache.
+ * @param   dc directory entry cache
+ * @param   parent directory inode
+ * @param   name entry name
+ * @param   name_len entry name length
+ * @param   inode inode found, 0 for a cached negative lookup
+ * @param   imode inode mode type of found inode
+ * @return  true if the name is in the cache*/
+bool ext4_dcache_lookup(struct ext4_dcache *dc, uint32_t parent,
+            const char *name, uint32_t name_len,
+            uint32_t *inode, uint32_t *imode);
+
+/**@brief   Store result of a directory lookup.
+ * @param   dc directory entry cache
+ * @param   parent directory inode
+ * @param   name entry name
+ * @param   name_len entry name length
+ * @param   inode inode found, 0 if the name does not exist
+ * @param   imode inode mode type of found inode*/
+void ext4_dcache_insert(struct ext4_dcache *dc, uint32_t parent,
+            const char *name, uint32_t name_len,
+            uint32_t inode, uint32_t imode);
+
+/**@brief   Forget a name (link, unlink, rename).
+ * @param   dc directory entry cache
+ * @param   parent directory inode
+ * @param   name entry name
+ * @param   name_len entry name length*/
+void ext4_dcache_invalidate(struct ext4_dcache *dc, uint32_t parent,
+                const char *name, uint32_t name_len);
+
+/**@brief   Forget every entry related to an inode being released.
+ * @param   dc directory entry cache
+ * @param   inode inode number*/
+void ext4_dcache_invalidate_inode(struct ext4_dcache *dc, uint32_t inode);
+
+#if CONFIG_DCACHE_BLOOM_DIRS
+/**@brief   Get bloom filter of a directory.
+ * @param   dc directory entry cache
+ * @param   dir directory inode
+ * @return  filter, NULL if the directory has none*/
+struct ext4_dcache_bloom *ext4_dcache_bloom_get(struct ext4_dcache *dc,
+                        uint32_t dir);
+
+/**@brief   Set up an empty bloom filter for a directory, replacing the
+ *          least recently used one. Filter bits stay NULL if the
+ *          directory is too big to be filtered.
+ * @param   dc directory entry cache
+ * @param   dir directory inode
+ * @param   dir_size directory size in bytes
+ * @return  filter slot*/
+struct ext4_dcache_bloom *ext4_dcache_bloom_new(struct ext4_dcache *dc,
+                        uint32_t dir,
+                        uint64_t dir_size);
+
+/**@brief   Release bloom filter.
+ * @param   b filter*/
+void ext4_dcache_bloom_drop(struct ext4_dcache_bloom *b);
+
+/**@brief   Add a name to bloom filter.
+ * @param   b filter
+ * @param   name entry name
+ * @param   name_len entry name length*/
+void ext4_dcache_bloom_set(struct ext4_dcache_bloom *b, const char *name,
+               uint32_t name_len);
+
+/**@brief   Check a name against bloom filter.
+ * @param   b filter
+ * @param   name entry name
+ * @param   name_len entry name length
+ * @return  false if the name is surely not in the directory*/
+bool ext4_dcache_bloom_test(struct ext4_dcache_bloom *b, const char *name,
+                uint32_t name_len);
+
+/**@brief   Note a name added to a directory.
+ * @param   dc directory entry cache
+ * @param   dir directory inode
+ * @param   name entry name
+ * @param   name_len entry name length*/
+void ext4_dcache_bloom_add(struct ext4_dcache *dc, uint32_t dir,
+               const char *name, uint32_t name_len);
+
+/**@brief   Note a name removed from a directory.
+ * @param   dc directory entry cache
+ * @param   dir directory inode*/
+void ext4_dcache_bloom_del(struct ext4_dcache *dc, uint32_t dir);
+#endif
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXT4_DCACHE_H_ */
+
+/**
+ * @}
+ */
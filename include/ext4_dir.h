@@ -59,11 +59,15 @@ struct ext4_dir_iter {
     struct ext4_block curr_blk;
     uint64_t curr_off;
     struct ext4_dir_en *curr;
+    /* "." or ".." entry of inline directory */
+    struct ext4_dir_idx_dot_en dot;
 };
 
 struct ext4_dir_search_result {
     struct ext4_block block;
     struct ext4_dir_en *dentry;
+    /* "." or ".." entry of inline directory */
+    struct ext4_dir_idx_dot_en dot;
 };
 
 
@@ -248,6 +252,19 @@ int ext4_dir_find_entry(struct ext4_dir_search_result *result,
 int ext4_dir_remove_entry(struct ext4_inode_ref *parent, const char *name,
               uint32_t name_len);
 
+/**@brief Try to insert entry to a buffer of directory entries.
+ * @param sb           Superblock
+ * @param data         Buffer holding entries
+ * @param size         Size of the buffer
+ * @param child        Child i-node to be inserted by new entry
+ * @param name         Name of the new entry
+ * @param name_len     Length of the new entry name
+ * @return Error code, ENOSPC if there is no room for the entry
+ */
+int ext4_dir_insert_in_buf(struct ext4_sblock *sb, uint8_t *data,
+               uint32_t size, struct ext4_inode_ref *child,
+               const char *name, uint32_t name_len);
+
 /**@brief Try to insert entry to concrete data block.
  * @param sb           Superblock
  * @param inode_ref    Directory i-node
@@ -263,6 +280,19 @@ int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
                   struct ext4_inode_ref *child, const char *name,
                   uint32_t name_len);
 
+/**@brief Try to find entry in a buffer of directory entries by name.
+ * @param data      Buffer holding entries
+ * @param size      Size of the buffer
+ * @param sb        Superblock
+ * @param name_len  Length of entry name
+ * @param name      Name of entry to be found
+ * @param res_entry Output pointer to found entry, NULL if not found
+ * @return Error code
+ */
+int ext4_dir_find_in_buf(uint8_t *data, uint32_t size, struct ext4_sblock *sb,
+             size_t name_len, const char *name,
+             struct ext4_dir_en **res_entry);
+
 /**@brief Try to find entry in block by name.
  * @param block     Block containing entries
  * @param sb        Superblock
@@ -72,6 +72,17 @@ struct ext4_dir_idx_block {
 int ext4_dir_dx_init(struct ext4_inode_ref *dir,
              struct ext4_inode_ref *parent);
 
+/**@brief Convert a linear directory to indexed one. Entries of all
+ *        blocks are sorted by hash and packed to leaves taking over
+ *        blocks 1.., block 0 is rebuilt as index root. Entry positions
+ *        of open directory streams are not valid after conversion.
+ *        Directories larger than @ref CONFIG_DIR_INDEX_CONVERT_BLOCKS
+ *        stay linear.
+ * @param dir Pointer to directory i-node
+ * @return Error code (ENOTSUP if directory can't be converted)
+ */
+int ext4_dir_dx_convert(struct ext4_inode_ref *dir);
+
 /**@brief Try to find directory entry using directory index.
  * @param result    Output value - if entry will be found,
  *                  than will be passed through this parameter
@@ -101,6 +112,24 @@ int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
 int ext4_dir_dx_reset_parent_inode(struct ext4_inode_ref *dir,
                                    uint32_t parent_inode);
 
+/**@brief Compute index hashes of names in directory.
+ * @param dir    Indexed directory i-node
+ * @param names  Names to hash
+ * @param count  Number of names
+ * @param hashes Output hash values
+ * @return Error code
+ */
+int ext4_dir_dx_hash_names(struct ext4_inode_ref *dir,
+               const char *const *names, size_t count,
+               uint32_t *hashes);
+
+/**@brief Compact indexed directory. Sparse neighbouring leaves are merged,
+ *        their index entries dropped and released blocks given back.
+ * @param dir Directory i-node
+ * @return Error code
+ */
+int ext4_dir_dx_compact(struct ext4_inode_ref *dir);
+
 #ifdef __cplusplus
 }
 #endif
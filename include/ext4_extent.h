@@ -51,14 +51,41 @@ extern "C" {
 void ext4_extent_tree_init(struct ext4_inode_ref *inode_ref);
 
 
+/**@brief Allocate missing blocks, unwritten blocks are converted to
+ *        written ones (and zeroed).*/
+#define EXT4_EXT_GET_CREATE 0x01
+
+/**@brief With @ref EXT4_EXT_GET_CREATE: missing blocks are allocated as
+ *        unwritten extents, unwritten blocks are left as they are.*/
+#define EXT4_EXT_GET_UNWRITTEN 0x02
+
+/**@brief Caller overwrites the whole range, unwritten blocks are
+ *        converted without zeroing.*/
+#define EXT4_EXT_GET_NOZERO 0x04
+
+/**@brief With @ref EXT4_EXT_GET_UNWRITTEN: written blocks are turned
+ *        back to unwritten ones, the range reads as zeros.*/
+#define EXT4_EXT_GET_ZERO 0x08
+
+/**@brief Map a range of logical blocks to physical blocks.
+ * @param inode_ref    I-node to map blocks of
+ * @param iblock       First logical block
+ * @param max_blocks   Maximum number of blocks to map
+ * @param result       Output: first physical block, 0 for a hole or an
+ *                     unwritten range which is not created
+ * @param flags        EXT4_EXT_GET_* flags
+ * @param blocks_count Output: number of blocks mapped the same way
+ * @return Error code */
 int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
-               uint32_t max_blocks, ext4_fsblk_t *result, bool create,
-               uint32_t *blocks_count);
+               uint32_t max_blocks, ext4_fsblk_t *result,
+               uint32_t flags, uint32_t *blocks_count);
 
 
-/**@brief Release all data blocks starting from specified logical block.
+/**@brief Release data blocks of a logical block range.
  * @param inode_ref   I-node to release blocks from
- * @param iblock_from First logical block to release
+ * @param from        First logical block to release
+ * @param to          Last logical block to release (EXT_MAX_BLOCKS for
+ *                    everything up to the end)
  * @return Error code */
 int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
                  ext4_lblk_t to);
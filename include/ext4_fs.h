@@ -49,10 +49,19 @@ extern "C" {
 #include <ext4_config.h>
 #include <ext4_types.h>
 #include <ext4_misc.h>
+#include <ext4_dcache.h>
+#include <ext4_xcache.h>
 
 #include <stdint.h>
 #include <stdbool.h>
 
+/**@brief Cached counters of one block group (used by i-node allocator).*/
+struct ext4_bg_stats {
+    uint32_t free_inodes;
+    uint32_t free_blocks;
+    uint32_t used_dirs;
+};
+
 struct ext4_fs {
     bool read_only;
 
@@ -67,6 +76,25 @@ struct ext4_fs {
     struct jbd_fs *jbd_fs;
     struct jbd_journal *jbd_journal;
     struct jbd_trans *curr_trans;
+
+    /* Superblock as of the running transaction start. Its counters and
+     * orphan list head live in memory only, an abort restores them */
+    struct ext4_sblock trans_sb;
+
+#if CONFIG_DCACHE_ENABLE
+    struct ext4_dcache dcache;
+#endif
+
+#if CONFIG_XCACHE_ENABLE
+    struct ext4_xcache xcache;
+#endif
+
+    /* Scratch space of htree leaf split, allocated on first use */
+    void *dx_scratch;
+
+    /* Counters of all block groups, loaded on first i-node allocation
+     * and kept in sync when group descriptors are put back dirty */
+    struct ext4_bg_stats *bg_stats;
 };
 
 struct ext4_block_group_ref {
@@ -164,6 +192,14 @@ int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
  */
 int ext4_fs_put_block_group_ref(struct ext4_block_group_ref *ref);
 
+/**@brief Copy counters of block group descriptor to cached stats.
+ * @param st Cached stats of the group
+ * @param bg Block group descriptor
+ * @param sb Superblock
+ */
+void ext4_fs_bg_stats_fill(struct ext4_bg_stats *st, struct ext4_bgroup *bg,
+               struct ext4_sblock *sb);
+
 /**@brief Get reference to i-node specified by index.
  * @param fs    Filesystem to find i-node on
  * @param index Index of i-node to load
@@ -173,6 +209,12 @@ int ext4_fs_put_block_group_ref(struct ext4_block_group_ref *ref);
 int ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
               struct ext4_inode_ref *ref);
 
+/**@brief Verify checksum of i-node.
+ * @param inode_ref I-node reference (fs, index and inode data)
+ * @return true means the i-node passed checksum verification
+ */
+bool ext4_fs_verify_inode_csum(struct ext4_inode_ref *inode_ref);
+
 /**@brief Reset blocks field of i-node.
  * @param fs        Filesystem to reset blocks field of i-inode on
  * @param inode_ref ref Pointer for inode to be operated on
@@ -196,10 +238,12 @@ uint32_t ext4_fs_correspond_inode_mode(int filetype);
  * @param fs        Filesystem to allocated i-node on
  * @param inode_ref Output pointer to return reference to allocated i-node
  * @param filetype  File type of newly created i-node
+ * @param parent    Parent directory i-node number (placement hint, 0 if
+ *                  unknown)
  * @return Error code
  */
 int ext4_fs_alloc_inode(struct ext4_fs *fs, struct ext4_inode_ref *inode_ref,
-            int filetype);
+            int filetype, uint32_t parent);
 
 /**@brief Release i-node and mark it as free.
  * @param inode_ref I-node to be released
@@ -207,9 +251,23 @@ int ext4_fs_alloc_inode(struct ext4_fs *fs, struct ext4_inode_ref *inode_ref,
  */
 int ext4_fs_free_inode(struct ext4_inode_ref *inode_ref);
 
+/**@brief Put an unlinked i-node on the orphan list, so that its blocks
+ *        can be released later, or after a crash on the next mount.
+ * @param inode_ref I-node to be added
+ * @return Error code
+ */
+int ext4_fs_orphan_add(struct ext4_inode_ref *inode_ref);
+
+/**@brief Remove i-node from the orphan list.
+ * @param inode_ref I-node to be removed
+ * @return Error code (ENOENT if the i-node is not on the list)
+ */
+int ext4_fs_orphan_del(struct ext4_inode_ref *inode_ref);
+
 /**@brief Truncate i-node data blocks.
  * @param inode_ref I-node to be truncated
- * @param new_size  New size of inode (must be < current size)
+ * @param new_size  New size of inode (must be <= current size, the same
+ *                  size only releases blocks preallocated past the end)
  * @return Error code
  */
 int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size);
@@ -250,6 +308,21 @@ int ext4_fs_get_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
                   ext4_lblk_t iblock, ext4_fsblk_t *fblock);
 
+/**@brief Map a run of logical blocks: the physical address of the first
+ *        one and how many following blocks are mapped the same way,
+ *        physically contiguous or all holes and unwritten blocks.
+ * @param inode_ref  I-node to read block addresses from
+ * @param iblock     First logical block
+ * @param max_blocks Maximum length of the run (not 0)
+ * @param fblock     Output physical address of the first block, 0 for
+ *                   a hole or an unwritten block
+ * @param count      Output length of the run
+ * @return Error code
+ */
+int ext4_fs_get_inode_dblk_run(struct ext4_inode_ref *inode_ref,
+                   ext4_lblk_t iblock, uint32_t max_blocks,
+                   ext4_fsblk_t *fblock, uint32_t *count);
+
 /**@brief Append following logical block to the i-node.
  * @param inode_ref I-node to append block to
  * @param fblock    Output physical block address of newly allocated block
@@ -259,6 +332,46 @@ int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
                   ext4_fsblk_t *fblock, ext4_lblk_t *iblock);
 
+/**@brief Get physical address of a data block the caller is going to
+ *        overwrite as a whole. Missing block is allocated (appended when
+ *        it is past the file end), unwritten block is converted without
+ *        zeroing.
+ * @param inode_ref I-node to proceed on
+ * @param iblock    Logical index of block, updated when appended
+ * @param fblock    Output physical block address
+ * @return Error code
+ */
+int ext4_fs_overwrite_inode_dblk(struct ext4_inode_ref *inode_ref,
+                 ext4_lblk_t *iblock, ext4_fsblk_t *fblock);
+
+/**@brief Preallocate a range of an extent i-node as unwritten blocks,
+ *        which read as zeros. The i-node size is left untouched.
+ * @param inode_ref I-node to proceed on
+ * @param iblock    First logical block
+ * @param count     Number of blocks
+ * @param zero      Turn written blocks of the range to unwritten too
+ * @return Error code (ENOTSUP for an i-node without extents)
+ */
+int ext4_fs_prealloc_inode_dblk(struct ext4_inode_ref *inode_ref,
+                ext4_lblk_t iblock, uint32_t count, bool zero);
+
+/**@brief Release the blocks of a range of an extent i-node, which then
+ *        reads as zeros. The i-node size is left untouched.
+ * @param inode_ref I-node to proceed on
+ * @param iblock    First logical block
+ * @param count     Number of blocks
+ * @return Error code (ENOTSUP for an i-node without extents)
+ */
+int ext4_fs_punch_inode_dblk(struct ext4_inode_ref *inode_ref,
+                 ext4_lblk_t iblock, uint32_t count);
+
+/**@brief Check if an i-node may hold blocks past its end, which
+ *        @ref ext4_fs_truncate_inode releases even if the size stays.
+ * @param inode_ref I-node to check
+ * @return true if truncate has to look for such blocks
+ */
+bool ext4_fs_inode_has_eof_blocks(struct ext4_inode_ref *inode_ref);
+
 /**@brief   Increment inode link count.
  * @param   inode none handle
  */
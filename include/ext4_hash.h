@@ -44,6 +44,7 @@ extern "C" {
 #include <ext4_config.h>
 
 #include <stdint.h>
+#include <stddef.h>
 
 struct ext4_hash_info {
     uint32_t hash;
@@ -65,6 +66,19 @@ int ext2_htree_hash(const char *name, int len, const uint32_t *hash_seed,
             int hash_version, uint32_t *hash_major,
             uint32_t *hash_minor);
 
+/**@brief   Hash a batch of NUL terminated entry names. Names are hashed
+ *          one by one with @ref ext2_htree_hash, there is no batching
+ *          (interleaving or vectorization) across names.
+ * @param   names entry names
+ * @param   count number of names
+ * @param   hash_seed (from superblock)
+ * @param   hash version (from superblock)
+ * @param   hash_major output values, one per name
+ * @return  standard error code (EINVAL if names or outputs are missing)*/
+int ext2_htree_hash_batch(const char *const *names, size_t count,
+              const uint32_t *hash_seed, int hash_version,
+              uint32_t *hash_major);
+
 #ifdef __cplusplus
 }
 #endif
@@ -65,14 +65,23 @@ void ext4_ialloc_set_bitmap_csum(struct ext4_sblock *sb, struct ext4_bgroup *bg,
 int ext4_ialloc_free_inode(struct ext4_fs *fs, uint32_t index, bool is_dir);
 
 /**@brief I-node allocation algorithm.
- * This is more simple algorithm, than Orlov allocator used
- * in the Linux kernel.
+ * With known parent, block group is chosen Orlov style from cached
+ * group counters: top level directories are spread, subdirectories and
+ * files are kept close to the parent. Otherwise (or when the chosen
+ * group turns out to be full) groups are scanned from the last used one.
  * @param fs     Filesystem to allocate i-node on
  * @param index  Output value - allocated i-node number
  * @param is_dir Flag if allocated i-node will be file or directory
+ * @param parent Parent directory i-node number (0 if unknown)
  * @return Error code
  */
-int ext4_ialloc_alloc_inode(struct ext4_fs *fs, uint32_t *index, bool is_dir);
+int ext4_ialloc_alloc_inode(struct ext4_fs *fs, uint32_t *index, bool is_dir,
+                uint32_t parent);
+
+/**@brief Drop cached block group counters (reloaded on next allocation).
+ * @param fs Filesystem
+ */
+void ext4_ialloc_stats_drop(struct ext4_fs *fs);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_inline.h
+ * @brief Inline data: small files and directories kept in the i-node.
+ *        First 60 bytes are stored in i_block, the rest in the value of
+ *        "system.data" extended attribute in the i-node body.
+ */
+
+#ifndef EXT4_INLINE_H_
+#define EXT4_INLINE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <ext4_config.h>
+#include <ext4_types.h>
+#include <ext4_fs.h>
+#include <ext4_inode.h>
+#include <ext4_dir.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**@brief   Check if i-node keeps its data inline.
+ * @param   inode_ref I-node reference
+ * @return  true if data are inline*/
+static inline bool ext4_inline_has_data(struct ext4_inode_ref *inode_ref)
+{
+    return ext4_inode_has_flag(inode_ref->inode,
+                   EXT4_INODE_FLAG_INLINE_DATA);
+}
+
+#if CONFIG_INLINE_DATA_ENABLE
+
+/**@brief   Largest data size the i-node can keep inline.
+ * @param   inode_ref I-node reference
+ * @return  size in bytes, 0 if inline data don't fit the i-node*/
+size_t ext4_inline_max_size(struct ext4_inode_ref *inode_ref);
+
+/**@brief   Turn an empty file without data blocks into inline one.
+ * @param   inode_ref I-node reference
+ * @return  standard error code, ENOSPC if the i-node has no room*/
+int ext4_inline_init(struct ext4_inode_ref *inode_ref);
+
+/**@brief   Drop inline data. I-node gets empty block map (or extent
+ *          tree) and zero size.
+ * @param   inode_ref I-node reference
+ * @return  standard error code*/
+int ext4_inline_clear(struct ext4_inode_ref *inode_ref);
+
+/**@brief   Undo @ref ext4_inline_clear after a failed conversion. Blocks
+ *          the i-node got meanwhile are released and the saved data are
+ *          made inline again.
+ * @param   inode_ref I-node reference
+ * @param   buf data read before the clear
+ * @param   len data length (former i-node size)
+ * @return  standard error code*/
+int ext4_inline_restore(struct ext4_inode_ref *inode_ref, const void *buf,
+            size_t len);
+
+/**@brief   Read inline file data.
+ * @param   inode_ref I-node reference
+ * @param   off offset in file
+ * @param   buf output buffer
+ * @param   len bytes to read (off + len must not exceed file size)
+ * @return  standard error code*/
+int ext4_inline_read(struct ext4_inode_ref *inode_ref, uint64_t off,
+             void *buf, size_t len);
+
+/**@brief   Write inline file data, file grows if needed.
+ * @param   inode_ref I-node reference
+ * @param   off offset in file (not beyond the file size)
+ * @param   buf input buffer
+ * @param   len bytes to write
+ * @return  standard error code, ENOSPC if data don't fit the i-node*/
+int ext4_inline_write(struct ext4_inode_ref *inode_ref, uint64_t off,
+              const void *buf, size_t len);
+
+/**@brief   Truncate inline data. Directories are cleared, see
+ *          @ref ext4_inline_clear.
+ * @param   inode_ref I-node reference
+ * @param   new_size new size (not bigger than current one)
+ * @return  standard error code*/
+int ext4_inline_truncate(struct ext4_inode_ref *inode_ref, uint64_t new_size);
+
+/**@brief   Initialize new directory as inline one.
+ * @param   dir directory i-node
+ * @param   parent parent directory i-node
+ * @return  standard error code, ENOSPC if the i-node has no room*/
+int ext4_inline_dir_init(struct ext4_inode_ref *dir,
+             struct ext4_inode_ref *parent);
+
+/**@brief   Set ".." of inline directory.
+ * @param   dir directory i-node
+ * @param   parent new parent i-node number*/
+void ext4_inline_dir_set_parent(struct ext4_inode_ref *dir, uint32_t parent);
+
+/**@brief   Get entry of inline directory at iterator position.
+ *          "." and ".." are not stored, they are built in @p dot.
+ * @param   dir directory i-node
+ * @param   pos iterator position
+ * @param   dot buffer for "." and ".." entries
+ * @param   en output entry, NULL at the end of directory
+ * @return  standard error code*/
+int ext4_inline_dir_seek(struct ext4_inode_ref *dir, uint64_t pos,
+             struct ext4_dir_idx_dot_en *dot,
+             struct ext4_dir_en **en);
+
+/**@brief   Find entry of inline directory.
+ * @param   result result structure, its block is not used
+ * @param   dir directory i-node
+ * @param   name entry name
+ * @param   name_len entry name length
+ * @return  standard error code, ENOENT if there is no such entry*/
+int ext4_inline_dir_find_entry(struct ext4_dir_search_result *result,
+                   struct ext4_inode_ref *dir, const char *name,
+                   uint32_t name_len);
+
+/**@brief   Add entry to inline directory, the xattr part grows if
+ *          needed.
+ * @param   dir directory i-node
+ * @param   name entry name
+ * @param   name_len entry name length
+ * @param   child child i-node
+ * @return  standard error code, ENOSPC if the entry doesn't fit
+ *          (directory should be converted, see
+ *          @ref ext4_inline_dir_convert)*/
+int ext4_inline_dir_add_entry(struct ext4_inode_ref *dir, const char *name,
+                  uint32_t name_len, struct ext4_inode_ref *child);
+
+/**@brief   Remove entry from inline directory.
+ * @param   dir directory i-node
+ * @param   name entry name
+ * @param   name_len entry name length
+ * @return  standard error code*/
+int ext4_inline_dir_remove_entry(struct ext4_inode_ref *dir, const char *name,
+                 uint32_t name_len);
+
+/**@brief   Move entries of inline directory to a directory block.
+ * @param   dir directory i-node
+ * @return  standard error code*/
+int ext4_inline_dir_convert(struct ext4_inode_ref *dir);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXT4_INLINE_H_ */
+
+/**
+ * @}
+ */
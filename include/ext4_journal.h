@@ -47,13 +47,35 @@ extern "C" {
 #include <misc/tree.h>
 
 struct jbd_fs {
+    struct ext4_fs *fs;
     struct ext4_blockdev *bdev;
     struct ext4_inode_ref inode_ref;
     struct jbd_sb sb;
 
+    bool external;
     bool dirty;
 };
 
+#if CONFIG_JOURNAL_HASH_INDEX
+/**@brief  Free object of a journal record pool.*/
+struct jbd_pool_obj {
+    SLIST_ENTRY(jbd_pool_obj) free_node;
+};
+
+/**@brief  Memory chunk owned by a journal record pool.*/
+struct jbd_pool_chunk {
+    SLIST_ENTRY(jbd_pool_chunk) chunk_node;
+};
+
+/**@brief  Fixed-size object pool for journal records.*/
+struct jbd_pool {
+    uint32_t obj_size;
+    uint32_t used;
+    SLIST_HEAD(jbd_pool_free, jbd_pool_obj) free_list;
+    SLIST_HEAD(jbd_pool_chunks, jbd_pool_chunk) chunk_list;
+};
+#endif
+
 struct jbd_buf {
     uint32_t jbd_lba;
     struct ext4_block block;
@@ -65,13 +87,32 @@ struct jbd_buf {
 
 struct jbd_revoke_rec {
     ext4_fsblk_t lba;
+#if CONFIG_JOURNAL_HASH_INDEX
+    struct jbd_trans *trans;
+    LIST_ENTRY(jbd_revoke_rec) hash_node;
+    LIST_ENTRY(jbd_revoke_rec) revoke_node;
+#else
     RB_ENTRY(jbd_revoke_rec) revoke_node;
+#endif
 };
 
+#if CONFIG_JOURNAL_ORDERED_DATA
+struct jbd_data_range {
+    uint64_t off;
+    uint32_t len;
+    const void *data;
+    TAILQ_ENTRY(jbd_data_range) range_node;
+};
+#endif
+
 struct jbd_block_rec {
     ext4_fsblk_t lba;
     struct jbd_trans *trans;
+#if CONFIG_JOURNAL_HASH_INDEX
+    LIST_ENTRY(jbd_block_rec) hash_node;
+#else
     RB_ENTRY(jbd_block_rec) block_rec_node;
+#endif
     LIST_ENTRY(jbd_block_rec) tbrec_node;
     TAILQ_HEAD(jbd_buf_dirty, jbd_buf) dirty_buf_queue;
 };
@@ -89,8 +130,15 @@ struct jbd_trans {
     struct jbd_journal *journal;
 
     TAILQ_HEAD(jbd_trans_buf, jbd_buf) buf_queue;
+#if CONFIG_JOURNAL_HASH_INDEX
+    LIST_HEAD(jbd_revoke_list, jbd_revoke_rec) revoke_list;
+#else
     RB_HEAD(jbd_revoke_tree, jbd_revoke_rec) revoke_root;
+#endif
     LIST_HEAD(jbd_trans_block_rec, jbd_block_rec) tbrec_list;
+#if CONFIG_JOURNAL_ORDERED_DATA
+    TAILQ_HEAD(jbd_trans_data, jbd_data_range) data_queue;
+#endif
     TAILQ_ENTRY(jbd_trans) trans_node;
 };
 
@@ -104,12 +152,25 @@ struct jbd_journal {
     uint32_t block_size;
 
     TAILQ_HEAD(jbd_cp_queue, jbd_trans) cp_queue;
+#if CONFIG_JOURNAL_HASH_INDEX
+    uint32_t block_rec_cnt;
+    LIST_HEAD(jbd_block_hash, jbd_block_rec)
+        block_rec_hash[CONFIG_JOURNAL_HASH_SIZE];
+    LIST_HEAD(jbd_revoke_hash, jbd_revoke_rec)
+        revoke_hash[CONFIG_JOURNAL_HASH_SIZE];
+
+    struct jbd_pool buf_pool;
+    struct jbd_pool block_rec_pool;
+    struct jbd_pool revoke_rec_pool;
+#else
     RB_HEAD(jbd_block, jbd_block_rec) block_rec_root;
+#endif
 
     struct jbd_fs *jbd_fs;
 };
 
 int jbd_get_fs(struct ext4_fs *fs,
+           struct ext4_blockdev *jbd_bdev,
            struct jbd_fs *jbd_fs);
 int jbd_put_fs(struct jbd_fs *jbd_fs);
 int jbd_inode_bmap(struct jbd_fs *jbd_fs,
@@ -127,6 +188,14 @@ int jbd_trans_revoke_block(struct jbd_trans *trans,
                ext4_fsblk_t lba);
 int jbd_trans_try_revoke_block(struct jbd_trans *trans,
                    ext4_fsblk_t lba);
+int jbd_trans_try_revoke_blocks(struct jbd_trans *trans,
+                ext4_fsblk_t lba, uint32_t cnt);
+#if CONFIG_JOURNAL_ORDERED_DATA
+int jbd_trans_add_data(struct jbd_trans *trans,
+               uint64_t off,
+               const void *data,
+               uint32_t len);
+#endif
 void jbd_journal_free_trans(struct jbd_journal *journal,
                 struct jbd_trans *trans,
                 bool abort);
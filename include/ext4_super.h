@@ -200,6 +200,13 @@ uint32_t ext4_inodes_in_group_cnt(struct ext4_sblock *s, uint32_t bgid);
  * @return  Standard error code */
 int ext4_sb_write(struct ext4_blockdev *bdev, struct ext4_sblock *s);
 
+/**@brief   Superblock write through the block cache, as a part of the
+ *          current transaction.
+ * @param   bdev block device descriptor.
+ * @param   s superblock descriptor
+ * @return  Standard error code */
+int ext4_sb_write_trans(struct ext4_blockdev *bdev, struct ext4_sblock *s);
+
 /**@brief   Superblock read.
  * @param   bdev block device descriptor.
  * @param   s superblock descriptor
@@ -50,6 +50,15 @@ extern "C" {
  * @return  standard error code*/
 int ext4_trans_set_block_dirty(struct ext4_buf *buf);
 
+/**@brief   Mark a directory, mapping or xattr block of an i-node dirty,
+ *          so that a sync of that i-node alone writes it.
+ * @param   buf buffer
+ * @param   ino i-node number
+ * @param   datasync the block is needed to read the data back
+ * @return  standard error code*/
+int ext4_trans_set_inode_block_dirty(struct ext4_buf *buf, uint32_t ino,
+                     bool datasync);
+
 /**@brief   Block get function (through cache, don't read).
  *          jbd_trans_get_access would be called in order to
  *          get write access to the buffer.
@@ -79,6 +88,15 @@ int ext4_trans_block_get(struct ext4_blockdev *bdev,
 int ext4_trans_try_revoke_block(struct ext4_blockdev *bdev,
                    uint64_t lba);
 
+/**@brief  Try to add a range of blocks to be revoked to the current
+ *         transaction.
+ * @param  bdev block device descriptor
+ * @param  lba first logical block address
+ * @param  cnt number of blocks
+ * @return standard error code*/
+int ext4_trans_try_revoke_blocks(struct ext4_blockdev *bdev,
+                 uint64_t lba, uint32_t cnt);
+
 #ifdef __cplusplus
 }
 #endif
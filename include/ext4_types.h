@@ -281,7 +281,8 @@ struct ext4_sblock {
 #define EXT4_SUPPORTED_FINCOM                              \
     (EXT4_FINCOM_FILETYPE | EXT4_FINCOM_META_BG |      \
      EXT4_FINCOM_EXTENTS | EXT4_FINCOM_FLEX_BG |       \
-     EXT4_FINCOM_64BIT)
+     EXT4_FINCOM_64BIT | EXT4_FINCOM_LARGEDIR |        \
+     EXT4_FINCOM_INLINE_DATA)
 
 #define EXT4_SUPPORTED_FRO_COM                             \
     (EXT4_FRO_COM_SPARSE_SUPER |                       \
@@ -299,10 +300,6 @@ struct ext4_sblock {
     EXT4_FINCOM_RECOVER | EXT4_FINCOM_MMP
 
 #if 0
-/*TODO: Features incompatible to implement*/
-#define EXT4_SUPPORTED_FINCOM
-                     (EXT4_FINCOM_INLINE_DATA)
-
 /*TODO: Features read only to implement*/
 #define EXT4_SUPPORTED_FRO_COM
                      EXT4_FRO_COM_BIGALLOC |\
@@ -460,6 +457,7 @@ struct ext4_inode {
 #define EXT4_INODE_FLAG_EXTENTS 0x00080000   /* Inode uses extents */
 #define EXT4_INODE_FLAG_EA_INODE 0x00200000  /* Inode used for large EA */
 #define EXT4_INODE_FLAG_EOFBLOCKS 0x00400000 /* Blocks allocated beyond EOF */
+#define EXT4_INODE_FLAG_INLINE_DATA 0x10000000 /* Inode has inline data */
 #define EXT4_INODE_FLAG_RESERVED 0x80000000  /* reserved for ext4 lib */
 
 #define EXT4_INODE_ROOT_INDEX 2
@@ -544,6 +542,10 @@ struct ext4_dir_idx_node {
     struct ext4_dir_idx_entry entries[];
 };
 
+/* Maximum depth of index tree (root included), with largedir feature */
+#define EXT4_DIR_DX_LEVELS_COMPAT 2
+#define EXT4_DIR_DX_LEVELS 3
+
 /*
  * This goes at the end of each htree block.
  */
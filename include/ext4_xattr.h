@@ -44,6 +44,18 @@ extern "C" {
 #include <ext4_config.h>
 #include <ext4_types.h>
 #include <ext4_inode.h>
+#include <ext4_xcache.h>
+
+/* Name indexes */
+#define EXT4_XATTR_INDEX_USER           1
+#define EXT4_XATTR_INDEX_POSIX_ACL_ACCESS   2
+#define EXT4_XATTR_INDEX_POSIX_ACL_DEFAULT  3
+#define EXT4_XATTR_INDEX_TRUSTED        4
+#define EXT4_XATTR_INDEX_LUSTRE         5
+#define EXT4_XATTR_INDEX_SECURITY           6
+#define EXT4_XATTR_INDEX_SYSTEM         7
+#define EXT4_XATTR_INDEX_RICHACL        8
+#define EXT4_XATTR_INDEX_ENCRYPTION     9
 
 struct ext4_xattr_info {
     uint8_t name_index;
@@ -87,10 +99,38 @@ const char *ext4_get_xattr_name_prefix(uint8_t name_index,
 int ext4_xattr_list(struct ext4_inode_ref *inode_ref,
             struct ext4_xattr_list_entry *list, size_t *list_len);
 
+/**@brief   Call @p iter for every xattr of an i-node. Inline file data
+ *          (system.data) are skipped.
+ * @param   inode_ref I-node reference
+ * @param   iter callback, anything but EOK stops the iteration
+ * @param   arg callback argument
+ * @return  standard error code or the value returned by @p iter*/
+int ext4_xattr_iterate(struct ext4_inode_ref *inode_ref,
+               int (*iter)(void *arg,
+                   const struct ext4_xattr_item *item),
+               void *arg);
+
 int ext4_xattr_get(struct ext4_inode_ref *inode_ref, uint8_t name_index,
            const char *name, size_t name_len, void *buf, size_t buf_len,
            size_t *data_len);
 
+#if CONFIG_XCACHE_ENABLE && CONFIG_XCACHE_INODES
+/**@brief   Get xattr value of an i-node whose xattrs are already decoded
+ *          in xattr cache, the i-node itself is not loaded.
+ * @param   fs filesystem
+ * @param   inode i-node number
+ * @param   name_index name index
+ * @param   name name without prefix
+ * @param   name_len name length
+ * @param   buf output buffer
+ * @param   buf_len output buffer length
+ * @param   data_len value length
+ * @return  standard error code, ENOENT if the i-node is not cached*/
+int ext4_xattr_cache_get(struct ext4_fs *fs, uint32_t inode,
+             uint8_t name_index, const char *name, size_t name_len,
+             void *buf, size_t buf_len, size_t *data_len);
+#endif
+
 int ext4_xattr_remove(struct ext4_inode_ref *inode_ref, uint8_t name_index,
               const char *name, size_t name_len);
 
@@ -98,6 +138,24 @@ int ext4_xattr_set(struct ext4_inode_ref *inode_ref, uint8_t name_index,
            const char *name, size_t name_len, const void *value,
            size_t value_len);
 
+/**@brief   Drop the reference of an i-node to its xattr block, the
+ *          block is freed if no other i-node shares it.
+ * @param   inode_ref I-node reference
+ * @return  standard error code*/
+int ext4_xattr_release_block(struct ext4_inode_ref *inode_ref);
+
+int ext4_xattr_ibody_get(struct ext4_inode_ref *inode_ref, uint8_t name_index,
+             const char *name, size_t name_len, void **value,
+             size_t *value_len);
+
+int ext4_xattr_ibody_set(struct ext4_inode_ref *inode_ref, uint8_t name_index,
+             const char *name, size_t name_len, const void *value,
+             size_t value_len);
+
+int ext4_xattr_ibody_max_value(struct ext4_inode_ref *inode_ref,
+                   uint8_t name_index, const char *name,
+                   size_t name_len, size_t *max_len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_xcache.h
+ * @brief Xattr caches: blocks by their hash, so an i-node can share
+ *        an existing block with identical attributes, and decoded
+ *        attributes of recently used i-nodes.
+ */
+
+#ifndef EXT4_XCACHE_H_
+#define EXT4_XCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <ext4_config.h>
+#include <ext4_types.h>
+
+#include <misc/queue.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**@brief   Decoded extended attribute.*/
+struct ext4_xattr_item {
+    /**@brief   Hash of name index and name.*/
+    uint32_t hash;
+
+    /**@brief   Name index (EXT4_XATTR_INDEX_...).*/
+    uint8_t name_index;
+
+    /**@brief   Name length.*/
+    uint8_t name_len;
+
+    /**@brief   Value length.*/
+    uint32_t value_len;
+
+    /**@brief   Name without prefix (not null terminated).*/
+    const char *name;
+
+    /**@brief   Value.*/
+    const void *value;
+};
+
+/**@brief   Hash of attribute name.
+ * @param   name_index name index
+ * @param   name name without prefix
+ * @param   name_len name length
+ * @return  hash*/
+uint32_t ext4_xcache_name_hash(uint8_t name_index, const char *name,
+                   size_t name_len);
+
+#if CONFIG_XCACHE_ENABLE
+
+/**@brief   Hash buckets of xattr block cache.*/
+#define EXT4_XCACHE_BUCKETS 32
+
+/**@brief   Cached xattr block.*/
+struct ext4_xcache_entry {
+    /**@brief   Block number, 0 if the entry is unused.*/
+    ext4_fsblk_t block;
+
+    /**@brief   Block hash (h_hash of the header).*/
+    uint32_t hash;
+
+    LIST_ENTRY(ext4_xcache_entry) hash_node;
+    TAILQ_ENTRY(ext4_xcache_entry) lru_node;
+};
+
+/**@brief   Decoded attributes of one i-node.*/
+struct ext4_xcache_inode {
+    /**@brief   I-node number, 0 if the slot is unused.*/
+    uint32_t inode;
+
+    /**@brief   Last use stamp.*/
+    uint32_t stamp;
+
+    /**@brief   Number of attributes.*/
+    uint32_t count;
+
+    /**@brief   Attributes, names and values are stored behind the
+     *          array in the same allocation.*/
+    struct ext4_xattr_item *items;
+};
+
+/**@brief   Xattr block cache.*/
+struct ext4_xcache {
+    struct ext4_xcache_entry entries[CONFIG_XCACHE_SIZE];
+
+    LIST_HEAD(ext4_xcache_bucket, ext4_xcache_entry)
+        buckets[EXT4_XCACHE_BUCKETS];
+
+    /**@brief   Least recently used entry first.*/
+    TAILQ_HEAD(ext4_xcache_lru, ext4_xcache_entry) lru;
+
+#if CONFIG_XCACHE_INODES
+    struct ext4_xcache_inode inodes[CONFIG_XCACHE_INODES];
+
+    /**@brief   I-node slot use counter.*/
+    uint32_t inode_stamp;
+#endif
+};
+
+/**@brief   Initialize xattr block cache.
+ * @param   xc xattr block cache*/
+void ext4_xcache_init(struct ext4_xcache *xc);
+
+/**@brief   Drop all entries of xattr block cache.
+ * @param   xc xattr block cache*/
+void ext4_xcache_purge(struct ext4_xcache *xc);
+
+/**@brief   Get blocks with a given hash, most recently used first.
+ * @param   xc xattr block cache
+ * @param   hash block hash
+ * @param   blocks output block numbers
+ * @param   max size of @p blocks
+ * @return  number of blocks found*/
+size_t ext4_xcache_lookup(struct ext4_xcache *xc, uint32_t hash,
+              ext4_fsblk_t *blocks, size_t max);
+
+/**@brief   Store (or refresh) a block, replacing its previous hash.
+ * @param   xc xattr block cache
+ * @param   hash block hash
+ * @param   block block number*/
+void ext4_xcache_insert(struct ext4_xcache *xc, uint32_t hash,
+            ext4_fsblk_t block);
+
+/**@brief   Forget a block (freed, changed or no longer shareable).
+ * @param   xc xattr block cache
+ * @param   block block number*/
+void ext4_xcache_remove(struct ext4_xcache *xc, ext4_fsblk_t block);
+
+#if CONFIG_XCACHE_INODES
+/**@brief   Get decoded attributes of an i-node.
+ * @param   xc xattr cache
+ * @param   inode i-node number
+ * @return  cached attributes, NULL if the i-node is not cached*/
+struct ext4_xcache_inode *ext4_xcache_inode_get(struct ext4_xcache *xc,
+                        uint32_t inode);
+
+/**@brief   Store decoded attributes of an i-node, replacing the least
+ *          recently used slot.
+ * @param   xc xattr cache
+ * @param   inode i-node number
+ * @param   items attributes allocated by ext4_malloc, the cache takes
+ *          ownership of them
+ * @param   count number of attributes
+ * @return  cached attributes*/
+struct ext4_xcache_inode *ext4_xcache_inode_set(struct ext4_xcache *xc,
+                        uint32_t inode,
+                        struct ext4_xattr_item *items,
+                        uint32_t count);
+
+/**@brief   Forget decoded attributes of an i-node (changed or freed).
+ * @param   xc xattr cache
+ * @param   inode i-node number*/
+void ext4_xcache_inode_drop(struct ext4_xcache *xc, uint32_t inode);
+
+/**@brief   Find an attribute of a cached i-node.
+ * @param   ci cached attributes
+ * @param   name_index name index
+ * @param   name name without prefix
+ * @param   name_len name length
+ * @return  attribute, NULL if the i-node has no such attribute*/
+const struct ext4_xattr_item *
+ext4_xcache_inode_find(struct ext4_xcache_inode *ci, uint8_t name_index,
+               const char *name, size_t name_len);
+#endif
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXT4_XCACHE_H_ */
+
+/**
+ * @}
+ */
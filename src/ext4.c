@@ -49,8 +49,10 @@
 #include <ext4_inode.h>
 #include <ext4_super.h>
 #include <ext4_block_group.h>
+#include <ext4_ialloc.h>
 #include <ext4_dir_idx.h>
 #include <ext4_xattr.h>
+#include <ext4_inline.h>
 #include <ext4_journal.h>
 
 
@@ -94,6 +96,12 @@ struct ext4_mountpoint {
 
     /**@brief   Block cache.*/
     struct ext4_bcache bc;
+
+    /**@brief   External journal device (@ref ext4_journal_dev_set).*/
+    struct ext4_blockdev *jbd_bdev;
+
+    /**@brief   Block cache of external journal device.*/
+    struct ext4_bcache jbd_bc;
 };
 
 /**@brief   Block devices descriptor.*/
@@ -112,6 +120,8 @@ static struct ext4_block_devices s_bdevices[CONFIG_EXT4_BLOCKDEVS_COUNT];
 /**@brief   Mountpoints.*/
 static struct ext4_mountpoint s_mp[CONFIG_EXT4_MOUNTPOINTS_COUNT];
 
+static int __ext4_orphan_cleanup(struct ext4_mountpoint *mp, uint32_t count);
+
 int ext4_device_register(struct ext4_blockdev *bd,
              const char *dev_name)
 {
@@ -234,6 +244,13 @@ static int ext4_link(struct ext4_mountpoint *mp, struct ext4_inode_ref *parent,
                    EXT4_INODE_MODE_DIRECTORY);
     if (is_dir && !rename) {
 
+#if CONFIG_INLINE_DATA_ENABLE
+        /* Keep entries in the i-node while they fit there */
+        if (ext4_sb_feature_incom(&mp->fs.sb, EXT4_FINCOM_INLINE_DATA) &&
+            ext4_inline_dir_init(ch, parent) == EOK) {
+            ch->dirty = true;
+        } else
+#endif
 #if CONFIG_DIR_INDEX_ENABLE
         /* Initialize directory index if supported */
         if (ext4_sb_feature_com(&mp->fs.sb, EXT4_FCOM_DIR_INDEX)) {
@@ -275,13 +292,18 @@ static int ext4_link(struct ext4_mountpoint *mp, struct ext4_inode_ref *parent,
         bool idx;
         idx = ext4_inode_has_flag(ch->inode, EXT4_INODE_FLAG_INDEX);
         struct ext4_dir_search_result res;
+#if CONFIG_INLINE_DATA_ENABLE
+        if (ext4_inline_has_data(ch)) {
+            ext4_inline_dir_set_parent(ch, parent->index);
+        } else
+#endif
         if (!idx) {
             r = ext4_dir_find_entry(&res, ch, "..", strlen(".."));
             if (r != EOK)
                 return EIO;
 
             ext4_dir_en_set_inode(res.dentry, parent->index);
-            ext4_trans_set_block_dirty(res.block.buf);
+            ext4_trans_set_inode_block_dirty(res.block.buf, ch->index, true);
             r = ext4_dir_destroy_result(ch, &res);
             if (r != EOK)
                 return r;
@@ -436,6 +458,11 @@ int ext4_mount(const char *dev_name, const char *mount_point,
 
     bd->fs = &mp->fs;
     mp->mounted = 1;
+
+    /*With a journal the orphans wait for ext4_journal_start.*/
+    if (!ext4_sb_feature_com(&mp->fs.sb, EXT4_FCOM_HAS_JOURNAL))
+        __ext4_orphan_cleanup(mp, 0);
+
     return r;
 }
 
@@ -456,6 +483,12 @@ int ext4_umount(const char *mount_point)
     if (!mp)
         return ENODEV;
 
+    /*A running journal releases the orphans in ext4_journal_stop. Not
+     * started, they are released directly, unless recovery is pending.*/
+    if (!mp->fs.jbd_journal &&
+        !ext4_sb_feature_incom(&mp->fs.sb, EXT4_FINCOM_RECOVER))
+        __ext4_orphan_cleanup(mp, 0);
+
     r = ext4_fs_fini(&mp->fs);
     if (r != EOK)
         goto Finish;
@@ -466,6 +499,12 @@ int ext4_umount(const char *mount_point)
     ext4_bcache_fini_dynamic(mp->fs.bdev->bc);
 
     r = ext4_block_fini(mp->fs.bdev);
+
+    if (mp->jbd_bdev) {
+        ext4_bcache_cleanup(&mp->jbd_bc);
+        ext4_bcache_fini_dynamic(&mp->jbd_bc);
+        ext4_block_fini(mp->jbd_bdev);
+    }
 Finish:
     mp->fs.bdev->fs = NULL;
     memset(mp, 0, sizeof(struct ext4_mountpoint));
@@ -486,6 +525,58 @@ static struct ext4_mountpoint *ext4_get_mount(const char *path)
     return NULL;
 }
 
+__unused
+static int __ext4_journal_dev_set(const char *mount_point,
+                  const char *dev_name)
+{
+    int r;
+    uint32_t bsize;
+    struct ext4_blockdev *bd = NULL;
+    struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+
+    if (!mp)
+        return ENOENT;
+
+    for (size_t i = 0; i < CONFIG_EXT4_BLOCKDEVS_COUNT; ++i) {
+        if (!strcmp(dev_name, s_bdevices[i].name)) {
+            bd = s_bdevices[i].bd;
+            break;
+        }
+    }
+
+    if (!bd)
+        return ENODEV;
+
+    if (bd == mp->fs.bdev || mp->jbd_bdev || mp->fs.jbd_journal)
+        return EBUSY;
+
+    r = ext4_block_init(bd);
+    if (r != EOK)
+        return r;
+
+    /*Journal blocks have the same size as filesystem blocks*/
+    bsize = ext4_sb_get_block_size(&mp->fs.sb);
+    ext4_block_set_lb_size(bd, bsize);
+
+    r = ext4_bcache_init_dynamic(&mp->jbd_bc, CONFIG_BLOCK_DEV_CACHE_SIZE,
+                     bsize);
+    if (r != EOK) {
+        ext4_block_fini(bd);
+        return r;
+    }
+
+    r = ext4_block_bind_bcache(bd, &mp->jbd_bc);
+    if (r != EOK) {
+        ext4_bcache_cleanup(&mp->jbd_bc);
+        ext4_block_fini(bd);
+        ext4_bcache_fini_dynamic(&mp->jbd_bc);
+        return r;
+    }
+
+    mp->jbd_bdev = bd;
+    return EOK;
+}
+
 __unused
 static int __ext4_journal_start(const char *mount_point)
 {
@@ -500,7 +591,7 @@ static int __ext4_journal_start(const char *mount_point)
 
     if (ext4_sb_feature_com(&mp->fs.sb,
                 EXT4_FCOM_HAS_JOURNAL)) {
-        r = jbd_get_fs(&mp->fs, &mp->jbd_fs);
+        r = jbd_get_fs(&mp->fs, mp->jbd_bdev, &mp->jbd_fs);
         if (r != EOK)
             goto Finish;
 
@@ -512,6 +603,10 @@ static int __ext4_journal_start(const char *mount_point)
         }
         mp->fs.jbd_fs = &mp->jbd_fs;
         mp->fs.jbd_journal = &mp->jbd_journal;
+
+        /*Orphans left by an earlier session are released now, with
+         * the journal protecting the updates.*/
+        __ext4_orphan_cleanup(mp, 0);
     }
 Finish:
     return r;
@@ -531,6 +626,7 @@ static int __ext4_journal_stop(const char *mount_point)
 
     if (ext4_sb_feature_com(&mp->fs.sb,
                 EXT4_FCOM_HAS_JOURNAL)) {
+        __ext4_orphan_cleanup(mp, 0);
         r = jbd_journal_stop(&mp->jbd_journal);
         if (r != EOK) {
             mp->jbd_fs.dirty = false;
@@ -571,7 +667,7 @@ static int __ext4_recover(const char *mount_point)
              goto Finish;
         }
 
-        r = jbd_get_fs(&mp->fs, jbd_fs);
+        r = jbd_get_fs(&mp->fs, mp->jbd_bdev, jbd_fs);
         if (r != EOK) {
             ext4_free(jbd_fs);
             goto Finish;
@@ -580,6 +676,15 @@ static int __ext4_recover(const char *mount_point)
         r = jbd_recover(jbd_fs);
         jbd_put_fs(jbd_fs);
         ext4_free(jbd_fs);
+#if CONFIG_DCACHE_ENABLE
+        /*Replayed blocks bypass cached names.*/
+        ext4_dcache_purge(&mp->fs.dcache);
+#endif
+#if CONFIG_XCACHE_ENABLE
+        /*Same for cached xattr blocks and decoded xattrs.*/
+        ext4_xcache_purge(&mp->fs.xcache);
+#endif
+        ext4_ialloc_stats_drop(&mp->fs);
     }
     if (r == EOK && !mp->fs.read_only) {
         uint32_t bgid;
@@ -626,11 +731,27 @@ static int __ext4_trans_start(struct ext4_mountpoint *mp)
             goto Finish;
         }
         mp->fs.curr_trans = trans;
+        mp->fs.trans_sb = mp->fs.sb;
     }
 Finish:
     return r;
 }
 
+/**@brief   Drop cached state which may refer to changes of a transaction
+ *          being thrown away.*/
+__unused
+static void __ext4_trans_forget(struct ext4_mountpoint *mp)
+{
+#if CONFIG_DCACHE_ENABLE
+    ext4_dcache_purge(&mp->fs.dcache);
+#endif
+#if CONFIG_XCACHE_ENABLE
+    /*Shared xattr blocks may have been allocated or freed.*/
+    ext4_xcache_purge(&mp->fs.xcache);
+#endif
+    ext4_ialloc_stats_drop(&mp->fs);
+}
+
 __unused
 static int __ext4_trans_stop(struct ext4_mountpoint *mp)
 {
@@ -641,6 +762,12 @@ static int __ext4_trans_stop(struct ext4_mountpoint *mp)
         struct jbd_trans *trans = mp->fs.curr_trans;
         r = jbd_journal_commit_trans(journal, trans);
         mp->fs.curr_trans = NULL;
+
+        /*Failed commit has thrown the transaction away*/
+        if (r != EOK) {
+            __ext4_trans_forget(mp);
+            mp->fs.sb = mp->fs.trans_sb;
+        }
     }
     return r;
 }
@@ -648,14 +775,26 @@ static int __ext4_trans_stop(struct ext4_mountpoint *mp)
 __unused
 static void __ext4_trans_abort(struct ext4_mountpoint *mp)
 {
+    __ext4_trans_forget(mp);
     if (mp->fs.jbd_journal && mp->fs.curr_trans) {
         struct jbd_journal *journal = mp->fs.jbd_journal;
         struct jbd_trans *trans = mp->fs.curr_trans;
         jbd_journal_free_trans(journal, trans, true);
         mp->fs.curr_trans = NULL;
+        mp->fs.sb = mp->fs.trans_sb;
     }
 }
 
+int ext4_journal_dev_set(const char *mount_point __unused,
+             const char *dev_name __unused)
+{
+    int r = ENOTSUP;
+#if CONFIG_JOURNALING_ENABLE
+    r = __ext4_journal_dev_set(mount_point, dev_name);
+#endif
+    return r;
+}
+
 int ext4_journal_start(const char *mount_point __unused)
 {
     int r = EOK;
@@ -816,6 +955,19 @@ static bool ext4_parse_flags(const char *flags, uint32_t *file_flags)
     return false;
 }
 
+/**@brief Check whether the running transaction has grown big enough
+ *        to be committed before more metadata gets dirty.
+ * @param mp mount point
+ * @return true if the transaction should be committed*/
+static bool ext4_trans_full(struct ext4_mountpoint *mp __unused)
+{
+#if CONFIG_JOURNALING_ENABLE
+    if (mp->fs.jbd_journal && mp->fs.curr_trans)
+        return mp->fs.curr_trans->data_cnt >= CONFIG_TRUNCATE_TRANS_BLOCKS;
+#endif
+    return false;
+}
+
 static int ext4_trunc_inode(struct ext4_mountpoint *mp,
                 uint32_t index, uint64_t new_size)
 {
@@ -823,25 +975,48 @@ static int ext4_trunc_inode(struct ext4_mountpoint *mp,
     struct ext4_fs *const fs = &mp->fs;
     struct ext4_inode_ref inode_ref;
     uint64_t inode_size;
+    uint64_t step;
+    bool eof_blocks;
     bool has_trans = mp->fs.jbd_journal && mp->fs.curr_trans;
     r = ext4_fs_get_inode_ref(fs, index, &inode_ref);
     if (r != EOK)
         return r;
 
     inode_size = ext4_inode_get_size(&fs->sb, inode_ref.inode);
+    eof_blocks = ext4_fs_inode_has_eof_blocks(&inode_ref);
     ext4_fs_put_inode_ref(&inode_ref);
+
+    /* Nothing to cut below new_size. A file ending exactly at new_size
+     * still gets one pass if it has blocks preallocated past the end.*/
+    if (inode_size < new_size || (inode_size == new_size && !eof_blocks))
+        return EOK;
+
     if (has_trans)
         ext4_trans_stop(mp);
 
-    while (inode_size > new_size + CONFIG_MAX_TRUNCATE_SIZE) {
+    /* Cut one block group worth of file at a time: whole extents are
+     * freed as bitmap ranges, so a slice dirties a few metadata blocks
+     * whatever its size. Slices are gathered into one transaction until
+     * it holds CONFIG_TRUNCATE_TRANS_BLOCKS blocks. Every slice leaves
+     * the size consistent with the extent tree, so an interrupted
+     * truncate can be restarted from the last committed size.*/
+    step = (uint64_t)ext4_get32(&fs->sb, blocks_per_group) *
+           ext4_sb_get_block_size(&fs->sb);
+    if (step < CONFIG_MAX_TRUNCATE_SIZE)
+        step = CONFIG_MAX_TRUNCATE_SIZE;
 
-        inode_size -= CONFIG_MAX_TRUNCATE_SIZE;
+    ext4_trans_start(mp);
+    do {
+
+        if (inode_size - new_size > step)
+            inode_size -= step;
+        else
+            inode_size = new_size;
 
-        ext4_trans_start(mp);
         r = ext4_fs_get_inode_ref(fs, index, &inode_ref);
         if (r != EOK) {
             ext4_trans_abort(mp);
-            break;
+            goto Finish;
         }
         r = ext4_fs_truncate_inode(&inode_ref, inode_size);
         if (r != EOK)
@@ -852,38 +1027,154 @@ static int ext4_trunc_inode(struct ext4_mountpoint *mp,
         if (r != EOK) {
             ext4_trans_abort(mp);
             goto Finish;
-        } else
-            ext4_trans_stop(mp);
-    }
+        }
 
-    if (inode_size > new_size) {
+        if (inode_size > new_size && ext4_trans_full(mp)) {
+            ext4_trans_stop(mp);
+            ext4_trans_start(mp);
+        }
+    } while (inode_size > new_size);
+    ext4_trans_stop(mp);
 
-        inode_size = new_size;
+Finish:
 
+    if (has_trans)
         ext4_trans_start(mp);
-        r = ext4_fs_get_inode_ref(fs, index, &inode_ref);
-        if (r != EOK) {
-            ext4_trans_abort(mp);
-            goto Finish;
-        }
-        r = ext4_fs_truncate_inode(&inode_ref, inode_size);
+
+    return r;
+}
+
+/**@brief Release an i-node whose last link is gone. Files bigger than
+ *        CONFIG_MAX_TRUNCATE_SIZE are only put on the orphan list, their
+ *        blocks are freed later by @ref ext4_orphan_cleanup.
+ * @param ref i-node reference
+ * @return standard error code*/
+static int ext4_unlinked_release(struct ext4_inode_ref *ref)
+{
+    struct ext4_sblock *sb = &ref->fs->sb;
+    uint64_t size = ext4_inode_get_size(sb, ref->inode);
+    bool eof_blocks = ext4_fs_inode_has_eof_blocks(ref);
+    int r;
+
+    if (size && !ext4_inode_can_truncate(sb, ref->inode))
+        return EINVAL;
+
+    /*Preallocated blocks count as well*/
+    if (eof_blocks && ext4_inode_get_blocks_count(sb, ref->inode) *
+              EXT4_INODE_BLOCK_SIZE > size)
+        size = ext4_inode_get_blocks_count(sb, ref->inode) *
+               EXT4_INODE_BLOCK_SIZE;
+
+    if (size > CONFIG_MAX_TRUNCATE_SIZE)
+        return ext4_fs_orphan_add(ref);
+
+    if (size || eof_blocks) {
+        r = ext4_fs_truncate_inode(ref, 0);
         if (r != EOK)
-            ext4_fs_put_inode_ref(&inode_ref);
-        else
-            r = ext4_fs_put_inode_ref(&inode_ref);
+            return r;
+    }
+
+    ext4_inode_set_del_time(ref->inode, -1L);
+    return ext4_fs_free_inode(ref);
+}
+
+/**@brief Release the i-node at the head of the orphan list. The data is
+ *        truncated in as many transactions as needed, the orphan stays
+ *        on the list until its i-node is freed, so the release resumes
+ *        after a crash.
+ * @param mp mount point
+ * @param index i-node number
+ * @return standard error code*/
+static int ext4_orphan_release(struct ext4_mountpoint *mp, uint32_t index)
+{
+    struct ext4_fs *const fs = &mp->fs;
+    struct ext4_inode_ref ref;
+    bool unlinked;
+    bool trunc;
+    int r;
+
+    r = ext4_fs_get_inode_ref(fs, index, &ref);
+    if (r != EOK)
+        return r;
+
+    unlinked = !ext4_inode_get_links_cnt(ref.inode);
+    trunc = unlinked && (ext4_inode_get_size(&fs->sb, ref.inode) ||
+                 ext4_fs_inode_has_eof_blocks(&ref)) &&
+        ext4_inode_can_truncate(&fs->sb, ref.inode);
+    ext4_fs_put_inode_ref(&ref);
 
+    if (trunc) {
+        r = ext4_trunc_inode(mp, index, 0);
         if (r != EOK)
-            ext4_trans_abort(mp);
-        else
-            ext4_trans_stop(mp);
+            return r;
+    }
 
+    ext4_trans_start(mp);
+    r = ext4_fs_get_inode_ref(fs, index, &ref);
+    if (r != EOK) {
+        ext4_trans_abort(mp);
+        return r;
     }
 
-Finish:
+    r = ext4_fs_orphan_del(&ref);
+    if (r == EOK && unlinked) {
+        ext4_inode_set_del_time(ref.inode, -1L);
+        r = ext4_fs_free_inode(&ref);
+    }
 
-    if (has_trans)
-        ext4_trans_start(mp);
+    if (r != EOK)
+        ext4_fs_put_inode_ref(&ref);
+    else
+        r = ext4_fs_put_inode_ref(&ref);
+
+    if (r != EOK)
+        ext4_trans_abort(mp);
+    else
+        ext4_trans_stop(mp);
+
+    return r;
+}
+
+/**@brief Release i-nodes from the orphan list.
+ * @param mp mount point
+ * @param count maximum number of i-nodes to release, 0 for all
+ * @return standard error code*/
+static int __ext4_orphan_cleanup(struct ext4_mountpoint *mp, uint32_t count)
+{
+    struct ext4_sblock *sb = &mp->fs.sb;
+    uint32_t index;
+    int r = EOK;
+
+    if (mp->fs.read_only)
+        return EOK;
+
+    ext4_block_cache_write_back(mp->fs.bdev, 1);
+    while ((index = ext4_get32(sb, last_orphan)) != 0) {
+        if (index > ext4_get32(sb, inodes_count)) {
+            r = EIO;
+            break;
+        }
+
+        r = ext4_orphan_release(mp, index);
+        if (r != EOK || (count && !--count))
+            break;
+    }
+    ext4_block_cache_write_back(mp->fs.bdev, 0);
+
+    return r;
+}
+
+int ext4_orphan_cleanup(const char *mount_point, uint32_t count)
+{
+    struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+    int r;
+
+    if (!mp)
+        return ENOENT;
 
+    EXT4_MP_LOCK(mp);
+    r = __ext4_orphan_cleanup(mp, count);
+    EXT4_MP_UNLOCK(mp);
     return r;
 }
 
@@ -898,9 +1189,18 @@ static int ext4_trunc_dir(struct ext4_mountpoint *mp,
     if (!is_dir)
         return EINVAL;
 
+#if CONFIG_INLINE_DATA_ENABLE
+    /* Inline directory has no blocks */
+    if (ext4_inline_has_data(dir))
+        return ext4_fs_truncate_inode(dir, 0);
+#endif
+
 #if CONFIG_DIR_INDEX_ENABLE
-    /* Initialize directory index if supported */
-    if (ext4_sb_feature_com(&mp->fs.sb, EXT4_FCOM_DIR_INDEX)) {
+    /* Initialize directory index if supported. A single block directory
+     * has no room for it, it is dropped as a whole below.*/
+    if (ext4_sb_feature_com(&mp->fs.sb, EXT4_FCOM_DIR_INDEX) &&
+        ext4_inode_get_size(&mp->fs.sb, dir->inode) >=
+        EXT4_DIR_DX_INIT_BCNT * block_size) {
         r = ext4_dir_dx_init(dir, parent);
         if (r != EOK)
             return r;
@@ -979,6 +1279,19 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
             break;
         }
 
+#if CONFIG_DCACHE_ENABLE
+        if (ext4_dcache_lookup(&fs->dcache, ref.index, path, len,
+                       &next_inode, &imode)) {
+            if (next_inode)
+                goto found;
+
+            if (!(f->flags & O_CREAT)) {
+                r = ENOENT;
+                break;
+            }
+        }
+#endif
+
         r = ext4_dir_find_entry(&result, &ref, path, len);
         if (r != EOK) {
 
@@ -987,13 +1300,17 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
             if (r != ENOENT)
                 break;
 
+#if CONFIG_DCACHE_ENABLE
+            ext4_dcache_insert(&fs->dcache, ref.index, path, len,
+                       0, 0);
+#endif
             if (!(f->flags & O_CREAT))
                 break;
 
             /*O_CREAT allows create new entry*/
             struct ext4_inode_ref child_ref;
             r = ext4_fs_alloc_inode(fs, &child_ref,
-                    is_goal ? ftype : EXT4_DE_DIR);
+                    is_goal ? ftype : EXT4_DE_DIR, ref.index);
 
             if (r != EOK)
                 break;
@@ -1016,9 +1333,6 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
             continue;
         }
 
-        if (parent_inode)
-            *parent_inode = ref.index;
-
         next_inode = ext4_dir_en_get_inode(result.dentry);
         if (ext4_sb_feature_incom(sb, EXT4_FINCOM_FILETYPE)) {
             uint8_t t;
@@ -1038,6 +1352,15 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
         if (r != EOK)
             break;
 
+#if CONFIG_DCACHE_ENABLE
+        if (!ext4_is_dots((const uint8_t *)path, len))
+            ext4_dcache_insert(&fs->dcache, ref.index, path, len,
+                       next_inode, imode);
+found:
+#endif
+        if (parent_inode)
+            *parent_inode = ref.index;
+
         /*If expected file error*/
         if (imode != EXT4_INODE_MODE_DIRECTORY && !is_goal) {
             r = ENOENT;
@@ -1432,6 +1755,22 @@ int ext4_cache_flush(const char *path)
 
     EXT4_MP_LOCK(mp);
     ret = ext4_block_cache_flush(mp->fs.bdev);
+    if (ret == EOK)
+        ret = ext4_block_flush_dev(mp->fs.bdev);
+    EXT4_MP_UNLOCK(mp);
+    return ret;
+}
+
+int ext4_cache_flusher(const char *path, uint32_t now)
+{
+    struct ext4_mountpoint *mp = ext4_get_mount(path);
+    int ret;
+
+    if (!mp)
+        return ENOENT;
+
+    EXT4_MP_LOCK(mp);
+    ret = ext4_block_cache_writeback(mp->fs.bdev, now);
     EXT4_MP_UNLOCK(mp);
     return ret;
 }
@@ -1493,20 +1832,6 @@ int ext4_fremove(const char *path)
         return r;
     }
 
-    /*Link count will be zero, the inode should be freed. */
-    if (ext4_inode_get_links_cnt(child.inode) == 1) {
-        ext4_block_cache_write_back(mp->fs.bdev, 1);
-        r = ext4_trunc_inode(mp, child.index, 0);
-        if (r != EOK) {
-            ext4_fs_put_inode_ref(&parent);
-            ext4_fs_put_inode_ref(&child);
-            ext4_trans_abort(mp);
-            EXT4_MP_UNLOCK(mp);
-            return r;
-        }
-        ext4_block_cache_write_back(mp->fs.bdev, 0);
-    }
-
     /*Set path*/
     path += name_off;
 
@@ -1519,9 +1844,7 @@ int ext4_fremove(const char *path)
 
     /*Link count is zero, the inode should be freed. */
     if (!ext4_inode_get_links_cnt(child.inode)) {
-        ext4_inode_set_del_time(child.inode, -1L);
-
-        r = ext4_fs_free_inode(&child);
+        r = ext4_unlinked_release(&child);
         if (r != EOK)
             goto Finish;
     }
@@ -1539,47 +1862,285 @@ Finish:
     return r;
 }
 
-int ext4_fopen(ext4_file *file, const char *path, const char *flags)
-{
-    struct ext4_mountpoint *mp = ext4_get_mount(path);
-    int r;
+struct ext4_batch_en {
+    uint32_t hash;
+    uint32_t idx;
+};
 
-    if (!mp)
-        return ENOENT;
+static int ext4_batch_en_cmp(const void *a, const void *b)
+{
+    const struct ext4_batch_en *x = a;
+    const struct ext4_batch_en *y = b;
 
-    EXT4_MP_LOCK(mp);
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
 
-    ext4_block_cache_write_back(mp->fs.bdev, 1);
-    r = ext4_generic_open(file, path, flags, true, 0, 0);
-    ext4_block_cache_write_back(mp->fs.bdev, 0);
+    if (x->idx == y->idx)
+        return 0;
 
-    EXT4_MP_UNLOCK(mp);
-    return r;
+    return x->idx < y->idx ? -1 : 1;
 }
 
-int ext4_fopen2(ext4_file *file, const char *path, int flags)
+/**@brief   Check batch names and order them by directory index hash.*/
+static int ext4_batch_order(struct ext4_inode_ref *dir,
+                const char *const *names, size_t count,
+                struct ext4_batch_en **order)
 {
-    struct ext4_mountpoint *mp = ext4_get_mount(path);
-    int r;
-    int filetype;
+    size_t i;
+    struct ext4_batch_en *ord;
 
-    if (!mp)
-        return ENOENT;
+    for (i = 0; i < count; i++) {
+        size_t len = strlen(names[i]);
+        if (!len || len > EXT4_DIRECTORY_FILENAME_LEN ||
+            strchr(names[i], '/'))
+            return EINVAL;
+    }
 
-    filetype = EXT4_DE_REG_FILE;
+    ord = ext4_malloc(count * sizeof(struct ext4_batch_en));
+    if (!ord)
+        return ENOMEM;
 
-    EXT4_MP_LOCK(mp);
-    ext4_block_cache_write_back(mp->fs.bdev, 1);
+    for (i = 0; i < count; i++) {
+        ord[i].hash = 0;
+        ord[i].idx = i;
+    }
 
-    if (flags & O_CREAT)
-        ext4_trans_start(mp);
+#if CONFIG_DIR_INDEX_ENABLE
+    if (ext4_sb_feature_com(&dir->fs->sb, EXT4_FCOM_DIR_INDEX) &&
+        ext4_inode_has_flag(dir->inode, EXT4_INODE_FLAG_INDEX)) {
+        uint32_t *hashes = ext4_malloc(count * sizeof(uint32_t));
 
-    r = ext4_generic_open2(file, path, flags, filetype, NULL, NULL);
+        if (hashes &&
+            ext4_dir_dx_hash_names(dir, names, count, hashes) == EOK) {
+            for (i = 0; i < count; i++)
+                ord[i].hash = hashes[i];
 
-    if (flags & O_CREAT) {
-        if (r == EOK)
-            ext4_trans_stop(mp);
-        else
+            qsort(ord, count, sizeof(struct ext4_batch_en),
+                  ext4_batch_en_cmp);
+        }
+
+        ext4_free(hashes);
+    }
+#endif
+
+    *order = ord;
+    return EOK;
+}
+
+int ext4_create_batch(ext4_dir *dir, const char *const *names,
+              size_t count)
+{
+    int r;
+    size_t i;
+    struct ext4_mountpoint *mp = dir->f.mp;
+    struct ext4_inode_ref parent;
+    struct ext4_inode_ref child;
+    struct ext4_dir_search_result result;
+    struct ext4_batch_en *order;
+
+    ext4_assert(mp && (names || !count));
+
+    if (mp->fs.read_only)
+        return EROFS;
+
+    if (!count)
+        return EOK;
+
+    EXT4_MP_LOCK(mp);
+    ext4_trans_start(mp);
+
+    r = ext4_fs_get_inode_ref(&mp->fs, dir->f.inode, &parent);
+    if (r != EOK)
+        goto Abort;
+
+    r = ext4_batch_order(&parent, names, count, &order);
+    if (r != EOK) {
+        ext4_fs_put_inode_ref(&parent);
+        goto Abort;
+    }
+
+    for (i = 0; i < count; i++) {
+        const char *name = names[order[i].idx];
+        uint32_t len = strlen(name);
+
+        r = ext4_dir_find_entry(&result, &parent, name, len);
+        ext4_dir_destroy_result(&parent, &result);
+        if (r != ENOENT) {
+            if (r == EOK)
+                r = EEXIST;
+            break;
+        }
+
+        r = ext4_fs_alloc_inode(&mp->fs, &child, EXT4_DE_REG_FILE,
+                    parent.index);
+        if (r != EOK)
+            break;
+
+        ext4_fs_inode_blocks_init(&mp->fs, &child);
+
+        r = ext4_link(mp, &parent, &child, name, len, false);
+        if (r != EOK) {
+            ext4_fs_free_inode(&child);
+            child.dirty = false;
+            ext4_fs_put_inode_ref(&child);
+            break;
+        }
+
+        r = ext4_fs_put_inode_ref(&child);
+        if (r != EOK)
+            break;
+    }
+
+    ext4_free(order);
+    if (r != EOK) {
+        ext4_fs_put_inode_ref(&parent);
+        goto Abort;
+    }
+
+    r = ext4_fs_put_inode_ref(&parent);
+    if (r != EOK)
+        goto Abort;
+
+    ext4_trans_stop(mp);
+    EXT4_MP_UNLOCK(mp);
+    return EOK;
+
+Abort:
+    ext4_trans_abort(mp);
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
+int ext4_unlink_batch(ext4_dir *dir, const char *const *names,
+              size_t count)
+{
+    int r;
+    size_t i;
+    struct ext4_mountpoint *mp = dir->f.mp;
+    struct ext4_inode_ref parent;
+    struct ext4_inode_ref child;
+    struct ext4_dir_search_result result;
+    struct ext4_batch_en *order;
+
+    ext4_assert(mp && (names || !count));
+
+    if (mp->fs.read_only)
+        return EROFS;
+
+    if (!count)
+        return EOK;
+
+    EXT4_MP_LOCK(mp);
+    ext4_trans_start(mp);
+
+    r = ext4_fs_get_inode_ref(&mp->fs, dir->f.inode, &parent);
+    if (r != EOK)
+        goto Abort;
+
+    r = ext4_batch_order(&parent, names, count, &order);
+    if (r != EOK) {
+        ext4_fs_put_inode_ref(&parent);
+        goto Abort;
+    }
+
+    for (i = 0; i < count; i++) {
+        const char *name = names[order[i].idx];
+        uint32_t len = strlen(name);
+        uint32_t ino;
+
+        r = ext4_dir_find_entry(&result, &parent, name, len);
+        if (r == EOK)
+            ino = ext4_dir_en_get_inode(result.dentry);
+        ext4_dir_destroy_result(&parent, &result);
+        if (r != EOK)
+            break;
+
+        r = ext4_fs_get_inode_ref(&mp->fs, ino, &child);
+        if (r != EOK)
+            break;
+
+        if (ext4_inode_type(&mp->fs.sb, child.inode) ==
+            EXT4_INODE_MODE_DIRECTORY) {
+            ext4_fs_put_inode_ref(&child);
+            r = EISDIR;
+            break;
+        }
+
+        r = ext4_unlink(mp, &parent, &child, name, len);
+        if (r == EOK && !ext4_inode_get_links_cnt(child.inode))
+            r = ext4_unlinked_release(&child);
+
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&child);
+            break;
+        }
+
+        r = ext4_fs_put_inode_ref(&child);
+        if (r != EOK)
+            break;
+    }
+
+    ext4_free(order);
+    if (r != EOK) {
+        ext4_fs_put_inode_ref(&parent);
+        goto Abort;
+    }
+
+    r = ext4_fs_put_inode_ref(&parent);
+    if (r != EOK)
+        goto Abort;
+
+    ext4_trans_stop(mp);
+    EXT4_MP_UNLOCK(mp);
+    return EOK;
+
+Abort:
+    ext4_trans_abort(mp);
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
+int ext4_fopen(ext4_file *file, const char *path, const char *flags)
+{
+    struct ext4_mountpoint *mp = ext4_get_mount(path);
+    int r;
+
+    if (!mp)
+        return ENOENT;
+
+    EXT4_MP_LOCK(mp);
+
+    ext4_block_cache_write_back(mp->fs.bdev, 1);
+    r = ext4_generic_open(file, path, flags, true, 0, 0);
+    ext4_block_cache_write_back(mp->fs.bdev, 0);
+
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
+int ext4_fopen2(ext4_file *file, const char *path, int flags)
+{
+    struct ext4_mountpoint *mp = ext4_get_mount(path);
+    int r;
+    int filetype;
+
+    if (!mp)
+        return ENOENT;
+
+    filetype = EXT4_DE_REG_FILE;
+
+    EXT4_MP_LOCK(mp);
+    ext4_block_cache_write_back(mp->fs.bdev, 1);
+
+    if (flags & O_CREAT)
+        ext4_trans_start(mp);
+
+    r = ext4_generic_open2(file, path, flags, filetype, NULL, NULL);
+
+    if (flags & O_CREAT) {
+        if (r == EOK)
+            ext4_trans_stop(mp);
+        else
             ext4_trans_abort(mp);
     }
 
@@ -1589,6 +2150,71 @@ int ext4_fopen2(ext4_file *file, const char *path, int flags)
     return r;
 }
 
+int ext4_open_by_ino(ext4_file *file, const char *mount_point, uint32_t ino,
+             int flags)
+{
+    int r;
+    uint32_t imode;
+    struct ext4_inode_ref ref;
+    struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+
+    if (!mp)
+        return ENOENT;
+
+    if (flags & O_CREAT)
+        return EINVAL;
+
+    if (ino < EXT4_INODE_ROOT_INDEX ||
+        ino > ext4_get32(&mp->fs.sb, inodes_count))
+        return EINVAL;
+
+    if (mp->fs.read_only && (flags & (O_WRONLY | O_RDWR | O_TRUNC)))
+        return EROFS;
+
+    EXT4_MP_LOCK(mp);
+
+    r = ext4_fs_get_inode_ref(&mp->fs, ino, &ref);
+    if (r != EOK)
+        goto Finish;
+
+    /*Released inode*/
+    if (!ext4_inode_get_links_cnt(ref.inode) ||
+        !ext4_inode_get_mode(&mp->fs.sb, ref.inode)) {
+        ext4_fs_put_inode_ref(&ref);
+        r = ENOENT;
+        goto Finish;
+    }
+
+    imode = ext4_inode_type(&mp->fs.sb, ref.inode);
+    r = ext4_fs_put_inode_ref(&ref);
+    if (r != EOK)
+        goto Finish;
+
+    if ((flags & O_TRUNC) && (imode == EXT4_INODE_MODE_FILE)) {
+        r = ext4_trunc_inode(mp, ino, 0);
+        if (r != EOK)
+            goto Finish;
+    }
+
+    r = ext4_fs_get_inode_ref(&mp->fs, ino, &ref);
+    if (r != EOK)
+        goto Finish;
+
+    file->mp = mp;
+    file->flags = flags;
+    file->inode = ino;
+    file->fsize = ext4_inode_get_size(&mp->fs.sb, ref.inode);
+    file->fpos = 0;
+
+    if (flags & O_APPEND)
+        file->fpos = file->fsize;
+
+    r = ext4_fs_put_inode_ref(&ref);
+Finish:
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
 int ext4_fclose(ext4_file *file)
 {
     ext4_assert(file && file->mp);
@@ -1613,9 +2239,9 @@ static int ext4_ftruncate_no_lock(ext4_file *file, uint64_t size)
         return r;
     }
 
-    /*Sync file size*/
+    /*Sync file size. The same size still drops preallocated blocks.*/
     file->fsize = ext4_inode_get_size(&file->mp->fs.sb, ref.inode);
-    if (file->fsize <= size) {
+    if (file->fsize < size) {
         r = EOK;
         goto Finish;
     }
@@ -1669,6 +2295,63 @@ int ext4_ftruncate(ext4_file *f, uint64_t size)
     return r;
 }
 
+/**@brief   Write the dirty state of one i-node to disk: its directory,
+ *          mapping and (unless datasync) xattr blocks, then the i-node
+ *          itself. File data never stays in the cache.
+ * @param   file file handle
+ * @param   datasync skip what is not needed to read the data back
+ * @return  standard error code*/
+static int ext4_fsync_inode(ext4_file *file, bool datasync)
+{
+    struct ext4_mountpoint *mp;
+    struct ext4_inode_ref ref;
+    uint64_t lba;
+    int r;
+
+    ext4_assert(file && file->mp);
+    mp = file->mp;
+
+    EXT4_MP_LOCK(mp);
+
+    r = ext4_fs_get_inode_ref(&mp->fs, file->inode, &ref);
+    if (r != EOK)
+        goto Finish;
+
+    lba = ref.block.lb_id;
+    r = ext4_fs_put_inode_ref(&ref);
+    if (r != EOK)
+        goto Finish;
+
+    /*With a journal, metadata are in the log once the operation which
+     * changed them returns, cached blocks are only checkpoints*/
+    if (!mp->fs.jbd_journal) {
+        r = ext4_block_cache_flush_owner(mp->fs.bdev, file->inode,
+                         datasync);
+        if (r != EOK)
+            goto Finish;
+
+        r = ext4_block_flush_lba(mp->fs.bdev, lba);
+        if (r != EOK)
+            goto Finish;
+    }
+
+    r = ext4_block_flush_dev(mp->fs.bdev);
+
+Finish:
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
+int ext4_fsync(ext4_file *file)
+{
+    return ext4_fsync_inode(file, false);
+}
+
+int ext4_fdatasync(ext4_file *file)
+{
+    return ext4_fsync_inode(file, true);
+}
+
 int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 {
     uint32_t unalg;
@@ -1717,6 +2400,21 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
     iblock_last = (uint32_t)((file->fpos + size) / block_size);
     unalg = (file->fpos) % block_size;
 
+#if CONFIG_INLINE_DATA_ENABLE
+    /*Data kept in the i-node, no block to read*/
+    if (ext4_inline_has_data(&ref)) {
+        r = ext4_inline_read(&ref, file->fpos, buf, size);
+        if (r != EOK)
+            goto Finish;
+
+        file->fpos += size;
+        if (rcnt)
+            *rcnt = size;
+
+        goto Finish;
+    }
+#endif
+
     /*If the size of symlink is smaller than 60 bytes*/
     bool softlink;
     softlink = ext4_inode_is_type(sb, ref.inode, EXT4_INODE_MODE_SOFTLINK);
@@ -1769,40 +2467,31 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
         iblock_idx++;
     }
 
-    fblock_start = 0;
-    fblock_count = 0;
     while (size >= block_size) {
-        while (iblock_idx < iblock_last) {
-            r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx,
-                               &fblock, true);
+        /*Physically continuous blocks, or a run of holes and
+         * unwritten blocks, in one lookup*/
+        r = ext4_fs_get_inode_dblk_run(&ref, iblock_idx,
+                           iblock_last - iblock_idx,
+                           &fblock_start, &fblock_count);
+        if (r != EOK)
+            goto Finish;
+
+        if (fblock_start) {
+            r = ext4_blocks_get_direct(file->mp->fs.bdev, u8_buf,
+                           fblock_start, fblock_count);
             if (r != EOK)
                 goto Finish;
+        } else {
+            memset(u8_buf, 0, block_size * fblock_count);
+        }
 
-            iblock_idx++;
-
-            if (!fblock_start)
-                fblock_start = fblock;
-
-            if ((fblock_start + fblock_count) != fblock)
-                break;
-
-            fblock_count++;
-        }
-
-        r = ext4_blocks_get_direct(file->mp->fs.bdev, u8_buf, fblock_start,
-                       fblock_count);
-        if (r != EOK)
-            goto Finish;
-
-        size -= block_size * fblock_count;
-        u8_buf += block_size * fblock_count;
-        file->fpos += block_size * fblock_count;
+        iblock_idx += fblock_count;
+        size -= block_size * fblock_count;
+        u8_buf += block_size * fblock_count;
+        file->fpos += block_size * fblock_count;
 
         if (rcnt)
             *rcnt += block_size * fblock_count;
-
-        fblock_start = fblock;
-        fblock_count = 1;
     }
 
     if (size) {
@@ -1811,10 +2500,15 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
         if (r != EOK)
             goto Finish;
 
-        off = fblock * block_size;
-        r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf, size);
-        if (r != EOK)
-            goto Finish;
+        if (fblock) {
+            off = fblock * block_size;
+            r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf,
+                         size);
+            if (r != EOK)
+                goto Finish;
+        } else {
+            memset(u8_buf, 0, size);
+        }
 
         file->fpos += size;
 
@@ -1828,6 +2522,151 @@ Finish:
     return r;
 }
 
+/**@brief   Write file data. With ordered data mode the write is deferred
+ *          until the running transaction commits.*/
+static int ext4_fdata_write(struct ext4_mountpoint *mp, uint64_t off,
+                const void *buf, uint32_t len)
+{
+#if CONFIG_JOURNALING_ENABLE && CONFIG_JOURNAL_ORDERED_DATA
+    if (mp->fs.jbd_journal && mp->fs.curr_trans)
+        return jbd_trans_add_data(mp->fs.curr_trans, off, buf, len);
+#endif
+    return ext4_block_writebytes(mp->fs.bdev, off, buf, len);
+}
+
+#if CONFIG_INLINE_DATA_ENABLE
+/**@brief   Move inline data of a file to a data block.
+ * @param   mp mount point
+ * @param   ref i-node reference
+ * @return  standard error code*/
+static int ext4_finline_convert(struct ext4_mountpoint *mp,
+                struct ext4_inode_ref *ref)
+{
+    struct ext4_sblock *const sb = &mp->fs.sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint64_t size = ext4_inode_get_size(sb, ref->inode);
+    ext4_fsblk_t fblk;
+    ext4_lblk_t iblk;
+    uint8_t *data;
+    int r;
+
+    data = ext4_calloc(1, block_size);
+    if (!data)
+        return ENOMEM;
+
+    r = ext4_inline_read(ref, 0, data, (size_t)size);
+    if (r != EOK)
+        goto Finish;
+
+    r = ext4_inline_clear(ref);
+    if (r != EOK || !size)
+        goto Finish;
+
+    r = ext4_fs_append_inode_dblk(ref, &fblk, &iblk);
+    if (r != EOK)
+        goto Restore;
+
+    ext4_inode_set_size(ref->inode, size);
+    ref->dirty = true;
+
+    /*Whole block goes out, tail beyond the file end is zeroed. Ordered
+     * data write would keep the buffer until commit, so write it now
+     * (still ahead of the metadata pointing at it).*/
+    r = ext4_block_writebytes(mp->fs.bdev, fblk * block_size, data,
+                  block_size);
+    if (r == EOK)
+        goto Finish;
+
+Restore:
+    /*Data stay inline, the error of conversion is returned*/
+    ext4_inline_restore(ref, data, (size_t)size);
+
+Finish:
+    ext4_free(data);
+    return r;
+}
+
+/**@brief   Decide if a write goes to inline data. Empty file becomes
+ *          inline if data fit the i-node, inline file which outgrows
+ *          the i-node is converted to a block one.
+ * @param   file file handle
+ * @param   ref i-node reference
+ * @param   size bytes to be written at the file position
+ * @param   inl output: write data inline
+ * @return  standard error code*/
+static int ext4_finline_prepare(ext4_file *file, struct ext4_inode_ref *ref,
+                size_t size, bool *inl)
+{
+    struct ext4_sblock *const sb = &file->mp->fs.sb;
+    uint64_t end = file->fpos + size;
+
+    *inl = false;
+    if (ext4_inline_has_data(ref)) {
+        if (end <= ext4_inline_max_size(ref)) {
+            *inl = true;
+            return EOK;
+        }
+
+        return ext4_finline_convert(file->mp, ref);
+    }
+
+    if (!ext4_sb_feature_incom(sb, EXT4_FINCOM_INLINE_DATA) ||
+        !ext4_inode_is_type(sb, ref->inode, EXT4_INODE_MODE_FILE) ||
+        file->fsize || ext4_inode_get_blocks_count(sb, ref->inode) ||
+        end > ext4_inline_max_size(ref))
+        return EOK;
+
+    *inl = ext4_inline_init(ref) == EOK;
+    return EOK;
+}
+#endif
+
+/**@brief   Write a part of a file block. A hole or an unwritten block
+ *          is written as a whole, zeros around the data: its old content
+ *          must not show up.
+ * @param   mp mount point
+ * @param   ref i-node reference
+ * @param   iblk logical block, updated when appended
+ * @param   unalg offset of the data in the block
+ * @param   buf data
+ * @param   len data length
+ * @return  standard error code*/
+static int ext4_fwrite_partial(struct ext4_mountpoint *mp,
+                   struct ext4_inode_ref *ref, uint32_t *iblk,
+                   uint32_t unalg, const void *buf, size_t len)
+{
+    uint32_t block_size = ext4_sb_get_block_size(&mp->fs.sb);
+    ext4_fsblk_t fblk;
+    uint8_t *data;
+    int r;
+
+    r = ext4_fs_get_inode_dblk_idx(ref, *iblk, &fblk, true);
+    if (r != EOK)
+        return r;
+
+    if (fblk)
+        return ext4_fdata_write(mp, fblk * block_size + unalg, buf,
+                    (uint32_t)len);
+
+    data = ext4_calloc(1, block_size);
+    if (!data)
+        return ENOMEM;
+
+    memcpy(data + unalg, buf, len);
+    r = ext4_fs_overwrite_inode_dblk(ref, iblk, &fblk);
+    if (r != EOK)
+        goto Finish;
+
+    /*Fresh block, nothing refers to it before the metadata commit, so
+     * it goes out right away rather than as ordered data*/
+    r = ext4_block_writebytes(mp->fs.bdev, fblk * block_size, data,
+                  block_size);
+
+Finish:
+    ext4_free(data);
+    return r;
+}
+
 int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 {
     uint32_t unalg;
@@ -1842,177 +2681,670 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 
     struct ext4_inode_ref ref;
     const uint8_t *u8_buf = buf;
+    uint64_t fpos;
     int r, rr = EOK;
 
     ext4_assert(file && file->mp);
 
-    if (file->mp->fs.read_only)
+    if (file->mp->fs.read_only)
+        return EROFS;
+
+    if (file->flags & O_RDONLY)
+        return EPERM;
+
+    fpos = file->fpos;
+
+    if (!size)
+        return EOK;
+
+    EXT4_MP_LOCK(file->mp);
+    ext4_trans_start(file->mp);
+
+    struct ext4_fs *const fs = &file->mp->fs;
+    struct ext4_sblock *const sb = &file->mp->fs.sb;
+
+    if (wcnt)
+        *wcnt = 0;
+
+    r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
+    if (r != EOK) {
+        ext4_trans_abort(file->mp);
+        EXT4_MP_UNLOCK(file->mp);
+        return r;
+    }
+
+    /*Sync file size*/
+    file->fsize = ext4_inode_get_size(sb, ref.inode);
+    block_size = ext4_sb_get_block_size(sb);
+
+#if CONFIG_INLINE_DATA_ENABLE
+    bool inl;
+    r = ext4_finline_prepare(file, &ref, size, &inl);
+    if (r == EOK && inl)
+        r = ext4_inline_write(&ref, file->fpos, buf, size);
+
+    if (r != EOK) {
+        ext4_fs_put_inode_ref(&ref);
+        ext4_trans_abort(file->mp);
+        EXT4_MP_UNLOCK(file->mp);
+        return r;
+    }
+
+    if (inl) {
+        file->fpos += size;
+        if (wcnt)
+            *wcnt = size;
+
+        goto out_fsize;
+    }
+#endif
+
+    iblock_last = (uint32_t)((file->fpos + size) / block_size);
+    iblk_idx = (uint32_t)(file->fpos / block_size);
+    ifile_blocks = (uint32_t)((file->fsize + block_size - 1) / block_size);
+
+    unalg = (file->fpos) % block_size;
+
+    if (unalg) {
+        size_t len =  size;
+        if (size > (block_size - unalg))
+            len = block_size - unalg;
+
+        r = ext4_fwrite_partial(file->mp, &ref, &iblk_idx, unalg, u8_buf,
+                    len);
+        if (r != EOK)
+            goto Finish;
+
+        u8_buf += len;
+        size -= len;
+        file->fpos += len;
+
+        if (wcnt)
+            *wcnt += len;
+
+        iblk_idx++;
+    }
+
+    /*Start write back cache mode.*/
+    r = ext4_block_cache_write_back(file->mp->fs.bdev, 1);
+    if (r != EOK)
+        goto Finish;
+
+    fblock_start = 0;
+    fblock_count = 0;
+    while (size >= block_size) {
+
+        while (iblk_idx < iblock_last) {
+            /*Whole blocks are written, unwritten ones need no zeros*/
+            if (iblk_idx < ifile_blocks) {
+                r = ext4_fs_overwrite_inode_dblk(&ref, &iblk_idx,
+                                 &fblk);
+                if (r != EOK)
+                    goto Finish;
+            } else {
+                rr = ext4_fs_overwrite_inode_dblk(&ref, &iblk_idx,
+                                  &fblk);
+                if (rr != EOK) {
+                    /* Unable to append more blocks. But
+                     * some block might be allocated already
+                     * */
+                    break;
+                }
+            }
+
+            iblk_idx++;
+
+            if (!fblock_start) {
+                fblock_start = fblk;
+            }
+
+            if ((fblock_start + fblock_count) != fblk)
+                break;
+
+            fblock_count++;
+        }
+
+        r = ext4_fdata_write(file->mp, fblock_start * block_size, u8_buf,
+                     block_size * fblock_count);
+        if (r != EOK)
+            break;
+
+        size -= block_size * fblock_count;
+        u8_buf += block_size * fblock_count;
+        file->fpos += block_size * fblock_count;
+
+        if (wcnt)
+            *wcnt += block_size * fblock_count;
+
+        fblock_start = fblk;
+        fblock_count = 1;
+
+        if (rr != EOK) {
+            /*ext4_fs_append_inode_block has failed and no
+             * more blocks might be written. But node size
+             * should be updated.*/
+            r = rr;
+            goto out_fsize;
+        }
+    }
+
+    /*Stop write back cache mode*/
+    ext4_block_cache_write_back(file->mp->fs.bdev, 0);
+
+    if (r != EOK)
+        goto Finish;
+
+    if (size) {
+        r = ext4_fwrite_partial(file->mp, &ref, &iblk_idx, 0, u8_buf,
+                    size);
+        if (r != EOK) {
+            if (iblk_idx < ifile_blocks)
+                goto Finish;
+
+            /*Node size sholud be updated.*/
+            goto out_fsize;
+        }
+
+        file->fpos += size;
+
+        if (wcnt)
+            *wcnt += size;
+    }
+
+out_fsize:
+    if (file->fpos > file->fsize) {
+        file->fsize = file->fpos;
+        ext4_inode_set_size(ref.inode, file->fsize);
+        ref.dirty = true;
+    }
+
+Finish:
+    /*Data written before an error are committed, the error is returned.
+     * A failed commit (e.g. ordered data write) throws the whole
+     * transaction away.*/
+    rr = ext4_fs_put_inode_ref(&ref);
+    if (rr != EOK)
+        ext4_trans_abort(file->mp);
+    else
+        rr = ext4_trans_stop(file->mp);
+
+    if (rr != EOK) {
+        file->fpos = fpos;
+        if (wcnt)
+            *wcnt = 0;
+    }
+
+    if (r == EOK)
+        r = rr;
+
+    EXT4_MP_UNLOCK(file->mp);
+    return r;
+}
+
+/**@brief   Zero a part of a written block. Holes and unwritten blocks
+ *          read as zeros already.
+ * @param   mp mount point
+ * @param   ref i-node reference
+ * @param   off first byte to zero
+ * @param   len byte count, within one block
+ * @return  standard error code*/
+static int ext4_fzero_partial(struct ext4_mountpoint *mp,
+                  struct ext4_inode_ref *ref, uint64_t off,
+                  uint32_t len)
+{
+    uint32_t block_size = ext4_sb_get_block_size(&mp->fs.sb);
+    ext4_fsblk_t fblk;
+    uint8_t *zero;
+    int r;
+
+    r = ext4_fs_get_inode_dblk_idx(ref, (ext4_lblk_t)(off / block_size),
+                       &fblk, true);
+    if (r != EOK || !fblk)
+        return r;
+
+    zero = ext4_calloc(1, len);
+    if (!zero)
+        return ENOMEM;
+
+    r = ext4_block_writebytes(mp->fs.bdev,
+                  fblk * block_size + off % block_size, zero, len);
+    ext4_free(zero);
+    return r;
+}
+
+/**@brief   Preallocate one slice of a fallocate range.
+ * @param   file file handle
+ * @param   ref i-node reference
+ * @param   offset first byte of the whole range
+ * @param   end end of the whole range
+ * @param   iblk first block of the slice
+ * @param   cnt block count of the slice
+ * @param   mode EXT4_FALLOC_FL_* flags
+ * @return  standard error code*/
+static int ext4_falloc_slice(ext4_file *file, struct ext4_inode_ref *ref,
+                 uint64_t offset, uint64_t end, ext4_lblk_t iblk,
+                 uint32_t cnt, uint32_t mode)
+{
+    struct ext4_sblock *const sb = &file->mp->fs.sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint64_t slice_start = (uint64_t)iblk * block_size;
+    uint64_t slice_end = (uint64_t)(iblk + cnt) * block_size;
+    uint64_t zstart, zend;
+    int r;
+
+    r = ext4_fs_prealloc_inode_dblk(ref, iblk, cnt, false);
+    if (r != EOK)
+        return r;
+
+    if (mode & EXT4_FALLOC_FL_ZERO_RANGE) {
+        zstart = offset > slice_start ? offset : slice_start;
+        zend = end < slice_end ? end : slice_end;
+
+        /*Blocks covered entirely just turn unwritten*/
+        if (zstart % block_size) {
+            uint64_t next = zstart - zstart % block_size + block_size;
+            uint64_t stop = zend < next ? zend : next;
+
+            r = ext4_fzero_partial(file->mp, ref, zstart,
+                           (uint32_t)(stop - zstart));
+            if (r != EOK)
+                return r;
+
+            zstart = stop;
+        }
+
+        if (zend > zstart && zend % block_size) {
+            uint64_t last = zend - zend % block_size;
+
+            r = ext4_fzero_partial(file->mp, ref, last,
+                           (uint32_t)(zend - last));
+            if (r != EOK)
+                return r;
+
+            zend = last;
+        }
+
+        if (zend > zstart) {
+            r = ext4_fs_prealloc_inode_dblk(
+                ref, (ext4_lblk_t)(zstart / block_size),
+                (uint32_t)((zend - zstart) / block_size), true);
+            if (r != EOK)
+                return r;
+        }
+    }
+
+    /*Size covers the data preallocated so far*/
+    if (!(mode & EXT4_FALLOC_FL_KEEP_SIZE)) {
+        uint64_t size = end < slice_end ? end : slice_end;
+        if (size > ext4_inode_get_size(sb, ref->inode)) {
+            ext4_inode_set_size(ref->inode, size);
+            ref->dirty = true;
+        }
+    }
+
+    return EOK;
+}
+
+int ext4_fallocate(ext4_file *file, uint64_t offset, uint64_t len,
+           uint32_t mode)
+{
+    struct ext4_mountpoint *mp;
+    struct ext4_inode_ref ref;
+    uint32_t block_size;
+    uint64_t end, size;
+    ext4_lblk_t iblk, iblk_end;
+    uint32_t step, cnt;
+    int r;
+
+    ext4_assert(file && file->mp);
+    mp = file->mp;
+
+    if (mode & ~(EXT4_FALLOC_FL_KEEP_SIZE | EXT4_FALLOC_FL_ZERO_RANGE))
+        return ENOTSUP;
+
+    if (mp->fs.read_only)
+        return EROFS;
+
+    if (file->flags & O_RDONLY)
+        return EPERM;
+
+    block_size = ext4_sb_get_block_size(&mp->fs.sb);
+    end = offset + len;
+    if (!len || end < offset)
+        return EINVAL;
+
+    if ((end + block_size - 1) / block_size > EXT_MAX_BLOCKS)
+        return EFBIG;
+
+    iblk = (ext4_lblk_t)(offset / block_size);
+    iblk_end = (ext4_lblk_t)((end + block_size - 1) / block_size);
+
+    EXT4_MP_LOCK(mp);
+    ext4_trans_start(mp);
+
+    r = ext4_fs_get_inode_ref(&mp->fs, file->inode, &ref);
+    if (r != EOK)
+        goto Abort;
+
+    if (!ext4_inode_is_type(&mp->fs.sb, ref.inode, EXT4_INODE_MODE_FILE)) {
+        ext4_fs_put_inode_ref(&ref);
+        r = ENODEV;
+        goto Abort;
+    }
+
+#if CONFIG_INLINE_DATA_ENABLE
+    /*Inline data can't be preallocated, move them to a block first*/
+    if (ext4_inline_has_data(&ref)) {
+        r = ext4_finline_convert(mp, &ref);
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&ref);
+            goto Abort;
+        }
+    }
+#endif
+
+    /*The end of the last block comes into the file, its bytes past the
+     * old end have never been written*/
+    size = ext4_inode_get_size(&mp->fs.sb, ref.inode);
+    if (!(mode & EXT4_FALLOC_FL_KEEP_SIZE) && end > size &&
+        size % block_size) {
+        uint64_t stop = size - size % block_size + block_size;
+
+        r = ext4_fzero_partial(mp, &ref, size,
+                       (uint32_t)((end < stop ? end : stop) - size));
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&ref);
+            goto Abort;
+        }
+    }
+
+    r = ext4_fs_put_inode_ref(&ref);
+    if (r != EOK)
+        goto Abort;
+
+    /*Start write back cache mode.*/
+    r = ext4_block_cache_write_back(mp->fs.bdev, 1);
+    if (r != EOK)
+        goto Abort;
+
+    /*Go one block group at a time, like truncate does, so the
+     * transaction can be committed between slices. Extents are
+     * allocated as long as free space allows, no data is written.
+     * A slice never exceeds the longest unwritten extent (32767
+     * blocks), otherwise every group would end in a 1 block extent.*/
+    step = ext4_get32(&mp->fs.sb, blocks_per_group);
+    if (step > (1u << 15) - 1)
+        step = (1u << 15) - 1;
+    while (iblk < iblk_end) {
+        cnt = iblk_end - iblk > step ? step : iblk_end - iblk;
+
+        r = ext4_fs_get_inode_ref(&mp->fs, file->inode, &ref);
+        if (r != EOK)
+            break;
+
+        r = ext4_falloc_slice(file, &ref, offset, end, iblk, cnt, mode);
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&ref);
+            break;
+        }
+
+        file->fsize = ext4_inode_get_size(&mp->fs.sb, ref.inode);
+        r = ext4_fs_put_inode_ref(&ref);
+        if (r != EOK)
+            break;
+
+        iblk += cnt;
+        if (iblk < iblk_end && ext4_trans_full(mp)) {
+            ext4_trans_stop(mp);
+            ext4_trans_start(mp);
+        }
+    }
+
+    /*Stop write back cache mode*/
+    ext4_block_cache_write_back(mp->fs.bdev, 0);
+
+    if (r != EOK)
+        goto Abort;
+
+    ext4_trans_stop(mp);
+    EXT4_MP_UNLOCK(mp);
+    return EOK;
+
+Abort:
+    ext4_trans_abort(mp);
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
+int ext4_fpunch_hole(ext4_file *file, uint64_t offset, uint64_t len)
+{
+    struct ext4_mountpoint *mp;
+    struct ext4_inode_ref ref;
+    uint32_t block_size;
+    uint64_t end, size;
+    ext4_lblk_t iblk, iblk_end;
+    uint32_t step, cnt;
+    int r;
+
+    ext4_assert(file && file->mp);
+    mp = file->mp;
+
+    if (mp->fs.read_only)
         return EROFS;
 
     if (file->flags & O_RDONLY)
         return EPERM;
 
-    if (!size)
-        return EOK;
+    end = offset + len;
+    if (!len || end < offset)
+        return EINVAL;
 
-    EXT4_MP_LOCK(file->mp);
-    ext4_trans_start(file->mp);
+    block_size = ext4_sb_get_block_size(&mp->fs.sb);
 
-    struct ext4_fs *const fs = &file->mp->fs;
-    struct ext4_sblock *const sb = &file->mp->fs.sb;
+    EXT4_MP_LOCK(mp);
+    ext4_trans_start(mp);
 
-    if (wcnt)
-        *wcnt = 0;
+    r = ext4_fs_get_inode_ref(&mp->fs, file->inode, &ref);
+    if (r != EOK)
+        goto Abort;
 
-    r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
-    if (r != EOK) {
-        ext4_trans_abort(file->mp);
-        EXT4_MP_UNLOCK(file->mp);
-        return r;
+    if (!ext4_inode_is_type(&mp->fs.sb, ref.inode, EXT4_INODE_MODE_FILE)) {
+        ext4_fs_put_inode_ref(&ref);
+        r = ENODEV;
+        goto Abort;
     }
 
-    /*Sync file size*/
-    file->fsize = ext4_inode_get_size(sb, ref.inode);
-    block_size = ext4_sb_get_block_size(sb);
+    /*Nothing is released past the block holding the file end*/
+    size = ext4_inode_get_size(&mp->fs.sb, ref.inode);
+    if (end > size)
+        end = size + (block_size - size % block_size) % block_size;
 
-    iblock_last = (uint32_t)((file->fpos + size) / block_size);
-    iblk_idx = (uint32_t)(file->fpos / block_size);
-    ifile_blocks = (uint32_t)((file->fsize + block_size - 1) / block_size);
+    if (offset >= end) {
+        r = ext4_fs_put_inode_ref(&ref);
+        goto Finish;
+    }
 
-    unalg = (file->fpos) % block_size;
+#if CONFIG_INLINE_DATA_ENABLE
+    /*Inline data have no block to release, zero the bytes in place*/
+    if (ext4_inline_has_data(&ref)) {
+        uint8_t *zero;
 
-    if (unalg) {
-        size_t len =  size;
-        uint64_t off;
-        if (size > (block_size - unalg))
-            len = block_size - unalg;
+        if (end > size)
+            end = size;
 
-        r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
-        if (r != EOK)
-            goto Finish;
+        zero = ext4_calloc(1, (size_t)(end - offset));
+        if (!zero) {
+            ext4_fs_put_inode_ref(&ref);
+            r = ENOMEM;
+            goto Abort;
+        }
 
-        off = fblk * block_size + unalg;
-        r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, len);
-        if (r != EOK)
-            goto Finish;
+        r = ext4_inline_write(&ref, offset, zero, (size_t)(end - offset));
+        ext4_free(zero);
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&ref);
+            goto Abort;
+        }
 
-        u8_buf += len;
-        size -= len;
-        file->fpos += len;
+        r = ext4_fs_put_inode_ref(&ref);
+        goto Finish;
+    }
+#endif
 
-        if (wcnt)
-            *wcnt += len;
+    if (!ext4_inode_has_flag(ref.inode, EXT4_INODE_FLAG_EXTENTS)) {
+        ext4_fs_put_inode_ref(&ref);
+        r = ENOTSUP;
+        goto Abort;
+    }
 
-        iblk_idx++;
+    /*Blocks only partly in the range keep their place*/
+    if (offset % block_size) {
+        uint64_t next = offset - offset % block_size + block_size;
+        uint64_t stop = end < next ? end : next;
+
+        r = ext4_fzero_partial(mp, &ref, offset,
+                       (uint32_t)(stop - offset));
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&ref);
+            goto Abort;
+        }
+
+        offset = stop;
     }
 
-    /*Start write back cache mode.*/
-    r = ext4_block_cache_write_back(file->mp->fs.bdev, 1);
-    if (r != EOK)
-        goto Finish;
+    if (end > offset && end % block_size) {
+        uint64_t last = end - end % block_size;
 
-    fblock_start = 0;
-    fblock_count = 0;
-    while (size >= block_size) {
+        r = ext4_fzero_partial(mp, &ref, last, (uint32_t)(end - last));
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&ref);
+            goto Abort;
+        }
 
-        while (iblk_idx < iblock_last) {
-            if (iblk_idx < ifile_blocks) {
-                r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx,
-                                &fblk);
-                if (r != EOK)
-                    goto Finish;
-            } else {
-                rr = ext4_fs_append_inode_dblk(&ref, &fblk,
-                                   &iblk_idx);
-                if (rr != EOK) {
-                    /* Unable to append more blocks. But
-                     * some block might be allocated already
-                     * */
-                    break;
-                }
-            }
+        end = last;
+    }
 
-            iblk_idx++;
+    r = ext4_fs_put_inode_ref(&ref);
+    if (r != EOK || end <= offset)
+        goto Finish;
 
-            if (!fblock_start) {
-                fblock_start = fblk;
-            }
+    iblk = (ext4_lblk_t)(offset / block_size);
+    iblk_end = (ext4_lblk_t)(end / block_size);
 
-            if ((fblock_start + fblock_count) != fblk)
-                break;
+    /*Release one block group at a time, like truncate does*/
+    step = ext4_get32(&mp->fs.sb, blocks_per_group);
+    while (iblk < iblk_end) {
+        cnt = iblk_end - iblk > step ? step : iblk_end - iblk;
 
-            fblock_count++;
+        r = ext4_fs_get_inode_ref(&mp->fs, file->inode, &ref);
+        if (r != EOK)
+            goto Abort;
+
+        r = ext4_fs_punch_inode_dblk(&ref, iblk, cnt);
+        if (r != EOK) {
+            ext4_fs_put_inode_ref(&ref);
+            goto Abort;
         }
 
-        r = ext4_blocks_set_direct(file->mp->fs.bdev, u8_buf, fblock_start,
-                       fblock_count);
+        r = ext4_fs_put_inode_ref(&ref);
         if (r != EOK)
-            break;
+            goto Abort;
 
-        size -= block_size * fblock_count;
-        u8_buf += block_size * fblock_count;
-        file->fpos += block_size * fblock_count;
+        iblk += cnt;
+        if (iblk < iblk_end && ext4_trans_full(mp)) {
+            ext4_trans_stop(mp);
+            ext4_trans_start(mp);
+        }
+    }
 
-        if (wcnt)
-            *wcnt += block_size * fblock_count;
+Finish:
+    if (r != EOK)
+        goto Abort;
 
-        fblock_start = fblk;
-        fblock_count = 1;
+    ext4_trans_stop(mp);
+    EXT4_MP_UNLOCK(mp);
+    return EOK;
 
-        if (rr != EOK) {
-            /*ext4_fs_append_inode_block has failed and no
-             * more blocks might be written. But node size
-             * should be updated.*/
-            r = rr;
-            goto out_fsize;
-        }
-    }
+Abort:
+    ext4_trans_abort(mp);
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
 
-    /*Stop write back cache mode*/
-    ext4_block_cache_write_back(file->mp->fs.bdev, 0);
+/**@brief   Look for the next data or hole of a file, from the extent
+ *          tree: holes are skipped without reading them.
+ * @param   file file handle
+ * @param   offset first byte to look at
+ * @param   origin @ref SEEK_DATA or @ref SEEK_HOLE
+ * @return  standard error code*/
+static int ext4_fseek_sparse(ext4_file *file, uint64_t offset,
+                 uint32_t origin)
+{
+    struct ext4_inode_ref ref;
+    struct ext4_sblock *const sb = &file->mp->fs.sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    ext4_lblk_t iblk, iblk_end;
+    ext4_fsblk_t fblk;
+    uint32_t cnt;
+    uint64_t pos;
+    int r;
 
-    if (r != EOK)
+    EXT4_MP_LOCK(file->mp);
+
+    r = ext4_fs_get_inode_ref(&file->mp->fs, file->inode, &ref);
+    if (r != EOK) {
+        EXT4_MP_UNLOCK(file->mp);
+        return r;
+    }
+
+    file->fsize = ext4_inode_get_size(sb, ref.inode);
+    if (offset >= file->fsize) {
+        r = ENXIO;
         goto Finish;
+    }
 
-    if (size) {
-        uint64_t off;
-        if (iblk_idx < ifile_blocks) {
-            r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
-            if (r != EOK)
-                goto Finish;
-        } else {
-            r = ext4_fs_append_inode_dblk(&ref, &fblk, &iblk_idx);
-            if (r != EOK)
-                /*Node size sholud be updated.*/
-                goto out_fsize;
-        }
+    /*Data kept in the i-node: no hole but the end of file*/
+    if (ext4_inline_has_data(&ref) ||
+        (ext4_inode_is_type(sb, ref.inode, EXT4_INODE_MODE_SOFTLINK) &&
+         file->fsize < sizeof(ref.inode->blocks) &&
+         !ext4_inode_get_blocks_count(sb, ref.inode))) {
+        pos = origin == SEEK_DATA ? offset : file->fsize;
+        goto Found;
+    }
 
-        off = fblk * block_size;
-        r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, size);
+    iblk = (ext4_lblk_t)(offset / block_size);
+    iblk_end = (ext4_lblk_t)((file->fsize + block_size - 1) / block_size);
+    while (iblk < iblk_end) {
+        r = ext4_fs_get_inode_dblk_run(&ref, iblk, iblk_end - iblk,
+                           &fblk, &cnt);
         if (r != EOK)
             goto Finish;
 
-        file->fpos += size;
+        if ((fblk != 0) == (origin == SEEK_DATA))
+            break;
 
-        if (wcnt)
-            *wcnt += size;
+        iblk += cnt;
     }
 
-out_fsize:
-    if (file->fpos > file->fsize) {
-        file->fsize = file->fpos;
-        ext4_inode_set_size(ref.inode, file->fsize);
-        ref.dirty = true;
+    if (iblk >= iblk_end) {
+        if (origin == SEEK_DATA) {
+            r = ENXIO;
+            goto Finish;
+        }
+
+        pos = file->fsize;
+        goto Found;
     }
 
-Finish:
-    r = ext4_fs_put_inode_ref(&ref);
+    pos = (uint64_t)iblk * block_size;
+    if (pos < offset)
+        pos = offset;
 
-    if (r != EOK)
-        ext4_trans_abort(file->mp);
-    else
-        ext4_trans_stop(file->mp);
+Found:
+    file->fpos = pos;
 
+Finish:
+    ext4_fs_put_inode_ref(&ref);
     EXT4_MP_UNLOCK(file->mp);
     return r;
 }
@@ -2040,6 +3372,12 @@ int ext4_fseek(ext4_file *file, int64_t offset, uint32_t origin)
 
         file->fpos = file->fsize - offset;
         return EOK;
+    case SEEK_DATA:
+    case SEEK_HOLE:
+        if (offset < 0)
+            return ENXIO;
+
+        return ext4_fseek_sparse(file, offset, origin);
     }
     return EINVAL;
 }
@@ -2128,6 +3466,28 @@ int ext4_raw_inode_fill(const char *path, uint32_t *ret_ino,
     return r;
 }
 
+int ext4_fstat(ext4_file *file, uint32_t *ret_ino, struct ext4_inode *inode)
+{
+    int r;
+    struct ext4_inode_ref inode_ref;
+
+    ext4_assert(file && file->mp);
+
+    EXT4_MP_LOCK(file->mp);
+    r = ext4_fs_get_inode_ref(&file->mp->fs, file->inode, &inode_ref);
+    if (r != EOK)
+        goto Finish;
+
+    if (ret_ino)
+        *ret_ino = file->inode;
+
+    memcpy(inode, inode_ref.inode, sizeof(struct ext4_inode));
+    r = ext4_fs_put_inode_ref(&inode_ref);
+Finish:
+    EXT4_MP_UNLOCK(file->mp);
+    return r;
+}
+
 int ext4_inode_exist(const char *path, int type)
 {
     int r;
@@ -2177,6 +3537,46 @@ int ext4_mode_set(const char *path, uint32_t mode)
     return r;
 }
 
+int ext4_dir_compact(const char *path)
+{
+    int r;
+    struct ext4_inode_ref inode_ref;
+    struct ext4_mountpoint *mp = ext4_get_mount(path);
+
+    if (!mp)
+        return ENOENT;
+
+    if (mp->fs.read_only)
+        return EROFS;
+
+    EXT4_MP_LOCK(mp);
+
+    r = ext4_trans_get_inode_ref(path, mp, &inode_ref);
+    if (r != EOK)
+        goto Finish;
+
+    if (!ext4_inode_is_type(&mp->fs.sb, inode_ref.inode,
+                EXT4_INODE_MODE_DIRECTORY))
+        r = ENOTDIR;
+#if CONFIG_DIR_INDEX_ENABLE
+    else
+        r = ext4_dir_dx_compact(&inode_ref);
+#endif
+
+    if (r != EOK) {
+        ext4_fs_put_inode_ref(&inode_ref);
+        ext4_trans_abort(mp);
+        goto Finish;
+    }
+
+    r = ext4_trans_put_inode_ref(mp, &inode_ref);
+
+    Finish:
+    EXT4_MP_UNLOCK(mp);
+
+    return r;
+}
+
 int ext4_owner_set(const char *path, uint32_t uid, uint32_t gid)
 {
     int r;
@@ -2490,18 +3890,68 @@ static int ext4_fsymlink_set(ext4_file *f, const void *buf, uint32_t size)
     /*Stop write back cache mode*/
     ext4_block_cache_write_back(f->mp->fs.bdev, 0);
 
-    if (r != EOK)
-        goto Finish;
+    if (r != EOK)
+        goto Finish;
+
+    ext4_inode_set_size(ref.inode, size);
+    ref.dirty = true;
+
+    f->fsize = size;
+    if (f->fpos > size)
+        f->fpos = size;
+
+Finish:
+    ext4_fs_put_inode_ref(&ref);
+    return r;
+}
+
+int ext4_fsetattr(ext4_file *file, const struct ext4_fattr *attr)
+{
+    int r;
+    struct ext4_inode_ref inode_ref;
+    struct ext4_mountpoint *mp;
+
+    ext4_assert(file && file->mp && attr);
+    mp = file->mp;
+
+    if (mp->fs.read_only)
+        return EROFS;
+
+    EXT4_MP_LOCK(mp);
+    ext4_trans_start(mp);
+
+    r = ext4_fs_get_inode_ref(&mp->fs, file->inode, &inode_ref);
+    if (r != EOK) {
+        ext4_trans_abort(mp);
+        goto Finish;
+    }
+
+    if (attr->valid & EXT4_FATTR_MODE) {
+        uint32_t mode = ext4_inode_get_mode(&mp->fs.sb, inode_ref.inode);
+        mode &= ~0xFFF;
+        mode |= attr->mode & 0xFFF;
+        ext4_inode_set_mode(&mp->fs.sb, inode_ref.inode, mode);
+    }
+
+    if (attr->valid & EXT4_FATTR_UID)
+        ext4_inode_set_uid(inode_ref.inode, attr->uid);
+
+    if (attr->valid & EXT4_FATTR_GID)
+        ext4_inode_set_gid(inode_ref.inode, attr->gid);
+
+    if (attr->valid & EXT4_FATTR_ATIME)
+        ext4_inode_set_access_time(inode_ref.inode, attr->atime);
 
-    ext4_inode_set_size(ref.inode, size);
-    ref.dirty = true;
+    if (attr->valid & EXT4_FATTR_MTIME)
+        ext4_inode_set_modif_time(inode_ref.inode, attr->mtime);
 
-    f->fsize = size;
-    if (f->fpos > size)
-        f->fpos = size;
+    if (attr->valid & EXT4_FATTR_CTIME)
+        ext4_inode_set_change_inode_time(inode_ref.inode, attr->ctime);
 
+    inode_ref.dirty = true;
+    r = ext4_trans_put_inode_ref(mp, &inode_ref);
 Finish:
-    ext4_fs_put_inode_ref(&ref);
+    EXT4_MP_UNLOCK(mp);
     return r;
 }
 
@@ -2654,23 +4104,16 @@ Finish:
     return r;
 }
 
-int ext4_setxattr(const char *path, const char *name, size_t name_len,
-          const void *data, size_t data_size)
+static int ext4_setxattr_ino(struct ext4_mountpoint *mp, uint32_t inode,
+                 const char *name, size_t name_len,
+                 const void *data, size_t data_size)
 {
     bool found;
     int r = EOK;
-    ext4_file f;
-    uint32_t inode;
     uint8_t name_index;
     const char *dissected_name = NULL;
     size_t dissected_len = 0;
     struct ext4_inode_ref inode_ref;
-    struct ext4_mountpoint *mp = ext4_get_mount(path);
-    if (!mp)
-        return ENOENT;
-
-    if (mp->fs.read_only)
-        return EROFS;
 
     dissected_name = ext4_extract_xattr_name(name, name_len,
                 &name_index, &dissected_len,
@@ -2678,15 +4121,6 @@ int ext4_setxattr(const char *path, const char *name, size_t name_len,
     if (!found)
         return EINVAL;
 
-    EXT4_MP_LOCK(mp);
-    r = ext4_generic_open2(&f, path, O_RDONLY, EXT4_DE_UNKNOWN, NULL, NULL);
-    if (r != EOK) {
-        EXT4_MP_UNLOCK(mp);
-        return r;
-    }
-
-    inode = f.inode;
-    ext4_fclose(&f);
     ext4_trans_start(mp);
 
     r = ext4_fs_get_inode_ref(&mp->fs, inode, &inode_ref);
@@ -2703,24 +4137,19 @@ Finish:
     else
         ext4_trans_stop(mp);
 
-    EXT4_MP_UNLOCK(mp);
     return r;
 }
 
-int ext4_getxattr(const char *path, const char *name, size_t name_len,
-          void *buf, size_t buf_size, size_t *data_size)
+static int ext4_getxattr_ino(struct ext4_mountpoint *mp, uint32_t inode,
+                 const char *name, size_t name_len,
+                 void *buf, size_t buf_size, size_t *data_size)
 {
     bool found;
     int r = EOK;
-    ext4_file f;
-    uint32_t inode;
     uint8_t name_index;
     const char *dissected_name = NULL;
     size_t dissected_len = 0;
     struct ext4_inode_ref inode_ref;
-    struct ext4_mountpoint *mp = ext4_get_mount(path);
-    if (!mp)
-        return ENOENT;
 
     dissected_name = ext4_extract_xattr_name(name, name_len,
                 &name_index, &dissected_len,
@@ -2728,27 +4157,101 @@ int ext4_getxattr(const char *path, const char *name, size_t name_len,
     if (!found)
         return EINVAL;
 
-    EXT4_MP_LOCK(mp);
-    r = ext4_generic_open2(&f, path, O_RDONLY, EXT4_DE_UNKNOWN, NULL, NULL);
-    if (r != EOK)
-        goto Finish;
-
-    inode = f.inode;
-    ext4_fclose(&f);
+#if CONFIG_XCACHE_ENABLE && CONFIG_XCACHE_INODES
+    /*Decoded xattrs don't need the i-node to be loaded.*/
+    r = ext4_xattr_cache_get(&mp->fs, inode, name_index, dissected_name,
+                 dissected_len, buf, buf_size, data_size);
+    if (r != ENOENT)
+        return r;
+#endif
 
     r = ext4_fs_get_inode_ref(&mp->fs, inode, &inode_ref);
     if (r != EOK)
-        goto Finish;
+        return r;
 
     r = ext4_xattr_get(&inode_ref, name_index, dissected_name,
                 dissected_len, buf, buf_size, data_size);
 
     ext4_fs_put_inode_ref(&inode_ref);
-Finish:
+    return r;
+}
+
+int ext4_setxattr(const char *path, const char *name, size_t name_len,
+          const void *data, size_t data_size)
+{
+    int r = EOK;
+    ext4_file f;
+    struct ext4_mountpoint *mp = ext4_get_mount(path);
+    if (!mp)
+        return ENOENT;
+
+    if (mp->fs.read_only)
+        return EROFS;
+
+    EXT4_MP_LOCK(mp);
+    r = ext4_generic_open2(&f, path, O_RDONLY, EXT4_DE_UNKNOWN, NULL, NULL);
+    if (r == EOK) {
+        uint32_t inode = f.inode;
+        ext4_fclose(&f);
+        r = ext4_setxattr_ino(mp, inode, name, name_len, data,
+                      data_size);
+    }
+
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
+int ext4_fsetxattr(ext4_file *file, const char *name, size_t name_len,
+           const void *data, size_t data_size)
+{
+    int r;
+    ext4_assert(file && file->mp);
+
+    if (file->mp->fs.read_only)
+        return EROFS;
+
+    EXT4_MP_LOCK(file->mp);
+    r = ext4_setxattr_ino(file->mp, file->inode, name, name_len, data,
+                  data_size);
+    EXT4_MP_UNLOCK(file->mp);
+    return r;
+}
+
+int ext4_getxattr(const char *path, const char *name, size_t name_len,
+          void *buf, size_t buf_size, size_t *data_size)
+{
+    int r = EOK;
+    ext4_file f;
+    struct ext4_mountpoint *mp = ext4_get_mount(path);
+    if (!mp)
+        return ENOENT;
+
+    EXT4_MP_LOCK(mp);
+    r = ext4_generic_open2(&f, path, O_RDONLY, EXT4_DE_UNKNOWN, NULL, NULL);
+    if (r == EOK) {
+        uint32_t inode = f.inode;
+        ext4_fclose(&f);
+        r = ext4_getxattr_ino(mp, inode, name, name_len, buf,
+                      buf_size, data_size);
+    }
+
     EXT4_MP_UNLOCK(mp);
     return r;
 }
 
+int ext4_fgetxattr(ext4_file *file, const char *name, size_t name_len,
+           void *buf, size_t buf_size, size_t *data_size)
+{
+    int r;
+    ext4_assert(file && file->mp);
+
+    EXT4_MP_LOCK(file->mp);
+    r = ext4_getxattr_ino(file->mp, file->inode, name, name_len, buf,
+                  buf_size, data_size);
+    EXT4_MP_UNLOCK(file->mp);
+    return r;
+}
+
 int ext4_listxattr(const char *path, char *list, size_t size, size_t *ret_size)
 {
     int r = EOK;
@@ -2828,6 +4331,84 @@ Finish:
 
 }
 
+struct ext4_getxattr_all_ctx {
+    char *buf;
+    size_t size;
+    size_t used;
+};
+
+static int ext4_getxattr_all_iter(void *arg, const struct ext4_xattr_item *item)
+{
+    struct ext4_getxattr_all_ctx *ctx = arg;
+    ext4_xattr_rec *rec;
+    size_t prefix_len, rec_len;
+    const char *prefix =
+        ext4_get_xattr_name_prefix(item->name_index, &prefix_len);
+
+    /*Names of unknown index can't be expressed, listxattr skips them too.*/
+    if (!prefix)
+        return EOK;
+
+    rec_len = sizeof(ext4_xattr_rec) + prefix_len + item->name_len + 1 +
+          item->value_len;
+    rec_len = (rec_len + 3) & ~(size_t)3;
+
+    if (ctx->size) {
+        if (ctx->used + rec_len > ctx->size)
+            return ERANGE;
+
+        rec = (ext4_xattr_rec *)(ctx->buf + ctx->used);
+        rec->rec_len = rec_len;
+        rec->value_len = item->value_len;
+        rec->name_len = prefix_len + item->name_len;
+        memcpy(rec->name, prefix, prefix_len);
+        memcpy(rec->name + prefix_len, item->name, item->name_len);
+        rec->name[rec->name_len] = 0;
+        memcpy(rec->name + rec->name_len + 1, item->value,
+               item->value_len);
+    }
+
+    ctx->used += rec_len;
+    return EOK;
+}
+
+int ext4_getxattr_all(const char *path, void *buf, size_t size,
+              size_t *ret_size)
+{
+    int r;
+    ext4_file f;
+    uint32_t inode;
+    struct ext4_inode_ref inode_ref;
+    struct ext4_getxattr_all_ctx ctx;
+    struct ext4_mountpoint *mp = ext4_get_mount(path);
+    if (!mp)
+        return ENOENT;
+
+    ctx.buf = buf;
+    ctx.size = buf ? size : 0;
+    ctx.used = 0;
+
+    EXT4_MP_LOCK(mp);
+    r = ext4_generic_open2(&f, path, O_RDONLY, EXT4_DE_UNKNOWN, NULL, NULL);
+    if (r != EOK)
+        goto Finish;
+    inode = f.inode;
+    ext4_fclose(&f);
+
+    r = ext4_fs_get_inode_ref(&mp->fs, inode, &inode_ref);
+    if (r != EOK)
+        goto Finish;
+
+    r = ext4_xattr_iterate(&inode_ref, ext4_getxattr_all_iter, &ctx);
+    ext4_fs_put_inode_ref(&inode_ref);
+
+    if (r == EOK && ret_size)
+        *ret_size = ctx.used;
+Finish:
+    EXT4_MP_UNLOCK(mp);
+    return r;
+}
+
 int ext4_removexattr(const char *path, const char *name, size_t name_len)
 {
     bool found;
@@ -2854,7 +4435,7 @@ int ext4_removexattr(const char *path, const char *name, size_t name_len)
     EXT4_MP_LOCK(mp);
     r = ext4_generic_open2(&f, path, O_RDONLY, EXT4_DE_UNKNOWN, NULL, NULL);
     if (r != EOK) {
-        EXT4_MP_LOCK(mp);
+        EXT4_MP_UNLOCK(mp);
         return r;
     }
 
@@ -3177,12 +4758,215 @@ int ext4_dir_close(ext4_dir *dir)
     return ext4_fclose(&dir->f);
 }
 
-const ext4_direntry *ext4_dir_entry_next(ext4_dir *dir)
-{
 #define EXT4_DIR_ENTRY_OFFSET_TERM (uint64_t)(-1)
 
+static void ext4_dir_entry_fill(struct ext4_sblock *sb,
+                struct ext4_dir_en *en, ext4_direntry *de)
+{
+    uint16_t name_length = ext4_dir_en_get_name_len(sb, en);
+
+    memset(&de->name, 0, sizeof(de->name));
+    memcpy(&de->name, en->name, name_length);
+
+    /* Directly copying the content isn't safe for Big-endian targets*/
+    de->inode = ext4_dir_en_get_inode(en);
+    de->entry_length = ext4_dir_en_get_entry_len(en);
+    de->name_length = name_length;
+    de->inode_type = ext4_dir_en_get_inode_type(sb, en);
+}
+
+static int ext4_dir_entries_fetch(ext4_dir *dir, ext4_direntry *buf,
+                  size_t max, size_t *count)
+{
+    int r;
+    size_t cnt = 0;
+    struct ext4_inode_ref dir_inode;
+    struct ext4_dir_iter it;
+
+    if (dir->next_off == EXT4_DIR_ENTRY_OFFSET_TERM || !max) {
+        r = EOK;
+        goto Finish;
+    }
+
+    r = ext4_fs_get_inode_ref(&dir->f.mp->fs, dir->f.inode, &dir_inode);
+    if (r != EOK)
+        goto Finish;
+
+    /*One iterator walks the directory block by block.*/
+    r = ext4_dir_iterator_init(&it, &dir_inode, dir->next_off);
+    while (r == EOK && it.curr && cnt < max) {
+        if (ext4_dir_en_get_inode(it.curr))
+            ext4_dir_entry_fill(&dir->f.mp->fs.sb, it.curr,
+                        &buf[cnt++]);
+
+        r = ext4_dir_iterator_next(&it);
+    }
+
+    if (r == EOK)
+        dir->next_off = it.curr ? it.curr_off :
+                      EXT4_DIR_ENTRY_OFFSET_TERM;
+
+    ext4_dir_iterator_fini(&it);
+    ext4_fs_put_inode_ref(&dir_inode);
+
+Finish:
+    /*Position is kept on error, so entries read so far are dropped.*/
+    *count = r == EOK ? cnt : 0;
+    return r;
+}
+
+int ext4_dir_entries_read(ext4_dir *dir, ext4_direntry *buf, size_t max,
+              size_t *count)
+{
+    int r;
+    size_t cnt;
+
+    ext4_assert(dir && dir->f.mp && (buf || !max));
+
+    EXT4_MP_LOCK(dir->f.mp);
+    r = ext4_dir_entries_fetch(dir, buf, max, &cnt);
+    EXT4_MP_UNLOCK(dir->f.mp);
+
+    if (count)
+        *count = cnt;
+
+    return r;
+}
+
+static int ext4_direntry_ino_cmp(const void *a, const void *b)
+{
+    const ext4_direntry *x = *(const ext4_direntry *const *)a;
+    const ext4_direntry *y = *(const ext4_direntry *const *)b;
+
+    if (x->inode == y->inode)
+        return 0;
+
+    return x->inode < y->inode ? -1 : 1;
+}
+
+/**@brief   Copy inodes of directory entries. Inodes are visited in
+ *          inode number order, so the ones sharing an inode table block
+ *          are copied from a single block get.*/
+static int ext4_dir_entries_inodes(struct ext4_fs *fs, ext4_direntry *buf,
+                   struct ext4_inode *inodes, size_t cnt)
+{
+    int r = EOK;
+    size_t i;
+    ext4_direntry **order;
+    struct ext4_block block = EXT4_BLOCK_ZERO();
+    ext4_fsblk_t table = 0;
+    uint32_t group = (uint32_t)-1;
+    uint32_t ipg = ext4_get32(&fs->sb, inodes_per_group);
+    uint32_t icount = ext4_get32(&fs->sb, inodes_count);
+    uint32_t inode_size = ext4_get16(&fs->sb, inode_size);
+    uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
+    uint32_t copy_size = inode_size < sizeof(struct ext4_inode) ?
+                 inode_size : sizeof(struct ext4_inode);
+
+    order = ext4_malloc(cnt * sizeof(ext4_direntry *));
+    if (!order)
+        return ENOMEM;
+
+    for (i = 0; i < cnt; i++)
+        order[i] = &buf[i];
+
+    qsort(order, cnt, sizeof(ext4_direntry *), ext4_direntry_ino_cmp);
+
+    for (i = 0; i < cnt; i++) {
+        uint32_t index = order[i]->inode - 1;
+        uint64_t byte_off = (uint64_t)(index % ipg) * inode_size;
+        ext4_fsblk_t blk;
+        struct ext4_inode *inode = &inodes[order[i] - buf];
+        struct ext4_inode_ref ref;
+
+        /* Corrupted entry, inode would be past the last group */
+        if (order[i]->inode == 0 || order[i]->inode > icount) {
+            r = EIO;
+            break;
+        }
+
+        if (index / ipg != group) {
+            struct ext4_block_group_ref bg_ref;
+
+            group = index / ipg;
+            r = ext4_fs_get_block_group_ref(fs, group, &bg_ref);
+            if (r != EOK)
+                break;
+
+            table = ext4_bg_get_inode_table_first_block(
+                    bg_ref.block_group, &fs->sb);
+            r = ext4_fs_put_block_group_ref(&bg_ref);
+            if (r != EOK)
+                break;
+        }
+
+        blk = table + byte_off / block_size;
+        if (block.lb_id != blk) {
+            if (block.lb_id) {
+                r = ext4_block_set(fs->bdev, &block);
+                block.lb_id = 0;
+                if (r != EOK)
+                    break;
+            }
+
+            r = ext4_block_get(fs->bdev, &block, blk);
+            if (r != EOK) {
+                block.lb_id = 0;
+                break;
+            }
+        }
+
+        ref.fs = fs;
+        ref.index = order[i]->inode;
+        ref.inode = (void *)(block.data + byte_off % block_size);
+        if (!ext4_fs_verify_inode_csum(&ref)) {
+            ext4_dbg(DEBUG_FS, DBG_WARN "Inode checksum failed."
+                 "Inode: %" PRIu32"\n", ref.index);
+            r = EIO;
+            break;
+        }
+
+        memset(inode, 0, sizeof(struct ext4_inode));
+        memcpy(inode, ref.inode, copy_size);
+    }
+
+    if (block.lb_id)
+        ext4_block_set(fs->bdev, &block);
+
+    ext4_free(order);
+    return r;
+}
+
+int ext4_dir_entries_read_plus(ext4_dir *dir, ext4_direntry *buf,
+                   struct ext4_inode *inodes, size_t max,
+                   size_t *count)
+{
+    int r;
+    size_t cnt;
+    uint64_t next_off = dir->next_off;
+
+    ext4_assert(dir && dir->f.mp && ((buf && inodes) || !max));
+
+    EXT4_MP_LOCK(dir->f.mp);
+    r = ext4_dir_entries_fetch(dir, buf, max, &cnt);
+    if (r == EOK && cnt) {
+        r = ext4_dir_entries_inodes(&dir->f.mp->fs, buf, inodes, cnt);
+        if (r != EOK) {
+            dir->next_off = next_off;
+            cnt = 0;
+        }
+    }
+    EXT4_MP_UNLOCK(dir->f.mp);
+
+    if (count)
+        *count = cnt;
+
+    return r;
+}
+
+const ext4_direntry *ext4_dir_entry_next(ext4_dir *dir)
+{
     int r;
-    uint16_t name_length;
     ext4_direntry *de = 0;
     struct ext4_inode_ref dir_inode;
     struct ext4_dir_iter it;
@@ -3205,18 +4989,15 @@ const ext4_direntry *ext4_dir_entry_next(ext4_dir *dir)
         goto Finish;
     }
 
-    memset(&dir->de.name, 0, sizeof(dir->de.name));
-    name_length = ext4_dir_en_get_name_len(&dir->f.mp->fs.sb,
-                           it.curr);
-    memcpy(&dir->de.name, it.curr->name, name_length);
-
-    /* Directly copying the content isn't safe for Big-endian targets*/
-    dir->de.inode = ext4_dir_en_get_inode(it.curr);
-    dir->de.entry_length = ext4_dir_en_get_entry_len(it.curr);
-    dir->de.name_length = name_length;
-    dir->de.inode_type = ext4_dir_en_get_inode_type(&dir->f.mp->fs.sb,
-                              it.curr);
+    /*Offset past the last entry (e.g. directory shrunk meanwhile)*/
+    if (!it.curr) {
+        dir->next_off = EXT4_DIR_ENTRY_OFFSET_TERM;
+        ext4_dir_iterator_fini(&it);
+        ext4_fs_put_inode_ref(&dir_inode);
+        goto Finish;
+    }
 
+    ext4_dir_entry_fill(&dir->f.mp->fs.sb, it.curr, &dir->de);
     de = &dir->de;
 
     ext4_dir_iterator_next(&it);
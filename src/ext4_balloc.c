@@ -285,7 +285,7 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
                 bg_ref.index);
         }
         uint32_t free_cnt;
-        free_cnt = ext4_sb_get_block_size(sb) * 8 - idx_in_bg_first;
+        free_cnt = ext4_blocks_in_group_cnt(sb, bg_first) - idx_in_bg_first;
 
         /*If last block, free only count blocks*/
         free_cnt = count > free_cnt ? free_cnt : count;
@@ -334,13 +334,9 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
         bg_first++;
     }
 
-    uint32_t i;
-    for (i = 0;i < blk_cnt;i++) {
-        rc = ext4_trans_try_revoke_block(fs->bdev, start_block + i);
-        if (rc != EOK)
-            return rc;
-
-    }
+    rc = ext4_trans_try_revoke_blocks(fs->bdev, start_block, blk_cnt);
+    if (rc != EOK)
+        return rc;
 
     ext4_bcache_invalidate_lba(fs->bdev->bc, start_block, blk_cnt);
     /*All blocks should be released*/
@@ -582,6 +578,168 @@ success:
     return r;
 }
 
+/**@brief   Look for a run of free blocks in a block group and allocate it
+ *          if it is long enough.
+ * @param   inode_ref inode reference
+ * @param   bgid block group index
+ * @param   idx_in_bg index to start the search from
+ * @param   want wanted run length, longer runs are cut
+ * @param   need minimal run length to allocate
+ * @param   run_idx output: index of the (longest) run found
+ * @param   run_len output: length of the run, the run is allocated
+ *          when it is at least need blocks long
+ * @return  standard error code*/
+static int ext4_balloc_alloc_run(struct ext4_inode_ref *inode_ref,
+                 uint32_t bgid, uint32_t idx_in_bg,
+                 uint32_t want, uint32_t need,
+                 uint32_t *run_idx, uint32_t *run_len)
+{
+    struct ext4_fs *fs = inode_ref->fs;
+    struct ext4_sblock *sb = &fs->sb;
+    struct ext4_block_group_ref bg_ref;
+    struct ext4_block b;
+    uint32_t blk_in_bg, free_blocks, idx, len;
+    int r;
+
+    *run_idx = 0;
+    *run_len = 0;
+
+    r = ext4_fs_get_block_group_ref(fs, bgid, &bg_ref);
+    if (r != EOK)
+        return r;
+
+    struct ext4_bgroup *bg = bg_ref.block_group;
+    free_blocks = ext4_bg_get_free_blocks_count(bg, sb);
+    if (free_blocks == 0)
+        return ext4_fs_put_block_group_ref(&bg_ref);
+
+    r = ext4_trans_block_get(fs->bdev, &b, ext4_bg_get_block_bitmap(bg, sb));
+    if (r != EOK) {
+        ext4_fs_put_block_group_ref(&bg_ref);
+        return r;
+    }
+
+    if (!ext4_balloc_verify_bitmap_csum(sb, bg, b.data)) {
+        ext4_dbg(DEBUG_BALLOC,
+            DBG_WARN "Bitmap checksum failed."
+            "Group: %" PRIu32"\n",
+            bg_ref.index);
+    }
+
+    /* First run long enough wins, otherwise the longest one */
+    blk_in_bg = ext4_blocks_in_group_cnt(sb, bgid);
+    while (idx_in_bg < blk_in_bg && *run_len < want) {
+        if (ext4_bmap_bit_find_clr(b.data, idx_in_bg, blk_in_bg,
+                       &idx) != EOK)
+            break;
+
+        len = ext4_bmap_bit_clr_run(b.data, idx, blk_in_bg);
+        if (len > *run_len) {
+            *run_idx = idx;
+            *run_len = len;
+        }
+        idx_in_bg = idx + len;
+    }
+
+    if (*run_len > want)
+        *run_len = want;
+
+    if (!*run_len || *run_len < need) {
+        r = ext4_block_set(fs->bdev, &b);
+        if (r != EOK) {
+            ext4_fs_put_block_group_ref(&bg_ref);
+            return r;
+        }
+        return ext4_fs_put_block_group_ref(&bg_ref);
+    }
+
+    len = *run_len;
+    ext4_bmap_bits_set(b.data, *run_idx, len);
+    ext4_balloc_set_bitmap_csum(sb, bg, b.data);
+    ext4_trans_set_block_dirty(b.buf);
+    r = ext4_block_set(fs->bdev, &b);
+    if (r != EOK) {
+        ext4_fs_put_block_group_ref(&bg_ref);
+        return r;
+    }
+
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+
+    /* Update superblock free blocks count */
+    uint64_t sb_free_blocks = ext4_sb_get_free_blocks_cnt(sb);
+    sb_free_blocks -= len;
+    ext4_sb_set_free_blocks_cnt(sb, sb_free_blocks);
+
+    /* Update inode blocks (different block size!) count */
+    uint64_t ino_blocks = ext4_inode_get_blocks_count(sb, inode_ref->inode);
+    ino_blocks += (uint64_t)len * (block_size / EXT4_INODE_BLOCK_SIZE);
+    ext4_inode_set_blocks_count(sb, inode_ref->inode, ino_blocks);
+    inode_ref->dirty = true;
+
+    /* Update block group free blocks count */
+    ext4_bg_set_free_blocks_count(bg, sb, free_blocks - len);
+    bg_ref.dirty = true;
+
+    return ext4_fs_put_block_group_ref(&bg_ref);
+}
+
+int ext4_balloc_alloc_blocks(struct ext4_inode_ref *inode_ref,
+                 ext4_fsblk_t goal, ext4_fsblk_t *first,
+                 uint32_t *count)
+{
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+    uint32_t bg_count = ext4_block_group_cnt(sb);
+    uint32_t bg_id = ext4_balloc_get_bgid_of_block(sb, goal);
+    uint32_t want = *count;
+    uint32_t best_bg = 0, best_idx = 0, best_len = 0;
+    uint32_t i, idx, len;
+    int r;
+
+    if (want <= 1) {
+        *count = 1;
+        return ext4_balloc_alloc_block(inode_ref, goal, first);
+    }
+
+    /* Walk the groups from the goal on, take the first free run which
+     * satisfies the whole request.*/
+    for (i = 0; i < bg_count; i++) {
+        uint32_t bgid = (bg_id + i) % bg_count;
+        uint32_t start = i ? 0 : ext4_fs_addr_to_idx_bg(sb, goal);
+
+        r = ext4_balloc_alloc_run(inode_ref, bgid, start, want, want,
+                      &idx, &len);
+        if (r != EOK)
+            return r;
+
+        if (len == want) {
+            *first = ext4_fs_bg_idx_to_addr(sb, idx, bgid);
+            return EOK;
+        }
+
+        if (len > best_len) {
+            best_bg = bgid;
+            best_idx = idx;
+            best_len = len;
+        }
+    }
+
+    if (!best_len)
+        return ENOSPC;
+
+    /* No run is long enough, settle for the longest one */
+    r = ext4_balloc_alloc_run(inode_ref, best_bg, best_idx, best_len,
+                  best_len, &idx, &len);
+    if (r != EOK)
+        return r;
+
+    if (len != best_len)
+        return EIO;
+
+    *first = ext4_fs_bg_idx_to_addr(sb, idx, best_bg);
+    *count = len;
+    return EOK;
+}
+
 int ext4_balloc_try_alloc_block(struct ext4_inode_ref *inode_ref,
                 ext4_fsblk_t baddr, bool *free)
 {
@@ -36,6 +36,7 @@
 
 #include <ext4_config.h>
 #include <ext4_types.h>
+#include <ext4_misc.h>
 #include <ext4_bcache.h>
 #include <ext4_blockdev.h>
 #include <ext4_debug.h>
@@ -158,6 +159,21 @@ struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc)
     return RB_MIN(ext4_buf_lru, &bc->lru_root);
 }
 
+struct ext4_buf *ext4_buf_next_lru(struct ext4_bcache *bc __unused,
+                   struct ext4_buf *buf)
+{
+    return RB_NEXT(ext4_buf_lru, &bc->lru_root, buf);
+}
+
+struct ext4_buf *ext4_buf_find_lru(struct ext4_bcache *bc, uint32_t lru_id)
+{
+    struct ext4_buf tmp = {
+        .lru_id = lru_id
+    };
+
+    return RB_NFIND(ext4_buf_lru, &bc->lru_root, &tmp);
+}
+
 void ext4_bcache_drop_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
 {
     /* Warn on dropping any referenced buffers.*/
@@ -196,7 +212,13 @@ void ext4_bcache_invalidate_lba(struct ext4_bcache *bc,
                 uint32_t cnt)
 {
     uint64_t end = from + cnt - 1;
-    struct ext4_buf *tmp = ext4_buf_lookup(bc, from), *buf;
+    struct ext4_buf key = {
+        .lba = from
+    };
+    struct ext4_buf *tmp, *buf;
+
+    /* The first block of the range need not be cached. */
+    tmp = RB_NFIND(ext4_buf_lba, &bc->lba_root, &key);
     RB_FOREACH_FROM(buf, ext4_buf_lba, tmp) {
         if (buf->lba > end)
             break;
@@ -273,9 +295,6 @@ int ext4_bcache_free(struct ext4_bcache *bc, struct ext4_block *b)
 
     ext4_assert(bc && b);
 
-    /*Check if valid.*/
-    ext4_assert(b->lb_id);
-
     /*Block should have a valid pointer to ext4_buf.*/
     ext4_assert(buf);
 
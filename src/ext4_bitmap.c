@@ -87,6 +87,53 @@ void ext4_bmap_bits_free(uint8_t *bmap, uint32_t sbit, uint32_t bcnt)
     }
 }
 
+void ext4_bmap_bits_set(uint8_t *bmap, uint32_t sbit, uint32_t bcnt)
+{
+    uint32_t i = sbit;
+
+    while (i & 7) {
+
+        if (!bcnt)
+            return;
+
+        ext4_bmap_bit_set(bmap, i);
+
+        bcnt--;
+        i++;
+    }
+    bmap += (i >> 3);
+
+    while (bcnt >= 8) {
+        *bmap = 0xFF;
+        bmap += 1;
+        bcnt -= 8;
+    }
+
+    for (i = 0; i < bcnt; ++i) {
+        ext4_bmap_bit_set(bmap, i);
+    }
+}
+
+uint32_t ext4_bmap_bit_clr_run(uint8_t *bmap, uint32_t sbit, uint32_t ebit)
+{
+    uint32_t i = sbit;
+
+    while (i < ebit && (i & 7)) {
+        if (ext4_bmap_is_bit_set(bmap, i))
+            return i - sbit;
+        i++;
+    }
+
+    /* Whole free bytes at once */
+    while (i + 8 <= ebit && !bmap[i >> 3])
+        i += 8;
+
+    while (i < ebit && ext4_bmap_is_bit_clr(bmap, i))
+        i++;
+
+    return i - sbit;
+}
+
 int ext4_bmap_bit_find_clr(uint8_t *bmap, uint32_t sbit, uint32_t ebit,
                uint32_t *bit_id)
 {
@@ -101,7 +148,7 @@ int ext4_bmap_bit_find_clr(uint8_t *bmap, uint32_t sbit, uint32_t ebit,
             return ENOSPC;
 
         if (ext4_bmap_is_bit_clr(bmap, i)) {
-            *bit_id = sbit;
+            *bit_id = i;
             return EOK;
         }
 
@@ -183,10 +183,57 @@ int ext4_block_flush_lba(struct ext4_blockdev *bdev, uint64_t lba)
     return r;
 }
 
+/**@brief   Number of dirty buffers above which a new block request
+ *          writes back the coldest ones first.*/
+#define EXT4_BCACHE_DIRTY_LIMIT(bc)                                     \
+    ((bc)->cnt * CONFIG_BLOCK_DEV_DIRTY_RATIO / 100)
+
+/**@brief   Number of dirty buffers the cold writeback brings the cache
+ *          down to.*/
+#define EXT4_BCACHE_DIRTY_BG_LIMIT(bc)                                  \
+    ((bc)->cnt * CONFIG_BLOCK_DEV_DIRTY_BG_RATIO / 100)
+
+/**@brief   Write back the coldest dirty buffers until at most limit of
+ *          them are left on the dirty list.
+ * @param   bdev block device descriptor
+ * @param   limit number of dirty buffers allowed to stay
+ * @return  standard error code*/
+static int ext4_block_cache_write_cold(struct ext4_blockdev *bdev,
+                       uint32_t limit)
+{
+    struct ext4_bcache *bc = bdev->bc;
+    struct ext4_buf *buf;
+    uint32_t lru_id;
+    bool callback;
+    int r;
+
+    /*Every buffer on the dirty list is unreferenced, so it is on the
+     * LRU tree too and the walk ends once enough of them are written*/
+    buf = ext4_buf_lowest_lru(bc);
+    while (buf && bc->dirty_cnt > limit) {
+        if (buf->on_dirty_list) {
+            callback = buf->end_write != NULL;
+            lru_id = buf->lru_id;
+            r = ext4_block_flush_buf(bdev, buf);
+            if (r != EOK)
+                return r;
+
+            /*A checkpoint callback may flush or drop other buffers
+             * as well, continue from the LRU position of buf*/
+            if (callback) {
+                buf = ext4_buf_find_lru(bc, lru_id + 1);
+                continue;
+            }
+        }
+        buf = ext4_buf_next_lru(bc, buf);
+    }
+    return EOK;
+}
+
 int ext4_block_cache_shake(struct ext4_blockdev *bdev)
 {
     int r = EOK;
-    struct ext4_buf *buf;
+    struct ext4_buf *buf, *clean;
     if (bdev->bc->dont_shake)
         return EOK;
 
@@ -197,6 +244,16 @@ int ext4_block_cache_shake(struct ext4_blockdev *bdev)
 
         buf = ext4_buf_lowest_lru(bdev->bc);
         ext4_assert(buf);
+
+        /*Prefer the coldest clean buffer, so that eviction has to
+         * write only if nothing else is left*/
+        clean = buf;
+        while (clean && ext4_bcache_test_flag(clean, BC_DIRTY))
+            clean = ext4_buf_next_lru(bdev->bc, clean);
+
+        if (clean)
+            buf = clean;
+
         if (ext4_bcache_test_flag(buf, BC_DIRTY)) {
             r = ext4_block_flush_buf(bdev, buf);
             if (r != EOK)
@@ -226,6 +283,19 @@ int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
 
     b->lb_id = lba;
 
+    /*Too many dirty buffers, write back the coldest ones. Going down
+     * to the background limit means the LRU walk runs once per many
+     * dirtied buffers, not on every block get above the limit.*/
+    if (!bdev->bc->dont_shake &&
+        bdev->bc->dirty_cnt > EXT4_BCACHE_DIRTY_LIMIT(bdev->bc)) {
+        bdev->bc->dont_shake = true;
+        r = ext4_block_cache_write_cold(bdev,
+                        EXT4_BCACHE_DIRTY_BG_LIMIT(bdev->bc));
+        bdev->bc->dont_shake = false;
+        if (r != EOK)
+            return r;
+    }
+
     /*If cache is full we have to (flush and) drop it anyway :(*/
     r = ext4_block_cache_shake(bdev);
     if (r != EOK)
@@ -455,6 +525,80 @@ int ext4_block_cache_flush(struct ext4_blockdev *bdev)
     return EOK;
 }
 
+int ext4_block_cache_flush_owner(struct ext4_blockdev *bdev, uint32_t owner,
+                 bool datasync)
+{
+    struct ext4_buf *buf, *tmp;
+    bool callback;
+    int r;
+
+Restart:
+    SLIST_FOREACH_SAFE(buf, &bdev->bc->dirty_list, dirty_node, tmp) {
+        if (buf->owner != owner)
+            continue;
+
+        if (datasync && !ext4_bcache_test_flag(buf, BC_DATASYNC))
+            continue;
+
+        /*A checkpoint callback may flush other buffers as well*/
+        callback = buf->end_write != NULL;
+        r = ext4_block_flush_buf(bdev, buf);
+        if (r != EOK)
+            return r;
+
+        if (callback)
+            goto Restart;
+    }
+    return EOK;
+}
+
+int ext4_block_flush_dev(struct ext4_blockdev *bdev)
+{
+    int r;
+
+    if (!bdev->bdif->flush)
+        return EOK;
+
+    ext4_bdif_lock(bdev);
+    r = bdev->bdif->flush(bdev);
+    ext4_bdif_unlock(bdev);
+    return r;
+}
+
+int ext4_block_cache_writeback(struct ext4_blockdev *bdev, uint32_t now)
+{
+    struct ext4_bcache *bc = bdev->bc;
+    struct ext4_buf *buf, *tmp;
+    bool callback;
+    int r;
+
+    bc->clock = now;
+    if (bc->dont_shake)
+        return EOK;
+
+    bc->dont_shake = true;
+
+Restart:
+    SLIST_FOREACH_SAFE(buf, &bc->dirty_list, dirty_node, tmp) {
+        if ((uint32_t)(now - buf->dirty_time) <
+            CONFIG_BLOCK_DEV_DIRTY_EXPIRE)
+            continue;
+
+        callback = buf->end_write != NULL;
+        r = ext4_block_flush_buf(bdev, buf);
+        if (r != EOK)
+            goto Finish;
+
+        if (callback)
+            goto Restart;
+    }
+
+    r = ext4_block_cache_write_cold(bdev, EXT4_BCACHE_DIRTY_BG_LIMIT(bc));
+Finish:
+    bc->dont_shake = false;
+    return r;
+}
+
 int ext4_block_cache_write_back(struct ext4_blockdev *bdev, uint8_t on_off)
 {
     if (on_off)
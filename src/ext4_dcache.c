@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_dcache.c
+ * @brief Directory entry lookup cache.
+ */
+
+#include <ext4_config.h>
+#include <ext4_types.h>
+#include <ext4_misc.h>
+#include <ext4_errno.h>
+#include <ext4_debug.h>
+
+#include <ext4_dcache.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#if CONFIG_DCACHE_ENABLE
+
+static uint32_t ext4_dcache_hash(uint32_t parent, const char *name,
+                 uint32_t name_len)
+{
+    /* FNV-1a over the parent inode number and the name. */
+    uint32_t h = 2166136261U ^ parent;
+    while (name_len--) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static struct ext4_dcache_entry *
+ext4_dcache_find(struct ext4_dcache *dc, uint32_t parent, const char *name,
+         uint32_t name_len, uint32_t hash)
+{
+    struct ext4_dcache_entry *e;
+    LIST_FOREACH(e, &dc->buckets[hash % EXT4_DCACHE_BUCKETS], hash_node) {
+        if (e->hash == hash && e->parent == parent &&
+            e->name_len == name_len && !memcmp(e->name, name, name_len))
+            return e;
+    }
+    return NULL;
+}
+
+static void ext4_dcache_drop(struct ext4_dcache *dc,
+                 struct ext4_dcache_entry *e)
+{
+    LIST_REMOVE(e, hash_node);
+    e->parent = 0;
+
+    /* Unused entries are recycled first. */
+    TAILQ_REMOVE(&dc->lru, e, lru_node);
+    TAILQ_INSERT_HEAD(&dc->lru, e, lru_node);
+}
+
+void ext4_dcache_init(struct ext4_dcache *dc)
+{
+    uint32_t i;
+
+    memset(dc, 0, sizeof(struct ext4_dcache));
+    TAILQ_INIT(&dc->lru);
+    for (i = 0; i < CONFIG_DCACHE_SIZE; i++)
+        TAILQ_INSERT_TAIL(&dc->lru, &dc->entries[i], lru_node);
+}
+
+void ext4_dcache_purge(struct ext4_dcache *dc)
+{
+    uint32_t i;
+    for (i = 0; i < CONFIG_DCACHE_SIZE; i++) {
+        if (dc->entries[i].parent)
+            ext4_dcache_drop(dc, &dc->entries[i]);
+    }
+
+#if CONFIG_DCACHE_BLOOM_DIRS
+    for (i = 0; i < CONFIG_DCACHE_BLOOM_DIRS; i++)
+        ext4_dcache_bloom_drop(&dc->blooms[i]);
+#endif
+}
+
+bool ext4_dcache_lookup(struct ext4_dcache *dc, uint32_t parent,
+            const char *name, uint32_t name_len,
+            uint32_t *inode, uint32_t *imode)
+{
+    struct ext4_dcache_entry *e;
+    if (name_len > CONFIG_DCACHE_NAME_LEN)
+        return false;
+
+    e = ext4_dcache_find(dc, parent, name, name_len,
+                 ext4_dcache_hash(parent, name, name_len));
+    if (!e)
+        return false;
+
+    TAILQ_REMOVE(&dc->lru, e, lru_node);
+    TAILQ_INSERT_TAIL(&dc->lru, e, lru_node);
+
+    *inode = e->inode;
+    *imode = e->imode;
+    return true;
+}
+
+void ext4_dcache_insert(struct ext4_dcache *dc, uint32_t parent,
+            const char *name, uint32_t name_len,
+            uint32_t inode, uint32_t imode)
+{
+    struct ext4_dcache_entry *e;
+    uint32_t hash;
+
+    /* Long names are not worth the memory. */
+    if (name_len > CONFIG_DCACHE_NAME_LEN)
+        return;
+
+    hash = ext4_dcache_hash(parent, name, name_len);
+    e = ext4_dcache_find(dc, parent, name, name_len, hash);
+    if (!e) {
+        /* Reuse the least recently used entry. */
+        e = TAILQ_FIRST(&dc->lru);
+        if (e->parent)
+            LIST_REMOVE(e, hash_node);
+
+        e->parent = parent;
+        e->hash = hash;
+        e->name_len = name_len;
+        memcpy(e->name, name, name_len);
+        LIST_INSERT_HEAD(&dc->buckets[hash % EXT4_DCACHE_BUCKETS], e,
+                 hash_node);
+    }
+
+    e->inode = inode;
+    e->imode = imode;
+    TAILQ_REMOVE(&dc->lru, e, lru_node);
+    TAILQ_INSERT_TAIL(&dc->lru, e, lru_node);
+}
+
+void ext4_dcache_invalidate(struct ext4_dcache *dc, uint32_t parent,
+                const char *name, uint32_t name_len)
+{
+    struct ext4_dcache_entry *e;
+    if (name_len > CONFIG_DCACHE_NAME_LEN)
+        return;
+
+    e = ext4_dcache_find(dc, parent, name, name_len,
+                 ext4_dcache_hash(parent, name, name_len));
+    if (e)
+        ext4_dcache_drop(dc, e);
+}
+
+void ext4_dcache_invalidate_inode(struct ext4_dcache *dc, uint32_t inode)
+{
+    uint32_t i;
+    for (i = 0; i < CONFIG_DCACHE_SIZE; i++) {
+        struct ext4_dcache_entry *e = &dc->entries[i];
+        if (e->parent && (e->parent == inode || e->inode == inode))
+            ext4_dcache_drop(dc, e);
+    }
+
+#if CONFIG_DCACHE_BLOOM_DIRS
+    struct ext4_dcache_bloom *b = ext4_dcache_bloom_get(dc, inode);
+    if (b)
+        ext4_dcache_bloom_drop(b);
+#endif
+}
+
+#if CONFIG_DCACHE_BLOOM_DIRS
+
+/**@brief   Bloom filter probes per name.*/
+#define EXT4_DCACHE_BLOOM_PROBES 4
+
+/**@brief   Smallest bloom filter (in bytes).*/
+#define EXT4_DCACHE_BLOOM_MIN_SIZE 64
+
+struct ext4_dcache_bloom *ext4_dcache_bloom_get(struct ext4_dcache *dc,
+                        uint32_t dir)
+{
+    uint32_t i;
+    for (i = 0; i < CONFIG_DCACHE_BLOOM_DIRS; i++) {
+        struct ext4_dcache_bloom *b = &dc->blooms[i];
+        if (b->dir == dir) {
+            b->stamp = ++dc->bloom_stamp;
+            return b;
+        }
+    }
+    return NULL;
+}
+
+struct ext4_dcache_bloom *ext4_dcache_bloom_new(struct ext4_dcache *dc,
+                        uint32_t dir,
+                        uint64_t dir_size)
+{
+    struct ext4_dcache_bloom *b = &dc->blooms[0];
+    uint64_t want = dir_size / 16;
+    uint32_t size = EXT4_DCACHE_BLOOM_MIN_SIZE;
+    uint32_t i;
+
+    for (i = 1; i < CONFIG_DCACHE_BLOOM_DIRS; i++) {
+        if (!b->dir)
+            break;
+        if (!dc->blooms[i].dir || dc->blooms[i].stamp < b->stamp)
+            b = &dc->blooms[i];
+    }
+
+    ext4_dcache_bloom_drop(b);
+    b->dir = dir;
+    b->stamp = ++dc->bloom_stamp;
+
+    /* About one byte per 16 bytes of directory, 8+ bits per name */
+    if (want > CONFIG_DCACHE_BLOOM_MAX_SIZE)
+        return b;
+
+    while (size < want)
+        size <<= 1;
+
+    b->bits = ext4_calloc(1, size);
+    if (b->bits)
+        b->nbits = size * 8;
+
+    return b;
+}
+
+void ext4_dcache_bloom_drop(struct ext4_dcache_bloom *b)
+{
+    ext4_free(b->bits);
+    b->bits = NULL;
+    b->dir = 0;
+    b->nbits = 0;
+    b->names = 0;
+    b->removed = 0;
+}
+
+/**@brief   Walk bloom filter bits of a name.
+ * @return  false if some bit is clear (only when @p set is false)*/
+static bool ext4_dcache_bloom_probe(struct ext4_dcache_bloom *b,
+                    const char *name, uint32_t name_len,
+                    bool set)
+{
+    uint32_t h1 = ext4_dcache_hash(0, name, name_len);
+    uint32_t h2 = (((h1 >> 17) | (h1 << 15)) * 0x9E3779B1U) | 1;
+    uint32_t i;
+
+    for (i = 0; i < EXT4_DCACHE_BLOOM_PROBES; i++) {
+        uint32_t bit = (h1 + i * h2) & (b->nbits - 1);
+        uint8_t mask = 1 << (bit & 7);
+
+        if (set)
+            b->bits[bit >> 3] |= mask;
+        else if (!(b->bits[bit >> 3] & mask))
+            return false;
+    }
+
+    return true;
+}
+
+void ext4_dcache_bloom_set(struct ext4_dcache_bloom *b, const char *name,
+               uint32_t name_len)
+{
+    ext4_dcache_bloom_probe(b, name, name_len, true);
+    b->names++;
+}
+
+bool ext4_dcache_bloom_test(struct ext4_dcache_bloom *b, const char *name,
+                uint32_t name_len)
+{
+    if (!b->bits)
+        return true;
+
+    return ext4_dcache_bloom_probe(b, name, name_len, false);
+}
+
+void ext4_dcache_bloom_add(struct ext4_dcache *dc, uint32_t dir,
+               const char *name, uint32_t name_len)
+{
+    struct ext4_dcache_bloom *b = ext4_dcache_bloom_get(dc, dir);
+    if (!b)
+        return;
+
+    if (!b->bits) {
+        /* Directory is growing, maybe too big now */
+        ext4_dcache_bloom_drop(b);
+        return;
+    }
+
+    ext4_dcache_bloom_set(b, name, name_len);
+
+    /* Too full - rebuild it bigger on the next miss */
+    if (b->names > b->nbits / 8)
+        ext4_dcache_bloom_drop(b);
+}
+
+void ext4_dcache_bloom_del(struct ext4_dcache *dc, uint32_t dir)
+{
+    struct ext4_dcache_bloom *b = ext4_dcache_bloom_get(dc, dir);
+    if (!b || !b->bits)
+        return;
+
+    /* Bits of removed names stay set, rebuild once they pile up */
+    if (++b->removed > b->names / 2)
+        ext4_dcache_bloom_drop(b);
+}
+
+#endif
+
+#endif
+
+/**
+ * @}
+ */
@@ -51,6 +51,7 @@
 #include <ext4_crc32.h>
 #include <ext4_inode.h>
 #include <ext4_fs.h>
+#include <ext4_inline.h>
 
 #include <string.h>
 
@@ -206,6 +207,14 @@ static int ext4_dir_iterator_seek(struct ext4_dir_iter *it, uint64_t pos)
     /* The iterator is not valid until we seek to the desired position */
     it->curr = NULL;
 
+#if CONFIG_INLINE_DATA_ENABLE
+    if (ext4_inline_has_data(it->inode_ref)) {
+        it->curr_off = pos;
+        return ext4_inline_dir_seek(it->inode_ref, pos, &it->dot,
+                        &it->curr);
+    }
+#endif
+
     /* Are we at the end? */
     if (pos >= size) {
         if (it->curr_blk.lb_id) {
@@ -340,6 +349,32 @@ void ext4_dir_write_entry(struct ext4_sblock *sb, struct ext4_dir_en *en,
     memcpy(en->name, name, name_len);
 }
 
+#if CONFIG_DIR_INDEX_ENABLE
+/**@brief Convert linear directory to indexed one and add entry to it.
+ * @param parent   Directory i-node
+ * @param child    Child i-node to be referenced by the new entry
+ * @param name     Name of the new entry
+ * @param name_len Length of entry name
+ * @return Error code, ENOTSUP if directory stays linear
+ */
+static int ext4_dir_convert_add(struct ext4_inode_ref *parent,
+                struct ext4_inode_ref *child, const char *name,
+                uint32_t name_len)
+{
+    int r = ext4_dir_dx_convert(parent);
+    if (r != EOK)
+        return r;
+
+    r = ext4_dir_dx_add_entry(parent, child, name, name_len);
+    if (r != EXT4_ERR_BAD_DX_DIR)
+        return r;
+
+    ext4_inode_clear_flag(parent->inode, EXT4_INODE_FLAG_INDEX);
+    parent->dirty = true;
+    return ENOTSUP;
+}
+#endif
+
 int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
                uint32_t name_len, struct ext4_inode_ref *child)
 {
@@ -347,6 +382,13 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
     struct ext4_fs *fs = parent->fs;
     struct ext4_sblock *sb = &parent->fs->sb;
 
+#if CONFIG_DCACHE_ENABLE
+    ext4_dcache_invalidate(&fs->dcache, parent->index, name, name_len);
+#if CONFIG_DCACHE_BLOOM_DIRS
+    ext4_dcache_bloom_add(&fs->dcache, parent->index, name, name_len);
+#endif
+#endif
+
 #if CONFIG_DIR_INDEX_ENABLE
     /* Index adding (if allowed) */
     if ((ext4_sb_feature_com(sb, EXT4_FCOM_DIR_INDEX)) &&
@@ -367,6 +409,19 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
     }
 #endif
 
+#if CONFIG_INLINE_DATA_ENABLE
+    /* Entries stay in the i-node while they fit there */
+    if (ext4_inline_has_data(parent)) {
+        r = ext4_inline_dir_add_entry(parent, name, name_len, child);
+        if (r != ENOSPC)
+            return r;
+
+        r = ext4_inline_dir_convert(parent);
+        if (r != EOK)
+            return r;
+    }
+#endif
+
     /* Linear algorithm */
     uint32_t iblock = 0;
     ext4_fsblk_t fblock = 0;
@@ -374,6 +429,16 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
     uint64_t inode_size = ext4_inode_get_size(sb, parent->inode);
     uint32_t total_blocks = (uint32_t)(inode_size / block_size);
 
+#if CONFIG_DIR_INDEX_ENABLE
+    /* Larger linear directory (e.g. created without index) is indexed
+     * on the first insert */
+    if (ext4_sb_feature_com(sb, EXT4_FCOM_DIR_INDEX) && total_blocks > 1) {
+        r = ext4_dir_convert_add(parent, child, name, name_len);
+        if (r != ENOTSUP)
+            return r;
+    }
+#endif
+
     /* Find block, where is space for new entry and try to add */
     bool success = false;
     for (iblock = 0; iblock < total_blocks; ++iblock) {
@@ -409,6 +474,15 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
             return EOK;
     }
 
+#if CONFIG_DIR_INDEX_ENABLE
+    /* Single block is full - build index instead of growing linearly */
+    if (ext4_sb_feature_com(sb, EXT4_FCOM_DIR_INDEX) && total_blocks == 1) {
+        r = ext4_dir_convert_add(parent, child, name, name_len);
+        if (r != ENOTSUP)
+            return r;
+    }
+#endif
+
     /* No free block found - needed to allocate next data block */
 
     iblock = 0;
@@ -439,15 +513,16 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
     }
 
     ext4_dir_set_csum(parent, (void *)b.data);
-    ext4_trans_set_block_dirty(b.buf);
+    ext4_trans_set_inode_block_dirty(b.buf, parent->index, true);
     r = ext4_block_set(fs->bdev, &b);
 
     return r;
 }
 
-int ext4_dir_find_entry(struct ext4_dir_search_result *result,
-            struct ext4_inode_ref *parent, const char *name,
-            uint32_t name_len)
+/**@brief Lookup entry on disk (index or linear search).*/
+static int ext4_dir_lookup(struct ext4_dir_search_result *result,
+               struct ext4_inode_ref *parent, const char *name,
+               uint32_t name_len)
 {
     int r;
     struct ext4_sblock *sb = &parent->fs->sb;
@@ -456,6 +531,11 @@ int ext4_dir_find_entry(struct ext4_dir_search_result *result,
     result->block.lb_id = 0;
     result->dentry = NULL;
 
+#if CONFIG_INLINE_DATA_ENABLE
+    if (ext4_inline_has_data(parent))
+        return ext4_inline_dir_find_entry(result, parent, name, name_len);
+#endif
+
 #if CONFIG_DIR_INDEX_ENABLE
     /* Index search */
     if ((ext4_sb_feature_com(sb, EXT4_FCOM_DIR_INDEX)) &&
@@ -524,6 +604,64 @@ int ext4_dir_find_entry(struct ext4_dir_search_result *result,
     return ENOENT;
 }
 
+#if CONFIG_DCACHE_ENABLE && CONFIG_DCACHE_BLOOM_DIRS
+/**@brief Build bloom filter of directory names by scanning all entries.*/
+static void ext4_dir_bloom_build(struct ext4_inode_ref *parent)
+{
+    int r;
+    struct ext4_dir_iter it;
+    struct ext4_dcache *dc = &parent->fs->dcache;
+    struct ext4_sblock *sb = &parent->fs->sb;
+    struct ext4_dcache_bloom *b;
+
+    b = ext4_dcache_bloom_new(dc, parent->index,
+                  ext4_inode_get_size(sb, parent->inode));
+    if (!b->bits)
+        return;
+
+    r = ext4_dir_iterator_init(&it, parent, 0);
+    while (r == EOK && it.curr) {
+        if (ext4_dir_en_get_inode(it.curr) != 0)
+            ext4_dcache_bloom_set(b, (char *)it.curr->name,
+                    ext4_dir_en_get_name_len(sb, it.curr));
+
+        r = ext4_dir_iterator_next(&it);
+    }
+
+    ext4_dir_iterator_fini(&it);
+    if (r != EOK || b->names > b->nbits / 8)
+        ext4_dcache_bloom_drop(b);
+}
+#endif
+
+int ext4_dir_find_entry(struct ext4_dir_search_result *result,
+            struct ext4_inode_ref *parent, const char *name,
+            uint32_t name_len)
+{
+    int r;
+
+#if CONFIG_DCACHE_ENABLE && CONFIG_DCACHE_BLOOM_DIRS
+    struct ext4_dcache_bloom *b;
+
+    b = ext4_dcache_bloom_get(&parent->fs->dcache, parent->index);
+    if (b && !ext4_dcache_bloom_test(b, name, name_len)) {
+        result->block.lb_id = 0;
+        result->dentry = NULL;
+        return ENOENT;
+    }
+#endif
+
+    r = ext4_dir_lookup(result, parent, name, name_len);
+
+#if CONFIG_DCACHE_ENABLE && CONFIG_DCACHE_BLOOM_DIRS
+    /* Filter is built on the first miss, further misses use it */
+    if (r == ENOENT && !b)
+        ext4_dir_bloom_build(parent);
+#endif
+
+    return r;
+}
+
 int ext4_dir_remove_entry(struct ext4_inode_ref *parent, const char *name,
               uint32_t name_len)
 {
@@ -532,6 +670,19 @@ int ext4_dir_remove_entry(struct ext4_inode_ref *parent, const char *name,
     if (!ext4_inode_is_type(sb, parent->inode, EXT4_INODE_MODE_DIRECTORY))
         return ENOTDIR;
 
+#if CONFIG_DCACHE_ENABLE
+    ext4_dcache_invalidate(&parent->fs->dcache, parent->index, name,
+                   name_len);
+#if CONFIG_DCACHE_BLOOM_DIRS
+    ext4_dcache_bloom_del(&parent->fs->dcache, parent->index);
+#endif
+#endif
+
+#if CONFIG_INLINE_DATA_ENABLE
+    if (ext4_inline_has_data(parent))
+        return ext4_inline_dir_remove_entry(parent, name, name_len);
+#endif
+
     /* Try to find entry */
     struct ext4_dir_search_result result;
     int rc = ext4_dir_find_entry(&result, parent, name, name_len);
@@ -572,27 +723,24 @@ int ext4_dir_remove_entry(struct ext4_inode_ref *parent, const char *name,
 
     ext4_dir_set_csum(parent,
             (struct ext4_dir_en *)result.block.data);
-    ext4_trans_set_block_dirty(result.block.buf);
+    ext4_trans_set_inode_block_dirty(result.block.buf, parent->index, true);
 
     return ext4_dir_destroy_result(parent, &result);
 }
 
-int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
-                  struct ext4_inode_ref *inode_ref,
-                  struct ext4_block *dst_blk,
-                  struct ext4_inode_ref *child, const char *name,
-                  uint32_t name_len)
+int ext4_dir_insert_in_buf(struct ext4_sblock *sb, uint8_t *data,
+               uint32_t size, struct ext4_inode_ref *child,
+               const char *name, uint32_t name_len)
 {
     /* Compute required length entry and align it to 4 bytes */
-    uint32_t block_size = ext4_sb_get_block_size(sb);
     uint16_t required_len = sizeof(struct ext4_fake_dir_entry) + name_len;
 
     if ((required_len % 4) != 0)
         required_len += 4 - (required_len % 4);
 
     /* Initialize pointers, stop means to upper bound */
-    struct ext4_dir_en *start = (void *)dst_blk->data;
-    struct ext4_dir_en *stop = (void *)(dst_blk->data + block_size);
+    struct ext4_dir_en *start = (void *)data;
+    struct ext4_dir_en *stop = (void *)(data + size);
 
     /*
      * Walk through the block and check for invalid entries
@@ -608,9 +756,6 @@ int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
             (rec_len >= required_len)) {
             ext4_dir_write_entry(sb, start, rec_len, child, name,
                          name_len);
-            ext4_dir_set_csum(inode_ref, (void *)dst_blk->data);
-            ext4_trans_set_block_dirty(dst_blk->buf);
-
             return EOK;
         }
 
@@ -635,10 +780,6 @@ int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
                 ext4_dir_en_set_entry_len(start, sz);
                 ext4_dir_write_entry(sb, new_entry, free_space,
                              child, name, name_len);
-
-                ext4_dir_set_csum(inode_ref,
-                          (void *)dst_blk->data);
-                ext4_trans_set_block_dirty(dst_blk->buf);
                 return EOK;
             }
         }
@@ -651,32 +792,64 @@ int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
     return ENOSPC;
 }
 
-int ext4_dir_find_in_block(struct ext4_block *block, struct ext4_sblock *sb,
-               size_t name_len, const char *name,
-               struct ext4_dir_en **res_entry)
+int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
+                  struct ext4_inode_ref *inode_ref,
+                  struct ext4_block *dst_blk,
+                  struct ext4_inode_ref *child, const char *name,
+                  uint32_t name_len)
+{
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    int r;
+
+    r = ext4_dir_insert_in_buf(sb, dst_blk->data, block_size, child,
+                   name, name_len);
+    if (r != EOK)
+        return r;
+
+    ext4_dir_set_csum(inode_ref, (void *)dst_blk->data);
+    ext4_trans_set_inode_block_dirty(dst_blk->buf, inode_ref->index, true);
+    return EOK;
+}
+
+int ext4_dir_find_in_buf(uint8_t *data, uint32_t size, struct ext4_sblock *sb,
+             size_t name_len, const char *name,
+             struct ext4_dir_en **res_entry)
 {
-    /* Start from the first entry in block */
-    struct ext4_dir_en *de = (struct ext4_dir_en *)block->data;
+    /* Start from the first entry in buffer */
+    struct ext4_dir_en *de = (struct ext4_dir_en *)data;
 
     /* Set upper bound for cycling */
-    uint8_t *addr_limit = block->data + ext4_sb_get_block_size(sb);
+    uint8_t *addr_limit = data + size;
+
+    /* Old revisions keep higher 8 bits of name length in type field */
+    bool len_high = (ext4_get32(sb, rev_level) == 0) &&
+            (ext4_get32(sb, minor_rev_level) < 5);
+    uint8_t len_lo = (uint8_t)name_len;
+    uint8_t len_hi = (uint8_t)(name_len >> 8);
+
+    /* First 4 bytes of name, compared as one word before memcmp */
+    uint32_t head = 0;
+    size_t head_len = name_len < sizeof(head) ? name_len : sizeof(head);
+    memcpy(&head, name, head_len);
 
     /* Walk through the block and check entries */
     while ((uint8_t *)de < addr_limit) {
         /* Termination condition */
-        if ((uint8_t *)de + name_len > addr_limit)
+        if (de->name + name_len > addr_limit)
             break;
 
-        /* Valid entry - check it */
-        if (ext4_dir_en_get_inode(de) != 0) {
-            /* For more efficient compare only lengths firstly*/
-            uint16_t el = ext4_dir_en_get_name_len(sb, de);
-            if (el == name_len) {
-                /* Compare names */
-                if (memcmp(name, de->name, name_len) == 0) {
-                    *res_entry = de;
-                    return EOK;
-                }
+        /* Filter by raw name length first, it is in entry header */
+        if (de->name_len == len_lo &&
+            (!len_high || de->in.name_length_high == len_hi) &&
+            de->inode != 0) {
+            uint32_t w = 0;
+
+            memcpy(&w, de->name, head_len);
+            if (w == head && memcmp(name + head_len,
+                        de->name + head_len,
+                        name_len - head_len) == 0) {
+                *res_entry = de;
+                return EOK;
             }
         }
 
@@ -694,6 +867,14 @@ int ext4_dir_find_in_block(struct ext4_block *block, struct ext4_sblock *sb,
     return ENOENT;
 }
 
+int ext4_dir_find_in_block(struct ext4_block *block, struct ext4_sblock *sb,
+               size_t name_len, const char *name,
+               struct ext4_dir_en **res_entry)
+{
+    return ext4_dir_find_in_buf(block->data, ext4_sb_get_block_size(sb),
+                    sb, name_len, name, res_entry);
+}
+
 int ext4_dir_destroy_result(struct ext4_inode_ref *parent,
                 struct ext4_dir_search_result *result)
 {
@@ -96,7 +96,7 @@ ext4_dir_dx_root_info_set_info_length(struct ext4_dir_idx_rinfo *ri,
 
 /**@brief Get number of indirect levels of HTree.
  * @param root_info Pointer to root info structure of index
- * @return Height of HTree (actually only 0 or 1)
+ * @return Height of HTree (0 or 1, up to 2 with largedir)
  */
 static inline uint8_t
 ext4_dir_dx_rinfo_get_indirect_levels(struct ext4_dir_idx_rinfo *ri)
@@ -106,7 +106,7 @@ ext4_dir_dx_rinfo_get_indirect_levels(struct ext4_dir_idx_rinfo *ri)
 
 /**@brief Set number of indirect levels of HTree.
  * @param root_info Pointer to root info structure of index
- * @param lvl Height of HTree (actually only 0 or 1)
+ * @param lvl Height of HTree (0 or 1, up to 2 with largedir)
  */
 static inline void
 ext4_dir_dx_rinfo_set_indirect_levels(struct ext4_dir_idx_rinfo *ri, uint8_t l)
@@ -114,6 +114,18 @@ ext4_dir_dx_rinfo_set_indirect_levels(struct ext4_dir_idx_rinfo *ri, uint8_t l)
     ri->indirect_levels = l;
 }
 
+/**@brief Get maximum depth of HTree (root included).
+ * @param sb Superblock
+ * @return Three levels with largedir feature, two otherwise
+ */
+static inline uint8_t ext4_dir_dx_max_levels(struct ext4_sblock *sb)
+{
+    if (ext4_sb_feature_incom(sb, EXT4_FINCOM_LARGEDIR))
+        return EXT4_DIR_DX_LEVELS;
+
+    return EXT4_DIR_DX_LEVELS_COMPAT;
+}
+
 /**@brief Get maximum number of index node entries.
  * @param climit Pointer to counlimit structure
  * @return Maximum of entries in node
@@ -197,7 +209,9 @@ ext4_dir_dx_entry_set_block(struct ext4_dir_idx_entry *entry, uint32_t block)
 /**@brief Sort entry item.*/
 struct ext4_dx_sort_entry {
     uint32_t hash;
-    uint32_t rec_len;
+    uint16_t rec_len;
+    uint8_t src;
+    uint8_t part;
     void *dentry;
 };
 
@@ -346,6 +360,42 @@ static void ext4_dir_set_dx_csum(struct ext4_inode_ref *inode_ref,
 
 /****************************************************************************/
 
+/**@brief Initialize root info and limits of index root block.
+ * @param dir  Directory i-node
+ * @param root Index root (dot entries are filled by caller)
+ */
+static void ext4_dir_dx_rinfo_init(struct ext4_inode_ref *dir,
+                   struct ext4_dir_idx_root *root)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    struct ext4_dir_idx_rinfo *info = &(root->info);
+
+    /* Initialize root info structure */
+    uint8_t hash_version = ext4_get8(sb, default_hash_version);
+
+    memset(info, 0, sizeof(struct ext4_dir_idx_rinfo));
+    ext4_dir_dx_rinfo_set_hash_version(info, hash_version);
+    ext4_dir_dx_rinfo_set_indirect_levels(info, 0);
+    ext4_dir_dx_root_info_set_info_length(info, 8);
+
+    /* Set limit and current number of entries */
+    struct ext4_dir_idx_climit *climit;
+    climit = (struct ext4_dir_idx_climit *)&root->en;
+
+    ext4_dir_dx_climit_set_count(climit, 1);
+
+    uint32_t entry_space;
+    entry_space = block_size - 2 * sizeof(struct ext4_dir_idx_dot_en) -
+            sizeof(struct ext4_dir_idx_rinfo);
+
+    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
+        entry_space -= sizeof(struct ext4_dir_idx_tail);
+
+    uint16_t root_limit = entry_space / sizeof(struct ext4_dir_idx_entry);
+    ext4_dir_dx_climit_set_limit(climit, root_limit);
+}
+
 int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
 {
     /* Load block 0, where will be index root located */
@@ -375,7 +425,6 @@ int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
 
     /* Initialize pointers to data structures */
     struct ext4_dir_idx_root *root = (void *)block.data;
-    struct ext4_dir_idx_rinfo *info = &(root->info);
 
     memset(root, 0, sizeof(struct ext4_dir_idx_root));
     struct ext4_dir_en *de;
@@ -388,28 +437,7 @@ int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
     uint16_t elen = block_size - 12;
     ext4_dir_write_entry(sb, de, elen, parent, "..", strlen(".."));
 
-    /* Initialize root info structure */
-    uint8_t hash_version = ext4_get8(&dir->fs->sb, default_hash_version);
-
-    ext4_dir_dx_rinfo_set_hash_version(info, hash_version);
-    ext4_dir_dx_rinfo_set_indirect_levels(info, 0);
-    ext4_dir_dx_root_info_set_info_length(info, 8);
-
-    /* Set limit and current number of entries */
-    struct ext4_dir_idx_climit *climit;
-    climit = (struct ext4_dir_idx_climit *)&root->en;
-
-    ext4_dir_dx_climit_set_count(climit, 1);
-
-    uint32_t entry_space;
-    entry_space = block_size - 2 * sizeof(struct ext4_dir_idx_dot_en) -
-            sizeof(struct ext4_dir_idx_rinfo);
-
-    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
-        entry_space -= sizeof(struct ext4_dir_idx_tail);
-
-    uint16_t root_limit = entry_space / sizeof(struct ext4_dir_idx_entry);
-    ext4_dir_dx_climit_set_limit(climit, root_limit);
+    ext4_dir_dx_rinfo_init(dir, root);
 
     /* Append new block, where will be new entries inserted in the future */
     iblock++;
@@ -446,7 +474,7 @@ int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
 
     ext4_dir_en_set_inode(be, 0);
 
-    ext4_trans_set_block_dirty(new_block.buf);
+    ext4_trans_set_inode_block_dirty(new_block.buf, dir->index, true);
     rc = ext4_block_set(dir->fs->bdev, &new_block);
     if (rc != EOK) {
         ext4_block_set(dir->fs->bdev, &block);
@@ -458,7 +486,7 @@ int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
     ext4_dir_dx_entry_set_block(entry, iblock);
 
     ext4_dir_set_dx_csum(dir, (struct ext4_dir_en *)block.data);
-    ext4_trans_set_block_dirty(block.buf);
+    ext4_trans_set_inode_block_dirty(block.buf, dir->index, true);
 
     return ext4_block_set(dir->fs->bdev, &block);
 }
@@ -489,7 +517,7 @@ static int ext4_dir_hinfo_init(struct ext4_hash_info *hinfo,
         return EXT4_ERR_BAD_DX_DIR;
 
     /* Check indirect levels */
-    if (root->info.indirect_levels > 1)
+    if (root->info.indirect_levels >= ext4_dir_dx_max_levels(sb))
         return EXT4_ERR_BAD_DX_DIR;
 
     /* Check if node limit is correct */
@@ -524,6 +552,36 @@ static int ext4_dir_hinfo_init(struct ext4_hash_info *hinfo,
     return EOK;
 }
 
+int ext4_dir_dx_hash_names(struct ext4_inode_ref *dir,
+               const char *const *names, size_t count,
+               uint32_t *hashes)
+{
+    ext4_fsblk_t fblock;
+    struct ext4_block root_block;
+    struct ext4_hash_info hinfo;
+    int rc;
+
+    rc = ext4_fs_get_inode_dblk_idx(dir, 0, &fblock, false);
+    if (rc != EOK)
+        return rc;
+
+    rc = ext4_trans_block_get(dir->fs->bdev, &root_block, fblock);
+    if (rc != EOK)
+        return rc;
+
+    rc = ext4_dir_hinfo_init(&hinfo, &root_block, &dir->fs->sb, 0, NULL);
+    if (rc != EOK) {
+        ext4_block_set(dir->fs->bdev, &root_block);
+        return EXT4_ERR_BAD_DX_DIR;
+    }
+
+    rc = ext2_htree_hash_batch(names, count, hinfo.seed, hinfo.hash_version,
+                   hashes);
+
+    ext4_block_set(dir->fs->bdev, &root_block);
+    return rc;
+}
+
 /**@brief Walk through index tree and load leaf with corresponding hash value.
  * @param hinfo      Initialized hash info structure
  * @param inode_ref  Current i-node
@@ -747,11 +805,8 @@ int ext4_dir_dx_find_entry(struct ext4_dir_search_result *result,
         return EXT4_ERR_BAD_DX_DIR;
     }
 
-    /*
-     * Hardcoded number 2 means maximum height of index tree,
-     * specified in the Linux driver.
-     */
-    struct ext4_dir_idx_block dx_blocks[2];
+    /* Path from root to leaf, as deep as the tree may be */
+    struct ext4_dir_idx_block dx_blocks[EXT4_DIR_DX_LEVELS];
     struct ext4_dir_idx_block *dx_block;
     struct ext4_dir_idx_block *tmp;
 
@@ -830,29 +885,6 @@ cleanup:
     return rc;
 }
 
-/**@brief  Compare function used to pass in quicksort implementation.
- *         It can compare two entries by hash value.
- * @param arg1  First entry
- * @param arg2  Second entry
- * @param dummy Unused parameter, can be NULL
- *
- * @return Classic compare result
- *         (0: equal, -1: arg1 < arg2, 1: arg1 > arg2)
- */
-static int ext4_dir_dx_entry_comparator(const void *arg1, const void *arg2)
-{
-    struct ext4_dx_sort_entry *entry1 = (void *)arg1;
-    struct ext4_dx_sort_entry *entry2 = (void *)arg2;
-
-    if (entry1->hash == entry2->hash)
-        return 0;
-
-    if (entry1->hash < entry2->hash)
-        return -1;
-    else
-        return 1;
-}
-
 /**@brief  Insert new index entry to block.
  *         Note that space for new entry must be checked by caller.
  * @param inode_ref   Directory i-node
@@ -881,367 +913,984 @@ ext4_dir_dx_insert_entry(struct ext4_inode_ref *inode_ref __unused,
     ext4_dir_dx_entry_set_hash(new_index_entry, hash);
     ext4_dir_dx_climit_set_count(climit, count + 1);
     ext4_dir_set_dx_csum(inode_ref, (void *)index_block->b.data);
-    ext4_trans_set_block_dirty(index_block->b.buf);
+    ext4_trans_set_inode_block_dirty(index_block->b.buf, inode_ref->index,
+                         true);
 }
 
-/**@brief Split directory entries to two parts preventing node overflow.
- * @param inode_ref      Directory i-node
- * @param hinfo          Hash info
- * @param old_data_block Block with data to be split
- * @param index_block    Block where index entries are located
- * @param new_data_block Output value for newly allocated data block
+/**@brief Load directory block by its logical number.
+ * @param dir    Directory i-node
+ * @param iblk   Logical block number
+ * @param b      Output block
+ * @param noread Don't read block content (block will be overwritten)
+ * @return Error code
  */
-static int ext4_dir_dx_split_data(struct ext4_inode_ref *inode_ref,
-                  struct ext4_hash_info *hinfo,
-                  struct ext4_block *old_data_block,
-                  struct ext4_dir_idx_block *index_block,
-                  struct ext4_block *new_data_block)
+static int ext4_dir_dx_block_get(struct ext4_inode_ref *dir, uint32_t iblk,
+                 struct ext4_block *b, bool noread)
 {
-    int rc = EOK;
-    struct ext4_sblock *sb = &inode_ref->fs->sb;
-    uint32_t block_size = ext4_sb_get_block_size(&inode_ref->fs->sb);
-
-    /* Allocate buffer for directory entries */
-    uint8_t *entry_buffer = ext4_malloc(block_size);
-    if (entry_buffer == NULL)
-        return ENOMEM;
+    ext4_fsblk_t fblk;
+    int rc = ext4_fs_get_inode_dblk_idx(dir, iblk, &fblk, false);
+    if (rc != EOK)
+        return rc;
 
-    /* dot entry has the smallest size available */
-    uint32_t max_ecnt = block_size / sizeof(struct ext4_dir_idx_dot_en);
+    if (noread)
+        return ext4_trans_block_get_noread(dir->fs->bdev, b, fblk);
 
-    /* Allocate sort entry */
-    struct ext4_dx_sort_entry *sort;
+    return ext4_trans_block_get(dir->fs->bdev, b, fblk);
+}
 
-    sort = ext4_malloc(max_ecnt * sizeof(struct ext4_dx_sort_entry));
-    if (sort == NULL) {
-        ext4_free(entry_buffer);
-        return ENOMEM;
-    }
+/**@brief Append live entries of leaf block to packed buffer.
+ * @param sb        Superblock
+ * @param src       Leaf block data
+ * @param leaf_size Space for entries in leaf block
+ * @param dst       Packed buffer
+ * @param pos       Used bytes in packed buffer
+ * @param last      Offset of the last entry in packed buffer
+ *                  (may be @p src itself to pack leaf in place)
+ * @return EOK, ENOSPC if entries don't fit or EXT4_ERR_BAD_DX_DIR
+ */
+static int ext4_dir_dx_leaf_pack(struct ext4_sblock *sb, uint8_t *src,
+                 uint32_t leaf_size, uint8_t *dst,
+                 uint32_t *pos, uint32_t *last)
+{
+    uint32_t off = 0;
 
-    uint32_t idx = 0;
-    uint32_t real_size = 0;
+    while (off < leaf_size) {
+        struct ext4_dir_en *de = (void *)(src + off);
+        uint16_t len, rlen;
 
-    /* Initialize hinfo */
-    struct ext4_hash_info hinfo_tmp;
-    memcpy(&hinfo_tmp, hinfo, sizeof(struct ext4_hash_info));
+        if (off + sizeof(struct ext4_fake_dir_entry) > leaf_size)
+            return EXT4_ERR_BAD_DX_DIR;
 
-    /* Load all valid entries to the buffer */
-    struct ext4_dir_en *de = (void *)old_data_block->data;
-    uint8_t *entry_buffer_ptr = entry_buffer;
-    while ((void *)de < (void *)(old_data_block->data + block_size)) {
-        /* Read only valid entries */
-        if (ext4_dir_en_get_inode(de) && de->name_len) {
-            uint16_t len = ext4_dir_en_get_name_len(sb, de);
-            rc = ext4_dir_dx_hash_string(&hinfo_tmp, len,
-                             (char *)de->name);
-            if (rc != EOK) {
-                ext4_free(sort);
-                ext4_free(entry_buffer);
-                return rc;
-            }
+        len = ext4_dir_en_get_entry_len(de);
+        rlen = sizeof(struct ext4_fake_dir_entry);
+        rlen += ext4_dir_en_get_name_len(sb, de);
+        if ((rlen % 4) != 0)
+            rlen += 4 - (rlen % 4);
 
-            uint32_t rec_len = 8 + len;
-            if ((rec_len % 4) != 0)
-                rec_len += 4 - (rec_len % 4);
+        if (len < sizeof(struct ext4_fake_dir_entry) ||
+            off + len > leaf_size)
+            return EXT4_ERR_BAD_DX_DIR;
 
-            memcpy(entry_buffer_ptr, de, rec_len);
+        if (ext4_dir_en_get_inode(de) != 0) {
+            if (len < rlen)
+                return EXT4_ERR_BAD_DX_DIR;
 
-            sort[idx].dentry = entry_buffer_ptr;
-            sort[idx].rec_len = rec_len;
-            sort[idx].hash = hinfo_tmp.hash;
+            if (*pos + rlen > leaf_size)
+                return ENOSPC;
 
-            entry_buffer_ptr += rec_len;
-            real_size += rec_len;
-            idx++;
+            memmove(dst + *pos, de, rlen);
+            ext4_dir_en_set_entry_len((void *)(dst + *pos), rlen);
+            *last = *pos;
+            *pos += rlen;
         }
 
-        size_t elen = ext4_dir_en_get_entry_len(de);
-        de = (void *)((uint8_t *)de + elen);
+        off += len;
     }
 
-    qsort(sort, idx, sizeof(struct ext4_dx_sort_entry),
-          ext4_dir_dx_entry_comparator);
+    return EOK;
+}
 
-    /* Allocate new block for store the second part of entries */
-    ext4_fsblk_t new_fblock;
-    uint32_t new_iblock;
-    rc = ext4_fs_append_inode_dblk(inode_ref, &new_fblock, &new_iblock);
-    if (rc != EOK) {
-        ext4_free(sort);
-        ext4_free(entry_buffer);
-        return rc;
-    }
+/**@brief Rewrite leaf block with packed entries.
+ * @param dir       Directory i-node
+ * @param b         Leaf block
+ * @param src       Packed entries (may be NULL if @p pos is 0 or
+ *                  @p b data when packed in place)
+ * @param pos       Length of packed entries
+ * @param last      Offset of the last packed entry
+ * @param leaf_size Space for entries in leaf block
+ */
+static void ext4_dir_dx_leaf_fill(struct ext4_inode_ref *dir,
+                  struct ext4_block *b, uint8_t *src,
+                  uint32_t pos, uint32_t last, uint32_t leaf_size)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    struct ext4_dir_en *de;
 
-    /* Load new block */
-    struct ext4_block new_data_block_tmp;
-    rc = ext4_trans_block_get_noread(inode_ref->fs->bdev, &new_data_block_tmp,
-                   new_fblock);
-    if (rc != EOK) {
-        ext4_free(sort);
-        ext4_free(entry_buffer);
-        return rc;
+    if (pos) {
+        if (src != b->data)
+            memcpy(b->data, src, pos);
+        memset(b->data + pos, 0, block_size - pos);
+        de = (void *)(b->data + last);
+        ext4_dir_en_set_entry_len(de, leaf_size - last);
+    } else {
+        memset(b->data, 0, block_size);
+        de = (void *)b->data;
+        ext4_dir_en_set_entry_len(de, leaf_size);
     }
 
-    /*
-     * Distribute entries to two blocks (by size)
-     * - compute the half
-     */
-    uint32_t new_hash = 0;
-    uint32_t current_size = 0;
-    uint32_t mid = 0;
-    uint32_t i;
-    for (i = 0; i < idx; ++i) {
-        if ((current_size + sort[i].rec_len) > (block_size / 2)) {
-            new_hash = sort[i].hash;
-            mid = i;
-            break;
-        }
-
-        current_size += sort[i].rec_len;
+    if (leaf_size != block_size) {
+        ext4_dir_init_entry_tail(EXT4_DIRENT_TAIL(b->data, block_size));
+        ext4_dir_set_csum(dir, (void *)b->data);
     }
 
-    /* Check hash collision */
-    uint32_t continued = 0;
-    if (new_hash == sort[mid - 1].hash)
-        continued = 1;
+    ext4_trans_set_inode_block_dirty(b->buf, dir->index, true);
+}
 
+/**@brief Hash live entries of leaf block into sort array.
+ * @param hinfo     Hash info (used as scratch)
+ * @param sb        Superblock
+ * @param data      Leaf block data
+ * @param leaf_size Space for entries in leaf block
+ * @param src       Source tag stored in collected items
+ * @param sort      Sort array
+ * @param cnt       Number of items in sort array
+ * @param size      Summary length of collected entries
+ * @return Error code
+ */
+static int ext4_dir_dx_leaf_collect(struct ext4_hash_info *hinfo,
+                    struct ext4_sblock *sb, uint8_t *data,
+                    uint32_t leaf_size, uint8_t src,
+                    struct ext4_dx_sort_entry *sort,
+                    uint32_t *cnt, uint32_t *size)
+{
     uint32_t off = 0;
-    void *ptr;
-    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
-        block_size -= sizeof(struct ext4_dir_entry_tail);
-
-    /* First part - to the old block */
-    for (i = 0; i < mid; ++i) {
-        ptr = old_data_block->data + off;
-        memcpy(ptr, sort[i].dentry, sort[i].rec_len);
+    int rc;
 
-        struct ext4_dir_en *t = ptr;
-        if (i < (mid - 1))
-            ext4_dir_en_set_entry_len(t, sort[i].rec_len);
-        else
-            ext4_dir_en_set_entry_len(t, block_size - off);
+    while (off < leaf_size) {
+        struct ext4_dir_en *de = (void *)(data + off);
+        uint16_t elen = ext4_dir_en_get_entry_len(de);
 
-        off += sort[i].rec_len;
-    }
+        if (elen < sizeof(struct ext4_fake_dir_entry))
+            return EXT4_ERR_BAD_DX_DIR;
 
-    /* Second part - to the new block */
-    off = 0;
-    for (i = mid; i < idx; ++i) {
-        ptr = new_data_block_tmp.data + off;
-        memcpy(ptr, sort[i].dentry, sort[i].rec_len);
+        /* Read only valid entries */
+        if (ext4_dir_en_get_inode(de) && de->name_len) {
+            struct ext4_dx_sort_entry *s = sort + *cnt;
+            uint16_t len = ext4_dir_en_get_name_len(sb, de);
+            uint16_t rec_len = sizeof(struct ext4_fake_dir_entry) + len;
 
-        struct ext4_dir_en *t = ptr;
-        if (i < (idx - 1))
-            ext4_dir_en_set_entry_len(t, sort[i].rec_len);
-        else
-            ext4_dir_en_set_entry_len(t, block_size - off);
+            if ((rec_len % 4) != 0)
+                rec_len += 4 - (rec_len % 4);
 
-        off += sort[i].rec_len;
-    }
+            if (rec_len > elen)
+                return EXT4_ERR_BAD_DX_DIR;
 
-    block_size = ext4_sb_get_block_size(&inode_ref->fs->sb);
+            rc = ext4_dir_dx_hash_string(hinfo, len, (char *)de->name);
+            if (rc != EOK)
+                return rc;
 
-    /* Do some steps to finish operation */
-    sb = &inode_ref->fs->sb;
-    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM)) {
-        struct ext4_dir_entry_tail *t;
+            s->hash = hinfo->hash;
+            s->rec_len = rec_len;
+            s->src = src;
+            s->dentry = de;
+            *size += rec_len;
+            (*cnt)++;
+        }
 
-        t = EXT4_DIRENT_TAIL(old_data_block->data, block_size);
-        ext4_dir_init_entry_tail(t);
-        t = EXT4_DIRENT_TAIL(new_data_block_tmp.data, block_size);
-        ext4_dir_init_entry_tail(t);
+        off += elen;
     }
-    ext4_dir_set_csum(inode_ref, (void *)old_data_block->data);
-    ext4_dir_set_csum(inode_ref, (void *)new_data_block_tmp.data);
-    ext4_trans_set_block_dirty(old_data_block->buf);
-    ext4_trans_set_block_dirty(new_data_block_tmp.buf);
 
-    ext4_free(sort);
-    ext4_free(entry_buffer);
+    return EOK;
+}
+
+/**@brief Partition sort items [lo, hi) around the entry where running
+ *        length of entries ordered by hash exceeds @p target. Items
+ *        before returned position have hashes lower or equal to items
+ *        at and after it. Ordering inside the parts is not defined.
+ * @param sort   Sort array
+ * @param lo     First item
+ * @param hi     Item after the last one
+ * @param target Length of entries to keep before the cut
+ * @return Position of the cut
+ */
+static uint32_t ext4_dir_dx_select(struct ext4_dx_sort_entry *sort,
+                   uint32_t lo, uint32_t hi, uint32_t target)
+{
+    struct ext4_dx_sort_entry tmp;
+
+    while (lo < hi) {
+        uint32_t pivot = sort[lo + (hi - lo) / 2].hash;
+        uint32_t lt = lo, i = lo, gt = hi;
+        uint32_t lsize = 0, esize = 0;
+
+        /* Three way partition: < pivot, == pivot, > pivot */
+        while (i < gt) {
+            if (sort[i].hash < pivot) {
+                lsize += sort[i].rec_len;
+                tmp = sort[lt];
+                sort[lt++] = sort[i];
+                sort[i++] = tmp;
+            } else if (sort[i].hash > pivot) {
+                tmp = sort[--gt];
+                sort[gt] = sort[i];
+                sort[i] = tmp;
+            } else {
+                esize += sort[i].rec_len;
+                i++;
+            }
+        }
 
-    ext4_dir_dx_insert_entry(inode_ref, index_block, new_hash + continued,
-                new_iblock);
+        if (target < lsize) {
+            hi = lt;
+        } else if (target < lsize + esize) {
+            target -= lsize;
+            for (i = lt; target >= sort[i].rec_len; i++)
+                target -= sort[i].rec_len;
+            return i;
+        } else {
+            target -= lsize + esize;
+            lo = gt;
+        }
+    }
 
-    *new_data_block = new_data_block_tmp;
-    return EOK;
+    return lo;
 }
 
-/**@brief  Split index node and maybe some parent nodes in the tree hierarchy.
- * @param inode_ref Directory i-node
- * @param dx_blocks Array with path from root to leaf node
- * @param dx_block  Leaf block to be split if needed
- * @return Error code
+/**@brief Index hash of the part starting at @p cut. Collision bit is set
+ *        when the previous part holds entries with the same hash.
+ * @param sort  Sort array
+ * @param first First item of the previous part
+ * @param cut   First item of the part
+ * @return Hash value for index entry
  */
-static int
-ext4_dir_dx_split_index(struct ext4_inode_ref *ino_ref,
-            struct ext4_dir_idx_block *dx_blks,
-            struct ext4_dir_idx_block *dxb,
-            struct ext4_dir_idx_block **new_dx_block)
+static uint32_t ext4_dir_dx_part_hash(struct ext4_dx_sort_entry *sort,
+                      uint32_t first, uint32_t cut)
 {
-    struct ext4_sblock *sb = &ino_ref->fs->sb;
-    struct ext4_dir_idx_entry *e;
-    int r;
+    uint32_t i;
 
-    uint32_t block_size = ext4_sb_get_block_size(&ino_ref->fs->sb);
-    uint32_t entry_space = block_size - sizeof(struct ext4_fake_dir_entry);
-    uint32_t node_limit =  entry_space / sizeof(struct ext4_dir_idx_entry);
+    for (i = first; i < cut; i++)
+        if (sort[i].hash == sort[cut].hash)
+            return sort[cut].hash + 1;
 
-    bool meta_csum = ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM);
+    return sort[cut].hash;
+}
 
-    if (dxb == dx_blks)
-        e = ((struct ext4_dir_idx_root *)dxb->b.data)->en;
-    else
-        e = ((struct ext4_dir_idx_node *)dxb->b.data)->entries;
+/**@brief Append sort item entry to packed leaf data.
+ * @param dst  Packed leaf data
+ * @param s    Sort item
+ * @param pos  Used bytes in packed data
+ * @param last Offset of the last entry in packed data
+ */
+static void ext4_dir_dx_leaf_put(uint8_t *dst, struct ext4_dx_sort_entry *s,
+                 uint32_t *pos, uint32_t *last)
+{
+    memcpy(dst + *pos, s->dentry, s->rec_len);
+    ext4_dir_en_set_entry_len((void *)(dst + *pos), s->rec_len);
+    *last = *pos;
+    *pos += s->rec_len;
+}
 
-    struct ext4_dir_idx_climit *climit = (struct ext4_dir_idx_climit *)e;
+static int ext4_dir_dx_sort_cmp(const void *a, const void *b)
+{
+    const struct ext4_dx_sort_entry *x = a;
+    const struct ext4_dx_sort_entry *y = b;
 
-    uint16_t leaf_limit = ext4_dir_dx_climit_get_limit(climit);
-    uint16_t leaf_count = ext4_dir_dx_climit_get_count(climit);
+    if (x->hash == y->hash)
+        return 0;
 
-    /* Check if is necessary to split index block */
-    if (leaf_limit == leaf_count) {
-        struct ext4_dir_idx_entry *ren;
-        ptrdiff_t levels = dxb - dx_blks;
+    return x->hash < y->hash ? -1 : 1;
+}
 
-        ren = ((struct ext4_dir_idx_root *)dx_blks[0].b.data)->en;
-        struct ext4_dir_idx_climit *rclimit = (void *)ren;
-        uint16_t root_limit = ext4_dir_dx_climit_get_limit(rclimit);
-        uint16_t root_count = ext4_dir_dx_climit_get_count(rclimit);
+/**@brief Check entries of linear directory block and count live ones.
+ * @param sb        Superblock
+ * @param data      Block data
+ * @param off       Offset of the first entry
+ * @param leaf_size Space for entries in block
+ * @param cnt       Number of live entries (incremented)
+ * @return EOK or ENOTSUP if block is malformed
+ */
+static int ext4_dir_dx_linear_count(struct ext4_sblock *sb, uint8_t *data,
+                    uint32_t off, uint32_t leaf_size,
+                    uint32_t *cnt)
+{
+    while (off < leaf_size) {
+        struct ext4_dir_en *de = (void *)(data + off);
+        uint16_t len = ext4_dir_en_get_entry_len(de);
+        uint16_t nlen = ext4_dir_en_get_name_len(sb, de);
+        uint16_t rlen = sizeof(struct ext4_fake_dir_entry) + nlen;
 
+        if ((rlen % 4) != 0)
+            rlen += 4 - (rlen % 4);
 
-        /* Linux limitation */
-        if ((levels > 0) && (root_limit == root_count))
-            return ENOSPC;
+        if (off + sizeof(struct ext4_fake_dir_entry) > leaf_size ||
+            len < rlen || off + len > leaf_size)
+            return ENOTSUP;
 
-        /* Add new block to directory */
-        ext4_fsblk_t new_fblk;
-        uint32_t new_iblk;
-        r = ext4_fs_append_inode_dblk(ino_ref, &new_fblk, &new_iblk);
-        if (r != EOK)
-            return r;
+        if (ext4_dir_en_get_inode(de) != 0 && nlen != 0)
+            (*cnt)++;
 
-        /* load new block */
-        struct ext4_block b;
-        r = ext4_trans_block_get_noread(ino_ref->fs->bdev, &b, new_fblk);
-        if (r != EOK)
-            return r;
+        off += len;
+    }
 
-        struct ext4_dir_idx_node *new_node = (void *)b.data;
-        struct ext4_dir_idx_entry *new_en = new_node->entries;
+    return EOK;
+}
 
-        memset(&new_node->fake, 0, sizeof(struct ext4_fake_dir_entry));
-        new_node->fake.entry_length = block_size;
+int ext4_dir_dx_convert(struct ext4_inode_ref *dir)
+{
+    struct ext4_fs *fs = dir->fs;
+    struct ext4_sblock *sb = &fs->sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint64_t dir_size = ext4_inode_get_size(sb, dir->inode);
+    uint32_t nblk = (uint32_t)(dir_size / block_size);
+    uint32_t leaf_size = block_size;
+    uint32_t fill, dots, cnt = 0, size = 0, nleaf, i, k;
+    uint32_t first = 0, prev = 0, pos, last;
+    struct ext4_dx_sort_entry *sort = NULL;
+    struct ext4_hash_info hinfo;
+    struct ext4_block block, leaf;
+    struct ext4_dir_idx_root *root;
+    struct ext4_dir_idx_climit *climit;
+    struct ext4_dir_en *dot, *dotdot;
+    ext4_fsblk_t fblock;
+    uint32_t iblock;
+    uint8_t *old, *img;
+    int rc;
 
-        /* Split leaf node */
-        if (levels > 0) {
-            uint32_t count_left = leaf_count / 2;
-            uint32_t count_right = leaf_count - count_left;
-            uint32_t hash_right;
-            size_t sz;
+    if (nblk == 0 || nblk > CONFIG_DIR_INDEX_CONVERT_BLOCKS ||
+        (uint64_t)nblk * block_size != dir_size)
+        return ENOTSUP;
 
-            struct ext4_dir_idx_climit *left_climit;
-            struct ext4_dir_idx_climit *right_climit;
+    hinfo.hash_version = ext4_get8(sb, default_hash_version);
+    if ((hinfo.hash_version != EXT2_HTREE_LEGACY) &&
+        (hinfo.hash_version != EXT2_HTREE_HALF_MD4) &&
+        (hinfo.hash_version != EXT2_HTREE_TEA))
+        return ENOTSUP;
 
-            hash_right = ext4_dir_dx_entry_get_hash(e + count_left);
-            /* Copy data to new node */
-            sz = count_right * sizeof(struct ext4_dir_idx_entry);
-            memcpy(new_en, e + count_left, sz);
+    if (ext4_sb_check_flag(sb, EXT4_SUPERBLOCK_FLAGS_UNSIGNED_HASH))
+        hinfo.hash_version += 3;
 
-            /* Initialize new node */
-            left_climit = (struct ext4_dir_idx_climit *)e;
-            right_climit = (struct ext4_dir_idx_climit *)new_en;
+    hinfo.seed = ext4_get8(sb, hash_seed);
 
-            ext4_dir_dx_climit_set_count(left_climit, count_left);
-            ext4_dir_dx_climit_set_count(right_climit, count_right);
+    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
+        leaf_size -= sizeof(struct ext4_dir_entry_tail);
 
-            if (meta_csum)
-                entry_space -= sizeof(struct ext4_dir_idx_tail);
+    /* Copy of all directory blocks followed by image of the root */
+    old = ext4_malloc((nblk + 1) * block_size);
+    if (!old)
+        return ENOMEM;
 
-            ext4_dir_dx_climit_set_limit(right_climit, node_limit);
+    img = old + nblk * block_size;
+    for (i = 1; i < nblk; i++) {
+        rc = ext4_fs_get_inode_dblk_idx(dir, i, &fblock, false);
+        if (rc == EOK && fblock == 0)
+            rc = ENOTSUP;
+        if (rc != EOK)
+            goto Free;
 
-            /* Which index block is target for new entry */
-            uint32_t position_index =
-                (dxb->position - dxb->entries);
-            if (position_index >= count_left) {
-                ext4_dir_set_dx_csum(
-                        ino_ref,
-                        (struct ext4_dir_en *)
-                        dxb->b.data);
-                ext4_trans_set_block_dirty(dxb->b.buf);
+        rc = ext4_trans_block_get(fs->bdev, &leaf, fblock);
+        if (rc != EOK)
+            goto Free;
 
-                struct ext4_block block_tmp = dxb->b;
+        memcpy(old + i * block_size, leaf.data, block_size);
+        rc = ext4_block_set(fs->bdev, &leaf);
+        if (rc != EOK)
+            goto Free;
 
-                dxb->b = b;
+        rc = ext4_dir_dx_linear_count(sb, old + i * block_size, 0,
+                          leaf_size, &cnt);
+        if (rc != EOK)
+            goto Free;
+    }
 
-                dxb->position =
-                    new_en + position_index - count_left;
-                dxb->entries = new_en;
+    rc = ext4_fs_get_inode_dblk_idx(dir, 0, &fblock, false);
+    if (rc == EOK && fblock == 0)
+        rc = ENOTSUP;
+    if (rc != EOK)
+        goto Free;
 
-                b = block_tmp;
-            }
+    rc = ext4_trans_block_get(fs->bdev, &block, fblock);
+    if (rc != EOK)
+        goto Free;
+
+    memcpy(old, block.data, block_size);
+
+    /* Only a well formed block starting with dot entries is converted */
+    dot = (void *)old;
+    dotdot = (void *)(old + ext4_dir_en_get_entry_len(dot));
+    if (ext4_dir_en_get_name_len(sb, dot) != 1 || dot->name[0] != '.' ||
+        ext4_dir_en_get_entry_len(dot) < 12 ||
+        ext4_dir_en_get_entry_len(dot) > block_size - 12 ||
+        ext4_dir_en_get_name_len(sb, dotdot) != 2 ||
+        memcmp(dotdot->name, "..", 2)) {
+        rc = ENOTSUP;
+        goto Finish;
+    }
 
-            /* Finally insert new entry */
-            ext4_dir_dx_insert_entry(ino_ref, dx_blks, hash_right,
-                         new_iblk);
-            ext4_dir_set_dx_csum(ino_ref, (void*)dx_blks[0].b.data);
-            ext4_dir_set_dx_csum(ino_ref, (void*)dx_blks[1].b.data);
-            ext4_trans_set_block_dirty(dx_blks[0].b.buf);
-            ext4_trans_set_block_dirty(dx_blks[1].b.buf);
-
-            ext4_dir_set_dx_csum(ino_ref, (void *)b.data);
-            ext4_trans_set_block_dirty(b.buf);
-            return ext4_block_set(ino_ref->fs->bdev, &b);
-        } else {
-            size_t sz;
-            /* Copy data from root to child block */
-            sz = leaf_count * sizeof(struct ext4_dir_idx_entry);
-            memcpy(new_en, e, sz);
+    dots = ext4_dir_en_get_entry_len(dot);
+    dots += ext4_dir_en_get_entry_len(dotdot);
+    rc = ext4_dir_dx_linear_count(sb, old, dots, leaf_size, &cnt);
+    if (rc != EOK)
+        goto Finish;
+
+    /* Build image of the root, keeping original dot entries */
+    root = (void *)img;
+    memset(img, 0, block_size);
+    memcpy(root->dots, old, 12);
+    ext4_dir_en_set_entry_len((void *)root->dots, 12);
+    memcpy(root->dots + 1, dotdot, 12);
+    ext4_dir_en_set_entry_len((void *)(root->dots + 1), block_size - 12);
+    ext4_dir_dx_rinfo_init(dir, root);
+    climit = (void *)root->en;
+
+    sort = ext4_malloc((cnt + 1) * sizeof(struct ext4_dx_sort_entry));
+    if (!sort) {
+        rc = ENOMEM;
+        goto Finish;
+    }
 
-            struct ext4_dir_idx_climit *new_climit = (void*)new_en;
-            if (meta_csum)
-                entry_space -= sizeof(struct ext4_dir_idx_tail);
+    cnt = 0;
+    rc = ext4_dir_dx_leaf_collect(&hinfo, sb, old + dots, leaf_size - dots,
+                      0, sort, &cnt, &size);
+    for (i = 1; i < nblk && rc == EOK; i++)
+        rc = ext4_dir_dx_leaf_collect(&hinfo, sb, old + i * block_size,
+                          leaf_size, 0, sort, &cnt, &size);
+    if (rc != EOK)
+        goto Finish;
 
-            ext4_dir_dx_climit_set_limit(new_climit, node_limit);
+    qsort(sort, cnt, sizeof(struct ext4_dx_sort_entry),
+          ext4_dir_dx_sort_cmp);
 
-            /* Set values in root node */
-            struct ext4_dir_idx_climit *new_root_climit = (void *)e;
+    /* Leaves are filled to 3/4, so next inserts don't split them */
+    fill = leaf_size / 4 * 3;
+    for (i = 0, pos = 0, nleaf = 1; i < cnt; i++) {
+        if (pos && pos + sort[i].rec_len > fill) {
+            nleaf++;
+            pos = 0;
+        }
+        pos += sort[i].rec_len;
+    }
 
-            ext4_dir_dx_climit_set_count(new_root_climit, 1);
-            ext4_dir_dx_entry_set_block(e, new_iblk);
+    if (nleaf > ext4_dir_dx_climit_get_limit(climit)) {
+        rc = ENOTSUP;
+        goto Finish;
+    }
 
-            struct ext4_dir_idx_root *r = (void *)dx_blks[0].b.data;
-            r->info.indirect_levels = 1;
+    /* Missing leaves are appended as empty blocks before any block is
+     * rewritten, so running out of space leaves the directory as it was */
+    for (k = nblk; k <= nleaf; k++) {
+        rc = ext4_fs_append_inode_dblk(dir, &fblock, &iblock);
+        if (rc == EOK)
+            rc = ext4_trans_block_get_noread(fs->bdev, &leaf, fblock);
 
-            /* Add new entry to the path */
-            dxb = dx_blks + 1;
-            dxb->position = dx_blks->position - e + new_en;
-            dxb->entries = new_en;
-            dxb->b = b;
-            *new_dx_block = dxb;
+        if (rc == EOK) {
+            ext4_dir_dx_leaf_fill(dir, &leaf, leaf.data, 0, 0,
+                          leaf_size);
+            rc = ext4_block_set(fs->bdev, &leaf);
+        }
 
-            ext4_dir_set_dx_csum(ino_ref, (void*)dx_blks[0].b.data);
-            ext4_dir_set_dx_csum(ino_ref, (void*)dx_blks[1].b.data);
-            ext4_trans_set_block_dirty(dx_blks[0].b.buf);
-            ext4_trans_set_block_dirty(dx_blks[1].b.buf);
+        if (rc != EOK) {
+            ext4_fs_truncate_inode(dir, dir_size);
+            goto Finish;
         }
     }
 
-    return EOK;
-}
+    /* Leaves take over blocks 1.. */
+    for (k = 1, i = 0; k <= nleaf; k++) {
+        rc = ext4_dir_dx_block_get(dir, k, &leaf, true);
+        if (rc != EOK)
+            goto Finish;
 
-int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
-              struct ext4_inode_ref *child, const char *name, uint32_t name_len)
-{
-    int rc2 = EOK;
-    int r;
-    /* Get direct block 0 (index root) */
-    ext4_fsblk_t rblock_addr;
-    r =  ext4_fs_get_inode_dblk_idx(parent, 0, &rblock_addr, false);
-    if (r != EOK)
-        return r;
+        first = i;
+        pos = 0;
+        last = 0;
+        while (i < cnt && (!pos || pos + sort[i].rec_len <= fill))
+            ext4_dir_dx_leaf_put(leaf.data, sort + i++, &pos, &last);
 
-    struct ext4_fs *fs = parent->fs;
-    struct ext4_block root_blk;
+        ext4_dir_dx_leaf_fill(dir, &leaf, leaf.data, pos, last,
+                      leaf_size);
+        rc = ext4_block_set(fs->bdev, &leaf);
+        if (rc != EOK)
+            goto Finish;
+
+        if (k > 1)
+            ext4_dir_dx_entry_set_hash(root->en + k - 1,
+                ext4_dir_dx_part_hash(sort, prev, first));
+
+        ext4_dir_dx_entry_set_block(root->en + k - 1, k);
+        prev = first;
+    }
+
+    ext4_dir_dx_climit_set_count(climit, nleaf);
+
+    /* Rebuild block 0 as index root */
+    memcpy(block.data, img, block_size);
+    ext4_dir_set_dx_csum(dir, (struct ext4_dir_en *)block.data);
+    ext4_trans_set_inode_block_dirty(block.buf, dir->index, true);
+
+    ext4_inode_set_flag(dir->inode, EXT4_INODE_FLAG_INDEX);
+    dir->dirty = true;
+
+    rc = ext4_block_set(fs->bdev, &block);
+    if (rc == EOK && nleaf + 1 < nblk)
+        rc = ext4_fs_truncate_inode(dir,
+                        (uint64_t)(nleaf + 1) * block_size);
+
+    ext4_free(sort);
+    ext4_free(old);
+    return rc;
+
+Finish:
+    ext4_block_set(fs->bdev, &block);
+Free:
+    if (sort)
+        ext4_free(sort);
+    ext4_free(old);
+    return rc;
+}
+
+/**@brief Split directory entries preventing node overflow and insert the
+ *        new entry. Full leaf is split to two blocks, or together with
+ *        its more than half full neighbour to three blocks. Entries are
+ *        partitioned around the cut hashes without sorting and moved
+ *        between the blocks in place.
+ * @param inode_ref      Directory i-node
+ * @param hinfo          Hash info of the new entry
+ * @param old_data_block Block with data to be split
+ * @param index_block    Block where index entries are located
+ * @param child          Child i-node of the new entry
+ * @param name           Name of the new entry
+ * @param name_len       Length of entry name
+ * @return Error code
+ */
+static int ext4_dir_dx_split_data(struct ext4_inode_ref *inode_ref,
+                  struct ext4_hash_info *hinfo,
+                  struct ext4_block *old_data_block,
+                  struct ext4_dir_idx_block *index_block,
+                  struct ext4_inode_ref *child, const char *name,
+                  uint32_t name_len)
+{
+    struct ext4_fs *fs = inode_ref->fs;
+    struct ext4_sblock *sb = &fs->sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint32_t leaf_size = block_size;
+    struct ext4_dir_idx_climit *climit = (void *)index_block->entries;
+    uint16_t count = ext4_dir_dx_climit_get_count(climit);
+    struct ext4_dir_idx_entry *lo = index_block->position;
+    struct ext4_dir_idx_entry *nb = NULL;
+    struct ext4_block nb_block, new_block;
+    struct ext4_block *l = old_data_block, *h = NULL, *dst;
+    struct ext4_dx_sort_entry *sort;
+    struct ext4_hash_info hinfo_tmp;
+    uint32_t cnt = 0, size = 0, nsize = 0;
+    uint32_t max_ecnt, c1, c2, h1 = 0, h2 = 0, i, j, rec_len;
+    uint32_t psize[3] = {0, 0, 0};
+    uint32_t pos[3] = {0, 0, 0}, last[3] = {0, 0, 0};
+    uint32_t spos = 0, slast = 0;
+    uint8_t old_src = 0;
+    uint8_t *buf;
+    ext4_fsblk_t new_fblock;
+    uint32_t new_iblock;
+    int rc, rc2;
+
+    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
+        leaf_size -= sizeof(struct ext4_dir_entry_tail);
+
+    /* Space needed by the new entry */
+    rec_len = sizeof(struct ext4_fake_dir_entry) + name_len;
+    if ((rec_len % 4) != 0)
+        rec_len += 4 - (rec_len % 4);
+
+    /* dot entry has the smallest size available */
+    max_ecnt = leaf_size / sizeof(struct ext4_dir_idx_dot_en);
+
+    /* Scratch space lives as long as the mount: sort items of two
+     * leaves followed by one block buffer */
+    if (!fs->dx_scratch) {
+        fs->dx_scratch = ext4_malloc(2 * max_ecnt * sizeof(*sort) +
+                         block_size);
+        if (!fs->dx_scratch)
+            return ENOMEM;
+    }
+
+    sort = fs->dx_scratch;
+    buf = (uint8_t *)(sort + 2 * max_ecnt);
+    memcpy(&hinfo_tmp, hinfo, sizeof(struct ext4_hash_info));
+
+    /* Neighbour leaf in the same index node for 2->3 split */
+    if (lo + 1 < index_block->entries + count)
+        nb = lo + 1;
+    else if (lo > index_block->entries)
+        nb = lo - 1;
+
+    if (nb) {
+        old_src = nb > lo ? 0 : 1;
+        rc = ext4_dir_dx_block_get(inode_ref,
+                       ext4_dir_dx_entry_get_block(nb),
+                       &nb_block, false);
+        if (rc != EOK)
+            return rc;
+
+        rc = ext4_dir_dx_leaf_collect(&hinfo_tmp, sb, nb_block.data,
+                          leaf_size, !old_src, sort, &cnt,
+                          &nsize);
+        if (rc != EOK || nsize <= leaf_size / 2) {
+            ext4_block_set(fs->bdev, &nb_block);
+            if (rc != EOK)
+                return rc;
+
+            nb = NULL;
+            cnt = 0;
+            nsize = 0;
+        }
+    }
+
+    rc = ext4_dir_dx_leaf_collect(&hinfo_tmp, sb, old_data_block->data,
+                      leaf_size, old_src, sort, &cnt, &size);
+    if (rc != EOK || cnt < 2) {
+        if (rc == EOK)
+            rc = EXT4_ERR_BAD_DX_DIR;
+        goto release_nb;
+    }
+
+    if (nb) {
+        size += nsize;
+        c1 = ext4_dir_dx_select(sort, 0, cnt, size / 3);
+        c1 = c1 ? c1 : 1;
+        for (i = 0; i < c1; i++)
+            psize[0] += sort[i].rec_len;
+
+        c2 = ext4_dir_dx_select(sort, c1, cnt, (size - psize[0]) / 2);
+        c2 = c2 > c1 ? c2 : c1 + 1;
+
+        for (i = c1; i < cnt; i++) {
+            sort[i].part = i < c2 ? 1 : 2;
+            psize[sort[i].part] += sort[i].rec_len;
+        }
+
+        for (i = 0; i < c1; i++)
+            sort[i].part = 0;
+
+        if (c2 < cnt) {
+            h1 = ext4_dir_dx_part_hash(sort, 0, c1);
+            h2 = ext4_dir_dx_part_hash(sort, c1, c2);
+            i = hinfo->hash >= h2 ? 2 : (hinfo->hash >= h1 ? 1 : 0);
+            psize[i] += rec_len;
+        }
+
+        /* Fall back to 2-way split if parts (with the new entry) don't
+         * fit or a hash collision would span three leaves */
+        if (c2 >= cnt || (h1 & ~1) == (h2 & ~1) ||
+            psize[0] > leaf_size || psize[1] > leaf_size ||
+            psize[2] > leaf_size) {
+            for (i = 0, j = 0; i < cnt; i++)
+                if (sort[i].src == old_src)
+                    sort[j++] = sort[i];
+
+            ext4_block_set(fs->bdev, &nb_block);
+            nb = NULL;
+            cnt = j;
+            size -= nsize;
+        }
+    }
+
+    if (!nb) {
+        c1 = ext4_dir_dx_select(sort, 0, cnt, size / 2);
+        c1 = c1 ? c1 : 1;
+        c1 = c1 < cnt ? c1 : cnt - 1;
+        c2 = cnt;
+        h1 = ext4_dir_dx_part_hash(sort, 0, c1);
+        for (i = 0; i < cnt; i++)
+            sort[i].part = i < c1 ? 0 : 2;
+    } else if (old_src) {
+        lo = nb;
+        l = &nb_block;
+        h = old_data_block;
+    } else {
+        h = &nb_block;
+    }
+
+    /* Allocate new block for store the last part of entries */
+    rc = ext4_fs_append_inode_dblk(inode_ref, &new_fblock, &new_iblock);
+    if (rc != EOK)
+        goto release_nb;
+
+    rc = ext4_trans_block_get_noread(fs->bdev, &new_block, new_fblock);
+    if (rc != EOK)
+        goto release_nb;
+
+    /* Move out everything that leaves its block: last part to the new
+     * block, middle part entries of the left leaf to the buffer */
+    for (i = 0; i < cnt; i++) {
+        if (sort[i].part == 2)
+            ext4_dir_dx_leaf_put(new_block.data, sort + i, &pos[2],
+                         &last[2]);
+        else if (sort[i].part == 1 && sort[i].src == 0)
+            ext4_dir_dx_leaf_put(buf, sort + i, &spos, &slast);
+        else
+            continue;
+
+        ext4_dir_en_set_inode(sort[i].dentry, 0);
+    }
+
+    rc = ext4_dir_dx_leaf_pack(sb, l->data, leaf_size, l->data, &pos[0],
+                   &last[0]);
+    if (rc != EOK)
+        goto release_new;
+
+    if (h) {
+        /* First part entries of the right leaf go to the left one */
+        for (i = 0; i < cnt; i++) {
+            if (sort[i].part != 0 || sort[i].src != 1)
+                continue;
+
+            ext4_dir_dx_leaf_put(l->data, sort + i, &pos[0],
+                         &last[0]);
+            ext4_dir_en_set_inode(sort[i].dentry, 0);
+        }
+
+        rc = ext4_dir_dx_leaf_pack(sb, h->data, leaf_size, h->data,
+                       &pos[1], &last[1]);
+        if (rc != EOK)
+            goto release_new;
+
+        if (spos) {
+            memcpy(h->data + pos[1], buf, spos);
+            last[1] = pos[1] + slast;
+            pos[1] += spos;
+        }
+
+        ext4_dir_dx_leaf_fill(inode_ref, h, h->data, pos[1], last[1],
+                      leaf_size);
+
+        /* Middle leaf keeps its block, only its hash moves */
+        ext4_dir_dx_entry_set_hash(lo + 1, h1);
+        index_block->position = lo + 1;
+    }
+
+    ext4_dir_dx_leaf_fill(inode_ref, l, l->data, pos[0], last[0],
+                  leaf_size);
+    ext4_dir_dx_leaf_fill(inode_ref, &new_block, new_block.data, pos[2],
+                  last[2], leaf_size);
+
+    ext4_dir_dx_insert_entry(inode_ref, index_block, h ? h2 : h1,
+                 new_iblock);
+
+    /* Where to save new entry */
+    if (hinfo->hash >= (h ? h2 : h1))
+        dst = &new_block;
+    else if (h && hinfo->hash >= h1)
+        dst = h;
+    else
+        dst = l;
+
+    rc = ext4_dir_try_insert_entry(sb, inode_ref, dst, child, name,
+                       name_len);
+
+release_new:
+    rc2 = ext4_block_set(fs->bdev, &new_block);
+    if (rc == EOK)
+        rc = rc2;
+
+release_nb:
+    if (nb) {
+        rc2 = ext4_block_set(fs->bdev, &nb_block);
+        if (rc == EOK)
+            rc = rc2;
+    }
+
+    return rc;
+}
+
+/**@brief  Check if index node of the path has no room for a new entry.
+ * @param dxb Index block of the path
+ * @return True if node is full
+ */
+static bool ext4_dir_dx_node_full(struct ext4_dir_idx_block *dxb)
+{
+    struct ext4_dir_idx_climit *climit = (void *)dxb->entries;
+
+    return ext4_dir_dx_climit_get_count(climit) ==
+           ext4_dir_dx_climit_get_limit(climit);
+}
+
+/**@brief  Move entries of full root to a new node, so the tree grows by
+ *         one level. New node is added to the path below the root.
+ * @param ino_ref    Directory i-node
+ * @param dx_blks    Array with path from root to leaf node
+ * @param dxb        Last index block of the path
+ * @param node_limit Entry limit of index node
+ * @return Error code, ENOSPC if the tree is as deep as allowed
+ */
+static int ext4_dir_dx_add_level(struct ext4_inode_ref *ino_ref,
+                 struct ext4_dir_idx_block *dx_blks,
+                 struct ext4_dir_idx_block *dxb,
+                 uint32_t node_limit)
+{
+    struct ext4_sblock *sb = &ino_ref->fs->sb;
+    struct ext4_dir_idx_root *root = (void *)dx_blks->b.data;
+    struct ext4_dir_idx_entry *e = root->en;
+    uint8_t levels = ext4_dir_dx_rinfo_get_indirect_levels(&root->info);
+    uint16_t count = ext4_dir_dx_climit_get_count((void *)e);
+    ext4_fsblk_t new_fblk;
+    uint32_t new_iblk;
+    struct ext4_block b;
+    int r;
+
+    if (levels + 1 >= ext4_dir_dx_max_levels(sb))
+        return ENOSPC;
+
+    /* Add new block to directory */
+    r = ext4_fs_append_inode_dblk(ino_ref, &new_fblk, &new_iblk);
+    if (r != EOK)
+        return r;
+
+    r = ext4_trans_block_get_noread(ino_ref->fs->bdev, &b, new_fblk);
+    if (r != EOK)
+        return r;
+
+    struct ext4_dir_idx_node *new_node = (void *)b.data;
+    struct ext4_dir_idx_entry *new_en = new_node->entries;
+
+    memset(&new_node->fake, 0, sizeof(struct ext4_fake_dir_entry));
+    new_node->fake.entry_length = ext4_sb_get_block_size(sb);
+
+    /* Copy data from root to child block */
+    memcpy(new_en, e, count * sizeof(struct ext4_dir_idx_entry));
+    ext4_dir_dx_climit_set_limit((void *)new_en, node_limit);
+
+    /* Set values in root node */
+    ext4_dir_dx_climit_set_count((void *)e, 1);
+    ext4_dir_dx_entry_set_block(e, new_iblk);
+    ext4_dir_dx_rinfo_set_indirect_levels(&root->info, levels + 1);
+
+    /* Add new node to the path */
+    memmove(dx_blks + 2, dx_blks + 1, (dxb - dx_blks) * sizeof(*dxb));
+    dx_blks[1].b = b;
+    dx_blks[1].entries = new_en;
+    dx_blks[1].position = new_en + (dx_blks->position - e);
+    dx_blks->position = e;
+
+    ext4_dir_set_dx_csum(ino_ref, (void *)dx_blks[0].b.data);
+    ext4_dir_set_dx_csum(ino_ref, (void *)dx_blks[1].b.data);
+    ext4_trans_set_inode_block_dirty(dx_blks[0].b.buf, ino_ref->index, true);
+    ext4_trans_set_inode_block_dirty(dx_blks[1].b.buf, ino_ref->index, true);
+    return EOK;
+}
+
+/**@brief  Split full index node in halves. Parent node must have room
+ *         for a new entry. Path continues through the half holding the
+ *         current position.
+ * @param ino_ref    Directory i-node
+ * @param dxb        Index block of the path to be split (not the root)
+ * @param node_limit Entry limit of index node
+ * @return Error code
+ */
+static int ext4_dir_dx_split_node(struct ext4_inode_ref *ino_ref,
+                  struct ext4_dir_idx_block *dxb,
+                  uint32_t node_limit)
+{
+    struct ext4_dir_idx_entry *e = dxb->entries;
+    uint16_t count = ext4_dir_dx_climit_get_count((void *)e);
+    uint32_t count_left = count / 2;
+    uint32_t count_right = count - count_left;
+    uint32_t hash_right = ext4_dir_dx_entry_get_hash(e + count_left);
+    uint32_t position_index = dxb->position - e;
+    ext4_fsblk_t new_fblk;
+    uint32_t new_iblk;
+    struct ext4_block b;
+    int r;
+
+    /* Add new block to directory */
+    r = ext4_fs_append_inode_dblk(ino_ref, &new_fblk, &new_iblk);
+    if (r != EOK)
+        return r;
+
+    r = ext4_trans_block_get_noread(ino_ref->fs->bdev, &b, new_fblk);
+    if (r != EOK)
+        return r;
+
+    struct ext4_dir_idx_node *new_node = (void *)b.data;
+    struct ext4_dir_idx_entry *new_en = new_node->entries;
+
+    memset(&new_node->fake, 0, sizeof(struct ext4_fake_dir_entry));
+    new_node->fake.entry_length = ext4_sb_get_block_size(&ino_ref->fs->sb);
+
+    /* Copy data to new node */
+    memcpy(new_en, e + count_left,
+           count_right * sizeof(struct ext4_dir_idx_entry));
+
+    ext4_dir_dx_climit_set_count((void *)e, count_left);
+    ext4_dir_dx_climit_set_count((void *)new_en, count_right);
+    ext4_dir_dx_climit_set_limit((void *)new_en, node_limit);
+
+    /* Link new node right after the split one */
+    ext4_dir_dx_insert_entry(ino_ref, dxb - 1, hash_right, new_iblk);
+
+    /* Which index block is target for new entry */
+    if (position_index >= count_left) {
+        struct ext4_block block_tmp = dxb->b;
+
+        dxb->b = b;
+        dxb->entries = new_en;
+        dxb->position = new_en + position_index - count_left;
+        (dxb - 1)->position++;
+        b = block_tmp;
+    }
+
+    ext4_dir_set_dx_csum(ino_ref, (void *)dxb->b.data);
+    ext4_trans_set_inode_block_dirty(dxb->b.buf, ino_ref->index, true);
+
+    ext4_dir_set_dx_csum(ino_ref, (void *)b.data);
+    ext4_trans_set_inode_block_dirty(b.buf, ino_ref->index, true);
+    return ext4_block_set(ino_ref->fs->bdev, &b);
+}
+
+/**@brief  Split index node and maybe some parent nodes in the tree hierarchy.
+ *         One full node is handled per pass, starting from the topmost
+ *         one of the full tail of the path, until the last index node
+ *         has room for a new entry.
+ * @param inode_ref Directory i-node
+ * @param dx_blocks Array with path from root to leaf node
+ * @param dx_block  Leaf block to be split if needed
+ * @return Error code
+ */
+static int
+ext4_dir_dx_split_index(struct ext4_inode_ref *ino_ref,
+            struct ext4_dir_idx_block *dx_blks,
+            struct ext4_dir_idx_block *dxb,
+            struct ext4_dir_idx_block **new_dx_block)
+{
+    struct ext4_sblock *sb = &ino_ref->fs->sb;
+    struct ext4_dir_idx_block *f;
+    int r;
+
+    uint32_t block_size = ext4_sb_get_block_size(&ino_ref->fs->sb);
+    uint32_t entry_space = block_size - sizeof(struct ext4_fake_dir_entry);
+
+    bool meta_csum = ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM);
+    if (meta_csum)
+        entry_space -= sizeof(struct ext4_dir_idx_tail);
+
+    uint32_t node_limit =  entry_space / sizeof(struct ext4_dir_idx_entry);
+
+    while (ext4_dir_dx_node_full(dxb)) {
+        f = dxb;
+        while (f > dx_blks && ext4_dir_dx_node_full(f - 1))
+            f--;
+
+        if (f == dx_blks) {
+            r = ext4_dir_dx_add_level(ino_ref, dx_blks, dxb,
+                          node_limit);
+            if (r != EOK)
+                return r;
+
+            dxb++;
+            *new_dx_block = dxb;
+            continue;
+        }
+
+        r = ext4_dir_dx_split_node(ino_ref, f, node_limit);
+        if (r != EOK)
+            return r;
+    }
+
+    return EOK;
+}
+
+int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
+              struct ext4_inode_ref *child, const char *name, uint32_t name_len)
+{
+    int rc2 = EOK;
+    int r;
+    /* Get direct block 0 (index root) */
+    ext4_fsblk_t rblock_addr;
+    r =  ext4_fs_get_inode_dblk_idx(parent, 0, &rblock_addr, false);
+    if (r != EOK)
+        return r;
+
+    struct ext4_fs *fs = parent->fs;
+    struct ext4_block root_blk;
 
     r = ext4_trans_block_get(fs->bdev, &root_blk, rblock_addr);
     if (r != EOK)
@@ -1264,11 +1913,8 @@ int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
         return EXT4_ERR_BAD_DX_DIR;
     }
 
-    /*
-     * Hardcoded number 2 means maximum height of index
-     * tree defined in Linux.
-     */
-    struct ext4_dir_idx_block dx_blks[2];
+    /* Path from root to leaf, as deep as the tree may be */
+    struct ext4_dir_idx_block dx_blks[EXT4_DIR_DX_LEVELS];
     struct ext4_dir_idx_block *dx_blk;
     struct ext4_dir_idx_block *dx_it;
 
@@ -1292,7 +1938,7 @@ int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
      */
     r = ext4_dir_dx_split_index(parent, dx_blks, dx_blk, &dx_blk);
     if (r != EOK)
-        goto release_target_index;
+        goto release_index;
 
     struct ext4_block target_block;
     r = ext4_trans_block_get(fs->bdev, &target_block, leaf_block_addr);
@@ -1314,28 +1960,9 @@ int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
     if (r == EOK)
         goto release_target_index;
 
-    /* Split entries to two blocks (includes sorting by hash value) */
-    struct ext4_block new_block;
+    /* Split entries to two or three blocks and save new entry */
     r = ext4_dir_dx_split_data(parent, &hinfo, &target_block, dx_blk,
-                    &new_block);
-    if (r != EOK) {
-        rc2 = r;
-        goto release_target_index;
-    }
-
-    /* Where to save new entry */
-    uint32_t blk_hash = ext4_dir_dx_entry_get_hash(dx_blk->position + 1);
-    if (hinfo.hash >= blk_hash)
-        r = ext4_dir_try_insert_entry(&fs->sb, parent, &new_block,
-                        child, name, name_len);
-    else
-        r = ext4_dir_try_insert_entry(&fs->sb, parent, &target_block,
-                        child, name, name_len);
-
-    /* Cleanup */
-    r = ext4_block_set(fs->bdev, &new_block);
-    if (r != EOK)
-        return r;
+                   child, name, name_len);
 
 /* Cleanup operations */
 
@@ -1393,11 +2020,377 @@ int ext4_dir_dx_reset_parent_inode(struct ext4_inode_ref *dir,
     ext4_dx_dot_en_set_inode(&root->dots[1], parent_inode);
 
     ext4_dir_set_dx_csum(dir, (void *)block.data);
-    ext4_trans_set_block_dirty(block.buf);
+    ext4_trans_set_inode_block_dirty(block.buf, dir->index, true);
 
     return ext4_block_set(dir->fs->bdev, &block);
 }
 
+/**@brief Move entries of the right leaf to the left one if they fit.
+ *        Right leaf is left empty.
+ * @param dir Directory i-node
+ * @param l   Index entry of the left leaf
+ * @param r   Index entry of the right leaf
+ * @param buf Working buffer (block size)
+ * @return EOK if merged, ENOSPC if leaves are too full
+ */
+static int ext4_dir_dx_merge_leaves(struct ext4_inode_ref *dir,
+                    struct ext4_dir_idx_entry *l,
+                    struct ext4_dir_idx_entry *r, uint8_t *buf)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    uint32_t leaf_size = ext4_sb_get_block_size(sb);
+    uint32_t pos = 0, last = 0;
+    struct ext4_block lb, rb;
+    int rc, rc2;
+
+    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
+        leaf_size -= sizeof(struct ext4_dir_entry_tail);
+
+    rc = ext4_dir_dx_block_get(dir, ext4_dir_dx_entry_get_block(l), &lb,
+                   false);
+    if (rc != EOK)
+        return rc;
+
+    rc = ext4_dir_dx_block_get(dir, ext4_dir_dx_entry_get_block(r), &rb,
+                   false);
+    if (rc != EOK) {
+        ext4_block_set(dir->fs->bdev, &lb);
+        return rc;
+    }
+
+    rc = ext4_dir_dx_leaf_pack(sb, lb.data, leaf_size, buf, &pos, &last);
+    if (rc == EOK)
+        rc = ext4_dir_dx_leaf_pack(sb, rb.data, leaf_size, buf, &pos,
+                       &last);
+
+    if (rc == EOK) {
+        ext4_dir_dx_leaf_fill(dir, &lb, buf, pos, last, leaf_size);
+        ext4_dir_dx_leaf_fill(dir, &rb, NULL, 0, 0, leaf_size);
+    }
+
+    rc2 = ext4_block_set(dir->fs->bdev, &rb);
+    if (rc == EOK)
+        rc = rc2;
+
+    rc2 = ext4_block_set(dir->fs->bdev, &lb);
+    if (rc == EOK)
+        rc = rc2;
+
+    return rc;
+}
+
+/**@brief Merge sparse neighbouring leaves of index node. Pairs starting
+ *        at positions [first, end) are tried, index entries of emptied
+ *        leaves are dropped.
+ * @param dir     Directory i-node
+ * @param entries Entries of index node
+ * @param first   First position to try
+ * @param end     Position after the last one to try
+ * @param buf     Working buffer (block size)
+ * @param freed   Output array of released logical blocks
+ * @param nfreed  Number of released blocks
+ * @return Error code
+ */
+static int ext4_dir_dx_compact_node(struct ext4_inode_ref *dir,
+                    struct ext4_dir_idx_entry *entries,
+                    uint16_t first, uint16_t end, uint8_t *buf,
+                    uint32_t *freed, uint32_t *nfreed)
+{
+    struct ext4_dir_idx_climit *climit = (void *)entries;
+    uint16_t cnt = ext4_dir_dx_climit_get_count(climit);
+    uint16_t i = first;
+    int rc;
+
+    while (i < end && i + 1 < cnt) {
+        rc = ext4_dir_dx_merge_leaves(dir, entries + i, entries + i + 1,
+                          buf);
+        if (rc == ENOSPC) {
+            i++;
+            continue;
+        }
+
+        if (rc != EOK)
+            return rc;
+
+        freed[(*nfreed)++] = ext4_dir_dx_entry_get_block(entries + i + 1);
+        memmove(entries + i + 1, entries + i + 2,
+            (cnt - i - 2) * sizeof(struct ext4_dir_idx_entry));
+        cnt--;
+        end--;
+        ext4_dir_dx_climit_set_count(climit, cnt);
+    }
+
+    return EOK;
+}
+
+/**@brief Point index entry referencing logical block @p from to @p to.
+ *        Subtree of index node is searched depth first.
+ * @param dir     Directory i-node
+ * @param blk     Index node block (root or inner node)
+ * @param entries Entries of index node
+ * @param levels  Index levels below this node
+ * @param from    Old logical block
+ * @param to      New logical block
+ * @param found   Set when the entry is relinked
+ * @return Error code
+ */
+static int ext4_dir_dx_relink_node(struct ext4_inode_ref *dir,
+                   struct ext4_block *blk,
+                   struct ext4_dir_idx_entry *entries,
+                   uint8_t levels, uint32_t from, uint32_t to,
+                   bool *found)
+{
+    uint16_t cnt = ext4_dir_dx_climit_get_count((void *)entries);
+    uint16_t i;
+    int rc;
+
+    for (i = 0; i < cnt; i++) {
+        if (ext4_dir_dx_entry_get_block(entries + i) == from) {
+            ext4_dir_dx_entry_set_block(entries + i, to);
+            ext4_dir_set_dx_csum(dir, (void *)blk->data);
+            ext4_trans_set_inode_block_dirty(blk->buf, dir->index, true);
+            *found = true;
+            return EOK;
+        }
+    }
+
+    if (levels == 0)
+        return EOK;
+
+    for (i = 0; i < cnt && !*found; i++) {
+        struct ext4_block b;
+        struct ext4_dir_idx_entry *en;
+
+        rc = ext4_dir_dx_block_get(dir,
+                ext4_dir_dx_entry_get_block(entries + i), &b, false);
+        if (rc != EOK)
+            return rc;
+
+        en = ((struct ext4_dir_idx_node *)b.data)->entries;
+        rc = ext4_dir_dx_relink_node(dir, &b, en, levels - 1, from, to,
+                         found);
+        if (rc != EOK) {
+            ext4_block_set(dir->fs->bdev, &b);
+            return rc;
+        }
+
+        rc = ext4_block_set(dir->fs->bdev, &b);
+        if (rc != EOK)
+            return rc;
+    }
+
+    return EOK;
+}
+
+/**@brief Point index entry referencing logical block @p from to @p to.
+ * @param dir      Directory i-node
+ * @param root_blk Index root block
+ * @param from     Old logical block
+ * @param to       New logical block
+ * @return Error code
+ */
+static int ext4_dir_dx_relink(struct ext4_inode_ref *dir,
+                  struct ext4_block *root_blk, uint32_t from,
+                  uint32_t to)
+{
+    struct ext4_dir_idx_root *root = (void *)root_blk->data;
+    bool found = false;
+
+    return ext4_dir_dx_relink_node(dir, root_blk, root->en,
+            ext4_dir_dx_rinfo_get_indirect_levels(&root->info),
+            from, to, &found);
+}
+
+static int ext4_dir_dx_blk_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    if (x == y)
+        return 0;
+
+    return x < y ? -1 : 1;
+}
+
+/**@brief Give back released directory blocks. Blocks from the end of
+ *        directory are moved to released slots, so the directory can be
+ *        truncated.
+ * @param dir    Directory i-node
+ * @param freed  Released logical blocks
+ * @param nfreed Number of released blocks
+ * @return Error code
+ */
+static int ext4_dir_dx_release_blocks(struct ext4_inode_ref *dir,
+                      uint32_t *freed, uint32_t nfreed)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint32_t nblk = ext4_inode_get_size(sb, dir->inode) / block_size;
+    uint32_t lo = 0, hi = nfreed;
+    struct ext4_block root_blk;
+    int rc, rc2;
+
+    qsort(freed, nfreed, sizeof(uint32_t), ext4_dir_dx_blk_cmp);
+
+    rc = ext4_dir_dx_block_get(dir, 0, &root_blk, false);
+    if (rc != EOK)
+        return rc;
+
+    while (lo < hi) {
+        struct ext4_block src, dst;
+        uint32_t last = nblk - 1;
+        uint32_t to;
+
+        if (freed[hi - 1] == last) {
+            hi--;
+            nblk--;
+            continue;
+        }
+
+        to = freed[lo++];
+        rc = ext4_dir_dx_block_get(dir, last, &src, false);
+        if (rc != EOK)
+            break;
+
+        rc = ext4_dir_dx_block_get(dir, to, &dst, true);
+        if (rc != EOK) {
+            ext4_block_set(dir->fs->bdev, &src);
+            break;
+        }
+
+        /* Checksums don't cover block number, plain copy is enough */
+        memcpy(dst.data, src.data, block_size);
+        ext4_trans_set_inode_block_dirty(dst.buf, dir->index, true);
+
+        rc = ext4_block_set(dir->fs->bdev, &dst);
+        rc2 = ext4_block_set(dir->fs->bdev, &src);
+        if (rc == EOK)
+            rc = rc2;
+        if (rc != EOK)
+            break;
+
+        rc = ext4_dir_dx_relink(dir, &root_blk, last, to);
+        if (rc != EOK)
+            break;
+
+        nblk--;
+    }
+
+    rc2 = ext4_block_set(dir->fs->bdev, &root_blk);
+    if (rc == EOK)
+        rc = rc2;
+
+    if (rc != EOK)
+        return rc;
+
+    return ext4_fs_truncate_inode(dir, (uint64_t)nblk * block_size);
+}
+
+/**@brief Merge sparse neighbouring leaves under all bottom level index
+ *        nodes of the subtree.
+ * @param dir     Directory i-node
+ * @param blk     Index node block (root or inner node)
+ * @param entries Entries of index node
+ * @param levels  Index levels below this node
+ * @param buf     Working buffer (block size)
+ * @param freed   Output array of released logical blocks
+ * @param nfreed  Number of released blocks
+ * @return Error code
+ */
+static int ext4_dir_dx_compact_tree(struct ext4_inode_ref *dir,
+                    struct ext4_block *blk,
+                    struct ext4_dir_idx_entry *entries,
+                    uint8_t levels, uint8_t *buf,
+                    uint32_t *freed, uint32_t *nfreed)
+{
+    uint16_t cnt = ext4_dir_dx_climit_get_count((void *)entries);
+    uint32_t n0 = *nfreed;
+    uint16_t i;
+    int rc = EOK, rc2;
+
+    if (levels == 0) {
+        rc = ext4_dir_dx_compact_node(dir, entries, 0, cnt, buf,
+                          freed, nfreed);
+        if (*nfreed != n0) {
+            ext4_dir_set_dx_csum(dir, (void *)blk->data);
+            ext4_trans_set_inode_block_dirty(blk->buf, dir->index, true);
+        }
+
+        return rc;
+    }
+
+    for (i = 0; i < cnt && rc == EOK; i++) {
+        struct ext4_block b;
+        struct ext4_dir_idx_entry *en;
+
+        rc = ext4_dir_dx_block_get(dir,
+                ext4_dir_dx_entry_get_block(entries + i), &b, false);
+        if (rc != EOK)
+            break;
+
+        en = ((struct ext4_dir_idx_node *)b.data)->entries;
+        rc = ext4_dir_dx_compact_tree(dir, &b, en, levels - 1, buf,
+                          freed, nfreed);
+
+        rc2 = ext4_block_set(dir->fs->bdev, &b);
+        if (rc == EOK)
+            rc = rc2;
+    }
+
+    return rc;
+}
+
+int ext4_dir_dx_compact(struct ext4_inode_ref *dir)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint32_t nblk = ext4_inode_get_size(sb, dir->inode) / block_size;
+    uint32_t nfreed = 0;
+    uint32_t *freed;
+    uint8_t *buf;
+    struct ext4_block root_blk;
+    struct ext4_hash_info hinfo;
+    int rc, rc2;
+
+    if (!ext4_sb_feature_com(sb, EXT4_FCOM_DIR_INDEX) ||
+        !ext4_inode_has_flag(dir->inode, EXT4_INODE_FLAG_INDEX))
+        return EOK;
+
+    rc = ext4_dir_dx_block_get(dir, 0, &root_blk, false);
+    if (rc != EOK)
+        return rc;
+
+    rc = ext4_dir_hinfo_init(&hinfo, &root_blk, sb, 0, NULL);
+    if (rc != EOK) {
+        ext4_block_set(dir->fs->bdev, &root_blk);
+        return EXT4_ERR_BAD_DX_DIR;
+    }
+
+    freed = ext4_malloc(nblk * sizeof(uint32_t));
+    buf = ext4_malloc(block_size);
+    if (!freed || !buf) {
+        rc = ENOMEM;
+        goto Finish;
+    }
+
+    struct ext4_dir_idx_root *root = (void *)root_blk.data;
+    rc = ext4_dir_dx_compact_tree(dir, &root_blk, root->en,
+            ext4_dir_dx_rinfo_get_indirect_levels(&root->info), buf,
+            freed, &nfreed);
+
+Finish:
+    rc2 = ext4_block_set(dir->fs->bdev, &root_blk);
+    if (rc == EOK)
+        rc = rc2;
+
+    if (rc == EOK && nfreed)
+        rc = ext4_dir_dx_release_blocks(dir, freed, nfreed);
+
+    ext4_free(freed);
+    ext4_free(buf);
+    return rc;
+}
+
 /**
  * @}
  */
@@ -500,6 +500,12 @@ static ext4_fsblk_t ext4_new_meta_blocks(struct ext4_inode_ref *inode_ref,
 {
     ext4_fsblk_t block = 0;
 
+    /* Data extents may ask for a whole run of blocks */
+    if (count && *count > 1) {
+        *errp = ext4_balloc_alloc_blocks(inode_ref, goal, &block, count);
+        return *errp == EOK ? block : 0;
+    }
+
     *errp = ext4_allocate_single_block(inode_ref, goal, &block);
     if (count)
         *count = 1;
@@ -693,7 +699,8 @@ static int ext4_ext_dirty(struct ext4_inode_ref *inode_ref,
               struct ext4_extent_path *path)
 {
     if (path->block.lb_id)
-        ext4_trans_set_block_dirty(path->block.buf);
+        ext4_trans_set_inode_block_dirty(path->block.buf, inode_ref->index,
+                             true);
     else
         inode_ref->dirty = true;
 
@@ -1070,7 +1077,7 @@ static int ext4_ext_split_node(struct ext4_inode_ref *inode_ref,
             npath[npath_at].header = neh;
             npath[npath_at].block = bh;
 
-            ext4_trans_set_block_dirty(bh.buf);
+            ext4_trans_set_inode_block_dirty(bh.buf, inode_ref->index, true);
         } else {
             int m = EXT_MAX_INDEX(path[i].header) - path[i].index;
             struct ext4_extent_header *neh;
@@ -1102,7 +1109,7 @@ static int ext4_ext_split_node(struct ext4_inode_ref *inode_ref,
             npath[npath_at].header = neh;
             npath[npath_at].block = bh;
 
-            ext4_trans_set_block_dirty(bh.buf);
+            ext4_trans_set_inode_block_dirty(bh.buf, inode_ref->index, true);
         }
     }
     newblock = 0;
@@ -1194,6 +1201,10 @@ static int ext4_ext_correct_indexes(struct ext4_inode_ref *inode_ref,
 static inline bool ext4_ext_can_prepend(struct ext4_extent *ex1,
                     struct ext4_extent *ex2)
 {
+    /* Unwritten and written blocks never share an extent */
+    if (ext4_ext_is_unwritten(ex1) != ext4_ext_is_unwritten(ex2))
+        return 0;
+
     if (ext4_ext_pblock(ex2) + ext4_ext_get_actual_len(ex2) !=
         ext4_ext_pblock(ex1))
         return 0;
@@ -1222,6 +1233,10 @@ static inline bool ext4_ext_can_prepend(struct ext4_extent *ex1,
 static inline bool ext4_ext_can_append(struct ext4_extent *ex1,
                        struct ext4_extent *ex2)
 {
+    /* Unwritten and written blocks never share an extent */
+    if (ext4_ext_is_unwritten(ex1) != ext4_ext_is_unwritten(ex2))
+        return 0;
+
     if (ext4_ext_pblock(ex1) + ext4_ext_get_actual_len(ex1) !=
         ext4_ext_pblock(ex2))
         return 0;
@@ -1280,12 +1295,19 @@ static int ext4_ext_insert_leaf(struct ext4_inode_ref *inode_ref,
             ext4_ext_can_prepend(curp->extent, newext)) {
             unwritten = ext4_ext_is_unwritten(curp->extent);
             curp->extent->first_block = newext->first_block;
+            ext4_ext_store_pblock(curp->extent,
+                          ext4_ext_pblock(newext));
             curp->extent->block_count =
                 to_le16(ext4_ext_get_actual_len(curp->extent) +
                     ext4_ext_get_actual_len(newext));
             if (unwritten)
                 ext4_ext_mark_unwritten(curp->extent);
 
+            /* The leaf may start at a lower block now */
+            err = ext4_ext_correct_indexes(inode_ref, path);
+            if (err != EOK)
+                goto out;
+
             err = ext4_ext_dirty(inode_ref, curp);
             goto out;
         }
@@ -1410,7 +1432,7 @@ static int ext4_ext_grow_indepth(struct ext4_inode_ref *inode_ref,
     }
     neh->depth = to_le16(to_le16(neh->depth) + 1);
 
-    ext4_trans_set_block_dirty(bh.buf);
+    ext4_trans_set_inode_block_dirty(bh.buf, inode_ref->index, true);
     inode_ref->dirty = true;
     ext4_block_set(inode_ref->fs->bdev, &bh);
 
@@ -1701,6 +1723,36 @@ static bool ext4_ext_more_to_rm(struct ext4_extent_path *path, ext4_lblk_t to)
     return true;
 }
 
+static ext4_lblk_t ext4_ext_next_allocated_block(struct ext4_extent_path *path)
+{
+    int32_t depth;
+
+    depth = path->depth;
+
+    if (depth == 0 && path->extent == NULL)
+        return EXT_MAX_BLOCKS;
+
+    while (depth >= 0) {
+        if (depth == path->depth) {
+            /* leaf */
+            if (path[depth].extent &&
+                path[depth].extent !=
+                EXT_LAST_EXTENT(path[depth].header))
+                return to_le32(
+                    path[depth].extent[1].first_block);
+        } else {
+            /* index */
+            if (path[depth].index !=
+                EXT_LAST_INDEX(path[depth].header))
+                return to_le32(
+                    path[depth].index[1].first_block);
+        }
+        depth--;
+    }
+
+    return EXT_MAX_BLOCKS;
+}
+
 int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
                  ext4_lblk_t to)
 {
@@ -1722,8 +1774,20 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
                  ext4_ext_get_actual_len(path[depth].extent));
 
     if (!in_range) {
-        ret = EOK;
-        goto out;
+        /* The range starts in a hole: go on from the next extent */
+        ext4_lblk_t next = to_le32(path[depth].extent->first_block);
+        if (from > next)
+            next = ext4_ext_next_allocated_block(path);
+
+        if (next == EXT_MAX_BLOCKS || next > to) {
+            ret = EOK;
+            goto out;
+        }
+
+        from = next;
+        ret = ext4_find_extent(inode_ref, from, &path, 0);
+        if (ret != EOK)
+            goto out;
     }
 
     /* If we do remove_space inside the range of an extent */
@@ -1737,6 +1801,9 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
         int32_t len = ext4_ext_get_actual_len(ex);
         ext4_fsblk_t newblock = to + 1 - ee_block + ext4_ext_pblock(ex);
 
+        /* the middle of the extent goes, its head and tail stay */
+        ext4_ext_remove_blocks(inode_ref, ex, from, to);
+
         ex->block_count = to_le16(from - ee_block);
         if (unwritten)
             ext4_ext_mark_unwritten(ex);
@@ -1900,66 +1967,90 @@ restore_extent_len:
     return err;
 }
 
-static int ext4_ext_convert_to_initialized(struct ext4_inode_ref *inode_ref,
-                       struct ext4_extent_path **ppath,
-                       ext4_lblk_t split, uint32_t blocks)
+/**@brief Move the head of an extent over to its left neighbour, so
+ *        a range converted block by block stays one extent.
+ * @return true if the range was merged*/
+static bool ext4_ext_convert_merge_left(struct ext4_extent_path *path,
+                    uint32_t blocks, bool unwritten)
 {
-    int32_t depth = ext_depth(inode_ref->inode), err = EOK;
-    struct ext4_extent *ex = (*ppath)[depth].extent;
+    struct ext4_extent *ex = path->extent;
+    struct ext4_extent *prev;
+    uint32_t ee_len = ext4_ext_get_actual_len(ex);
+    uint32_t prev_len;
 
-    ext4_assert(to_le32(ex->first_block) <= split);
-
-    if (split + blocks ==
-        to_le32(ex->first_block) + ext4_ext_get_actual_len(ex)) {
-        /* split and initialize right part */
-        err = ext4_ext_split_extent_at(inode_ref, ppath, split,
-                           EXT4_EXT_MARK_UNWRIT1);
-    } else if (to_le32(ex->first_block) == split) {
-        /* split and initialize left part */
-        err = ext4_ext_split_extent_at(inode_ref, ppath, split + blocks,
-                           EXT4_EXT_MARK_UNWRIT2);
-    } else {
-        /* split 1 extent to 3 and initialize the 2nd */
-        err = ext4_ext_split_extent_at(inode_ref, ppath, split + blocks,
-                           EXT4_EXT_MARK_UNWRIT1 |
-                           EXT4_EXT_MARK_UNWRIT2);
-        if (err == EOK) {
-            err = ext4_ext_split_extent_at(inode_ref, ppath, split,
-                               EXT4_EXT_MARK_UNWRIT1);
-        }
-    }
+    if (ex == EXT_FIRST_EXTENT(path->header) || blocks >= ee_len)
+        return false;
 
-    return err;
+    prev = ex - 1;
+    prev_len = ext4_ext_get_actual_len(prev);
+    if (!ext4_ext_is_unwritten(prev) != !unwritten ||
+        to_le32(prev->first_block) + prev_len != to_le32(ex->first_block) ||
+        ext4_ext_pblock(prev) + prev_len != ext4_ext_pblock(ex) ||
+        prev_len + blocks > (unwritten ? EXT_UNWRITTEN_MAX_LEN
+                       : EXT_INIT_MAX_LEN))
+        return false;
+
+    prev->block_count = to_le16(prev_len + blocks);
+    if (unwritten)
+        ext4_ext_mark_unwritten(prev);
+
+    ex->first_block = to_le32(to_le32(ex->first_block) + blocks);
+    ext4_ext_store_pblock(ex, ext4_ext_pblock(ex) + blocks);
+    ex->block_count = to_le16(ee_len - blocks);
+    if (!unwritten)
+        ext4_ext_mark_unwritten(ex);
+
+    return true;
 }
 
-static ext4_lblk_t ext4_ext_next_allocated_block(struct ext4_extent_path *path)
+/**@brief Switch a range of the extent found by the path between the
+ *        written and unwritten state, splitting the extent as needed.
+ * @param inode_ref I-node the extent belongs to
+ * @param ppath Path to the extent holding the whole range
+ * @param split First block of the range
+ * @param blocks Range length
+ * @param unwritten New state of the range
+ * @return Error code*/
+static int ext4_ext_convert_range(struct ext4_inode_ref *inode_ref,
+                  struct ext4_extent_path **ppath,
+                  ext4_lblk_t split, uint32_t blocks,
+                  bool unwritten)
 {
-    int32_t depth;
+    int32_t depth = ext_depth(inode_ref->inode), err = EOK;
+    struct ext4_extent *ex = (*ppath)[depth].extent;
+    ext4_lblk_t ee_block = to_le32(ex->first_block);
+    uint32_t ee_len = ext4_ext_get_actual_len(ex);
+    uint32_t old_flag, new_flag;
 
-    depth = path->depth;
+    ext4_assert(ee_block <= split && split + blocks <= ee_block + ee_len);
 
-    if (depth == 0 && path->extent == NULL)
-        return EXT_MAX_BLOCKS;
+    if (ext4_ext_is_unwritten(ex) == unwritten)
+        return EOK;
 
-    while (depth >= 0) {
-        if (depth == path->depth) {
-            /* leaf */
-            if (path[depth].extent &&
-                path[depth].extent !=
-                EXT_LAST_EXTENT(path[depth].header))
-                return to_le32(
-                    path[depth].extent[1].first_block);
-        } else {
-            /* index */
-            if (path[depth].index !=
-                EXT_LAST_INDEX(path[depth].header))
-                return to_le32(
-                    path[depth].index[1].first_block);
-        }
-        depth--;
+    if (split == ee_block &&
+        ext4_ext_convert_merge_left(*ppath + depth, blocks, unwritten))
+        return ext4_ext_dirty(inode_ref, *ppath + depth);
+
+    old_flag = unwritten ? 0 : EXT4_EXT_MARK_UNWRIT1;
+    new_flag = unwritten ? EXT4_EXT_MARK_UNWRIT2 : 0;
+
+    if (split + blocks < ee_block + ee_len) {
+        /* cut the tail off, it keeps the old state */
+        err = ext4_ext_split_extent_at(
+            inode_ref, ppath, split + blocks,
+            old_flag | (old_flag ? EXT4_EXT_MARK_UNWRIT2 : 0));
+        if (err != EOK)
+            return err;
+
+        /* the insert left the path at the tail */
+        err = ext4_find_extent(inode_ref, split, ppath, 0);
+        if (err != EOK)
+            return err;
     }
 
-    return EXT_MAX_BLOCKS;
+    /* the range is the tail now (or the whole extent) */
+    return ext4_ext_split_extent_at(inode_ref, ppath, split,
+                    old_flag | new_flag);
 }
 
 static int ext4_ext_zero_unwritten_range(struct ext4_inode_ref *inode_ref,
@@ -1969,19 +2060,23 @@ static int ext4_ext_zero_unwritten_range(struct ext4_inode_ref *inode_ref,
     int err = EOK;
     uint32_t i;
     uint32_t block_size = ext4_sb_get_block_size(&inode_ref->fs->sb);
-    for (i = 0; i < blocks_count; i++) {
-        struct ext4_block bh = EXT4_BLOCK_ZERO();
-        err = ext4_trans_block_get_noread(inode_ref->fs->bdev, &bh,
-                          block + i);
-        if (err != EOK)
-            break;
+    struct ext4_blockdev *bdev = inode_ref->fs->bdev;
+    void *zero;
+
+    /* File data bypass the block cache, so do the zeros: a cached
+     * copy written back later would wipe out the data.*/
+    zero = ext4_calloc(1, block_size);
+    if (!zero)
+        return ENOMEM;
 
-        memset(bh.data, 0, block_size);
-        ext4_trans_set_block_dirty(bh.buf);
-        err = ext4_block_set(inode_ref->fs->bdev, &bh);
+    for (i = 0; i < blocks_count; i++) {
+        err = ext4_blocks_set_direct(bdev, zero, block + i, 1);
         if (err != EOK)
             break;
     }
+
+    ext4_bcache_invalidate_lba(bdev->bc, block, blocks_count);
+    ext4_free(zero);
     return err;
 }
 
@@ -2012,7 +2107,7 @@ __unused static void print_path(struct ext4_extent_path *path)
 
 int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
                uint32_t max_blocks, ext4_fsblk_t *result,
-               bool create, uint32_t *blocks_count)
+               uint32_t flags, uint32_t *blocks_count)
 {
     struct ext4_extent_path *path = NULL;
     struct ext4_extent newex, *ex;
@@ -2022,6 +2117,8 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
     uint32_t allocated = 0;
     ext4_lblk_t next;
     ext4_fsblk_t newblock;
+    bool create = flags & EXT4_EXT_GET_CREATE;
+    bool unwritten = create && (flags & EXT4_EXT_GET_UNWRITTEN);
 
     if (result)
         *result = 0;
@@ -2052,9 +2149,23 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
         if (IN_RANGE(iblock, ee_block, ee_len)) {
             /* number of remain blocks in the extent */
             allocated = ee_len - (iblock - ee_block);
+            if (allocated > max_blocks)
+                allocated = max_blocks;
 
+            newblock = iblock - ee_block + ee_start;
             if (!ext4_ext_is_unwritten(ex)) {
-                newblock = iblock - ee_block + ee_start;
+                if (!unwritten || !(flags & EXT4_EXT_GET_ZERO))
+                    goto out;
+
+                /* drop the data, the range reads as zeros */
+                if (allocated > EXT_UNWRITTEN_MAX_LEN)
+                    allocated = EXT_UNWRITTEN_MAX_LEN;
+
+                err = ext4_ext_convert_range(inode_ref, &path,
+                                 iblock, allocated, true);
+                if (err != EOK)
+                    goto out2;
+
                 goto out;
             }
 
@@ -2063,19 +2174,18 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
                 goto out;
             }
 
-            uint32_t zero_range;
-            zero_range = allocated;
-            if (zero_range > max_blocks)
-                zero_range = max_blocks;
+            if (unwritten)
+                goto out;
 
-            newblock = iblock - ee_block + ee_start;
-            err = ext4_ext_zero_unwritten_range(inode_ref, newblock,
-                                zero_range);
-            if (err != EOK)
-                goto out2;
+            if (!(flags & EXT4_EXT_GET_NOZERO)) {
+                err = ext4_ext_zero_unwritten_range(
+                    inode_ref, newblock, allocated);
+                if (err != EOK)
+                    goto out2;
+            }
 
-            err = ext4_ext_convert_to_initialized(
-                inode_ref, &path, iblock, zero_range);
+            err = ext4_ext_convert_range(inode_ref, &path, iblock,
+                             allocated, false);
             if (err != EOK)
                 goto out2;
 
@@ -2083,21 +2193,29 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
         }
     }
 
-    /*
-     * requested block isn't allocated yet
-     * we couldn't try to create block if create flag is zero
-     */
-    if (!create) {
-        goto out2;
-    }
-
     /* find next allocated block so that we know how many
      * blocks we can allocate without ovelapping next extent */
     next = ext4_ext_next_allocated_block(path);
+    if (ex && iblock < to_le32(ex->first_block))
+        next = to_le32(ex->first_block);
+
     allocated = next - iblock;
     if (allocated > max_blocks)
         allocated = max_blocks;
 
+    /*
+     * requested block isn't allocated yet
+     * we couldn't try to create block if create flag is zero,
+     * only report the length of the hole
+     */
+    if (!create) {
+        newblock = 0;
+        goto out;
+    }
+
+    if (allocated > (unwritten ? EXT_UNWRITTEN_MAX_LEN : EXT_INIT_MAX_LEN))
+        allocated = unwritten ? EXT_UNWRITTEN_MAX_LEN : EXT_INIT_MAX_LEN;
+
     /* allocate new block */
     goal = ext4_ext_find_goal(inode_ref, path, iblock);
     newblock = ext4_new_meta_blocks(inode_ref, goal, 0, &allocated, &err);
@@ -2108,17 +2226,16 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
     newex.first_block = to_le32(iblock);
     ext4_ext_store_pblock(&newex, newblock);
     newex.block_count = to_le16(allocated);
+    if (unwritten)
+        ext4_ext_mark_unwritten(&newex);
+
     err = ext4_ext_insert_extent(inode_ref, &path, &newex, 0);
     if (err != EOK) {
         /* free data blocks we just allocated */
-        ext4_ext_free_blocks(inode_ref, ext4_ext_pblock(&newex),
-                     to_le16(newex.block_count), 0);
+        ext4_ext_free_blocks(inode_ref, newblock, allocated, 0);
         goto out2;
     }
 
-    /* previous routine could use block we allocated */
-    newblock = ext4_ext_pblock(&newex);
-
 out:
     if (allocated > max_blocks)
         allocated = max_blocks;
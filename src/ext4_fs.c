@@ -55,8 +55,11 @@
 #include <ext4_inode.h>
 #include <ext4_ialloc.h>
 #include <ext4_extent.h>
+#include <ext4_inline.h>
+#include <ext4_xattr.h>
 
 #include <string.h>
+#include <stdlib.h>
 
 int ext4_fs_init(struct ext4_fs *fs, struct ext4_blockdev *bdev,
          bool read_only)
@@ -70,6 +73,14 @@ int ext4_fs_init(struct ext4_fs *fs, struct ext4_blockdev *bdev,
     fs->bdev = bdev;
 
     fs->read_only = read_only;
+    fs->dx_scratch = NULL;
+    fs->bg_stats = NULL;
+#if CONFIG_DCACHE_ENABLE
+    ext4_dcache_init(&fs->dcache);
+#endif
+#if CONFIG_XCACHE_ENABLE
+    ext4_xcache_init(&fs->xcache);
+#endif
 
     r = ext4_sb_read(fs->bdev, &fs->sb);
     if (r != EOK)
@@ -127,6 +138,17 @@ int ext4_fs_fini(struct ext4_fs *fs)
 {
     ext4_assert(fs);
 
+#if CONFIG_DCACHE_ENABLE
+    ext4_dcache_purge(&fs->dcache);
+#endif
+#if CONFIG_XCACHE_ENABLE
+    ext4_xcache_purge(&fs->xcache);
+#endif
+
+    ext4_free(fs->dx_scratch);
+    fs->dx_scratch = NULL;
+    ext4_ialloc_stats_drop(fs);
+
     /*Set superblock state*/
     ext4_set16(&fs->sb, state, EXT4_SUPERBLOCK_STATE_VALID_FS);
 
@@ -228,6 +250,10 @@ int ext4_fs_check_features(struct ext4_fs *fs, bool *read_only)
     /*Check features_incompatible*/
     v = (ext4_get32(&fs->sb, features_incompatible) &
          (~CONFIG_SUPPORTED_FINCOM));
+#if !CONFIG_INLINE_DATA_ENABLE
+    v |= ext4_get32(&fs->sb, features_incompatible) &
+         EXT4_FINCOM_INLINE_DATA;
+#endif
     if (v) {
         ext4_dbg(DEBUG_FS, DBG_ERROR
                 "sblock has unsupported features incompatible:\n");
@@ -644,12 +670,25 @@ int ext4_fs_put_block_group_ref(struct ext4_block_group_ref *ref)
 
         /* Mark block dirty for writing changes to physical device */
         ext4_trans_set_block_dirty(ref->block.buf);
+
+        /* Keep cached counters in sync */
+        if (ref->fs->bg_stats)
+            ext4_fs_bg_stats_fill(ref->fs->bg_stats + ref->index,
+                          ref->block_group, &ref->fs->sb);
     }
 
     /* Put back block, that contains block group descriptor */
     return ext4_block_set(ref->fs->bdev, &ref->block);
 }
 
+void ext4_fs_bg_stats_fill(struct ext4_bg_stats *st, struct ext4_bgroup *bg,
+               struct ext4_sblock *sb)
+{
+    st->free_inodes = ext4_bg_get_free_inodes_count(bg, sb);
+    st->free_blocks = ext4_bg_get_free_blocks_count(bg, sb);
+    st->used_dirs = ext4_bg_get_used_dirs_count(bg, sb);
+}
+
 #if CONFIG_META_CSUM_ENABLE
 static uint32_t ext4_fs_inode_checksum(struct ext4_inode_ref *inode_ref)
 {
@@ -702,19 +741,20 @@ static void ext4_fs_set_inode_checksum(struct ext4_inode_ref *inode_ref)
     ext4_inode_set_csum(sb, inode_ref->inode, csum);
 }
 
-#if CONFIG_META_CSUM_ENABLE
-static bool ext4_fs_verify_inode_csum(struct ext4_inode_ref *inode_ref)
+bool ext4_fs_verify_inode_csum(struct ext4_inode_ref *inode_ref)
 {
+#if CONFIG_META_CSUM_ENABLE
     struct ext4_sblock *sb = &inode_ref->fs->sb;
     if (!ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
         return true;
 
     return ext4_inode_get_csum(sb, inode_ref->inode) ==
         ext4_fs_inode_checksum(inode_ref);
-}
 #else
-#define ext4_fs_verify_inode_csum(...) true
+    (void)inode_ref;
+    return true;
 #endif
+}
 
 static int
 __ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
@@ -853,7 +893,7 @@ uint32_t ext4_fs_correspond_inode_mode(int filetype)
 }
 
 int ext4_fs_alloc_inode(struct ext4_fs *fs, struct ext4_inode_ref *inode_ref,
-            int filetype)
+            int filetype, uint32_t parent)
 {
     /* Check if newly allocated i-node will be a directory */
     bool is_dir;
@@ -863,7 +903,7 @@ int ext4_fs_alloc_inode(struct ext4_fs *fs, struct ext4_inode_ref *inode_ref,
 
     /* Allocate inode by allocation algorithm */
     uint32_t index;
-    int rc = ext4_ialloc_alloc_inode(fs, &index, is_dir);
+    int rc = ext4_ialloc_alloc_inode(fs, &index, is_dir, parent);
     if (rc != EOK)
         return rc;
 
@@ -930,12 +970,87 @@ int ext4_fs_alloc_inode(struct ext4_fs *fs, struct ext4_inode_ref *inode_ref,
     return EOK;
 }
 
+/**@brief Check that an orphan list link refers to an existing i-node.
+ * @param sb superblock
+ * @param index i-node number
+ * @return true if the link may be followed*/
+static bool ext4_fs_orphan_valid(struct ext4_sblock *sb, uint32_t index)
+{
+    return index && index <= ext4_get32(sb, inodes_count);
+}
+
+int ext4_fs_orphan_add(struct ext4_inode_ref *inode_ref)
+{
+    struct ext4_fs *fs = inode_ref->fs;
+    struct ext4_sblock *sb = &fs->sb;
+
+    /* The deletion time of an orphan holds the next list entry. */
+    ext4_inode_set_del_time(inode_ref->inode, ext4_get32(sb, last_orphan));
+    inode_ref->dirty = true;
+
+    ext4_set32(sb, last_orphan, inode_ref->index);
+    return ext4_sb_write_trans(fs->bdev, sb);
+}
+
+int ext4_fs_orphan_del(struct ext4_inode_ref *inode_ref)
+{
+    struct ext4_fs *fs = inode_ref->fs;
+    struct ext4_sblock *sb = &fs->sb;
+    struct ext4_inode_ref prev;
+    uint32_t next = ext4_inode_get_del_time(inode_ref->inode);
+    uint32_t index = ext4_get32(sb, last_orphan);
+    uint32_t limit = ext4_get32(sb, inodes_count);
+    int r;
+
+    if (!ext4_fs_orphan_valid(sb, next))
+        next = 0;
+
+    ext4_inode_set_del_time(inode_ref->inode, 0);
+    inode_ref->dirty = true;
+
+    if (index == inode_ref->index) {
+        ext4_set32(sb, last_orphan, next);
+        return ext4_sb_write_trans(fs->bdev, sb);
+    }
+
+    /* Find the predecessor, the list is normally short. */
+    while (ext4_fs_orphan_valid(sb, index) && limit--) {
+        r = ext4_fs_get_inode_ref(fs, index, &prev);
+        if (r != EOK)
+            return r;
+
+        index = ext4_inode_get_del_time(prev.inode);
+        if (index == inode_ref->index) {
+            ext4_inode_set_del_time(prev.inode, next);
+            prev.dirty = true;
+            return ext4_fs_put_inode_ref(&prev);
+        }
+
+        r = ext4_fs_put_inode_ref(&prev);
+        if (r != EOK)
+            return r;
+    }
+
+    return ENOENT;
+}
+
 int ext4_fs_free_inode(struct ext4_inode_ref *inode_ref)
 {
     struct ext4_fs *fs = inode_ref->fs;
     uint32_t offset;
     uint32_t suboff;
     int rc;
+#if CONFIG_DCACHE_ENABLE
+    ext4_dcache_invalidate_inode(&fs->dcache, inode_ref->index);
+#endif
+#if CONFIG_XCACHE_ENABLE && CONFIG_XCACHE_INODES
+    ext4_xcache_inode_drop(&fs->xcache, inode_ref->index);
+#endif
+#if CONFIG_INLINE_DATA_ENABLE
+    /* Inline data have no blocks */
+    if (ext4_inline_has_data(inode_ref))
+        goto finish;
+#endif
 #if CONFIG_EXTENT_ENABLE
     /* For extents must be data block destroyed by other way */
     if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
@@ -1049,6 +1164,12 @@ finish:
     inode_ref->dirty = true;
 
     /* Free block with extended attributes if present */
+#if CONFIG_XATTR_ENABLE
+    /* It may be shared with other i-nodes */
+    rc = ext4_xattr_release_block(inode_ref);
+    if (rc != EOK)
+        return rc;
+#else
     ext4_fsblk_t xattr_block =
         ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
     if (xattr_block) {
@@ -1058,6 +1179,7 @@ finish:
 
         ext4_inode_set_file_acl(inode_ref->inode, &fs->sb, 0);
     }
+#endif
 
     /* Free inode by allocator */
     if (ext4_inode_is_type(&fs->sb, inode_ref->inode,
@@ -1145,7 +1267,7 @@ static int ext4_fs_release_inode_block(struct ext4_inode_ref *inode_ref,
         /* Set zero if physical data block address found */
         if (level == 1) {
             ((uint32_t *)block.data)[offset_in_block] = to_le32(0);
-            ext4_trans_set_block_dirty(block.buf);
+            ext4_trans_set_inode_block_dirty(block.buf, inode_ref->index, true);
         }
 
         rc = ext4_block_set(fs->bdev, &block);
@@ -1175,6 +1297,23 @@ static int ext4_fs_release_inode_block(struct ext4_inode_ref *inode_ref,
     return ext4_balloc_free_block(inode_ref, fblock);
 }
 
+bool ext4_fs_inode_has_eof_blocks(struct ext4_inode_ref *inode_ref)
+{
+#if CONFIG_EXTENT_ENABLE
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+
+    /* Cheap test: extent file holding any block may have some
+     * preallocated past its end */
+    return ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS) &&
+           ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS) &&
+           ext4_inode_get_blocks_count(sb, inode_ref->inode) &&
+           !ext4_inline_has_data(inode_ref);
+#else
+    (void)inode_ref;
+    return false;
+#endif
+}
+
 int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
 {
     struct ext4_sblock *sb = &inode_ref->fs->sb;
@@ -1186,15 +1325,21 @@ int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
     if (!ext4_inode_can_truncate(sb, inode_ref->inode))
         return EINVAL;
 
-    /* If sizes are equal, nothing has to be done. */
+    /* If sizes are equal, nothing has to be done, but for the blocks
+     * an extent file may have preallocated past its end. */
     uint64_t old_size = ext4_inode_get_size(sb, inode_ref->inode);
-    if (old_size == new_size)
+    if (old_size == new_size && !ext4_fs_inode_has_eof_blocks(inode_ref))
         return EOK;
 
     /* It's not supported to make the larger file by truncate operation */
     if (old_size < new_size)
         return EINVAL;
 
+#if CONFIG_INLINE_DATA_ENABLE
+    if (ext4_inline_has_data(inode_ref))
+        return ext4_inline_truncate(inode_ref, new_size);
+#endif
+
     /* For symbolic link which is small enough */
     v = ext4_inode_is_type(sb, inode_ref->inode, EXT4_INODE_MODE_SOFTLINK);
     if (v && old_size < sizeof(inode_ref->inode->blocks) &&
@@ -1228,8 +1373,9 @@ int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
     if ((ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS)) &&
         (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
 
-        /* Extents require special operation */
-        if (diff_blocks_cnt) {
+        /* Extents require special operation. Everything past the new
+         * end goes, preallocated blocks included. */
+        if (diff_blocks_cnt || ext4_fs_inode_has_eof_blocks(inode_ref)) {
             r = ext4_extent_remove_space(inode_ref, new_blocks_cnt,
                              EXT_MAX_BLOCKS);
             if (r != EOK)
@@ -1345,7 +1491,7 @@ int ext4_fs_indirect_find_goal(struct ext4_inode_ref *inode_ref,
 
 static int ext4_fs_get_inode_dblk_idx_internal(struct ext4_inode_ref *inode_ref,
                        ext4_lblk_t iblock, ext4_fsblk_t *fblock,
-                       bool extent_create,
+                       uint32_t extent_flags,
                        bool support_unwritten __unused)
 {
     struct ext4_fs *fs = inode_ref->fs;
@@ -1356,9 +1502,13 @@ static int ext4_fs_get_inode_dblk_idx_internal(struct ext4_inode_ref *inode_ref,
         return EOK;
     }
 
+    /* Inline data are not mapped to blocks */
+    if (ext4_inline_has_data(inode_ref))
+        return ENOTSUP;
+
     ext4_fsblk_t current_block;
 
-    (void)extent_create;
+    (void)extent_flags;
 #if CONFIG_EXTENT_ENABLE
     /* Handle i-node using extents */
     if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
@@ -1366,7 +1516,7 @@ static int ext4_fs_get_inode_dblk_idx_internal(struct ext4_inode_ref *inode_ref,
 
         ext4_fsblk_t current_fsblk;
         int rc = ext4_extent_get_blocks(inode_ref, iblock, 1,
-                &current_fsblk, extent_create, NULL);
+                &current_fsblk, extent_flags, NULL);
         if (rc != EOK)
             return rc;
 
@@ -1463,14 +1613,50 @@ int ext4_fs_get_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
                    bool support_unwritten)
 {
     return ext4_fs_get_inode_dblk_idx_internal(inode_ref, iblock, fblock,
-                           false, support_unwritten);
+                           0, support_unwritten);
 }
 
 int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
                 ext4_lblk_t iblock, ext4_fsblk_t *fblock)
 {
     return ext4_fs_get_inode_dblk_idx_internal(inode_ref, iblock, fblock,
-                           true, true);
+                           EXT4_EXT_GET_CREATE, true);
+}
+
+int ext4_fs_get_inode_dblk_run(struct ext4_inode_ref *inode_ref,
+                   ext4_lblk_t iblock, uint32_t max_blocks,
+                   ext4_fsblk_t *fblock, uint32_t *count)
+{
+    ext4_fsblk_t next;
+    int r;
+
+    ext4_assert(max_blocks);
+
+#if CONFIG_EXTENT_ENABLE
+    /* One lookup covers a whole extent or hole */
+    if ((ext4_sb_feature_incom(&inode_ref->fs->sb, EXT4_FINCOM_EXTENTS)) &&
+        (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS)) &&
+        ext4_inode_get_size(&inode_ref->fs->sb, inode_ref->inode) &&
+        !ext4_inline_has_data(inode_ref))
+        return ext4_extent_get_blocks(inode_ref, iblock, max_blocks,
+                          fblock, 0, count);
+#endif
+
+    r = ext4_fs_get_inode_dblk_idx(inode_ref, iblock, fblock, true);
+    if (r != EOK)
+        return r;
+
+    for (*count = 1; *count < max_blocks; (*count)++) {
+        r = ext4_fs_get_inode_dblk_idx(inode_ref, iblock + *count, &next,
+                           true);
+        if (r != EOK)
+            return r;
+
+        if (*fblock ? next != *fblock + *count : next != 0)
+            break;
+    }
+
+    return EOK;
 }
 
 static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
@@ -1548,7 +1734,7 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 
         /* Initialize new block */
         memset(new_block.data, 0, block_size);
-        ext4_trans_set_block_dirty(new_block.buf);
+        ext4_trans_set_inode_block_dirty(new_block.buf, inode_ref->index, true);
 
         /* Put back the allocated block */
         rc = ext4_block_set(fs->bdev, &new_block);
@@ -1595,7 +1781,8 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 
             /* Initialize allocated block */
             memset(new_block.data, 0, block_size);
-            ext4_trans_set_block_dirty(new_block.buf);
+            ext4_trans_set_inode_block_dirty(new_block.buf, inode_ref->index,
+                                 true);
 
             rc = ext4_block_set(fs->bdev, &new_block);
             if (rc != EOK) {
@@ -1606,7 +1793,7 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
             /* Write block address to the parent */
             uint32_t * p = (uint32_t * )block.data;
             p[off_in_blk] = to_le32((uint32_t)new_blk);
-            ext4_trans_set_block_dirty(block.buf);
+            ext4_trans_set_inode_block_dirty(block.buf, inode_ref->index, true);
             current_block = new_blk;
         }
 
@@ -1614,7 +1801,7 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
         if (l == 1) {
             uint32_t * p = (uint32_t * )block.data;
             p[off_in_blk] = to_le32((uint32_t)fblock);
-            ext4_trans_set_block_dirty(block.buf);
+            ext4_trans_set_inode_block_dirty(block.buf, inode_ref->index, true);
         }
 
         rc = ext4_block_set(fs->bdev, &block);
@@ -1639,9 +1826,15 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 }
 
 
-int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
-                  ext4_fsblk_t *fblock, ext4_lblk_t *iblock)
+static int ext4_fs_append_inode_dblk_internal(struct ext4_inode_ref *inode_ref,
+                          ext4_fsblk_t *fblock,
+                          ext4_lblk_t *iblock,
+                          uint32_t extent_flags)
 {
+    /* Inline data have to be moved to a block by caller */
+    if (ext4_inline_has_data(inode_ref))
+        return ENOTSUP;
+
 #if CONFIG_EXTENT_ENABLE
     /* Handle extents separately */
     if ((ext4_sb_feature_incom(&inode_ref->fs->sb, EXT4_FINCOM_EXTENTS)) &&
@@ -1654,7 +1847,7 @@ int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
         *iblock = (uint32_t)((inode_size + block_size - 1) / block_size);
 
         rc = ext4_extent_get_blocks(inode_ref, *iblock, 1,
-                        &current_fsblk, true, NULL);
+                        &current_fsblk, extent_flags, NULL);
         if (rc != EOK)
             return rc;
 
@@ -1709,6 +1902,89 @@ int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
     return EOK;
 }
 
+int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
+                  ext4_fsblk_t *fblock, ext4_lblk_t *iblock)
+{
+    return ext4_fs_append_inode_dblk_internal(inode_ref, fblock, iblock,
+                          EXT4_EXT_GET_CREATE);
+}
+
+int ext4_fs_overwrite_inode_dblk(struct ext4_inode_ref *inode_ref,
+                 ext4_lblk_t *iblock, ext4_fsblk_t *fblock)
+{
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+    uint64_t inode_size = ext4_inode_get_size(sb, inode_ref->inode);
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint32_t flags = EXT4_EXT_GET_CREATE | EXT4_EXT_GET_NOZERO;
+
+    if (*iblock < (inode_size + block_size - 1) / block_size)
+        return ext4_fs_get_inode_dblk_idx_internal(inode_ref, *iblock,
+                               fblock, flags, true);
+
+    return ext4_fs_append_inode_dblk_internal(inode_ref, fblock, iblock,
+                          flags);
+}
+
+int ext4_fs_prealloc_inode_dblk(struct ext4_inode_ref *inode_ref,
+                ext4_lblk_t iblock, uint32_t count, bool zero)
+{
+#if CONFIG_EXTENT_ENABLE
+    uint32_t flags = EXT4_EXT_GET_CREATE | EXT4_EXT_GET_UNWRITTEN;
+    uint32_t n;
+    int r;
+
+    if (!ext4_sb_feature_incom(&inode_ref->fs->sb, EXT4_FINCOM_EXTENTS) ||
+        !ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS) ||
+        ext4_inline_has_data(inode_ref))
+        return ENOTSUP;
+
+    if (zero)
+        flags |= EXT4_EXT_GET_ZERO;
+
+    while (count) {
+        r = ext4_extent_get_blocks(inode_ref, iblock, count, NULL, flags,
+                       &n);
+        if (r != EOK)
+            return r;
+
+        if (!n)
+            return EIO;
+
+        iblock += n;
+        count -= n;
+    }
+
+    return EOK;
+#else
+    (void)inode_ref;
+    (void)iblock;
+    (void)count;
+    (void)zero;
+    return ENOTSUP;
+#endif
+}
+
+int ext4_fs_punch_inode_dblk(struct ext4_inode_ref *inode_ref,
+                 ext4_lblk_t iblock, uint32_t count)
+{
+#if CONFIG_EXTENT_ENABLE
+    if (!ext4_sb_feature_incom(&inode_ref->fs->sb, EXT4_FINCOM_EXTENTS) ||
+        !ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS) ||
+        ext4_inline_has_data(inode_ref))
+        return ENOTSUP;
+
+    if (!count)
+        return EOK;
+
+    return ext4_extent_remove_space(inode_ref, iblock, iblock + count - 1);
+#else
+    (void)inode_ref;
+    (void)iblock;
+    (void)count;
+    return ENOTSUP;
+#endif
+}
+
 void ext4_fs_inode_links_count_inc(struct ext4_inode_ref *inode_ref)
 {
     uint16_t link;
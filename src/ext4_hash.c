@@ -153,22 +153,34 @@ static void ext2_half_md4(uint32_t hash[4], uint32_t data[8])
     hash[3] += d;
 }
 
+/*
+ * One TEA cycle.
+ */
+#define TEA_CYCLE(x, y, a, b, c, d, sum, delta)                                \
+    {                                                                      \
+        (sum) += (delta);                                              \
+        (x) += (((y) << 4) + (a)) ^ ((y) + (sum)) ^ (((y) >> 5) + (b));  \
+        (y) += (((x) << 4) + (c)) ^ ((x) + (sum)) ^ (((x) >> 5) + (d));  \
+    \
+}
+
 /*
  * Tiny Encryption Algorithm.
  */
 static void ext2_tea(uint32_t hash[4], uint32_t data[8])
 {
     uint32_t tea_delta = 0x9E3779B9;
-    uint32_t sum;
+    uint32_t sum = 0;
     uint32_t x = hash[0], y = hash[1];
-    int n = 16;
-    int i = 1;
-
-    while (n-- > 0) {
-        sum = i * tea_delta;
-        x += ((y << 4) + data[0]) ^ (y + sum) ^ ((y >> 5) + data[1]);
-        y += ((x << 4) + data[2]) ^ (x + sum) ^ ((x >> 5) + data[3]);
-        i++;
+    uint32_t a = data[0], b = data[1], c = data[2], d = data[3];
+    int n;
+
+    /* 16 cycles, unrolled by 4 */
+    for (n = 0; n < 4; n++) {
+        TEA_CYCLE(x, y, a, b, c, d, sum, tea_delta);
+        TEA_CYCLE(x, y, a, b, c, d, sum, tea_delta);
+        TEA_CYCLE(x, y, a, b, c, d, sum, tea_delta);
+        TEA_CYCLE(x, y, a, b, c, d, sum, tea_delta);
     }
 
     hash[0] += x;
@@ -199,51 +211,48 @@ static uint32_t ext2_legacy_hash(const char *name, int len, int unsigned_char)
     return (h1 << 1);
 }
 
+/*
+ * Pack name into hash input words (big-endian, 4 bytes at a time), the
+ * rest of the buffer is filled with padding derived from the name length.
+ * With signed chars every negative byte borrows one from the byte above
+ * it, which is what adding sign extended bytes one by one results in.
+ */
 static void ext2_prep_hashbuf(const char *src, uint32_t slen, uint32_t *dst,
                   int dlen, int unsigned_char)
 {
     uint32_t padding = slen | (slen << 8) | (slen << 16) | (slen << 24);
-    uint32_t buf_val;
-    int len, i;
-    int buf_byte;
-    const unsigned char *ubuf = (const unsigned char *)src;
-    const signed char *sbuf = (const signed char *)src;
-
-    if (slen > (uint32_t)dlen)
-        len = dlen;
-    else
-        len = slen;
+    const uint8_t *p = (const uint8_t *)src;
+    uint32_t words = (uint32_t)dlen / sizeof(uint32_t);
+    uint32_t len = slen < (uint32_t)dlen ? slen : (uint32_t)dlen;
+    uint32_t tail = len % 4;
+    uint32_t i, w;
+
+    for (i = 0; i < len / 4; i++, p += 4) {
+        w = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+            ((uint32_t)p[2] << 8) | p[3];
+        if (!unsigned_char)
+            w -= (w & 0x00808080) << 1;
+
+        dst[i] = w;
+    }
 
-    buf_val = padding;
+    if (tail) {
+        uint32_t u = p[0];
 
-    for (i = 0; i < len; i++) {
-        if (unsigned_char)
-            buf_byte = (unsigned int)ubuf[i];
-        else
-            buf_byte = (int)sbuf[i];
+        if (tail > 1)
+            u = (u << 8) | p[1];
+        if (tail > 2)
+            u = (u << 8) | p[2];
 
-        if ((i % 4) == 0)
-            buf_val = padding;
+        w = (padding << (8 * tail)) + u;
+        if (!unsigned_char)
+            w -= (u & (0x80808080 >> (32 - 8 * tail))) << 1;
 
-        buf_val <<= 8;
-        buf_val += buf_byte;
-
-        if ((i % 4) == 3) {
-            *dst++ = buf_val;
-            dlen -= sizeof(uint32_t);
-            buf_val = padding;
-        }
+        dst[i++] = w;
     }
 
-    dlen -= sizeof(uint32_t);
-    if (dlen >= 0)
-        *dst++ = buf_val;
-
-    dlen -= sizeof(uint32_t);
-    while (dlen >= 0) {
-        *dst++ = padding;
-        dlen -= sizeof(uint32_t);
-    }
+    while (i < words)
+        dst[i++] = padding;
 }
 
 int ext2_htree_hash(const char *name, int len, const uint32_t *hash_seed,
@@ -322,6 +331,26 @@ error:
     return ENOTSUP;
 }
 
+int ext2_htree_hash_batch(const char *const *names, size_t count,
+              const uint32_t *hash_seed, int hash_version,
+              uint32_t *hash_major)
+{
+    size_t i;
+    int r;
+
+    if (!names || !hash_major)
+        return EINVAL;
+
+    for (i = 0; i < count; i++) {
+        r = ext2_htree_hash(names[i], (int)strlen(names[i]), hash_seed,
+                    hash_version, &hash_major[i], NULL);
+        if (r != EOK)
+            return r;
+    }
+
+    return EOK;
+}
+
 /**
  * @}
  */
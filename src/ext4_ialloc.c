@@ -54,6 +54,8 @@
 #include <ext4_block_group.h>
 #include <ext4_bitmap.h>
 
+#include <stdlib.h>
+
 /**@brief  Convert i-node number to relative index in block group.
  * @param sb    Superblock
  * @param inode I-node number to be converted
@@ -226,137 +228,324 @@ int ext4_ialloc_free_inode(struct ext4_fs *fs, uint32_t index, bool is_dir)
     return EOK;
 }
 
-int ext4_ialloc_alloc_inode(struct ext4_fs *fs, uint32_t *idx, bool is_dir)
+/**@brief Try to allocate i-node in one block group.
+ * @param fs     Filesystem
+ * @param bgid   Block group to allocate from
+ * @param is_dir Allocated i-node will be a directory
+ * @param idx    Output value - allocated i-node number
+ * @return EOK, ENOSPC if the group has no free i-node or error code
+ */
+static int ext4_ialloc_alloc_in_group(struct ext4_fs *fs, uint32_t bgid,
+                      bool is_dir, uint32_t *idx)
 {
     struct ext4_sblock *sb = &fs->sb;
+    struct ext4_block_group_ref bg_ref;
+    int rc = ext4_fs_get_block_group_ref(fs, bgid, &bg_ref);
+    if (rc != EOK)
+        return rc;
 
-    uint32_t bgid = fs->last_inode_bg_id;
+    struct ext4_bgroup *bg = bg_ref.block_group;
+
+    /* Read necessary values for algorithm */
+    uint32_t free_inodes = ext4_bg_get_free_inodes_count(bg, sb);
+    uint32_t used_dirs = ext4_bg_get_used_dirs_count(bg, sb);
+
+    /* Check if this block group is good candidate for allocation */
+    if (free_inodes == 0) {
+        ext4_fs_put_block_group_ref(&bg_ref);
+        return ENOSPC;
+    }
+
+    /* Load block with bitmap */
+    ext4_fsblk_t bmp_blk_add = ext4_bg_get_inode_bitmap(bg, sb);
+
+    struct ext4_block b;
+    rc = ext4_trans_block_get(fs->bdev, &b, bmp_blk_add);
+    if (rc != EOK) {
+        ext4_fs_put_block_group_ref(&bg_ref);
+        return rc;
+    }
+
+    if (!ext4_ialloc_verify_bitmap_csum(sb, bg, b.data)) {
+        ext4_dbg(DEBUG_IALLOC,
+            DBG_WARN "Bitmap checksum failed."
+            "Group: %" PRIu32"\n",
+            bg_ref.index);
+    }
+
+    /* Try to allocate i-node in the bitmap */
+    uint32_t inodes_in_bg;
+    uint32_t idx_in_bg;
+
+    inodes_in_bg = ext4_inodes_in_group_cnt(sb, bgid);
+    rc = ext4_bmap_bit_find_clr(b.data, 0, inodes_in_bg, &idx_in_bg);
+    /* Block group has not any free i-node */
+    if (rc == ENOSPC) {
+        rc = ext4_block_set(fs->bdev, &b);
+        ext4_fs_put_block_group_ref(&bg_ref);
+        return rc == EOK ? ENOSPC : rc;
+    }
+
+    ext4_bmap_bit_set(b.data, idx_in_bg);
+
+    /* Free i-node found, save the bitmap */
+    ext4_ialloc_set_bitmap_csum(sb, bg, b.data);
+    ext4_trans_set_block_dirty(b.buf);
+
+    rc = ext4_block_set(fs->bdev, &b);
+    if (rc != EOK) {
+        ext4_fs_put_block_group_ref(&bg_ref);
+        return rc;
+    }
+
+    /* Modify filesystem counters */
+    free_inodes--;
+    ext4_bg_set_free_inodes_count(bg, sb, free_inodes);
+
+    /* Increment used directories counter */
+    if (is_dir) {
+        used_dirs++;
+        ext4_bg_set_used_dirs_count(bg, sb, used_dirs);
+    }
+
+    /* Decrease unused inodes count */
+    uint32_t unused = ext4_bg_get_itable_unused(bg, sb);
+    uint32_t free = inodes_in_bg - unused;
+
+    if (idx_in_bg >= free) {
+        unused = inodes_in_bg - (idx_in_bg + 1);
+        ext4_bg_set_itable_unused(bg, sb, unused);
+    }
+
+    /* Save modified block group */
+    bg_ref.dirty = true;
+
+    rc = ext4_fs_put_block_group_ref(&bg_ref);
+    if (rc != EOK)
+        return rc;
+
+    /* Update superblock */
+    ext4_set32(sb, free_inodes_count,
+           ext4_get32(sb, free_inodes_count) - 1);
+
+    /* Compute the absolute i-nodex number */
+    *idx = ext4_ialloc_bgidx_to_inode(sb, idx_in_bg, bgid);
+
+    fs->last_inode_bg_id = bgid;
+
+    return EOK;
+}
+
+/**@brief Load counters of all block groups to memory (once per mount).
+ * @param fs Filesystem
+ * @return Error code
+ */
+static int ext4_ialloc_stats_load(struct ext4_fs *fs)
+{
+    struct ext4_sblock *sb = &fs->sb;
     uint32_t bg_count = ext4_block_group_cnt(sb);
-    uint32_t sb_free_inodes = ext4_get32(sb, free_inodes_count);
-    bool rewind = false;
+    struct ext4_bg_stats *st;
+    uint32_t i;
+    int rc;
 
-    /* Try to find free i-node in all block groups */
-    while (bgid <= bg_count) {
+    if (fs->bg_stats)
+        return EOK;
 
-        if (bgid == bg_count) {
-            if (rewind)
-                break;
-            bg_count = fs->last_inode_bg_id;
-            bgid = 0;
-            rewind = true;
-            continue;
-        }
+    st = ext4_calloc(bg_count, sizeof(struct ext4_bg_stats));
+    if (!st)
+        return ENOMEM;
 
-        /* Load block group to check */
+    for (i = 0; i < bg_count; i++) {
         struct ext4_block_group_ref bg_ref;
-        int rc = ext4_fs_get_block_group_ref(fs, bgid, &bg_ref);
-        if (rc != EOK)
-            return rc;
 
-        struct ext4_bgroup *bg = bg_ref.block_group;
+        rc = ext4_fs_get_block_group_ref(fs, i, &bg_ref);
+        if (rc != EOK) {
+            ext4_free(st);
+            return rc;
+        }
 
-        /* Read necessary values for algorithm */
-        uint32_t free_inodes = ext4_bg_get_free_inodes_count(bg, sb);
-        uint32_t used_dirs = ext4_bg_get_used_dirs_count(bg, sb);
+        ext4_fs_bg_stats_fill(st + i, bg_ref.block_group, sb);
+        rc = ext4_fs_put_block_group_ref(&bg_ref);
+        if (rc != EOK) {
+            ext4_free(st);
+            return rc;
+        }
+    }
 
-        /* Check if this block group is good candidate for allocation */
-        if (free_inodes > 0) {
-            /* Load block with bitmap */
-            ext4_fsblk_t bmp_blk_add = ext4_bg_get_inode_bitmap(bg, sb);
+    fs->bg_stats = st;
+    return EOK;
+}
 
-            struct ext4_block b;
-            rc = ext4_trans_block_get(fs->bdev, &b, bmp_blk_add);
-            if (rc != EOK) {
-                ext4_fs_put_block_group_ref(&bg_ref);
-                return rc;
-            }
+void ext4_ialloc_stats_drop(struct ext4_fs *fs)
+{
+    ext4_free(fs->bg_stats);
+    fs->bg_stats = NULL;
+}
 
-            if (!ext4_ialloc_verify_bitmap_csum(sb, bg, b.data)) {
-                ext4_dbg(DEBUG_IALLOC,
-                    DBG_WARN "Bitmap checksum failed."
-                    "Group: %" PRIu32"\n",
-                    bg_ref.index);
-            }
+/**@brief Orlov placement of a directory. Top level directories go to
+ *        groups with the fewest directories among those with above
+ *        average free i-nodes and blocks. Subdirectories stay near the
+ *        parent unless its neighbourhood is crowded.
+ * @param fs     Filesystem
+ * @param parent Parent directory i-node number
+ * @param bgid   Output value - chosen block group
+ * @return EOK or ENOSPC if no group has free i-nodes
+ */
+static int ext4_ialloc_find_group_dir(struct ext4_fs *fs, uint32_t parent,
+                      uint32_t *bgid)
+{
+    struct ext4_sblock *sb = &fs->sb;
+    struct ext4_bg_stats *st = fs->bg_stats;
+    uint32_t ngroups = ext4_block_group_cnt(sb);
+    uint32_t pg = ext4_ialloc_get_bgid_of_inode(sb, parent);
+    uint32_t ipg = ext4_get32(sb, inodes_per_group);
+    uint32_t bpg = ext4_get32(sb, blocks_per_group);
+    uint32_t avefreei = ext4_get32(sb, free_inodes_count) / ngroups;
+    uint64_t avefreeb = ext4_sb_get_free_blocks_cnt(sb) / ngroups;
+    uint64_t ndirs = 0;
+    uint32_t i, g;
+
+    for (i = 0; i < ngroups; i++)
+        ndirs += st[i].used_dirs;
+
+    if (parent == EXT4_INODE_ROOT_INDEX) {
+        uint32_t best = ngroups;
+
+        for (i = 0; i < ngroups; i++) {
+            if (st[i].free_inodes == 0 ||
+                st[i].free_inodes < avefreei ||
+                st[i].free_blocks < avefreeb)
+                continue;
 
-            /* Try to allocate i-node in the bitmap */
-            uint32_t inodes_in_bg;
-            uint32_t idx_in_bg;
-
-            inodes_in_bg = ext4_inodes_in_group_cnt(sb, bgid);
-            rc = ext4_bmap_bit_find_clr(b.data, 0, inodes_in_bg,
-                            &idx_in_bg);
-            /* Block group has not any free i-node */
-            if (rc == ENOSPC) {
-                rc = ext4_block_set(fs->bdev, &b);
-                if (rc != EOK) {
-                    ext4_fs_put_block_group_ref(&bg_ref);
-                    return rc;
-                }
-
-                rc = ext4_fs_put_block_group_ref(&bg_ref);
-                if (rc != EOK)
-                    return rc;
+            if (best == ngroups ||
+                st[i].used_dirs < st[best].used_dirs ||
+                (st[i].used_dirs == st[best].used_dirs &&
+                 st[i].free_blocks > st[best].free_blocks))
+                best = i;
+        }
 
-                continue;
+        if (best != ngroups) {
+            *bgid = best;
+            return EOK;
+        }
+    } else {
+        uint64_t max_dirs = ndirs / ngroups + ipg / 16;
+        uint32_t min_inodes = avefreei > ipg / 4 ? avefreei - ipg / 4 : 1;
+        uint64_t min_blocks = avefreeb > bpg / 4 ? avefreeb - bpg / 4 : 0;
+
+        for (i = 0; i < ngroups; i++) {
+            g = (pg + i) % ngroups;
+            if (st[g].used_dirs < max_dirs &&
+                st[g].free_inodes >= min_inodes &&
+                st[g].free_blocks >= min_blocks) {
+                *bgid = g;
+                return EOK;
             }
+        }
+    }
 
-            ext4_bmap_bit_set(b.data, idx_in_bg);
+    /* Fallback: first group with average free i-nodes, then any */
+    for (i = 0; i < ngroups; i++) {
+        g = (pg + i) % ngroups;
+        if (st[g].free_inodes && st[g].free_inodes >= avefreei) {
+            *bgid = g;
+            return EOK;
+        }
+    }
 
-            /* Free i-node found, save the bitmap */
-            ext4_ialloc_set_bitmap_csum(sb,bg,
-                            b.data);
-            ext4_trans_set_block_dirty(b.buf);
+    for (i = 0; i < ngroups; i++) {
+        g = (pg + i) % ngroups;
+        if (st[g].free_inodes) {
+            *bgid = g;
+            return EOK;
+        }
+    }
 
-            ext4_block_set(fs->bdev, &b);
-            if (rc != EOK) {
-                ext4_fs_put_block_group_ref(&bg_ref);
-                return rc;
-            }
+    return ENOSPC;
+}
 
-            /* Modify filesystem counters */
-            free_inodes--;
-            ext4_bg_set_free_inodes_count(bg, sb, free_inodes);
+/**@brief Placement of non-directory i-node: parent group first, then
+ *        quadratic probing for a group with free i-nodes and blocks,
+ *        then any group with free i-nodes.
+ * @param fs     Filesystem
+ * @param parent Parent directory i-node number
+ * @param bgid   Output value - chosen block group
+ * @return EOK or ENOSPC if no group has free i-nodes
+ */
+static int ext4_ialloc_find_group_other(struct ext4_fs *fs, uint32_t parent,
+                    uint32_t *bgid)
+{
+    struct ext4_sblock *sb = &fs->sb;
+    struct ext4_bg_stats *st = fs->bg_stats;
+    uint32_t ngroups = ext4_block_group_cnt(sb);
+    uint32_t pg = ext4_ialloc_get_bgid_of_inode(sb, parent);
+    uint32_t i, g;
+
+    if (st[pg].free_inodes && st[pg].free_blocks) {
+        *bgid = pg;
+        return EOK;
+    }
 
-            /* Increment used directories counter */
-            if (is_dir) {
-                used_dirs++;
-                ext4_bg_set_used_dirs_count(bg, sb, used_dirs);
-            }
+    g = (pg + parent) % ngroups;
+    for (i = 1; i < ngroups; i <<= 1) {
+        g = (g + i) % ngroups;
+        if (st[g].free_inodes && st[g].free_blocks) {
+            *bgid = g;
+            return EOK;
+        }
+    }
 
-            /* Decrease unused inodes count */
-            uint32_t unused =
-                ext4_bg_get_itable_unused(bg, sb);
+    for (i = 1; i <= ngroups; i++) {
+        g = (pg + i) % ngroups;
+        if (st[g].free_inodes) {
+            *bgid = g;
+            return EOK;
+        }
+    }
 
-            uint32_t free = inodes_in_bg - unused;
+    return ENOSPC;
+}
 
-            if (idx_in_bg >= free) {
-                unused = inodes_in_bg - (idx_in_bg + 1);
-                ext4_bg_set_itable_unused(bg, sb, unused);
-            }
+int ext4_ialloc_alloc_inode(struct ext4_fs *fs, uint32_t *idx, bool is_dir,
+                uint32_t parent)
+{
+    struct ext4_sblock *sb = &fs->sb;
 
-            /* Save modified block group */
-            bg_ref.dirty = true;
+    uint32_t bgid = fs->last_inode_bg_id;
+    uint32_t bg_count = ext4_block_group_cnt(sb);
+    bool rewind = false;
+    int rc;
 
-            rc = ext4_fs_put_block_group_ref(&bg_ref);
-            if (rc != EOK)
-                return rc;
+    /* Pick a group from cached counters when the parent is known */
+    if (parent && ext4_ialloc_stats_load(fs) == EOK) {
+        uint32_t goal;
 
-            /* Update superblock */
-            sb_free_inodes--;
-            ext4_set32(sb, free_inodes_count, sb_free_inodes);
+        if (is_dir)
+            rc = ext4_ialloc_find_group_dir(fs, parent, &goal);
+        else
+            rc = ext4_ialloc_find_group_other(fs, parent, &goal);
 
-            /* Compute the absolute i-nodex number */
-            *idx = ext4_ialloc_bgidx_to_inode(sb, idx_in_bg, bgid);
+        if (rc == EOK) {
+            rc = ext4_ialloc_alloc_in_group(fs, goal, is_dir, idx);
+            if (rc != ENOSPC)
+                return rc;
+        }
+    }
 
-            fs->last_inode_bg_id = bgid;
+    /* Try to find free i-node in all block groups */
+    while (bgid <= bg_count) {
 
-            return EOK;
+        if (bgid == bg_count) {
+            if (rewind)
+                break;
+            bg_count = fs->last_inode_bg_id;
+            bgid = 0;
+            rewind = true;
+            continue;
         }
 
-        /* Block group not modified, put it and jump to the next block
-         * group */
-        ext4_fs_put_block_group_ref(&bg_ref);
-        if (rc != EOK)
+        rc = ext4_ialloc_alloc_in_group(fs, bgid, is_dir, idx);
+        if (rc != ENOSPC)
             return rc;
 
         ++bgid;
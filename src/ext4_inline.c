@@ -0,0 +1,684 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_inline.c
+ * @brief Inline data: small files and directories kept in the i-node.
+ */
+
+#include <ext4_config.h>
+#include <ext4_types.h>
+#include <ext4_misc.h>
+#include <ext4_errno.h>
+#include <ext4_debug.h>
+
+#include <ext4_trans.h>
+#include <ext4_fs.h>
+#include <ext4_inode.h>
+#include <ext4_dir.h>
+#include <ext4_xattr.h>
+#include <ext4_inline.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#if CONFIG_INLINE_DATA_ENABLE
+
+/**@brief Name of the xattr holding data beyond i_block.*/
+#define EXT4_INLINE_XATTR_NAME "data"
+#define EXT4_INLINE_XATTR_NAME_LEN 4
+
+/**@brief Data bytes kept in i_block.*/
+#define EXT4_INLINE_IBLOCK_SIZE 60
+
+/**@brief Parent i-node number at the start of inline directory.*/
+#define EXT4_INLINE_DOTDOT_SIZE 4
+
+/**@brief Length of "." and ".." entries.*/
+#define EXT4_INLINE_DOT_LEN 12
+
+/*
+ * Iterator positions of inline directory (as the kernel reports them):
+ * ".", "..", entries of i_block, then entries of the xattr.
+ */
+#define EXT4_INLINE_POS_DOTDOT EXT4_INLINE_DOT_LEN
+#define EXT4_INLINE_POS_IBLOCK (2 * EXT4_INLINE_DOT_LEN)
+#define EXT4_INLINE_POS_XATTR                                       \
+    (EXT4_INLINE_POS_IBLOCK + EXT4_INLINE_IBLOCK_SIZE -             \
+     EXT4_INLINE_DOTDOT_SIZE)
+
+/**@brief Get the xattr part of inline data.
+ * @param inode_ref I-node reference
+ * @param value output pointer into the i-node (NULL if empty)
+ * @param len output length
+ * @return standard error code*/
+static int ext4_inline_xattr(struct ext4_inode_ref *inode_ref,
+                 uint8_t **value, size_t *len)
+{
+    void *v = NULL;
+    int r;
+
+    r = ext4_xattr_ibody_get(inode_ref, EXT4_XATTR_INDEX_SYSTEM,
+                 EXT4_INLINE_XATTR_NAME,
+                 EXT4_INLINE_XATTR_NAME_LEN, &v, len);
+    if (r == ENODATA) {
+        /* Data never grew beyond i_block */
+        *len = 0;
+        r = EOK;
+    }
+
+    *value = v;
+    return r;
+}
+
+/**@brief Set the xattr part of inline data.
+ * @param inode_ref I-node reference
+ * @param value new value (must not point into the i-node)
+ * @param len new length
+ * @return standard error code*/
+static int ext4_inline_xattr_set(struct ext4_inode_ref *inode_ref,
+                 const void *value, size_t len)
+{
+    return ext4_xattr_ibody_set(inode_ref, EXT4_XATTR_INDEX_SYSTEM,
+                    EXT4_INLINE_XATTR_NAME,
+                    EXT4_INLINE_XATTR_NAME_LEN, value, len);
+}
+
+/**@brief Resize the xattr part of inline data, keeping its content.
+ *        New bytes are zeroed.
+ * @param inode_ref I-node reference
+ * @param len new length
+ * @return standard error code*/
+static int ext4_inline_xattr_resize(struct ext4_inode_ref *inode_ref,
+                    size_t len)
+{
+    uint8_t *old, *tmp = NULL;
+    size_t old_len;
+    int r;
+
+    r = ext4_inline_xattr(inode_ref, &old, &old_len);
+    if (r != EOK)
+        return r;
+
+    if (len) {
+        tmp = ext4_calloc(1, len);
+        if (!tmp)
+            return ENOMEM;
+
+        if (old_len)
+            memcpy(tmp, old, old_len < len ? old_len : len);
+    }
+
+    r = ext4_inline_xattr_set(inode_ref, tmp ? (void *)tmp : "", len);
+    ext4_free(tmp);
+    return r;
+}
+
+size_t ext4_inline_max_size(struct ext4_inode_ref *inode_ref)
+{
+    size_t max;
+
+    if (ext4_xattr_ibody_max_value(inode_ref, EXT4_XATTR_INDEX_SYSTEM,
+                       EXT4_INLINE_XATTR_NAME,
+                       EXT4_INLINE_XATTR_NAME_LEN,
+                       &max) != EOK)
+        return 0;
+
+    return EXT4_INLINE_IBLOCK_SIZE + max;
+}
+
+int ext4_inline_init(struct ext4_inode_ref *inode_ref)
+{
+    int r;
+
+    /* Empty xattr has to be present, even when data fit i_block */
+    r = ext4_inline_xattr_set(inode_ref, "", 0);
+    if (r != EOK)
+        return r;
+
+    memset(inode_ref->inode->blocks, 0, sizeof(inode_ref->inode->blocks));
+    ext4_inode_clear_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS);
+    ext4_inode_set_flag(inode_ref->inode, EXT4_INODE_FLAG_INLINE_DATA);
+    inode_ref->dirty = true;
+    return EOK;
+}
+
+int ext4_inline_clear(struct ext4_inode_ref *inode_ref)
+{
+    int r;
+
+    r = ext4_inline_xattr_set(inode_ref, NULL, 0);
+    if (r != EOK)
+        return r;
+
+    memset(inode_ref->inode->blocks, 0, sizeof(inode_ref->inode->blocks));
+    ext4_inode_clear_flag(inode_ref->inode, EXT4_INODE_FLAG_INLINE_DATA);
+    ext4_inode_set_size(inode_ref->inode, 0);
+    ext4_fs_inode_blocks_init(inode_ref->fs, inode_ref);
+    inode_ref->dirty = true;
+    return EOK;
+}
+
+int ext4_inline_restore(struct ext4_inode_ref *inode_ref, const void *buf,
+            size_t len)
+{
+    int r;
+
+    r = ext4_fs_truncate_inode(inode_ref, 0);
+    if (r != EOK)
+        return r;
+
+    r = ext4_inline_init(inode_ref);
+    if (r != EOK)
+        return r;
+
+    return ext4_inline_write(inode_ref, 0, buf, len);
+}
+
+int ext4_inline_read(struct ext4_inode_ref *inode_ref, uint64_t off,
+             void *buf, size_t len)
+{
+    uint8_t *u8_buf = buf;
+    uint8_t *value;
+    size_t value_len;
+    int r;
+
+    if (off < EXT4_INLINE_IBLOCK_SIZE) {
+        size_t n = EXT4_INLINE_IBLOCK_SIZE - (size_t)off;
+        if (n > len)
+            n = len;
+
+        memcpy(u8_buf, (uint8_t *)inode_ref->inode->blocks + off, n);
+        u8_buf += n;
+        off += n;
+        len -= n;
+    }
+
+    if (!len)
+        return EOK;
+
+    r = ext4_inline_xattr(inode_ref, &value, &value_len);
+    if (r != EOK)
+        return r;
+
+    off -= EXT4_INLINE_IBLOCK_SIZE;
+    if (off + len > value_len)
+        return EIO;
+
+    memcpy(u8_buf, value + off, len);
+    return EOK;
+}
+
+int ext4_inline_write(struct ext4_inode_ref *inode_ref, uint64_t off,
+              const void *buf, size_t len)
+{
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+    const uint8_t *u8_buf = buf;
+    uint64_t size = ext4_inode_get_size(sb, inode_ref->inode);
+    uint64_t end = off + len;
+    uint8_t *value;
+    size_t value_len;
+    int r;
+
+    if (end > size)
+        size = end;
+
+    /* Grow xattr part first, it is the one which may not fit */
+    if (size > EXT4_INLINE_IBLOCK_SIZE) {
+        r = ext4_inline_xattr(inode_ref, &value, &value_len);
+        if (r != EOK)
+            return r;
+
+        if (value_len != size - EXT4_INLINE_IBLOCK_SIZE) {
+            r = ext4_inline_xattr_resize(inode_ref,
+                    size - EXT4_INLINE_IBLOCK_SIZE);
+            if (r != EOK)
+                return r;
+        }
+    }
+
+    if (off < EXT4_INLINE_IBLOCK_SIZE) {
+        size_t n = EXT4_INLINE_IBLOCK_SIZE - (size_t)off;
+        if (n > len)
+            n = len;
+
+        memcpy((uint8_t *)inode_ref->inode->blocks + off, u8_buf, n);
+        u8_buf += n;
+        off += n;
+        len -= n;
+    }
+
+    if (len) {
+        r = ext4_inline_xattr(inode_ref, &value, &value_len);
+        if (r != EOK)
+            return r;
+
+        memcpy(value + off - EXT4_INLINE_IBLOCK_SIZE, u8_buf, len);
+    }
+
+    ext4_inode_set_size(inode_ref->inode, size);
+    inode_ref->dirty = true;
+    return EOK;
+}
+
+int ext4_inline_truncate(struct ext4_inode_ref *inode_ref, uint64_t new_size)
+{
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+    size_t value_len = 0;
+    int r;
+
+    if (ext4_inode_is_type(sb, inode_ref->inode, EXT4_INODE_MODE_DIRECTORY))
+        return new_size ? EINVAL : ext4_inline_clear(inode_ref);
+
+    if (new_size < EXT4_INLINE_IBLOCK_SIZE)
+        memset((uint8_t *)inode_ref->inode->blocks + new_size, 0,
+               EXT4_INLINE_IBLOCK_SIZE - (size_t)new_size);
+    else
+        value_len = (size_t)(new_size - EXT4_INLINE_IBLOCK_SIZE);
+
+    r = ext4_inline_xattr_resize(inode_ref, value_len);
+    if (r != EOK)
+        return r;
+
+    ext4_inode_set_size(inode_ref->inode, new_size);
+    inode_ref->dirty = true;
+    return EOK;
+}
+
+/**@brief Get the two parts of inline directory holding entries.
+ * @param dir directory i-node
+ * @param data output part addresses
+ * @param size output part sizes
+ * @return standard error code*/
+static int ext4_inline_dir_parts(struct ext4_inode_ref *dir,
+                 uint8_t *data[2], size_t size[2])
+{
+    data[0] = (uint8_t *)dir->inode->blocks + EXT4_INLINE_DOTDOT_SIZE;
+    size[0] = EXT4_INLINE_IBLOCK_SIZE - EXT4_INLINE_DOTDOT_SIZE;
+    return ext4_inline_xattr(dir, &data[1], &size[1]);
+}
+
+/**@brief Build "." or ".." entry.
+ * @param sb superblock
+ * @param en entry to fill
+ * @param inode i-node number
+ * @param name_len 1 for ".", 2 for ".."*/
+static void ext4_inline_dir_dot(struct ext4_sblock *sb, struct ext4_dir_en *en,
+                uint32_t inode, uint16_t name_len)
+{
+    memset(en, 0, EXT4_INLINE_DOT_LEN);
+    ext4_dir_en_set_inode(en, inode);
+    ext4_dir_en_set_entry_len(en, EXT4_INLINE_DOT_LEN);
+    ext4_dir_en_set_name_len(sb, en, name_len);
+    ext4_dir_en_set_inode_type(sb, en, EXT4_DE_DIR);
+    memset(en->name, '.', name_len);
+}
+
+/**@brief Get parent i-node number of inline directory.*/
+static uint32_t ext4_inline_dir_parent(struct ext4_inode_ref *dir)
+{
+    return to_le32(dir->inode->blocks[0]);
+}
+
+int ext4_inline_dir_init(struct ext4_inode_ref *dir,
+             struct ext4_inode_ref *parent)
+{
+    struct ext4_dir_en *en;
+    int r;
+
+    r = ext4_inline_init(dir);
+    if (r != EOK)
+        return r;
+
+    /* i_block: parent, then one empty entry over the rest */
+    ext4_inline_dir_set_parent(dir, parent->index);
+    en = (void *)((uint8_t *)dir->inode->blocks + EXT4_INLINE_DOTDOT_SIZE);
+    ext4_dir_en_set_entry_len(en, EXT4_INLINE_IBLOCK_SIZE -
+                      EXT4_INLINE_DOTDOT_SIZE);
+
+    ext4_inode_set_size(dir->inode, EXT4_INLINE_IBLOCK_SIZE);
+    return EOK;
+}
+
+void ext4_inline_dir_set_parent(struct ext4_inode_ref *dir, uint32_t parent)
+{
+    dir->inode->blocks[0] = to_le32(parent);
+    dir->dirty = true;
+}
+
+int ext4_inline_dir_seek(struct ext4_inode_ref *dir, uint64_t pos,
+             struct ext4_dir_idx_dot_en *dot,
+             struct ext4_dir_en **en)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    struct ext4_dir_en *de;
+    uint8_t *data[2];
+    size_t size[2];
+    uint16_t len;
+    size_t off;
+    int r, i;
+
+    *en = NULL;
+    if (pos == 0 || pos == EXT4_INLINE_POS_DOTDOT) {
+        uint32_t inode = pos ? ext4_inline_dir_parent(dir) : dir->index;
+
+        ext4_inline_dir_dot(sb, (void *)dot, inode, pos ? 2 : 1);
+        *en = (void *)dot;
+        return EOK;
+    }
+
+    if (pos < EXT4_INLINE_POS_IBLOCK)
+        return EIO;
+
+    r = ext4_inline_dir_parts(dir, data, size);
+    if (r != EOK)
+        return r;
+
+    i = pos < EXT4_INLINE_POS_XATTR ? 0 : 1;
+    off = (size_t)(pos - (i ? EXT4_INLINE_POS_XATTR :
+                  EXT4_INLINE_POS_IBLOCK));
+
+    /* Are we at the end? */
+    if (i && off >= size[1])
+        return EOK;
+
+    /* Same checks as for an entry in directory block */
+    if ((off % 4) != 0 || off + sizeof(struct ext4_fake_dir_entry) > size[i])
+        return EIO;
+
+    de = (void *)(data[i] + off);
+    len = ext4_dir_en_get_entry_len(de);
+    if (len < sizeof(struct ext4_fake_dir_entry) || off + len > size[i])
+        return EIO;
+
+    if (ext4_dir_en_get_name_len(sb, de) > len - 8)
+        return EIO;
+
+    *en = de;
+    return EOK;
+}
+
+int ext4_inline_dir_find_entry(struct ext4_dir_search_result *result,
+                   struct ext4_inode_ref *dir, const char *name,
+                   uint32_t name_len)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    uint8_t *data[2];
+    size_t size[2];
+    int r, i;
+
+    result->block.lb_id = 0;
+    result->dentry = NULL;
+
+    if ((name_len == 1 || name_len == 2) &&
+        !memcmp(name, "..", name_len)) {
+        uint32_t inode = name_len == 1 ? dir->index :
+                         ext4_inline_dir_parent(dir);
+
+        ext4_inline_dir_dot(sb, (void *)&result->dot, inode,
+                    (uint16_t)name_len);
+        result->dentry = (void *)&result->dot;
+        return EOK;
+    }
+
+    r = ext4_inline_dir_parts(dir, data, size);
+    if (r != EOK)
+        return r;
+
+    for (i = 0; i < 2; i++) {
+        if (!size[i])
+            continue;
+
+        r = ext4_dir_find_in_buf(data[i], (uint32_t)size[i], sb, name_len,
+                     name, &result->dentry);
+        if (r != ENOENT)
+            return r;
+    }
+
+    return ENOENT;
+}
+
+int ext4_inline_dir_add_entry(struct ext4_inode_ref *dir, const char *name,
+                  uint32_t name_len, struct ext4_inode_ref *child)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    uint16_t required_len;
+    uint8_t *data[2];
+    size_t size[2];
+    size_t max;
+    int r, i;
+
+    r = ext4_inline_dir_parts(dir, data, size);
+    if (r != EOK)
+        return r;
+
+    for (i = 0; i < 2; i++) {
+        if (!size[i])
+            continue;
+
+        r = ext4_dir_insert_in_buf(sb, data[i], (uint32_t)size[i], child,
+                       name, name_len);
+        if (r != ENOSPC) {
+            if (r == EOK)
+                dir->dirty = true;
+            return r;
+        }
+    }
+
+    /* Grow the xattr part by the new entry */
+    required_len = sizeof(struct ext4_fake_dir_entry) + name_len;
+    if ((required_len % 4) != 0)
+        required_len += 4 - (required_len % 4);
+
+    r = ext4_xattr_ibody_max_value(dir, EXT4_XATTR_INDEX_SYSTEM,
+                       EXT4_INLINE_XATTR_NAME,
+                       EXT4_INLINE_XATTR_NAME_LEN, &max);
+    if (r != EOK || size[1] + required_len > max)
+        return ENOSPC;
+
+    r = ext4_inline_xattr_resize(dir, size[1] + required_len);
+    if (r != EOK)
+        return r;
+
+    r = ext4_inline_dir_parts(dir, data, size);
+    if (r != EOK)
+        return r;
+
+    ext4_dir_write_entry(sb, (void *)(data[1] + size[1] - required_len),
+                 required_len, child, name, name_len);
+
+    ext4_inode_set_size(dir->inode, EXT4_INLINE_IBLOCK_SIZE + size[1]);
+    dir->dirty = true;
+    return EOK;
+}
+
+int ext4_inline_dir_remove_entry(struct ext4_inode_ref *dir, const char *name,
+                 uint32_t name_len)
+{
+    struct ext4_sblock *sb = &dir->fs->sb;
+    struct ext4_dir_en *de, *prev;
+    uint8_t *data[2];
+    size_t size[2];
+    int r, i;
+
+    r = ext4_inline_dir_parts(dir, data, size);
+    if (r != EOK)
+        return r;
+
+    for (i = 0; i < 2; i++) {
+        if (!size[i])
+            continue;
+
+        r = ext4_dir_find_in_buf(data[i], (uint32_t)size[i], sb, name_len,
+                     name, &de);
+        if (r == EOK)
+            break;
+
+        if (r != ENOENT)
+            return r;
+    }
+
+    if (i == 2)
+        return ENOENT;
+
+    /* Invalidate entry */
+    ext4_dir_en_set_inode(de, 0);
+
+    /* Merge it with predecessor, unless first in its part */
+    if ((uint8_t *)de != data[i]) {
+        prev = (void *)data[i];
+        while ((uint8_t *)prev + ext4_dir_en_get_entry_len(prev) <
+               (uint8_t *)de)
+            prev = (void *)((uint8_t *)prev +
+                    ext4_dir_en_get_entry_len(prev));
+
+        ext4_dir_en_set_entry_len(prev, ext4_dir_en_get_entry_len(prev) +
+                        ext4_dir_en_get_entry_len(de));
+    }
+
+    dir->dirty = true;
+    return EOK;
+}
+
+int ext4_inline_dir_convert(struct ext4_inode_ref *dir)
+{
+    struct ext4_fs *fs = dir->fs;
+    struct ext4_sblock *sb = &fs->sb;
+    uint32_t block_size = ext4_sb_get_block_size(sb);
+    uint32_t limit = block_size;
+    struct ext4_dir_en *de, *last;
+    struct ext4_block b;
+    ext4_fsblk_t fblock;
+    ext4_lblk_t iblock;
+    uint8_t *data[2];
+    size_t size[2];
+    uint8_t *buf;
+    uint32_t off;
+    size_t pos, isize;
+    int r, i;
+
+    r = ext4_inline_dir_parts(dir, data, size);
+    if (r != EOK)
+        return r;
+
+    /* Block image followed by raw copy of inline data for restore */
+    isize = (size_t)ext4_inode_get_size(sb, dir->inode);
+    buf = ext4_calloc(1, block_size + isize);
+    if (!buf)
+        return ENOMEM;
+
+    r = ext4_inline_read(dir, 0, buf + block_size, isize);
+    if (r != EOK)
+        goto Finish;
+
+    if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
+        limit -= sizeof(struct ext4_dir_entry_tail);
+
+    /* Build the block: ".", ".." and live entries packed together */
+    ext4_inline_dir_dot(sb, (void *)buf, dir->index, 1);
+    ext4_inline_dir_dot(sb, (void *)(buf + EXT4_INLINE_DOT_LEN),
+                ext4_inline_dir_parent(dir), 2);
+    last = (void *)(buf + EXT4_INLINE_DOT_LEN);
+    off = 2 * EXT4_INLINE_DOT_LEN;
+
+    for (i = 0; i < 2; i++) {
+        for (pos = 0; pos + sizeof(struct ext4_fake_dir_entry) <= size[i];
+             pos += ext4_dir_en_get_entry_len(de)) {
+            uint16_t name_len, len;
+
+            de = (void *)(data[i] + pos);
+            if (ext4_dir_en_get_entry_len(de) <
+                sizeof(struct ext4_fake_dir_entry)) {
+                r = EIO;
+                goto Finish;
+            }
+
+            if (!ext4_dir_en_get_inode(de))
+                continue;
+
+            name_len = ext4_dir_en_get_name_len(sb, de);
+            len = sizeof(struct ext4_fake_dir_entry) + name_len;
+            if ((len % 4) != 0)
+                len += 4 - (len % 4);
+
+            if (off + len > limit) {
+                r = ENOSPC;
+                goto Finish;
+            }
+
+            last = (void *)(buf + off);
+            memcpy(last, de, sizeof(struct ext4_fake_dir_entry) +
+                     name_len);
+            ext4_dir_en_set_entry_len(last, len);
+            off += len;
+        }
+    }
+
+    /* Last entry spans the rest of the block */
+    ext4_dir_en_set_entry_len(last, ext4_dir_en_get_entry_len(last) +
+                    limit - off);
+
+    r = ext4_inline_clear(dir);
+    if (r != EOK)
+        goto Finish;
+
+    r = ext4_fs_append_inode_dblk(dir, &fblock, &iblock);
+    if (r != EOK)
+        goto Restore;
+
+    r = ext4_trans_block_get_noread(fs->bdev, &b, fblock);
+    if (r != EOK)
+        goto Restore;
+
+    memcpy(b.data, buf, block_size);
+    if (limit != block_size)
+        ext4_dir_init_entry_tail(EXT4_DIRENT_TAIL(b.data, block_size));
+
+    ext4_dir_set_csum(dir, (void *)b.data);
+    ext4_trans_set_inode_block_dirty(b.buf, dir->index, true);
+    r = ext4_block_set(fs->bdev, &b);
+    if (r == EOK)
+        goto Finish;
+
+Restore:
+    /* Entries stay inline, the error of conversion is returned */
+    ext4_inline_restore(dir, buf + block_size, isize);
+
+Finish:
+    ext4_free(buf);
+    return r;
+}
+
+#endif
+
+/**
+ * @}
+ */
@@ -62,8 +62,13 @@ struct revoke_entry {
      *         be replayed.*/
     uint32_t trans_id;
 
+#if CONFIG_JOURNAL_HASH_INDEX
+    /**@brief  Revoke hash chain node.*/
+    LIST_ENTRY(revoke_entry) revoke_node;
+#else
     /**@brief  Revoke tree node.*/
     RB_ENTRY(revoke_entry) revoke_node;
+#endif
 };
 
 /**@brief  Valid journal replay information.*/
@@ -80,8 +85,16 @@ struct recover_info {
     /**@brief  No of transactions went through.*/
     uint32_t trans_cnt;
 
+#if CONFIG_JOURNAL_HASH_INDEX
+    /**@brief  Hash table storing revoke entries.*/
+    LIST_HEAD(jbd_revoke, revoke_entry) *revoke_hash;
+
+    /**@brief  Pool the revoke entries are allocated from.*/
+    struct jbd_pool revoke_pool;
+#else
     /**@brief  RB-Tree storing revoke entries.*/
     RB_HEAD(jbd_revoke, revoke_entry) revoke_root;
+#endif
 };
 
 /**@brief  Journal replay internal arguments.*/
@@ -110,6 +123,114 @@ trans_id_diff(uint32_t x, uint32_t y)
     return diff;
 }
 
+#if CONFIG_JOURNAL_HASH_INDEX
+/**@brief  Hash a block address into a journal hash table bucket.
+ * @param  lba block address
+ * @return bucket index*/
+static inline uint32_t jbd_hash_lba(ext4_fsblk_t lba)
+{
+    uint32_t h = (uint32_t)lba ^ (uint32_t)(lba >> 32);
+    h *= 0x9E3779B1U;
+    h ^= h >> 16;
+    return h & (CONFIG_JOURNAL_HASH_SIZE - 1);
+}
+
+/**@brief  Initialize a journal record pool.
+ * @param  pool record pool
+ * @param  obj_size size of objects in the pool*/
+static void jbd_pool_init(struct jbd_pool *pool, uint32_t obj_size)
+{
+    /* Keep every object suitably aligned for 64-bit members. */
+    obj_size = (obj_size + sizeof(uint64_t) - 1) &
+           ~(uint32_t)(sizeof(uint64_t) - 1);
+    pool->obj_size = obj_size;
+    pool->used = 0;
+    SLIST_INIT(&pool->free_list);
+    SLIST_INIT(&pool->chunk_list);
+}
+
+/**@brief  Release all memory held by a journal record pool.
+ * @param  pool record pool*/
+static void jbd_pool_fini(struct jbd_pool *pool)
+{
+    struct jbd_pool_chunk *chunk;
+
+    /* Objects still in use would point to freed memory. */
+    if (pool->used) {
+        ext4_dbg(DEBUG_JBD,
+             DBG_WARN "%" PRIu32 " objects still in use "
+                  "in journal pool!\n", pool->used);
+        return;
+    }
+
+    while ((chunk = SLIST_FIRST(&pool->chunk_list))) {
+        SLIST_REMOVE_HEAD(&pool->chunk_list, chunk_node);
+        ext4_free(chunk);
+    }
+    SLIST_INIT(&pool->free_list);
+}
+
+/**@brief  Get a zeroed object from a journal record pool.
+ * @param  pool record pool
+ * @return object allocated, NULL if out of memory*/
+static void *jbd_pool_alloc(struct jbd_pool *pool)
+{
+    struct jbd_pool_obj *obj;
+    if (SLIST_EMPTY(&pool->free_list)) {
+        uint32_t i;
+        char *objs;
+        size_t hdr_size = (sizeof(struct jbd_pool_chunk) +
+                   sizeof(uint64_t) - 1) &
+                  ~(sizeof(uint64_t) - 1);
+        struct jbd_pool_chunk *chunk =
+            ext4_malloc(hdr_size + (size_t)pool->obj_size *
+                        CONFIG_JOURNAL_POOL_CHUNK);
+        if (!chunk)
+            return NULL;
+
+        SLIST_INSERT_HEAD(&pool->chunk_list, chunk, chunk_node);
+        objs = (char *)chunk + hdr_size;
+        for (i = 0; i < CONFIG_JOURNAL_POOL_CHUNK; i++) {
+            obj = (struct jbd_pool_obj *)(objs + i * pool->obj_size);
+            SLIST_INSERT_HEAD(&pool->free_list, obj, free_node);
+        }
+    }
+
+    obj = SLIST_FIRST(&pool->free_list);
+    SLIST_REMOVE_HEAD(&pool->free_list, free_node);
+    pool->used++;
+    memset(obj, 0, pool->obj_size);
+    return obj;
+}
+
+/**@brief  Return an object to a journal record pool.
+ * @param  pool record pool
+ * @param  addr object to be returned*/
+static void jbd_pool_free(struct jbd_pool *pool, void *addr)
+{
+    struct jbd_pool_obj *obj = addr;
+    SLIST_INSERT_HEAD(&pool->free_list, obj, free_node);
+    pool->used--;
+}
+
+#define jbd_alloc_buf(j) jbd_pool_alloc(&(j)->buf_pool)
+#define jbd_free_buf(j, addr) jbd_pool_free(&(j)->buf_pool, addr)
+#define jbd_alloc_block_rec(j) jbd_pool_alloc(&(j)->block_rec_pool)
+#define jbd_free_block_rec(j, addr) jbd_pool_free(&(j)->block_rec_pool, addr)
+#define jbd_alloc_revoke_rec(j) jbd_pool_alloc(&(j)->revoke_rec_pool)
+#define jbd_free_revoke_rec(j, addr) \
+    jbd_pool_free(&(j)->revoke_rec_pool, addr)
+
+#define jbd_alloc_revoke_entry(info) jbd_pool_alloc(&(info)->revoke_pool)
+#define jbd_free_revoke_entry(info, addr) \
+    jbd_pool_free(&(info)->revoke_pool, addr)
+
+#define jbd_trans_revoke_empty(trans) LIST_EMPTY(&(trans)->revoke_list)
+#define jbd_trans_foreach_revoke_safe(rec, trans, tmp) \
+    LIST_FOREACH_SAFE(rec, &(trans)->revoke_list, revoke_node, tmp)
+
+#else
+
 static int
 jbd_revoke_entry_cmp(struct revoke_entry *a, struct revoke_entry *b)
 {
@@ -147,8 +268,22 @@ RB_GENERATE_INTERNAL(jbd_block, jbd_block_rec, block_rec_node,
 RB_GENERATE_INTERNAL(jbd_revoke_tree, jbd_revoke_rec, revoke_node,
              jbd_revoke_rec_cmp, static inline)
 
-#define jbd_alloc_revoke_entry() ext4_calloc(1, sizeof(struct revoke_entry))
-#define jbd_free_revoke_entry(addr) ext4_free(addr)
+#define jbd_alloc_buf(j) ext4_calloc(1, sizeof(struct jbd_buf))
+#define jbd_free_buf(j, addr) ext4_free(addr)
+#define jbd_alloc_block_rec(j) ext4_calloc(1, sizeof(struct jbd_block_rec))
+#define jbd_free_block_rec(j, addr) ext4_free(addr)
+#define jbd_alloc_revoke_rec(j) ext4_calloc(1, sizeof(struct jbd_revoke_rec))
+#define jbd_free_revoke_rec(j, addr) ext4_free(addr)
+
+#define jbd_alloc_revoke_entry(info) \
+    ext4_calloc(1, sizeof(struct revoke_entry))
+#define jbd_free_revoke_entry(info, addr) ext4_free(addr)
+
+#define jbd_trans_revoke_empty(trans) RB_EMPTY(&(trans)->revoke_root)
+#define jbd_trans_foreach_revoke_safe(rec, trans, tmp) \
+    RB_FOREACH_SAFE(rec, jbd_revoke_tree, &(trans)->revoke_root, tmp)
+
+#endif
 
 static int jbd_has_csum(struct jbd_sb *jbd_sb)
 {
@@ -368,6 +503,23 @@ static void jbd_block_tag_csum_set(struct jbd_fs *jbd_fs, void *__tag,
     }
 }
 
+/**@brief  Get the address of jbd superblock on the journal device.
+ * @param  jbd_fs jbd filesystem
+ * @param  fblock block address of jbd superblock
+ * @return standard error code*/
+static int jbd_sb_bmap(struct jbd_fs *jbd_fs, ext4_fsblk_t *fblock)
+{
+    uint32_t block_size;
+    if (!jbd_fs->external)
+        return jbd_inode_bmap(jbd_fs, 0, fblock);
+
+    /* An external journal device starts with an ext4 superblock,
+     * and the jbd superblock lives in the block right after it.*/
+    block_size = ext4_sb_get_block_size(&jbd_fs->fs->sb);
+    *fblock = EXT4_SUPERBLOCK_OFFSET / block_size + 1;
+    return EOK;
+}
+
 /**@brief  Write jbd superblock to disk.
  * @param  jbd_fs jbd filesystem
  * @param  s jbd superblock
@@ -375,16 +527,16 @@ static void jbd_block_tag_csum_set(struct jbd_fs *jbd_fs, void *__tag,
 static int jbd_sb_write(struct jbd_fs *jbd_fs, struct jbd_sb *s)
 {
     int rc;
-    struct ext4_fs *fs = jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = jbd_fs->fs;
     uint64_t offset;
     ext4_fsblk_t fblock;
-    rc = jbd_inode_bmap(jbd_fs, 0, &fblock);
+    rc = jbd_sb_bmap(jbd_fs, &fblock);
     if (rc != EOK)
         return rc;
 
     jbd_sb_csum_set(s);
     offset = fblock * ext4_sb_get_block_size(&fs->sb);
-    return ext4_block_writebytes(fs->bdev, offset, s,
+    return ext4_block_writebytes(jbd_fs->bdev, offset, s,
                      EXT4_SUPERBLOCK_SIZE);
 }
 
@@ -395,15 +547,15 @@ static int jbd_sb_write(struct jbd_fs *jbd_fs, struct jbd_sb *s)
 static int jbd_sb_read(struct jbd_fs *jbd_fs, struct jbd_sb *s)
 {
     int rc;
-    struct ext4_fs *fs = jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = jbd_fs->fs;
     uint64_t offset;
     ext4_fsblk_t fblock;
-    rc = jbd_inode_bmap(jbd_fs, 0, &fblock);
+    rc = jbd_sb_bmap(jbd_fs, &fblock);
     if (rc != EOK)
         return rc;
 
     offset = fblock * ext4_sb_get_block_size(&fs->sb);
-    return ext4_block_readbytes(fs->bdev, offset, s,
+    return ext4_block_readbytes(jbd_fs->bdev, offset, s,
                     EXT4_SUPERBLOCK_SIZE);
 }
 
@@ -439,27 +591,83 @@ static int jbd_write_sb(struct jbd_fs *jbd_fs)
     return rc;
 }
 
+/**@brief  Check that a block device holds the external journal
+ *         of the filesystem.
+ * @param  fs filesystem
+ * @param  bdev journal block device
+ * @return standard error code*/
+static int jbd_verify_journal_dev(struct ext4_fs *fs,
+                  struct ext4_blockdev *bdev)
+{
+    int rc;
+    struct ext4_sblock *sb;
+
+    if (ext4_sb_get_block_size(&fs->sb) != bdev->lg_bsize)
+        return ENOTSUP;
+
+    sb = ext4_malloc(sizeof(struct ext4_sblock));
+    if (!sb)
+        return ENOMEM;
+
+    rc = ext4_block_readbytes(bdev, EXT4_SUPERBLOCK_OFFSET, sb,
+                  EXT4_SUPERBLOCK_SIZE);
+    if (rc != EOK)
+        goto Finish;
+
+    if (ext4_get16(sb, magic) != EXT4_SUPERBLOCK_MAGIC ||
+        !ext4_sb_feature_incom(sb, EXT4_FINCOM_JOURNAL_DEV) ||
+        ext4_sb_get_block_size(sb) != bdev->lg_bsize) {
+        rc = EIO;
+        goto Finish;
+    }
+
+    if (memcmp(sb->uuid, fs->sb.journal_uuid, UUID_SIZE)) {
+        ext4_dbg(DEBUG_JBD, DBG_WARN "Journal device UUID "
+                         "mismatch\n");
+        rc = ENODEV;
+    }
+Finish:
+    ext4_free(sb);
+    return rc;
+}
+
 /**@brief  Get reference to jbd filesystem.
  * @param  fs Filesystem to load journal of
+ * @param  jbd_bdev external journal device, NULL if there is none
  * @param  jbd_fs jbd filesystem
  * @return standard error code*/
 int jbd_get_fs(struct ext4_fs *fs,
+           struct ext4_blockdev *jbd_bdev,
            struct jbd_fs *jbd_fs)
 {
     int rc;
     uint32_t journal_ino;
 
     memset(jbd_fs, 0, sizeof(struct jbd_fs));
+    jbd_fs->fs = fs;
+
     /* See if there is journal inode on this filesystem.*/
-    /* FIXME: detection on existance ofbkejournal bdev is
-     *        missing.*/
     journal_ino = ext4_get32(&fs->sb, journal_inode_number);
+    if (journal_ino) {
+        rc = ext4_fs_get_inode_ref(fs,
+                       journal_ino,
+                       &jbd_fs->inode_ref);
+        if (rc != EOK)
+            return rc;
 
-    rc = ext4_fs_get_inode_ref(fs,
-                   journal_ino,
-                   &jbd_fs->inode_ref);
-    if (rc != EOK)
-        return rc;
+        jbd_fs->bdev = fs->bdev;
+    } else {
+        /* The log lives on an external journal device.*/
+        if (!jbd_bdev)
+            return ENODEV;
+
+        rc = jbd_verify_journal_dev(fs, jbd_bdev);
+        if (rc != EOK)
+            return rc;
+
+        jbd_fs->bdev = jbd_bdev;
+        jbd_fs->external = true;
+    }
 
     rc = jbd_sb_read(jbd_fs, &jbd_fs->sb);
     if (rc != EOK)
@@ -470,12 +678,11 @@ int jbd_get_fs(struct ext4_fs *fs,
         goto Error;
     }
 
-    if (rc == EOK)
-        jbd_fs->bdev = fs->bdev;
-
     return rc;
 Error:
-    ext4_fs_put_inode_ref(&jbd_fs->inode_ref);
+    if (!jbd_fs->external)
+        ext4_fs_put_inode_ref(&jbd_fs->inode_ref);
+
     memset(jbd_fs, 0, sizeof(struct jbd_fs));
 
     return rc;
@@ -489,7 +696,9 @@ int jbd_put_fs(struct jbd_fs *jbd_fs)
     int rc = EOK;
     rc = jbd_write_sb(jbd_fs);
 
-    ext4_fs_put_inode_ref(&jbd_fs->inode_ref);
+    if (!jbd_fs->external)
+        ext4_fs_put_inode_ref(&jbd_fs->inode_ref);
+
     return rc;
 }
 
@@ -502,7 +711,15 @@ int jbd_inode_bmap(struct jbd_fs *jbd_fs,
            ext4_lblk_t iblock,
            ext4_fsblk_t *fblock)
 {
-    int rc = ext4_fs_get_inode_dblk_idx(
+    int rc;
+
+    /* Blocks of an external journal are addressed directly.*/
+    if (jbd_fs->external) {
+        *fblock = iblock;
+        return EOK;
+    }
+
+    rc = ext4_fs_get_inode_dblk_idx(
             &jbd_fs->inode_ref,
             iblock,
             fblock,
@@ -519,7 +736,6 @@ static int jbd_block_get(struct jbd_fs *jbd_fs,
           struct ext4_block *block,
           ext4_fsblk_t fblock)
 {
-    /* TODO: journal device. */
     int rc;
     struct ext4_blockdev *bdev = jbd_fs->bdev;
     ext4_lblk_t iblock = (ext4_lblk_t)fblock;
@@ -554,7 +770,6 @@ static int jbd_block_get_noread(struct jbd_fs *jbd_fs,
              struct ext4_block *block,
              ext4_fsblk_t fblock)
 {
-    /* TODO: journal device. */
     int rc;
     struct ext4_blockdev *bdev = jbd_fs->bdev;
     ext4_lblk_t iblock = (ext4_lblk_t)fblock;
@@ -866,11 +1081,21 @@ static void jbd_display_block_tags(struct jbd_fs *jbd_fs,
 static struct revoke_entry *
 jbd_revoke_entry_lookup(struct recover_info *info, ext4_fsblk_t block)
 {
+#if CONFIG_JOURNAL_HASH_INDEX
+    struct revoke_entry *revoke_entry;
+    LIST_FOREACH(revoke_entry, &info->revoke_hash[jbd_hash_lba(block)],
+             revoke_node) {
+        if (revoke_entry->block == block)
+            return revoke_entry;
+    }
+    return NULL;
+#else
     struct revoke_entry tmp = {
         .block = block
     };
 
     return RB_FIND(jbd_revoke, &info->revoke_root, &tmp);
+#endif
 }
 
 /**@brief  Replay a block in a transaction.
@@ -886,7 +1111,8 @@ static void jbd_replay_block_tags(struct jbd_fs *jbd_fs,
     uint32_t *this_block = arg->this_block;
     struct revoke_entry *revoke_entry;
     struct ext4_block journal_block, ext4_block;
-    struct ext4_fs *fs = jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = jbd_fs->fs;
+    uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
 
     (*this_block)++;
     wrap(&jbd_fs->sb, *this_block);
@@ -907,7 +1133,7 @@ static void jbd_replay_block_tags(struct jbd_fs *jbd_fs,
         return;
 
     /* We need special treatment for ext4 superblock. */
-    if (tag_info->block) {
+    if (tag_info->block != EXT4_SUPERBLOCK_OFFSET / block_size) {
         r = ext4_block_get_noread(fs->bdev, &ext4_block, tag_info->block);
         if (r != EOK) {
             jbd_block_set(jbd_fs, &journal_block);
@@ -930,7 +1156,7 @@ static void jbd_replay_block_tags(struct jbd_fs *jbd_fs,
         state = ext4_get16(&fs->sb, state);
 
         memcpy(&fs->sb,
-            journal_block.data + EXT4_SUPERBLOCK_OFFSET,
+            journal_block.data + EXT4_SUPERBLOCK_OFFSET % block_size,
             EXT4_SUPERBLOCK_SIZE);
 
         /* Mark system as mounted */
@@ -966,24 +1192,37 @@ static void jbd_add_revoke_block_tags(struct recover_info *info,
         return;
     }
 
-    revoke_entry = jbd_alloc_revoke_entry();
+    revoke_entry = jbd_alloc_revoke_entry(info);
     ext4_assert(revoke_entry);
     revoke_entry->block = block;
     revoke_entry->trans_id = info->this_trans_id;
+#if CONFIG_JOURNAL_HASH_INDEX
+    LIST_INSERT_HEAD(&info->revoke_hash[jbd_hash_lba(block)],
+             revoke_entry, revoke_node);
+#else
     RB_INSERT(jbd_revoke, &info->revoke_root, revoke_entry);
+#endif
 
     return;
 }
 
 static void jbd_destroy_revoke_tree(struct recover_info *info)
 {
+#if CONFIG_JOURNAL_HASH_INDEX
+    /* All the entries go away together with their pool. */
+    info->revoke_pool.used = 0;
+    jbd_pool_fini(&info->revoke_pool);
+    ext4_free(info->revoke_hash);
+    info->revoke_hash = NULL;
+#else
     while (!RB_EMPTY(&info->revoke_root)) {
         struct revoke_entry *revoke_entry =
             RB_MIN(jbd_revoke, &info->revoke_root);
         ext4_assert(revoke_entry);
         RB_REMOVE(jbd_revoke, &info->revoke_root, revoke_entry);
-        jbd_free_revoke_entry(revoke_entry);
+        jbd_free_revoke_entry(info, revoke_entry);
     }
+#endif
 }
 
 
@@ -1219,15 +1458,24 @@ int jbd_recover(struct jbd_fs *jbd_fs)
     if (!sb->start)
         return EOK;
 
+#if CONFIG_JOURNAL_HASH_INDEX
+    info.revoke_hash = ext4_calloc(CONFIG_JOURNAL_HASH_SIZE,
+                       sizeof(*info.revoke_hash));
+    if (!info.revoke_hash)
+        return ENOMEM;
+
+    jbd_pool_init(&info.revoke_pool, sizeof(struct revoke_entry));
+#else
     RB_INIT(&info.revoke_root);
+#endif
 
     r = jbd_iterate_log(jbd_fs, &info, ACTION_SCAN);
     if (r != EOK)
-        return r;
+        goto Finish;
 
     r = jbd_iterate_log(jbd_fs, &info, ACTION_REVOKE);
     if (r != EOK)
-        return r;
+        goto Finish;
 
     r = jbd_iterate_log(jbd_fs, &info, ACTION_RECOVER);
     if (r == EOK) {
@@ -1236,18 +1484,19 @@ int jbd_recover(struct jbd_fs *jbd_fs)
          * ext4 superblock, and set the start of
          * journal to 0.*/
         uint32_t features_incompatible =
-            ext4_get32(&jbd_fs->inode_ref.fs->sb,
+            ext4_get32(&jbd_fs->fs->sb,
                    features_incompatible);
         jbd_set32(&jbd_fs->sb, start, 0);
         jbd_set32(&jbd_fs->sb, sequence, info.last_trans_id);
         features_incompatible &= ~EXT4_FINCOM_RECOVER;
-        ext4_set32(&jbd_fs->inode_ref.fs->sb,
+        ext4_set32(&jbd_fs->fs->sb,
                features_incompatible,
                features_incompatible);
         jbd_fs->dirty = true;
-        r = ext4_sb_write(jbd_fs->bdev,
-                  &jbd_fs->inode_ref.fs->sb);
+        r = ext4_sb_write(jbd_fs->fs->bdev,
+                  &jbd_fs->fs->sb);
     }
+Finish:
     jbd_destroy_revoke_tree(&info);
     return r;
 }
@@ -1269,14 +1518,14 @@ int jbd_journal_start(struct jbd_fs *jbd_fs,
 {
     int r;
     uint32_t features_incompatible =
-            ext4_get32(&jbd_fs->inode_ref.fs->sb,
+            ext4_get32(&jbd_fs->fs->sb,
                    features_incompatible);
     features_incompatible |= EXT4_FINCOM_RECOVER;
-    ext4_set32(&jbd_fs->inode_ref.fs->sb,
+    ext4_set32(&jbd_fs->fs->sb,
             features_incompatible,
             features_incompatible);
-    r = ext4_sb_write(jbd_fs->bdev,
-            &jbd_fs->inode_ref.fs->sb);
+    r = ext4_sb_write(jbd_fs->fs->bdev,
+            &jbd_fs->fs->sb);
     if (r != EOK)
         return r;
 
@@ -1294,14 +1543,24 @@ int jbd_journal_start(struct jbd_fs *jbd_fs,
     journal->block_size = jbd_get32(&jbd_fs->sb, blocksize);
 
     TAILQ_INIT(&journal->cp_queue);
+#if CONFIG_JOURNAL_HASH_INDEX
+    journal->block_rec_cnt = 0;
+    memset(journal->block_rec_hash, 0, sizeof(journal->block_rec_hash));
+    memset(journal->revoke_hash, 0, sizeof(journal->revoke_hash));
+    jbd_pool_init(&journal->buf_pool, sizeof(struct jbd_buf));
+    jbd_pool_init(&journal->block_rec_pool, sizeof(struct jbd_block_rec));
+    jbd_pool_init(&journal->revoke_rec_pool,
+              sizeof(struct jbd_revoke_rec));
+#else
     RB_INIT(&journal->block_rec_root);
+#endif
     journal->jbd_fs = jbd_fs;
     jbd_journal_write_sb(journal);
     r = jbd_write_sb(jbd_fs);
     if (r != EOK)
         return r;
 
-    jbd_fs->bdev->journal = journal;
+    jbd_fs->fs->bdev->journal = journal;
     return EOK;
 }
 
@@ -1316,7 +1575,7 @@ static void jbd_journal_flush_trans(struct jbd_trans *trans)
 {
     struct jbd_buf *jbd_buf, *tmp;
     struct jbd_journal *journal = trans->journal;
-    struct ext4_fs *fs = journal->jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = journal->jbd_fs->fs;
     void *tmp_data = ext4_malloc(journal->block_size);
     ext4_assert(tmp_data);
 
@@ -1425,20 +1684,30 @@ int jbd_journal_stop(struct jbd_journal *journal)
 
     /* There should be no block record in this journal
      * session. */
+#if CONFIG_JOURNAL_HASH_INDEX
+    if (journal->block_rec_cnt)
+#else
     if (!RB_EMPTY(&journal->block_rec_root))
+#endif
         ext4_dbg(DEBUG_JBD,
              DBG_WARN "There are still block records "
                   "in this journal session!\n");
 
+#if CONFIG_JOURNAL_HASH_INDEX
+    jbd_pool_fini(&journal->buf_pool);
+    jbd_pool_fini(&journal->block_rec_pool);
+    jbd_pool_fini(&journal->revoke_rec_pool);
+#endif
+
     features_incompatible =
-        ext4_get32(&jbd_fs->inode_ref.fs->sb,
+        ext4_get32(&jbd_fs->fs->sb,
                features_incompatible);
     features_incompatible &= ~EXT4_FINCOM_RECOVER;
-    ext4_set32(&jbd_fs->inode_ref.fs->sb,
+    ext4_set32(&jbd_fs->fs->sb,
             features_incompatible,
             features_incompatible);
-    r = ext4_sb_write(jbd_fs->bdev,
-            &jbd_fs->inode_ref.fs->sb);
+    r = ext4_sb_write(jbd_fs->fs->bdev,
+            &jbd_fs->fs->sb);
     if (r != EOK)
         return r;
 
@@ -1475,6 +1744,15 @@ static struct jbd_block_rec *
 jbd_trans_block_rec_lookup(struct jbd_journal *journal,
                ext4_fsblk_t lba)
 {
+#if CONFIG_JOURNAL_HASH_INDEX
+    struct jbd_block_rec *block_rec;
+    LIST_FOREACH(block_rec, &journal->block_rec_hash[jbd_hash_lba(lba)],
+             hash_node) {
+        if (block_rec->lba == lba)
+            return block_rec;
+    }
+    return NULL;
+#else
     struct jbd_block_rec tmp = {
         .lba = lba
     };
@@ -1482,6 +1760,43 @@ jbd_trans_block_rec_lookup(struct jbd_journal *journal,
     return RB_FIND(jbd_block,
                &journal->block_rec_root,
                &tmp);
+#endif
+}
+
+static struct jbd_revoke_rec *
+jbd_trans_revoke_rec_lookup(struct jbd_trans *trans,
+                ext4_fsblk_t lba)
+{
+#if CONFIG_JOURNAL_HASH_INDEX
+    struct jbd_revoke_rec *rec;
+    LIST_FOREACH(rec, &trans->journal->revoke_hash[jbd_hash_lba(lba)],
+             hash_node) {
+        if (rec->lba == lba && rec->trans == trans)
+            return rec;
+    }
+    return NULL;
+#else
+    struct jbd_revoke_rec tmp = {
+        .lba = lba
+    };
+
+    return RB_FIND(jbd_revoke_tree,
+               &trans->revoke_root,
+               &tmp);
+#endif
+}
+
+static void
+jbd_trans_remove_revoke_rec(struct jbd_trans *trans,
+                struct jbd_revoke_rec *rec)
+{
+#if CONFIG_JOURNAL_HASH_INDEX
+    LIST_REMOVE(rec, hash_node);
+    LIST_REMOVE(rec, revoke_node);
+#else
+    RB_REMOVE(jbd_revoke_tree, &trans->revoke_root, rec);
+#endif
+    jbd_free_revoke_rec(trans->journal, rec);
 }
 
 static void
@@ -1506,7 +1821,7 @@ jbd_trans_insert_block_rec(struct jbd_trans *trans,
         jbd_trans_change_ownership(block_rec, trans);
         return block_rec;
     }
-    block_rec = ext4_calloc(1, sizeof(struct jbd_block_rec));
+    block_rec = jbd_alloc_block_rec(trans->journal);
     if (!block_rec)
         return NULL;
 
@@ -1514,7 +1829,13 @@ jbd_trans_insert_block_rec(struct jbd_trans *trans,
     block_rec->trans = trans;
     TAILQ_INIT(&block_rec->dirty_buf_queue);
     LIST_INSERT_HEAD(&trans->tbrec_list, block_rec, tbrec_node);
+#if CONFIG_JOURNAL_HASH_INDEX
+    LIST_INSERT_HEAD(&trans->journal->block_rec_hash[jbd_hash_lba(lba)],
+             block_rec, hash_node);
+    trans->journal->block_rec_cnt++;
+#else
     RB_INSERT(jbd_block, &trans->journal->block_rec_root, block_rec);
+#endif
     return block_rec;
 }
 
@@ -1528,7 +1849,7 @@ jbd_trans_finish_callback(struct jbd_journal *journal,
               bool abort,
               bool revoke)
 {
-    struct ext4_fs *fs = journal->jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = journal->jbd_fs->fs;
     if (block_rec->trans != trans)
         return;
 
@@ -1597,10 +1918,15 @@ jbd_trans_remove_block_rec(struct jbd_journal *journal,
      * give up.*/
     if (block_rec->trans == trans) {
         LIST_REMOVE(block_rec, tbrec_node);
+#if CONFIG_JOURNAL_HASH_INDEX
+        LIST_REMOVE(block_rec, hash_node);
+        journal->block_rec_cnt--;
+#else
         RB_REMOVE(jbd_block,
                 &journal->block_rec_root,
                 block_rec);
-        ext4_free(block_rec);
+#endif
+        jbd_free_block_rec(journal, block_rec);
     }
 }
 
@@ -1612,9 +1938,7 @@ int jbd_trans_set_block_dirty(struct jbd_trans *trans,
                   struct ext4_block *block)
 {
     struct jbd_buf *jbd_buf;
-    struct jbd_revoke_rec *rec, tmp_rec = {
-        .lba = block->lb_id
-    };
+    struct jbd_revoke_rec *rec;
     struct jbd_block_rec *block_rec;
 
     if (block->buf->end_write == jbd_trans_end_write) {
@@ -1622,13 +1946,13 @@ int jbd_trans_set_block_dirty(struct jbd_trans *trans,
         if (jbd_buf && jbd_buf->trans == trans)
             return EOK;
     }
-    jbd_buf = ext4_calloc(1, sizeof(struct jbd_buf));
+    jbd_buf = jbd_alloc_buf(trans->journal);
     if (!jbd_buf)
         return ENOMEM;
 
     if ((block_rec = jbd_trans_insert_block_rec(trans,
                     block->lb_id)) == NULL) {
-        ext4_free(jbd_buf);
+        jbd_free_buf(trans->journal, jbd_buf);
         return ENOMEM;
     }
 
@@ -1650,14 +1974,9 @@ int jbd_trans_set_block_dirty(struct jbd_trans *trans,
     TAILQ_INSERT_HEAD(&trans->buf_queue, jbd_buf, buf_node);
 
     ext4_bcache_set_dirty(block->buf);
-    rec = RB_FIND(jbd_revoke_tree,
-            &trans->revoke_root,
-            &tmp_rec);
-    if (rec) {
-        RB_REMOVE(jbd_revoke_tree, &trans->revoke_root,
-              rec);
-        ext4_free(rec);
-    }
+    rec = jbd_trans_revoke_rec_lookup(trans, block->lb_id);
+    if (rec)
+        jbd_trans_remove_revoke_rec(trans, rec);
 
     return EOK;
 }
@@ -1669,24 +1988,47 @@ int jbd_trans_set_block_dirty(struct jbd_trans *trans,
 int jbd_trans_revoke_block(struct jbd_trans *trans,
                ext4_fsblk_t lba)
 {
-    struct jbd_revoke_rec tmp_rec = {
-        .lba = lba
-    }, *rec;
-    rec = RB_FIND(jbd_revoke_tree,
-              &trans->revoke_root,
-              &tmp_rec);
+    struct jbd_revoke_rec *rec;
+    rec = jbd_trans_revoke_rec_lookup(trans, lba);
     if (rec)
         return EOK;
 
-    rec = ext4_calloc(1, sizeof(struct jbd_revoke_rec));
+    rec = jbd_alloc_revoke_rec(trans->journal);
     if (!rec)
         return ENOMEM;
 
     rec->lba = lba;
+#if CONFIG_JOURNAL_HASH_INDEX
+    rec->trans = trans;
+    LIST_INSERT_HEAD(&trans->journal->revoke_hash[jbd_hash_lba(lba)],
+             rec, hash_node);
+    LIST_INSERT_HEAD(&trans->revoke_list, rec, revoke_node);
+#else
     RB_INSERT(jbd_revoke_tree, &trans->revoke_root, rec);
+#endif
     return EOK;
 }
 
+/**@brief  Revoke the block of a block record if it may still be
+ *         replayed from the journal.
+ * @param  trans transaction
+ * @param  block_rec block record
+ * @return standard error code*/
+static int jbd_trans_try_revoke_rec(struct jbd_trans *trans,
+                    struct jbd_block_rec *block_rec)
+{
+    if (block_rec->trans == trans) {
+        struct jbd_buf *jbd_buf =
+            TAILQ_LAST(&block_rec->dirty_buf_queue,
+                jbd_buf_dirty);
+        /* If there are still unwritten buffers. */
+        if (TAILQ_FIRST(&block_rec->dirty_buf_queue) == jbd_buf)
+            return EOK;
+    }
+
+    return jbd_trans_revoke_block(trans, block_rec->lba);
+}
+
 /**@brief  Try to add block to be revoked to a transaction.
  *         If @lba still remains in an transaction on checkpoint
  *         queue, add @lba as a revoked block to the transaction.
@@ -1700,21 +2042,63 @@ int jbd_trans_try_revoke_block(struct jbd_trans *trans,
     struct jbd_block_rec *block_rec =
         jbd_trans_block_rec_lookup(journal, lba);
 
-    if (block_rec) {
-        if (block_rec->trans == trans) {
-            struct jbd_buf *jbd_buf =
-                TAILQ_LAST(&block_rec->dirty_buf_queue,
-                    jbd_buf_dirty);
-            /* If there are still unwritten buffers. */
-            if (TAILQ_FIRST(&block_rec->dirty_buf_queue) !=
-                jbd_buf)
-                jbd_trans_revoke_block(trans, lba);
+    if (block_rec)
+        return jbd_trans_try_revoke_rec(trans, block_rec);
 
-        } else
-            jbd_trans_revoke_block(trans, lba);
+    return EOK;
+}
+
+/**@brief  Try to revoke a range of blocks in a transaction.
+ *         Only blocks having a block record in the journal can
+ *         need a revoke, so a long range is matched against the
+ *         records instead of being looked up block by block.
+ * @param  trans transaction
+ * @param  lba first logical block address
+ * @param  cnt number of blocks
+ * @return standard error code*/
+int jbd_trans_try_revoke_blocks(struct jbd_trans *trans,
+                ext4_fsblk_t lba, uint32_t cnt)
+{
+    int r = EOK;
+    struct jbd_journal *journal = trans->journal;
+    struct jbd_block_rec *block_rec;
+    ext4_fsblk_t end = lba + cnt;
+#if CONFIG_JOURNAL_HASH_INDEX
+    uint32_t i;
+
+    if (!journal->block_rec_cnt)
+        return EOK;
+
+    if (cnt <= CONFIG_JOURNAL_HASH_SIZE + journal->block_rec_cnt) {
+        for (; lba < end && r == EOK; lba++)
+            r = jbd_trans_try_revoke_block(trans, lba);
+
+        return r;
     }
 
-    return EOK;
+    for (i = 0; i < CONFIG_JOURNAL_HASH_SIZE && r == EOK; i++) {
+        LIST_FOREACH(block_rec, &journal->block_rec_hash[i],
+                 hash_node) {
+            if (block_rec->lba < lba || block_rec->lba >= end)
+                continue;
+
+            r = jbd_trans_try_revoke_rec(trans, block_rec);
+            if (r != EOK)
+                break;
+        }
+    }
+#else
+    struct jbd_block_rec tmp = {
+        .lba = lba
+    };
+
+    block_rec = RB_NFIND(jbd_block, &journal->block_rec_root, &tmp);
+    for (; block_rec && block_rec->lba < end && r == EOK;
+         block_rec = RB_NEXT(jbd_block, &journal->block_rec_root,
+                     block_rec))
+        r = jbd_trans_try_revoke_rec(trans, block_rec);
+#endif
+    return r;
 }
 
 /**@brief  Free a transaction
@@ -1729,7 +2113,16 @@ void jbd_journal_free_trans(struct jbd_journal *journal,
     struct jbd_buf *jbd_buf, *tmp;
     struct jbd_revoke_rec *rec, *tmp2;
     struct jbd_block_rec *block_rec, *tmp3;
-    struct ext4_fs *fs = journal->jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = journal->jbd_fs->fs;
+#if CONFIG_JOURNAL_ORDERED_DATA
+    struct jbd_data_range *range;
+
+    /* Data which has not been flushed yet is dropped.*/
+    while ((range = TAILQ_FIRST(&trans->data_queue))) {
+        TAILQ_REMOVE(&trans->data_queue, range, range_node);
+        ext4_free(range);
+    }
+#endif
     TAILQ_FOREACH_SAFE(jbd_buf, &trans->buf_queue, buf_node,
               tmp) {
         block_rec = jbd_buf->block_rec;
@@ -1749,13 +2142,11 @@ void jbd_journal_free_trans(struct jbd_journal *journal,
                 abort,
                 false);
         TAILQ_REMOVE(&trans->buf_queue, jbd_buf, buf_node);
-        ext4_free(jbd_buf);
-    }
-    RB_FOREACH_SAFE(rec, jbd_revoke_tree, &trans->revoke_root,
-              tmp2) {
-        RB_REMOVE(jbd_revoke_tree, &trans->revoke_root, rec);
-        ext4_free(rec);
+        jbd_free_buf(journal, jbd_buf);
     }
+    jbd_trans_foreach_revoke_safe(rec, trans, tmp2)
+        jbd_trans_remove_revoke_rec(trans, rec);
+
     LIST_FOREACH_SAFE(block_rec, &trans->tbrec_list, tbrec_node,
               tmp3) {
         jbd_trans_remove_block_rec(journal, block_rec, trans);
@@ -1764,6 +2155,81 @@ void jbd_journal_free_trans(struct jbd_journal *journal,
     ext4_free(trans);
 }
 
+#if CONFIG_JOURNAL_ORDERED_DATA
+/**@brief  Attach a range of file data to a transaction, so that it is
+ *         written to disk before the transaction commits.
+ * @param  trans transaction
+ * @param  off byte offset of the data on the filesystem device
+ * @param  data data to be written, it must stay valid until the
+ *         transaction is committed or freed
+ * @param  len length of the data
+ * @return standard error code*/
+int jbd_trans_add_data(struct jbd_trans *trans,
+               uint64_t off,
+               const void *data,
+               uint32_t len)
+{
+    struct jbd_data_range *range, *prev;
+
+    /* Ranges are kept sorted by offset. Most of the time data is
+     * appended, so look for the insert position from the tail. A
+     * range which overlaps the new one must stay in front of it.*/
+    TAILQ_FOREACH_REVERSE(prev, &trans->data_queue,
+                  jbd_trans_data, range_node) {
+        if (prev->off <= off ||
+            (prev->off < off + len && off < prev->off + prev->len))
+            break;
+    }
+
+    /* Extend the previous range if the data follows it both on disk
+     * and in memory.*/
+    if (prev && prev->off + prev->len == off &&
+        (const uint8_t *)prev->data + prev->len == data &&
+        prev->len + len > prev->len) {
+        prev->len += len;
+        return EOK;
+    }
+
+    range = ext4_malloc(sizeof(struct jbd_data_range));
+    if (!range)
+        return ENOMEM;
+
+    range->off = off;
+    range->len = len;
+    range->data = data;
+    if (prev)
+        TAILQ_INSERT_AFTER(&trans->data_queue, prev, range,
+                   range_node);
+    else
+        TAILQ_INSERT_HEAD(&trans->data_queue, range, range_node);
+
+    return EOK;
+}
+
+/**@brief  Write out file data attached to a transaction.
+ * @param  journal current journal session
+ * @param  trans transaction
+ * @return standard error code*/
+static int jbd_trans_flush_data(struct jbd_journal *journal,
+                struct jbd_trans *trans)
+{
+    int r, rc = EOK;
+    struct jbd_data_range *range;
+    struct ext4_fs *fs = journal->jbd_fs->fs;
+
+    while ((range = TAILQ_FIRST(&trans->data_queue))) {
+        r = ext4_block_writebytes(fs->bdev, range->off, range->data,
+                      range->len);
+        if (r != EOK && rc == EOK)
+            rc = r;
+
+        TAILQ_REMOVE(&trans->data_queue, range, range_node);
+        ext4_free(range);
+    }
+    return rc;
+}
+#endif
+
 /**@brief  Write commit block for a transaction
  * @param  trans transaction
  * @return standard error code*/
@@ -1814,7 +2280,7 @@ static int jbd_journal_prepare(struct jbd_journal *journal,
     uint32_t data_iblock = 0;
     char *tag_start = NULL, *tag_ptr = NULL;
     struct jbd_buf *jbd_buf, *tmp;
-    struct ext4_fs *fs = journal->jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = journal->jbd_fs->fs;
     uint32_t checksum = EXT4_CRC32_INIT;
     struct jbd_bhdr *bhdr = NULL;
     void *data;
@@ -1823,9 +2289,6 @@ static int jbd_journal_prepare(struct jbd_journal *journal,
      * buf_queue. */
     TAILQ_FOREACH_REVERSE_SAFE(jbd_buf, &trans->buf_queue,
             jbd_trans_buf, buf_node, tmp) {
-        struct jbd_revoke_rec tmp_rec = {
-            .lba = jbd_buf->block_rec->lba
-        };
         /* We stop the iteration when we find a dirty buffer. */
         if (ext4_bcache_test_flag(jbd_buf->block.buf,
                     BC_DIRTY))
@@ -1841,25 +2304,21 @@ static int jbd_journal_prepare(struct jbd_journal *journal,
                 trans,
                 jbd_buf->block_rec,
                 true,
-                RB_FIND(jbd_revoke_tree,
-                    &trans->revoke_root,
-                    &tmp_rec));
+                jbd_trans_revoke_rec_lookup(trans,
+                    jbd_buf->block_rec->lba));
         jbd_trans_remove_block_rec(journal,
                     jbd_buf->block_rec, trans);
         trans->data_cnt--;
 
         ext4_block_set(fs->bdev, &jbd_buf->block);
         TAILQ_REMOVE(&trans->buf_queue, jbd_buf, buf_node);
-        ext4_free(jbd_buf);
+        jbd_free_buf(journal, jbd_buf);
     }
 
     TAILQ_FOREACH_SAFE(jbd_buf, &trans->buf_queue, buf_node, tmp) {
         struct tag_info tag_info;
         bool uuid_exist = false;
         bool is_escape = false;
-        struct jbd_revoke_rec tmp_rec = {
-            .lba = jbd_buf->block_rec->lba
-        };
         if (!ext4_bcache_test_flag(jbd_buf->block.buf,
                        BC_DIRTY)) {
             TAILQ_REMOVE(&jbd_buf->block_rec->dirty_buf_queue,
@@ -1875,16 +2334,15 @@ static int jbd_journal_prepare(struct jbd_journal *journal,
                     trans,
                     jbd_buf->block_rec,
                     true,
-                    RB_FIND(jbd_revoke_tree,
-                        &trans->revoke_root,
-                        &tmp_rec));
+                    jbd_trans_revoke_rec_lookup(trans,
+                        jbd_buf->block_rec->lba));
             jbd_trans_remove_block_rec(journal,
                     jbd_buf->block_rec, trans);
             trans->data_cnt--;
 
             ext4_block_set(fs->bdev, &jbd_buf->block);
             TAILQ_REMOVE(&trans->buf_queue, jbd_buf, buf_node);
-            ext4_free(jbd_buf);
+            jbd_free_buf(journal, jbd_buf);
             continue;
         }
         checksum = jbd_block_csum(journal->jbd_fs,
@@ -2013,8 +2471,7 @@ jbd_journal_prepare_revoke(struct jbd_journal *journal,
                      JBD_FEATURE_INCOMPAT_64BIT))
         record_len = 8;
 
-    RB_FOREACH_SAFE(rec, jbd_revoke_tree, &trans->revoke_root,
-              tmp) {
+    jbd_trans_foreach_revoke_safe(rec, trans, tmp) {
 again:
         if (!desc_iblock) {
             desc_iblock = jbd_journal_alloc_block(journal, trans);
@@ -2088,7 +2545,7 @@ again:
 void jbd_journal_cp_trans(struct jbd_journal *journal, struct jbd_trans *trans)
 {
     struct jbd_buf *jbd_buf, *tmp;
-    struct ext4_fs *fs = journal->jbd_fs->inode_ref.fs;
+    struct ext4_fs *fs = journal->jbd_fs->fs;
     TAILQ_FOREACH_SAFE(jbd_buf, &trans->buf_queue, buf_node,
             tmp) {
         struct ext4_block block = jbd_buf->block;
@@ -2128,7 +2585,7 @@ static void jbd_trans_end_write(struct ext4_bcache *bc __unused,
         buf->end_write_arg = NULL;
     }
 
-    ext4_free(jbd_buf);
+    jbd_free_buf(journal, jbd_buf);
 
     trans->written_cnt++;
     if (trans->written_cnt == trans->data_cnt) {
@@ -2164,6 +2621,16 @@ static int __jbd_journal_commit_trans(struct jbd_journal *journal,
     struct jbd_revoke_rec *rec, *tmp;
 
     trans->trans_id = journal->alloc_trans_id;
+#if CONFIG_JOURNAL_ORDERED_DATA
+    /* File data has to reach the disk before the metadata
+     * referring to it gets committed. If it doesn't, the
+     * transaction is thrown away.*/
+    rc = jbd_trans_flush_data(journal, trans);
+    if (rc != EOK) {
+        jbd_journal_free_trans(journal, trans, true);
+        return rc;
+    }
+#endif
     rc = jbd_journal_prepare(journal, trans);
     if (rc != EOK)
         goto Finish;
@@ -2173,7 +2640,7 @@ static int __jbd_journal_commit_trans(struct jbd_journal *journal,
         goto Finish;
 
     if (TAILQ_EMPTY(&trans->buf_queue) &&
-        RB_EMPTY(&trans->revoke_root)) {
+        jbd_trans_revoke_empty(trans)) {
         /* Since there are no entries in both buffer list
          * and revoke entry list, we do not consider trans as
          * complete transaction and just return EOK.*/
@@ -2188,8 +2655,7 @@ static int __jbd_journal_commit_trans(struct jbd_journal *journal,
     journal->alloc_trans_id++;
 
     /* Complete the checkpoint of buffers which are revoked. */
-    RB_FOREACH_SAFE(rec, jbd_revoke_tree, &trans->revoke_root,
-            tmp) {
+    jbd_trans_foreach_revoke_safe(rec, trans, tmp) {
         struct jbd_block_rec *block_rec =
             jbd_trans_block_rec_lookup(journal, rec->lba);
         struct jbd_buf *jbd_buf = NULL;
@@ -2204,15 +2670,15 @@ static int __jbd_journal_commit_trans(struct jbd_journal *journal,
              * ext4_buf::end_write_arg fields so that the checkpoint
              * callback won't be triggered again.
              */
-            buf = ext4_bcache_find_get(journal->jbd_fs->bdev->bc,
+            buf = ext4_bcache_find_get(journal->jbd_fs->fs->bdev->bc,
                     &block,
                     jbd_buf->block_rec->lba);
-            jbd_trans_end_write(journal->jbd_fs->bdev->bc,
+            jbd_trans_end_write(journal->jbd_fs->fs->bdev->bc,
                     buf,
                     EOK,
                     jbd_buf);
             if (buf)
-                ext4_block_set(journal->jbd_fs->bdev, &block);
+                ext4_block_set(journal->jbd_fs->fs->bdev, &block);
         }
     }
 
@@ -2272,6 +2738,9 @@ jbd_journal_new_trans(struct jbd_journal *journal)
     trans->data_csum = EXT4_CRC32_INIT;
     trans->error = EOK;
     TAILQ_INIT(&trans->buf_queue);
+#if CONFIG_JOURNAL_ORDERED_DATA
+    TAILQ_INIT(&trans->data_queue);
+#endif
     return trans;
 }
 
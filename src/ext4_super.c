@@ -47,6 +47,10 @@
 
 #include <ext4_super.h>
 #include <ext4_crc32.h>
+#include <ext4_blockdev.h>
+#include <ext4_trans.h>
+
+#include <string.h>
 
 uint32_t ext4_block_group_cnt(struct ext4_sblock *s)
 {
@@ -115,13 +119,54 @@ static void ext4_sb_set_csum(struct ext4_sblock *s)
     s->checksum = to_le32(ext4_sb_csum(s));
 }
 
+/**@brief   Refresh the cached copy of the superblock block, if any, so
+ *          that a later write back of that block can not bring an
+ *          older superblock back.
+ * @param   bdev block device descriptor.
+ * @param   s superblock descriptor*/
+static void ext4_sb_update_cached(struct ext4_blockdev *bdev,
+                  struct ext4_sblock *s)
+{
+    struct ext4_block b;
+    uint64_t lba;
+
+    if (!bdev->fs || !bdev->bc || !bdev->lg_bsize)
+        return;
+
+    lba = EXT4_SUPERBLOCK_OFFSET / bdev->lg_bsize;
+    if (!ext4_bcache_find_get(bdev->bc, &b, lba))
+        return;
+
+    memcpy(b.data + EXT4_SUPERBLOCK_OFFSET % bdev->lg_bsize, s,
+           EXT4_SUPERBLOCK_SIZE);
+    ext4_bcache_free(bdev->bc, &b);
+}
+
 int ext4_sb_write(struct ext4_blockdev *bdev, struct ext4_sblock *s)
 {
     ext4_sb_set_csum(s);
+    ext4_sb_update_cached(bdev, s);
     return ext4_block_writebytes(bdev, EXT4_SUPERBLOCK_OFFSET, s,
                      EXT4_SUPERBLOCK_SIZE);
 }
 
+int ext4_sb_write_trans(struct ext4_blockdev *bdev, struct ext4_sblock *s)
+{
+    struct ext4_block b;
+    uint64_t lba = EXT4_SUPERBLOCK_OFFSET / bdev->lg_bsize;
+    int r;
+
+    ext4_sb_set_csum(s);
+    r = ext4_trans_block_get(bdev, &b, lba);
+    if (r != EOK)
+        return r;
+
+    memcpy(b.data + EXT4_SUPERBLOCK_OFFSET % bdev->lg_bsize, s,
+           EXT4_SUPERBLOCK_SIZE);
+    ext4_trans_set_block_dirty(b.buf);
+    return ext4_block_set(bdev, &b);
+}
+
 int ext4_sb_read(struct ext4_blockdev *bdev, struct ext4_sblock *s)
 {
     return ext4_block_readbytes(bdev, EXT4_SUPERBLOCK_OFFSET, s,
@@ -64,6 +64,18 @@ int ext4_trans_set_block_dirty(struct ext4_buf *buf)
     return r;
 }
 
+int ext4_trans_set_inode_block_dirty(struct ext4_buf *buf, uint32_t ino,
+                     bool datasync)
+{
+    buf->owner = ino;
+    if (datasync)
+        ext4_bcache_set_flag(buf, BC_DATASYNC);
+    else
+        ext4_bcache_clear_flag(buf, BC_DATASYNC);
+
+    return ext4_trans_set_block_dirty(buf);
+}
+
 int ext4_trans_block_get_noread(struct ext4_blockdev *bdev,
               struct ext4_block *b,
               uint64_t lba)
@@ -102,6 +114,24 @@ int ext4_trans_try_revoke_block(struct ext4_blockdev *bdev __unused,
     return r;
 }
 
+int ext4_trans_try_revoke_blocks(struct ext4_blockdev *bdev __unused,
+                 uint64_t lba __unused, uint32_t cnt __unused)
+{
+    int r = EOK;
+#if CONFIG_JOURNALING_ENABLE
+    struct ext4_fs *fs = bdev->fs;
+    if (fs->jbd_journal && fs->curr_trans) {
+        struct jbd_trans *trans = fs->curr_trans;
+        r = jbd_trans_try_revoke_blocks(trans, lba, cnt);
+    } else if (fs->jbd_journal) {
+        uint64_t end = lba + cnt;
+        for (; lba < end && r == EOK; lba++)
+            r = ext4_block_flush_lba(fs->bdev, lba);
+    }
+#endif
+    return r;
+}
+
 /**
  * @}
  */
@@ -50,16 +50,8 @@
 /* Maximum number of references to one attribute block */
 #define EXT4_XATTR_REFCOUNT_MAX     1024
 
-/* Name indexes */
-#define EXT4_XATTR_INDEX_USER           1
-#define EXT4_XATTR_INDEX_POSIX_ACL_ACCESS   2
-#define EXT4_XATTR_INDEX_POSIX_ACL_DEFAULT  3
-#define EXT4_XATTR_INDEX_TRUSTED        4
-#define EXT4_XATTR_INDEX_LUSTRE         5
-#define EXT4_XATTR_INDEX_SECURITY           6
-#define EXT4_XATTR_INDEX_SYSTEM         7
-#define EXT4_XATTR_INDEX_RICHACL        8
-#define EXT4_XATTR_INDEX_ENCRYPTION     9
+/* Cached blocks of the same hash compared before giving up sharing */
+#define EXT4_XATTR_SHARE_TRIES      8
 
 #define EXT4_XATTR_PAD_BITS 2
 #define EXT4_XATTR_PAD (1 << EXT4_XATTR_PAD_BITS)
@@ -299,6 +291,45 @@ const char *ext4_get_xattr_name_prefix(uint8_t name_index,
 
 static const char ext4_xattr_empty_value;
 
+/**
+ * @brief Compute the free space of a search context buffer. The space
+ *    taken by the entry found (if any) is counted as free.
+ *
+ * @param s Search context block
+ * @param last Returns the terminating entry of the buffer
+ * @param min_offs Returns the offset of the lowest value in the buffer
+ *
+ * @return Free space in bytes
+ */
+static size_t ext4_xattr_free_space(struct ext4_xattr_search *s,
+                    struct ext4_xattr_entry **last,
+                    size_t *min_offs)
+{
+    struct ext4_xattr_entry *entry;
+    size_t free, offs = (char *)s->end - (char *)s->base;
+
+    /* Compute min_offs and last. */
+    entry = s->first;
+    for (; !EXT4_XATTR_IS_LAST_ENTRY(entry);
+         entry = EXT4_XATTR_NEXT(entry)) {
+        if (entry->e_value_size) {
+            size_t o = to_le16(entry->e_value_offs);
+            if (o < offs)
+                offs = o;
+        }
+    }
+
+    /* Calculate free space in the block. */
+    free = offs - ((char *)entry - (char *)s->base) - sizeof(uint32_t);
+    if (!s->not_found)
+        free += EXT4_XATTR_SIZE(s->here->e_value_size) +
+            EXT4_XATTR_LEN(s->here->e_name_len);
+
+    *last = entry;
+    *min_offs = offs;
+    return free;
+}
+
 /**
  * @brief Insert/Remove/Modify the given entry
  *
@@ -312,8 +343,7 @@ static int ext4_xattr_set_entry(struct ext4_xattr_info *i,
                 struct ext4_xattr_search *s, bool dry_run)
 {
     struct ext4_xattr_entry *last;
-    size_t free, min_offs = (char *)s->end - (char *)s->base,
-             name_len = i->name_len;
+    size_t free, min_offs, name_len = i->name_len;
 
     /*
      * If the entry is going to be removed but not found, return 0 to
@@ -322,21 +352,7 @@ static int ext4_xattr_set_entry(struct ext4_xattr_info *i,
     if (!i->value && s->not_found)
         return EOK;
 
-    /* Compute min_offs and last. */
-    last = s->first;
-    for (; !EXT4_XATTR_IS_LAST_ENTRY(last); last = EXT4_XATTR_NEXT(last)) {
-        if (last->e_value_size) {
-            size_t offs = to_le16(last->e_value_offs);
-            if (offs < min_offs)
-                min_offs = offs;
-        }
-    }
-
-    /* Calculate free space in the block. */
-    free = min_offs - ((char *)last - (char *)s->base) - sizeof(uint32_t);
-    if (!s->not_found)
-        free += EXT4_XATTR_SIZE(s->here->e_value_size) +
-            EXT4_XATTR_LEN(s->here->e_name_len);
+    free = ext4_xattr_free_space(s, &last, &min_offs);
 
     if (i->value) {
         /* See whether there is enough space to hold new entry */
@@ -382,7 +398,7 @@ static int ext4_xattr_set_entry(struct ext4_xattr_info *i,
             size_t offs = to_le16(last->e_value_offs);
 
             /* For zero-value-length entry, offs will be zero. */
-            if (offs < value_offs)
+            if (offs && offs < value_offs)
                 last->e_value_offs = to_le16(offs + value_size);
         }
     }
@@ -531,10 +547,10 @@ static bool ext4_xattr_is_block_valid(struct ext4_inode_ref *inode_ref,
      */
     for (; !EXT4_XATTR_IS_LAST_ENTRY(entry);
          entry = EXT4_XATTR_NEXT(entry)) {
-        if (!to_le32(entry->e_value_size) &&
-            to_le16(entry->e_value_offs))
-            return false;
-
+        /*
+         * Empty value may still carry an offset (older versions
+         * left one behind), only its bounds are checked.
+         */
         if ((char *)base + to_le16(entry->e_value_offs) +
             to_le32(entry->e_value_size) >
             (char *)end)
@@ -582,7 +598,8 @@ static bool ext4_xattr_is_ibody_valid(struct ext4_inode_ref *inode_ref)
 
     iheader = EXT4_XATTR_IHDR(&fs->sb, inode_ref->inode);
     entry = EXT4_XATTR_IFIRST(iheader);
-    base = iheader;
+    /* Value offsets are relative to the first entry, not the header */
+    base = entry;
     end = (char *)inode_ref->inode + inode_size;
     min_offs = (char *)end - (char *)base;
 
@@ -598,10 +615,10 @@ static bool ext4_xattr_is_ibody_valid(struct ext4_inode_ref *inode_ref)
      */
     for (; !EXT4_XATTR_IS_LAST_ENTRY(entry);
          entry = EXT4_XATTR_NEXT(entry)) {
-        if (!to_le32(entry->e_value_size) &&
-            to_le16(entry->e_value_offs))
-            return false;
-
+        /*
+         * Empty value may still carry an offset (mke2fs writes the
+         * inline data entry that way), only its bounds are checked.
+         */
         if ((char *)base + to_le16(entry->e_value_offs) +
             to_le32(entry->e_value_size) >
             (char *)end)
@@ -668,25 +685,22 @@ static void ext4_xattr_ibody_initialize(struct ext4_inode_ref *inode_ref)
 }
 
 /**
- * @brief Initialize a given xattr block
+ * @brief Check whether the inode body has an EA header
  *
  * @param inode_ref Inode reference
- * @param block xattr block buffer
+ *
+ * @return true if there is room for EAs and the header magic is set
  */
-static void ext4_xattr_block_initialize(struct ext4_inode_ref *inode_ref,
-                    struct ext4_block *block)
+static bool ext4_xattr_ibody_has_header(struct ext4_inode_ref *inode_ref)
 {
-    struct ext4_xattr_header *header;
-    struct ext4_fs *fs = inode_ref->fs;
-
-    memset(block->data, 0, ext4_sb_get_block_size(&fs->sb));
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+    struct ext4_xattr_ibody_header *iheader;
 
-    header = EXT4_XATTR_BHDR(block);
-    header->h_magic = to_le32(EXT4_XATTR_MAGIC);
-    header->h_refcount = to_le32(1);
-    header->h_blocks = to_le32(1);
+    if (!ext4_inode_get_extra_isize(sb, inode_ref->inode))
+        return false;
 
-    ext4_trans_set_block_dirty(block->buf);
+    iheader = EXT4_XATTR_IHDR(sb, inode_ref->inode);
+    return iheader->h_magic == to_le32(EXT4_XATTR_MAGIC);
 }
 
 static void ext4_xattr_block_init_search(struct ext4_inode_ref *inode_ref,
@@ -759,10 +773,10 @@ static int ext4_xattr_ibody_find_entry(struct ext4_inode_ref *inode_ref,
     memset(&finder->s, 0, sizeof(finder->s));
 
     /*
-     * If there is no extra inode space
+     * If there is no extra inode space or no EA in it yet
      * set ext4_xattr_ibody_finder::s::not_found to true and return EOK
      */
-    if (!extra_isize) {
+    if (!extra_isize || !ext4_xattr_ibody_has_header(inode_ref)) {
         finder->s.not_found = true;
         return EOK;
     }
@@ -814,26 +828,227 @@ Finish:
 }
 
 /**
- * @brief Try to free a block holding EA entries.
+ * @brief Account a xattr block shared with other inodes in the inode's
+ *    block count (the allocator does it for blocks it hands out)
  *
  * @param inode_ref Inode reference
+ * @param add true when the inode takes a reference, false when it
+ *      drops one
+ */
+static void ext4_xattr_count_block(struct ext4_inode_ref *inode_ref,
+                   bool add)
+{
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+    uint64_t ino_blocks = ext4_inode_get_blocks_count(sb, inode_ref->inode);
+    uint32_t n = ext4_sb_get_block_size(sb) / EXT4_INODE_BLOCK_SIZE;
+
+    ino_blocks = add ? ino_blocks + n : ino_blocks - n;
+    ext4_inode_set_blocks_count(sb, inode_ref->inode, ino_blocks);
+    inode_ref->dirty = true;
+}
+
+#if CONFIG_XCACHE_ENABLE
+/**
+ * @brief Compare the EA entries of two xattr blocks
+ *
+ * @param h1 Header of the first block
+ * @param h2 Header of the second block (validated)
+ *
+ * @return true if both blocks hold the same entries with same values
+ */
+static bool ext4_xattr_block_same(struct ext4_xattr_header *h1,
+                  struct ext4_xattr_header *h2)
+{
+    struct ext4_xattr_entry *e1 = EXT4_XATTR_ENTRY(h1 + 1);
+    struct ext4_xattr_entry *e2 = EXT4_XATTR_ENTRY(h2 + 1);
+
+    while (!EXT4_XATTR_IS_LAST_ENTRY(e1)) {
+        if (EXT4_XATTR_IS_LAST_ENTRY(e2))
+            return false;
+
+        if (e1->e_hash != e2->e_hash ||
+            e1->e_name_index != e2->e_name_index ||
+            e1->e_name_len != e2->e_name_len ||
+            e1->e_value_size != e2->e_value_size ||
+            e1->e_value_block || e2->e_value_block)
+            return false;
+
+        if (memcmp(EXT4_XATTR_NAME(e1), EXT4_XATTR_NAME(e2),
+               e1->e_name_len))
+            return false;
+
+        if (memcmp((char *)h1 + to_le16(e1->e_value_offs),
+               (char *)h2 + to_le16(e2->e_value_offs),
+               to_le32(e1->e_value_size)))
+            return false;
+
+        e1 = EXT4_XATTR_NEXT(e1);
+        e2 = EXT4_XATTR_NEXT(e2);
+    }
+
+    return EXT4_XATTR_IS_LAST_ENTRY(e2);
+}
+
+/**
+ * @brief Remember a xattr block in the cache if it may be shared,
+ *    forget it otherwise
+ *
+ * @param inode_ref Inode reference
+ * @param block The xattr block
+ */
+static void ext4_xattr_block_cache(struct ext4_inode_ref *inode_ref,
+                   struct ext4_block *block)
+{
+    struct ext4_xcache *xc = &inode_ref->fs->xcache;
+    struct ext4_xattr_header *header = EXT4_XATTR_BHDR(block);
+
+    if (header->h_hash &&
+        to_le32(header->h_refcount) < EXT4_XATTR_REFCOUNT_MAX)
+        ext4_xcache_insert(xc, to_le32(header->h_hash), block->lb_id);
+    else
+        ext4_xcache_remove(xc, block->lb_id);
+}
+
+/**
+ * @brief Find a cached xattr block holding the same EA entries and
+ *    take a reference to it
+ *
+ * @param inode_ref Inode reference
+ * @param header Header of the entries wanted (hashed)
+ * @param own Block not to be taken, 0 if none
+ *
+ * @return Block number, 0 if there is no such block
+ */
+static ext4_fsblk_t ext4_xattr_block_share(struct ext4_inode_ref *inode_ref,
+                       struct ext4_xattr_header *header,
+                       ext4_fsblk_t own)
+{
+    struct ext4_fs *fs = inode_ref->fs;
+    ext4_fsblk_t blocks[EXT4_XATTR_SHARE_TRIES];
+    uint32_t hash = to_le32(header->h_hash);
+    size_t n, k;
+
+    /* Zero hash marks a block which must not be shared */
+    if (!hash)
+        return 0;
+
+    n = ext4_xcache_lookup(&fs->xcache, hash, blocks,
+                   EXT4_XATTR_SHARE_TRIES);
+    for (k = 0; k < n; k++) {
+        struct ext4_xattr_header *cand;
+        struct ext4_block block;
+        uint32_t refcount;
+
+        if (blocks[k] == own)
+            continue;
+
+        if (ext4_trans_block_get(fs->bdev, &block, blocks[k]) != EOK)
+            return 0;
+
+        /* Cache is only a hint: block may have changed since */
+        cand = EXT4_XATTR_BHDR(&block);
+        refcount = to_le32(cand->h_refcount);
+        if (!ext4_xattr_is_block_valid(inode_ref, &block) ||
+            to_le32(cand->h_hash) != hash ||
+            refcount >= EXT4_XATTR_REFCOUNT_MAX) {
+            ext4_xcache_remove(&fs->xcache, blocks[k]);
+            ext4_block_set(fs->bdev, &block);
+            continue;
+        }
+
+        if (!ext4_xattr_block_same(header, cand)) {
+            ext4_block_set(fs->bdev, &block);
+            continue;
+        }
+
+        cand->h_refcount = to_le32(refcount + 1);
+        ext4_xattr_set_block_checksum(inode_ref, block.lb_id, cand);
+        ext4_trans_set_inode_block_dirty(block.buf, inode_ref->index, false);
+        ext4_xattr_block_cache(inode_ref, &block);
+        ext4_block_set(fs->bdev, &block);
+        ext4_xattr_count_block(inode_ref, true);
+        return blocks[k];
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief Write back a xattr block of the inode which has just been
+ *    modified. If a cached block holds the same entries, the inode
+ *    shares that one and its own block is freed.
+ *
+ * @param inode_ref Inode reference
+ * @param block Own xattr block of the inode (not shared), hashed.
+ *      The buffer is released.
  *
  * @return Error code
  */
-static void ext4_xattr_try_free_block(struct ext4_inode_ref *inode_ref)
+static int ext4_xattr_block_put(struct ext4_inode_ref *inode_ref,
+                struct ext4_block *block)
 {
-    ext4_fsblk_t xattr_block;
-    xattr_block =
-        ext4_inode_get_file_acl(inode_ref->inode, &inode_ref->fs->sb);
-    /*
-     * Free the xattr block used by the inode when there is one.
-     */
-    if (xattr_block) {
-        ext4_inode_set_file_acl(inode_ref->inode, &inode_ref->fs->sb,
-                    0);
-        ext4_balloc_free_block(inode_ref, xattr_block);
+    struct ext4_fs *fs = inode_ref->fs;
+    struct ext4_xattr_header *header = EXT4_XATTR_BHDR(block);
+
+#if CONFIG_XCACHE_ENABLE
+    ext4_fsblk_t own = block->lb_id;
+    ext4_fsblk_t shared = ext4_xattr_block_share(inode_ref, header, own);
+
+    if (shared) {
+        ext4_block_set(fs->bdev, block);
+        ext4_xcache_remove(&fs->xcache, own);
+        ext4_inode_set_file_acl(inode_ref->inode, &fs->sb, shared);
         inode_ref->dirty = true;
+        return ext4_balloc_free_block(inode_ref, own);
     }
+
+    ext4_xattr_block_cache(inode_ref, block);
+#endif
+
+    ext4_xattr_set_block_checksum(inode_ref, block->lb_id, header);
+    ext4_trans_set_inode_block_dirty(block->buf, inode_ref->index, false);
+    return ext4_block_set(fs->bdev, block);
+}
+
+int ext4_xattr_release_block(struct ext4_inode_ref *inode_ref)
+{
+    int ret;
+    struct ext4_block block;
+    struct ext4_xattr_header *header;
+    struct ext4_fs *fs = inode_ref->fs;
+    ext4_fsblk_t xattr_block;
+
+    xattr_block = ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
+    if (!xattr_block)
+        return EOK;
+
+    ret = ext4_trans_block_get(fs->bdev, &block, xattr_block);
+    if (ret != EOK)
+        return ret;
+
+    ext4_inode_set_file_acl(inode_ref->inode, &fs->sb, 0);
+    inode_ref->dirty = true;
+
+    /* Other inodes still use the block */
+    header = EXT4_XATTR_BHDR(&block);
+    if (header->h_magic == to_le32(EXT4_XATTR_MAGIC) &&
+        to_le32(header->h_refcount) > 1) {
+        header->h_refcount = to_le32(to_le32(header->h_refcount) - 1);
+        ext4_xattr_set_block_checksum(inode_ref, block.lb_id, header);
+        ext4_trans_set_inode_block_dirty(block.buf, inode_ref->index, false);
+#if CONFIG_XCACHE_ENABLE
+        ext4_xattr_block_cache(inode_ref, &block);
+#endif
+        ext4_xattr_count_block(inode_ref, false);
+        return ext4_block_set(fs->bdev, &block);
+    }
+
+    ext4_block_set(fs->bdev, &block);
+#if CONFIG_XCACHE_ENABLE
+    ext4_xcache_remove(&fs->xcache, xattr_block);
+#endif
+    return ext4_balloc_free_block(inode_ref, xattr_block);
 }
 
 /**
@@ -980,6 +1195,312 @@ out:
     return ret;
 }
 
+/**
+ * @brief Check whether an EA entry holds inline file data. Its value
+ *    changes with every write of the file, so it is never decoded.
+ */
+static bool ext4_xattr_is_inline_data(uint8_t name_index, const char *name,
+                      size_t name_len)
+{
+    return name_index == EXT4_XATTR_INDEX_SYSTEM && name_len == 4 &&
+           !memcmp(name, "data", 4);
+}
+
+/**
+ * @brief Decode EA entries of one buffer. Called first with @items
+ *    NULL to count entries and their bytes, then to fill them.
+ *
+ * @param entry First entry of the buffer
+ * @param base Base of value offsets
+ * @param items Output items, NULL to count only
+ * @param count Number of items, incremented
+ * @param data Place for names and values, advanced
+ * @param data_len Bytes of names and values, incremented
+ */
+static void ext4_xattr_decode_entries(struct ext4_xattr_entry *entry,
+                      void *base,
+                      struct ext4_xattr_item *items,
+                      uint32_t *count, char **data,
+                      size_t *data_len)
+{
+    for (; !EXT4_XATTR_IS_LAST_ENTRY(entry);
+         entry = EXT4_XATTR_NEXT(entry)) {
+        size_t name_len = entry->e_name_len;
+        size_t value_len = to_le32(entry->e_value_size);
+        char *name = EXT4_XATTR_NAME(entry);
+
+        if (ext4_xattr_is_inline_data(entry->e_name_index, name,
+                          name_len))
+            continue;
+
+        if (items) {
+            struct ext4_xattr_item *it = &items[*count];
+            it->hash = ext4_xcache_name_hash(entry->e_name_index,
+                             name, name_len);
+            it->name_index = entry->e_name_index;
+            it->name_len = (uint8_t)name_len;
+            it->value_len = (uint32_t)value_len;
+
+            memcpy(*data, name, name_len);
+            it->name = *data;
+            *data += name_len;
+
+            memcpy(*data,
+                   (char *)base + to_le16(entry->e_value_offs),
+                   value_len);
+            it->value = *data;
+            *data += value_len;
+        }
+
+        (*count)++;
+        *data_len += name_len + value_len;
+    }
+}
+
+/**
+ * @brief Decode all EA entries of an inode into one allocation.
+ *    Entries of the inode body come first, like in lookups.
+ *
+ * @param inode_ref Inode reference
+ * @param items Returns items allocated by ext4_malloc (NULL if there
+ *      are none), names and values are stored behind the array
+ * @param count Returns number of items
+ *
+ * @return Error code
+ */
+static int ext4_xattr_decode(struct ext4_inode_ref *inode_ref,
+                 struct ext4_xattr_item **items, uint32_t *count)
+{
+    int ret = EOK;
+    struct ext4_fs *fs = inode_ref->fs;
+    struct ext4_xattr_entry *ifirst = NULL, *bfirst = NULL;
+    struct ext4_block block;
+    ext4_fsblk_t xattr_block;
+    size_t data_len = 0;
+    char *data = NULL;
+
+    *items = NULL;
+    *count = 0;
+
+    if (ext4_xattr_ibody_has_header(inode_ref)) {
+        if (!ext4_xattr_is_ibody_valid(inode_ref))
+            return EIO;
+
+        ifirst = EXT4_XATTR_IFIRST(
+            EXT4_XATTR_IHDR(&fs->sb, inode_ref->inode));
+        ext4_xattr_decode_entries(ifirst, ifirst, NULL, count, NULL,
+                      &data_len);
+    }
+
+    xattr_block = ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
+    if (xattr_block) {
+        ret = ext4_trans_block_get(fs->bdev, &block, xattr_block);
+        if (ret != EOK)
+            return ret;
+
+        if (!ext4_xattr_is_block_valid(inode_ref, &block)) {
+            ext4_block_set(fs->bdev, &block);
+            return EIO;
+        }
+
+        bfirst = EXT4_XATTR_BFIRST(&block);
+        ext4_xattr_decode_entries(bfirst, block.data, NULL, count,
+                      NULL, &data_len);
+    }
+
+    if (*count) {
+        *items = ext4_malloc(*count * sizeof(struct ext4_xattr_item) +
+                     data_len);
+        if (!*items) {
+            ret = ENOMEM;
+            goto out;
+        }
+
+        data = (char *)(*items + *count);
+        *count = 0;
+        if (ifirst)
+            ext4_xattr_decode_entries(ifirst, ifirst, *items, count,
+                          &data, &data_len);
+        if (bfirst)
+            ext4_xattr_decode_entries(bfirst, block.data, *items,
+                          count, &data, &data_len);
+    }
+
+#if CONFIG_XCACHE_ENABLE
+    if (bfirst)
+        ext4_xattr_block_cache(inode_ref, &block);
+#endif
+out:
+    if (xattr_block)
+        ext4_block_set(fs->bdev, &block);
+
+    return ret;
+}
+
+#if CONFIG_XCACHE_ENABLE && CONFIG_XCACHE_INODES
+/**
+ * @brief Get decoded EA entries of an inode, decoding them on the
+ *    first access
+ *
+ * @param inode_ref Inode reference
+ * @param ci Returns cached entries
+ *
+ * @return Error code
+ */
+static int ext4_xattr_cached(struct ext4_inode_ref *inode_ref,
+                 struct ext4_xcache_inode **ci)
+{
+    int ret;
+    uint32_t count;
+    struct ext4_xattr_item *items;
+    struct ext4_xcache *xc = &inode_ref->fs->xcache;
+
+    *ci = ext4_xcache_inode_get(xc, inode_ref->index);
+    if (*ci)
+        return EOK;
+
+    ret = ext4_xattr_decode(inode_ref, &items, &count);
+    if (ret != EOK)
+        return ret;
+
+    *ci = ext4_xcache_inode_set(xc, inode_ref->index, items, count);
+    return EOK;
+}
+
+/**
+ * @brief Query EA entry's value from decoded entries
+ *
+ * @param ci Decoded entries of the inode
+ * @param name_index Name-index
+ * @param name Name of the EA entry to be queried
+ * @param name_len Length of name in bytes
+ * @param buf Output buffer to hold content
+ * @param buf_len Output buffer's length
+ * @param data_len The length of data of the EA entry found
+ *
+ * @return Error code
+ */
+static int ext4_xattr_cached_get(struct ext4_xcache_inode *ci,
+                 uint8_t name_index, const char *name,
+                 size_t name_len, void *buf, size_t buf_len,
+                 size_t *data_len)
+{
+    const struct ext4_xattr_item *it;
+
+    it = ext4_xcache_inode_find(ci, name_index, name, name_len);
+    if (!it)
+        return ENODATA;
+
+    if (buf_len && buf)
+        memcpy(buf, it->value,
+               (buf_len < it->value_len) ? buf_len : it->value_len);
+    if (data_len)
+        *data_len = it->value_len;
+
+    return EOK;
+}
+
+/**
+ * @brief Query EA entry's value of an inode whose entries are already
+ *    decoded, without loading the inode
+ *
+ * @param fs Filesystem
+ * @param inode Inode number
+ * @param name_index Name-index
+ * @param name Name of the EA entry to be queried
+ * @param name_len Length of name in bytes
+ * @param buf Output buffer to hold content
+ * @param buf_len Output buffer's length
+ * @param data_len The length of data of the EA entry found
+ *
+ * @return Error code, ENOENT if entries of the inode are not cached
+ */
+int ext4_xattr_cache_get(struct ext4_fs *fs, uint32_t inode,
+             uint8_t name_index, const char *name, size_t name_len,
+             void *buf, size_t buf_len, size_t *data_len)
+{
+    struct ext4_xcache_inode *ci;
+
+    if (ext4_xattr_is_inline_data(name_index, name, name_len))
+        return ENOENT;
+
+    ci = ext4_xcache_inode_get(&fs->xcache, inode);
+    if (!ci)
+        return ENOENT;
+
+    if (data_len)
+        *data_len = 0;
+
+    return ext4_xattr_cached_get(ci, name_index, name, name_len, buf,
+                     buf_len, data_len);
+}
+#endif
+
+/**
+ * @brief Forget decoded EA entries of an inode being changed
+ *
+ * @param inode_ref Inode reference
+ */
+static void ext4_xattr_forget(struct ext4_inode_ref *inode_ref)
+{
+#if CONFIG_XCACHE_ENABLE && CONFIG_XCACHE_INODES
+    ext4_xcache_inode_drop(&inode_ref->fs->xcache, inode_ref->index);
+#else
+    (void)inode_ref;
+#endif
+}
+
+/**
+ * @brief Call @iter for every EA entry of an inode, except inline
+ *    file data
+ *
+ * @param inode_ref Inode reference
+ * @param iter Callback, anything but EOK stops the iteration
+ * @param arg Callback argument
+ *
+ * @return Error code, or the value returned by @iter
+ */
+int ext4_xattr_iterate(struct ext4_inode_ref *inode_ref,
+               int (*iter)(void *arg,
+                   const struct ext4_xattr_item *item),
+               void *arg)
+{
+    int ret;
+    uint32_t k;
+#if CONFIG_XCACHE_ENABLE && CONFIG_XCACHE_INODES
+    struct ext4_xcache_inode *ci;
+
+    ret = ext4_xattr_cached(inode_ref, &ci);
+    if (ret != EOK)
+        return ret;
+
+    for (k = 0; k < ci->count; k++) {
+        ret = iter(arg, &ci->items[k]);
+        if (ret != EOK)
+            return ret;
+    }
+    return EOK;
+#else
+    uint32_t count;
+    struct ext4_xattr_item *items;
+
+    ret = ext4_xattr_decode(inode_ref, &items, &count);
+    if (ret != EOK)
+        return ret;
+
+    for (k = 0; k < count; k++) {
+        ret = iter(arg, &items[k]);
+        if (ret != EOK)
+            break;
+    }
+
+    if (items)
+        ext4_free(items);
+
+    return ret;
+#endif
+}
+
 /**
  * @brief Query EA entry's value with given name-index and name
  *
@@ -1015,6 +1536,18 @@ int ext4_xattr_get(struct ext4_inode_ref *inode_ref, uint8_t name_index,
     if (data_len)
         *data_len = 0;
 
+#if CONFIG_XCACHE_ENABLE && CONFIG_XCACHE_INODES
+    if (!ext4_xattr_is_inline_data(name_index, name, name_len)) {
+        struct ext4_xcache_inode *ci;
+
+        /* Damaged entries are left to the search below */
+        if (ext4_xattr_cached(inode_ref, &ci) == EOK)
+            return ext4_xattr_cached_get(ci, name_index, name,
+                             name_len, buf, buf_len,
+                             data_len);
+    }
+#endif
+
     ibody_finder.i = i;
     ret = ext4_xattr_ibody_find_entry(inode_ref, &ibody_finder);
     if (ret != EOK)
@@ -1066,6 +1599,11 @@ int ext4_xattr_get(struct ext4_inode_ref *inode_ref, uint8_t name_index,
                    (buf_len < value_len) ? buf_len : value_len);
         }
 
+#if CONFIG_XCACHE_ENABLE
+        /* Blocks written before mount become shareable once read */
+        ext4_xattr_block_cache(inode_ref, &block);
+#endif
+
         /*
          * Free the xattr block buffer returned by
          * ext4_xattr_block_find_entry.
@@ -1119,7 +1657,8 @@ static int ext4_xattr_copy_new_block(struct ext4_inode_ref *inode_ref,
         if (ret != EOK)
             goto out;
 
-        ret = ext4_trans_block_get(fs->bdev, new_block, xattr_block);
+        ret = ext4_trans_block_get_noread(fs->bdev, new_block,
+                          xattr_block);
         if (ret != EOK)
             goto out;
 
@@ -1132,8 +1671,14 @@ static int ext4_xattr_copy_new_block(struct ext4_inode_ref *inode_ref,
          * by one
          */
         header->h_refcount = to_le32(to_le32(header->h_refcount) - 1);
-        ext4_trans_set_block_dirty(block->buf);
-        ext4_trans_set_block_dirty(new_block->buf);
+        ext4_xattr_set_block_checksum(inode_ref, block->lb_id, header);
+        ext4_xattr_count_block(inode_ref, false);
+        ext4_trans_set_inode_block_dirty(block->buf, inode_ref->index, false);
+        ext4_trans_set_inode_block_dirty(new_block->buf, inode_ref->index,
+                             false);
+#if CONFIG_XCACHE_ENABLE
+        ext4_xattr_block_cache(inode_ref, block);
+#endif
 
         header = EXT4_XATTR_BHDR(new_block);
         header->h_refcount = to_le32(1);
@@ -1180,6 +1725,7 @@ int ext4_xattr_remove(struct ext4_inode_ref *inode_ref, uint8_t name_index,
     struct ext4_fs *fs = inode_ref->fs;
     ext4_fsblk_t xattr_block;
 
+    ext4_xattr_forget(inode_ref);
     xattr_block = ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
 
     i.name_index = name_index;
@@ -1244,24 +1790,18 @@ int ext4_xattr_remove(struct ext4_inode_ref *inode_ref, uint8_t name_index,
 
         if (ext4_xattr_is_empty(&block_finder.s)) {
             ext4_block_set(fs->bdev, &new_block);
-            ext4_xattr_try_free_block(inode_ref);
+            ret = ext4_xattr_release_block(inode_ref);
         } else {
             struct ext4_xattr_header *header =
                 EXT4_XATTR_BHDR(&new_block);
-            header = EXT4_XATTR_BHDR(&new_block);
             ext4_assert(block_finder.s.first);
             ext4_xattr_rehash(header, block_finder.s.first);
-            ext4_xattr_set_block_checksum(inode_ref,
-                              block.lb_id,
-                              header);
-
-            ext4_trans_set_block_dirty(new_block.buf);
-            ext4_block_set(fs->bdev, &new_block);
+            ret = ext4_xattr_block_put(inode_ref, &new_block);
         }
 
     } else {
         /* Now remove the entry */
-        ext4_xattr_set_entry(&i, &block_finder.s, false);
+        ext4_xattr_set_entry(&i, &ibody_finder.s, false);
         inode_ref->dirty = true;
     }
 out:
@@ -1271,6 +1811,86 @@ out:
     return ret;
 }
 
+/**
+ * @brief Give the inode a new xattr block holding one EA entry. If a
+ *    cached block holds just the same entry, it is shared instead.
+ *
+ * @param inode_ref Inode reference (without xattr block)
+ * @param i The information of the given EA entry
+ *
+ * @return Error code
+ */
+static int ext4_xattr_block_new(struct ext4_inode_ref *inode_ref,
+                struct ext4_xattr_info *i)
+{
+    int ret;
+    char *buf;
+    struct ext4_block block;
+    struct ext4_xattr_search s;
+    struct ext4_xattr_header *header;
+    struct ext4_fs *fs = inode_ref->fs;
+    uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
+    ext4_fsblk_t xattr_block;
+
+    /* Build the block content first, no need to allocate if shared */
+    buf = ext4_calloc(1, block_size);
+    if (!buf)
+        return ENOMEM;
+
+    header = (struct ext4_xattr_header *)buf;
+    header->h_magic = to_le32(EXT4_XATTR_MAGIC);
+    header->h_refcount = to_le32(1);
+    header->h_blocks = to_le32(1);
+
+    s.base = buf;
+    s.end = buf + block_size;
+    s.first = EXT4_XATTR_ENTRY(header + 1);
+    s.here = NULL;
+    s.not_found = true;
+
+    ret = ext4_xattr_set_entry(i, &s, false);
+    if (ret != EOK)
+        goto out;
+
+    ext4_assert(s.here);
+    ext4_xattr_compute_hash(header, s.here);
+    ext4_xattr_rehash(header, s.first);
+
+#if CONFIG_XCACHE_ENABLE
+    xattr_block = ext4_xattr_block_share(inode_ref, header, 0);
+    if (xattr_block) {
+        ext4_inode_set_file_acl(inode_ref->inode, &fs->sb, xattr_block);
+        inode_ref->dirty = true;
+        goto out;
+    }
+#endif
+
+    ret = ext4_xattr_try_alloc_block(inode_ref);
+    if (ret != EOK)
+        goto out;
+
+    inode_ref->dirty = true;
+    xattr_block = ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
+    ret = ext4_trans_block_get_noread(fs->bdev, &block, xattr_block);
+    if (ret != EOK) {
+        ext4_inode_set_file_acl(inode_ref->inode, &fs->sb, 0);
+        ext4_balloc_free_block(inode_ref, xattr_block);
+        goto out;
+    }
+
+    memcpy(block.data, buf, block_size);
+    ext4_xattr_set_block_checksum(inode_ref, block.lb_id,
+                      EXT4_XATTR_BHDR(&block));
+    ext4_trans_set_inode_block_dirty(block.buf, inode_ref->index, false);
+#if CONFIG_XCACHE_ENABLE
+    ext4_xattr_block_cache(inode_ref, &block);
+#endif
+    ret = ext4_block_set(fs->bdev, &block);
+out:
+    ext4_free(buf);
+    return ret;
+}
+
 /**
  * @brief Insert/overwrite an EA entry into/in a xattr block
  *
@@ -1293,46 +1913,13 @@ static int ext4_xattr_block_set(struct ext4_inode_ref *inode_ref,
 
     ext4_assert(i->value);
     if (!orig_xattr_block) {
-        struct ext4_xattr_search s;
-        struct ext4_xattr_header *header;
-
         /* If insertion of new entry is not allowed... */
         if (no_insert) {
             ret = ENODATA;
             goto out;
         }
 
-        ret = ext4_xattr_try_alloc_block(inode_ref);
-        if (ret != EOK)
-            goto out;
-
-        orig_xattr_block =
-            ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
-        ret = ext4_trans_block_get(fs->bdev, &block, orig_xattr_block);
-        if (ret != EOK) {
-            ext4_xattr_try_free_block(inode_ref);
-            goto out;
-        }
-
-        ext4_xattr_block_initialize(inode_ref, &block);
-        ext4_xattr_block_init_search(inode_ref, &s, &block);
-
-        ret = ext4_xattr_set_entry(i, &s, false);
-        if (ret == EOK) {
-            header = EXT4_XATTR_BHDR(&block);
-
-            ext4_assert(s.here);
-            ext4_assert(s.first);
-            ext4_xattr_compute_hash(header, s.here);
-            ext4_xattr_rehash(header, s.first);
-            ext4_xattr_set_block_checksum(inode_ref,
-                              block.lb_id,
-                              header);
-            ext4_trans_set_block_dirty(block.buf);
-        }
-        ext4_block_set(fs->bdev, &block);
-        if (ret != EOK)
-            ext4_xattr_try_free_block(inode_ref);
+        ret = ext4_xattr_block_new(inode_ref, i);
 
     } else {
         struct ext4_xattr_finder finder;
@@ -1378,7 +1965,7 @@ static int ext4_xattr_block_set(struct ext4_inode_ref *inode_ref,
 
         if (allocated) {
             ext4_block_set(fs->bdev, &block);
-            new_block = block;
+            block = new_block;
         }
 
         ret = ext4_xattr_block_find_entry(inode_ref, &finder, &block);
@@ -1388,19 +1975,17 @@ static int ext4_xattr_block_set(struct ext4_inode_ref *inode_ref,
         }
 
         ret = ext4_xattr_set_entry(i, &finder.s, false);
-        if (ret == EOK) {
-            header = EXT4_XATTR_BHDR(&block);
-
-            ext4_assert(finder.s.here);
-            ext4_assert(finder.s.first);
-            ext4_xattr_compute_hash(header, finder.s.here);
-            ext4_xattr_rehash(header, finder.s.first);
-            ext4_xattr_set_block_checksum(inode_ref,
-                              block.lb_id,
-                              header);
-            ext4_trans_set_block_dirty(block.buf);
+        if (ret != EOK) {
+            ext4_block_set(fs->bdev, &block);
+            goto out;
         }
-        ext4_block_set(fs->bdev, &block);
+
+        header = EXT4_XATTR_BHDR(&block);
+        ext4_assert(finder.s.here);
+        ext4_assert(finder.s.first);
+        ext4_xattr_compute_hash(header, finder.s.here);
+        ext4_xattr_rehash(header, finder.s.first);
+        ret = ext4_xattr_block_put(inode_ref, &block);
     }
 out:
     return ret;
@@ -1448,23 +2033,28 @@ static int ext4_xattr_block_remove(struct ext4_inode_ref *inode_ref,
         block = new_block;
     }
 
-    ext4_xattr_block_find_entry(inode_ref, &finder, &block);
+    finder.i = *i;
+    ret = ext4_xattr_block_find_entry(inode_ref, &finder, &block);
+    if (ret != EOK || finder.s.not_found) {
+        ext4_block_set(fs->bdev, &block);
+        goto out;
+    }
 
-    if (!finder.s.not_found) {
-        i->value = NULL;
-        ret = ext4_xattr_set_entry(i, &finder.s, false);
-        i->value = value;
+    i->value = NULL;
+    ret = ext4_xattr_set_entry(i, &finder.s, false);
+    i->value = value;
 
-        header = EXT4_XATTR_BHDR(&block);
-        ext4_assert(finder.s.first);
-        ext4_xattr_rehash(header, finder.s.first);
-        ext4_xattr_set_block_checksum(inode_ref,
-                          block.lb_id,
-                          header);
-        ext4_trans_set_block_dirty(block.buf);
+    /* Last entry gone, so is the block */
+    if (ext4_xattr_is_empty(&finder.s)) {
+        ext4_block_set(fs->bdev, &block);
+        ret = ext4_xattr_release_block(inode_ref);
+        goto out;
     }
 
-    ext4_block_set(fs->bdev, &block);
+    header = EXT4_XATTR_BHDR(&block);
+    ext4_assert(finder.s.first);
+    ext4_xattr_rehash(header, finder.s.first);
+    ret = ext4_xattr_block_put(inode_ref, &block);
 out:
     return ret;
 }
@@ -1490,10 +2080,13 @@ int ext4_xattr_set(struct ext4_inode_ref *inode_ref, uint8_t name_index,
     struct ext4_xattr_finder ibody_finder;
     struct ext4_xattr_info i;
     bool block_found = false;
+    bool block_has_entry = false;
     ext4_fsblk_t orig_xattr_block;
     size_t extra_isize =
         ext4_inode_get_extra_isize(&fs->sb, inode_ref->inode);
 
+    ext4_xattr_forget(inode_ref);
+
     i.name_index = name_index;
     i.name = name;
     i.name_len = name_len;
@@ -1508,6 +2101,9 @@ int ext4_xattr_set(struct ext4_inode_ref *inode_ref, uint8_t name_index,
      * Even if entry is not found, search context block inside the
      * finder is still valid and can be used to insert entry.
      */
+    if (extra_isize && !ext4_xattr_ibody_has_header(inode_ref))
+        ext4_xattr_ibody_initialize(inode_ref);
+
     ret = ext4_xattr_ibody_find_entry(inode_ref, &ibody_finder);
     if (ret != EOK) {
         ext4_xattr_ibody_initialize(inode_ref);
@@ -1518,9 +2114,10 @@ int ext4_xattr_set(struct ext4_inode_ref *inode_ref, uint8_t name_index,
         if (orig_xattr_block) {
             block_found = true;
             ret = ext4_xattr_block_set(inode_ref, &i, true);
-            if (ret == ENOSPC)
+            if (ret == ENOSPC) {
+                block_has_entry = true;
                 goto try_insert;
-            else if (ret == ENODATA)
+            } else if (ret == ENODATA)
                 goto try_insert;
             else if (ret != EOK)
                 goto out;
@@ -1539,10 +2136,17 @@ int ext4_xattr_set(struct ext4_inode_ref *inode_ref, uint8_t name_index,
         if (ret == ENOSPC) {
             if (!block_found) {
                 ret = ext4_xattr_block_set(inode_ref, &i, false);
+                if (ret != EOK)
+                    goto out;
+
+                /* Old value moved to the block */
                 ibody_finder.i.value = NULL;
                 ext4_xattr_set_entry(&ibody_finder.i,
                              &ibody_finder.s, false);
                 inode_ref->dirty = true;
+            } else if (!block_has_entry) {
+                /* Shared block was not touched above, add it there */
+                ret = ext4_xattr_block_set(inode_ref, &i, false);
             }
 
         } else if (ret == EOK) {
@@ -1557,6 +2161,158 @@ out:
     return ret;
 }
 
+/**
+ * @brief Find an EA entry in the inode body and return the location
+ *    of its value, without copying it
+ *
+ * @param inode_ref Inode reference
+ * @param name_index Name-index
+ * @param name Name of the EA entry to be found
+ * @param name_len Length of name
+ * @param value Returns the value inside the inode buffer
+ *      (NULL for an empty value)
+ * @param value_len Returns the length of the value
+ *
+ * @return Error code, ENODATA if the inode body has no such entry
+ */
+int ext4_xattr_ibody_get(struct ext4_inode_ref *inode_ref, uint8_t name_index,
+             const char *name, size_t name_len, void **value,
+             size_t *value_len)
+{
+    int ret;
+    struct ext4_xattr_finder finder;
+
+    if (!ext4_xattr_ibody_has_header(inode_ref))
+        return ENODATA;
+
+    finder.i.name_index = name_index;
+    finder.i.name = name;
+    finder.i.name_len = name_len;
+    finder.i.value = NULL;
+    finder.i.value_len = 0;
+
+    ret = ext4_xattr_ibody_find_entry(inode_ref, &finder);
+    if (ret != EOK)
+        return ret;
+
+    if (finder.s.not_found)
+        return ENODATA;
+
+    *value = (void *)finder.i.value;
+    *value_len = finder.i.value_len;
+    return EOK;
+}
+
+/**
+ * @brief Insert/Remove/Modify an EA entry in the inode body only. The
+ *    entry is never moved to the xattr block.
+ *
+ * @param inode_ref Inode reference
+ * @param name_index Name-index
+ * @param name Name of the EA entry
+ * @param name_len Length of name
+ * @param value Input content, NULL to remove the entry. It must not
+ *      point into the inode body.
+ * @param value_len Length of input content
+ *
+ * @return Error code, ENOSPC if the entry does not fit the inode body
+ */
+int ext4_xattr_ibody_set(struct ext4_inode_ref *inode_ref, uint8_t name_index,
+             const char *name, size_t name_len, const void *value,
+             size_t value_len)
+{
+    int ret;
+    struct ext4_xattr_finder finder;
+    struct ext4_xattr_info i;
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+
+    if (!ext4_inode_get_extra_isize(sb, inode_ref->inode))
+        return value ? ENOSPC : EOK;
+
+    if (!ext4_xattr_is_inline_data(name_index, name, name_len))
+        ext4_xattr_forget(inode_ref);
+
+    i.name_index = name_index;
+    i.name = name;
+    i.name_len = name_len;
+    i.value = value;
+    i.value_len = value_len;
+    if (value && !value_len)
+        i.value = &ext4_xattr_empty_value;
+
+    if (!ext4_xattr_ibody_has_header(inode_ref)) {
+        if (!value)
+            return EOK;
+
+        ext4_xattr_ibody_initialize(inode_ref);
+    }
+
+    finder.i = i;
+    ret = ext4_xattr_ibody_find_entry(inode_ref, &finder);
+    if (ret != EOK)
+        return ret;
+
+    ret = ext4_xattr_set_entry(&i, &finder.s, false);
+    if (ret == EOK)
+        inode_ref->dirty = true;
+
+    return ret;
+}
+
+/**
+ * @brief Compute the longest value an EA entry may have if it is kept
+ *    in the inode body, counting the space of its current value
+ *
+ * @param inode_ref Inode reference
+ * @param name_index Name-index
+ * @param name Name of the EA entry
+ * @param name_len Length of name
+ * @param max_len Returns the longest value length
+ *
+ * @return Error code, ENOSPC if not even an empty entry fits
+ */
+int ext4_xattr_ibody_max_value(struct ext4_inode_ref *inode_ref,
+                   uint8_t name_index, const char *name,
+                   size_t name_len, size_t *max_len)
+{
+    int ret;
+    size_t free, min_offs;
+    struct ext4_xattr_entry *last;
+    struct ext4_xattr_finder finder;
+    struct ext4_sblock *sb = &inode_ref->fs->sb;
+    size_t extra_isize = ext4_inode_get_extra_isize(sb, inode_ref->inode);
+    size_t inode_size = ext4_get16(sb, inode_size);
+
+    *max_len = 0;
+    if (!extra_isize)
+        return ENOSPC;
+
+    if (ext4_xattr_ibody_has_header(inode_ref)) {
+        finder.i.name_index = name_index;
+        finder.i.name = name;
+        finder.i.name_len = name_len;
+        finder.i.value = NULL;
+        finder.i.value_len = 0;
+
+        ret = ext4_xattr_ibody_find_entry(inode_ref, &finder);
+        if (ret != EOK)
+            return ret;
+
+        free = ext4_xattr_free_space(&finder.s, &last, &min_offs);
+    } else {
+        /* Header to be initialized and the terminating entry */
+        free = inode_size - EXT4_GOOD_OLD_INODE_SIZE - extra_isize -
+               sizeof(struct ext4_xattr_ibody_header) -
+               sizeof(uint32_t);
+    }
+
+    if (free < EXT4_XATTR_LEN(name_len))
+        return ENOSPC;
+
+    *max_len = (free - EXT4_XATTR_LEN(name_len)) & ~EXT4_XATTR_ROUND;
+    return EOK;
+}
+
 #endif
 
 /**
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2015 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_xcache.c
+ * @brief Xattr block cache.
+ */
+
+#include <ext4_config.h>
+#include <ext4_types.h>
+#include <ext4_misc.h>
+#include <ext4_errno.h>
+#include <ext4_debug.h>
+
+#include <ext4_xcache.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+uint32_t ext4_xcache_name_hash(uint8_t name_index, const char *name,
+                   size_t name_len)
+{
+    /* FNV-1a over the name index and the name. */
+    uint32_t h = 2166136261U ^ name_index;
+    while (name_len--) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+#if CONFIG_XCACHE_ENABLE
+
+static struct ext4_xcache_entry *ext4_xcache_find(struct ext4_xcache *xc,
+                          ext4_fsblk_t block)
+{
+    uint32_t i;
+    for (i = 0; i < CONFIG_XCACHE_SIZE; i++) {
+        if (xc->entries[i].block == block)
+            return &xc->entries[i];
+    }
+    return NULL;
+}
+
+static void ext4_xcache_drop(struct ext4_xcache *xc,
+                 struct ext4_xcache_entry *e)
+{
+    LIST_REMOVE(e, hash_node);
+    e->block = 0;
+
+    /* Unused entries are recycled first. */
+    TAILQ_REMOVE(&xc->lru, e, lru_node);
+    TAILQ_INSERT_HEAD(&xc->lru, e, lru_node);
+}
+
+void ext4_xcache_init(struct ext4_xcache *xc)
+{
+    uint32_t i;
+
+    memset(xc, 0, sizeof(struct ext4_xcache));
+    TAILQ_INIT(&xc->lru);
+    for (i = 0; i < CONFIG_XCACHE_SIZE; i++)
+        TAILQ_INSERT_TAIL(&xc->lru, &xc->entries[i], lru_node);
+}
+
+void ext4_xcache_purge(struct ext4_xcache *xc)
+{
+    uint32_t i;
+    for (i = 0; i < CONFIG_XCACHE_SIZE; i++) {
+        if (xc->entries[i].block)
+            ext4_xcache_drop(xc, &xc->entries[i]);
+    }
+#if CONFIG_XCACHE_INODES
+    for (i = 0; i < CONFIG_XCACHE_INODES; i++) {
+        if (xc->inodes[i].inode)
+            ext4_xcache_inode_drop(xc, xc->inodes[i].inode);
+    }
+#endif
+}
+
+size_t ext4_xcache_lookup(struct ext4_xcache *xc, uint32_t hash,
+              ext4_fsblk_t *blocks, size_t max)
+{
+    struct ext4_xcache_entry *e;
+    size_t n = 0;
+
+    LIST_FOREACH(e, &xc->buckets[hash % EXT4_XCACHE_BUCKETS], hash_node) {
+        if (n == max)
+            break;
+
+        if (e->hash == hash)
+            blocks[n++] = e->block;
+    }
+    return n;
+}
+
+void ext4_xcache_insert(struct ext4_xcache *xc, uint32_t hash,
+            ext4_fsblk_t block)
+{
+    struct ext4_xcache_entry *e;
+
+    e = ext4_xcache_find(xc, block);
+    if (e && e->hash != hash) {
+        ext4_xcache_drop(xc, e);
+        e = NULL;
+    }
+
+    if (!e) {
+        /* Reuse the least recently used entry. */
+        e = TAILQ_FIRST(&xc->lru);
+        if (e->block)
+            LIST_REMOVE(e, hash_node);
+
+        e->block = block;
+        e->hash = hash;
+    } else {
+        LIST_REMOVE(e, hash_node);
+    }
+
+    /* Most recently used blocks are tried first. */
+    LIST_INSERT_HEAD(&xc->buckets[hash % EXT4_XCACHE_BUCKETS], e,
+             hash_node);
+    TAILQ_REMOVE(&xc->lru, e, lru_node);
+    TAILQ_INSERT_TAIL(&xc->lru, e, lru_node);
+}
+
+void ext4_xcache_remove(struct ext4_xcache *xc, ext4_fsblk_t block)
+{
+    struct ext4_xcache_entry *e = ext4_xcache_find(xc, block);
+    if (e)
+        ext4_xcache_drop(xc, e);
+}
+
+#if CONFIG_XCACHE_INODES
+struct ext4_xcache_inode *ext4_xcache_inode_get(struct ext4_xcache *xc,
+                        uint32_t inode)
+{
+    uint32_t i;
+    for (i = 0; i < CONFIG_XCACHE_INODES; i++) {
+        if (xc->inodes[i].inode == inode) {
+            xc->inodes[i].stamp = ++xc->inode_stamp;
+            return &xc->inodes[i];
+        }
+    }
+    return NULL;
+}
+
+struct ext4_xcache_inode *ext4_xcache_inode_set(struct ext4_xcache *xc,
+                        uint32_t inode,
+                        struct ext4_xattr_item *items,
+                        uint32_t count)
+{
+    struct ext4_xcache_inode *ci = &xc->inodes[0];
+    uint32_t i;
+
+    ext4_xcache_inode_drop(xc, inode);
+    for (i = 1; i < CONFIG_XCACHE_INODES && ci->inode; i++) {
+        if (!xc->inodes[i].inode || xc->inodes[i].stamp < ci->stamp)
+            ci = &xc->inodes[i];
+    }
+
+    if (ci->items)
+        ext4_free(ci->items);
+
+    ci->inode = inode;
+    ci->stamp = ++xc->inode_stamp;
+    ci->count = count;
+    ci->items = items;
+    return ci;
+}
+
+void ext4_xcache_inode_drop(struct ext4_xcache *xc, uint32_t inode)
+{
+    uint32_t i;
+    for (i = 0; i < CONFIG_XCACHE_INODES; i++) {
+        struct ext4_xcache_inode *ci = &xc->inodes[i];
+        if (ci->inode == inode) {
+            if (ci->items)
+                ext4_free(ci->items);
+            memset(ci, 0, sizeof(struct ext4_xcache_inode));
+            return;
+        }
+    }
+}
+
+const struct ext4_xattr_item *
+ext4_xcache_inode_find(struct ext4_xcache_inode *ci, uint8_t name_index,
+               const char *name, size_t name_len)
+{
+    uint32_t hash = ext4_xcache_name_hash(name_index, name, name_len);
+    uint32_t i;
+
+    for (i = 0; i < ci->count; i++) {
+        struct ext4_xattr_item *it = &ci->items[i];
+        if (it->hash == hash && it->name_index == name_index &&
+            it->name_len == name_len &&
+            !memcmp(it->name, name, name_len))
+            return it;
+    }
+    return NULL;
+}
+#endif
+
+#endif
+
+/**
+ * @}
+ */